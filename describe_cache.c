@@ -0,0 +1,388 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include "describe_cache.h"
+#include "hashtable/hashtable.h"
+#include "hashtable/hashfunction.h"
+#include "rtsp.h"
+
+#define INOTIFY_MASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF)
+
+struct DESCRIBE_ENTRY;
+
+/* Inotify watch of a media file. Uris with different hosts name the same
+ * file, and inotify gives them the same watch. It's removed with the last
+ * of its entries */
+typedef struct {
+    int wd; /* Key of watch_hash */
+    struct DESCRIBE_ENTRY *entries; /* Linked by watch_next */
+} DESCRIBE_WATCH;
+
+typedef struct DESCRIBE_ENTRY {
+    char uri[DESCRIBE_URI_MAX]; /* Normalized uri. Key of uri_hash */
+    char path[DESCRIBE_URI_MAX + 1]; /* Media file, relative to the working directory */
+    DESCRIBE_WATCH *watch; /* 0 if the file isn't watched */
+    struct DESCRIBE_ENTRY *watch_next; /* Next entry of the same watch */
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    off_t size;
+    DESCRIBE_BODY *body;
+    struct DESCRIBE_ENTRY *prev;
+    struct DESCRIBE_ENTRY *next;
+} DESCRIBE_ENTRY;
+
+void describe_cache_inotify_handler(EVENT_LOOP *loop, void *data, unsigned int events);
+
+/* Entries by uri, and watches by inotify watch descriptor. Keys point
+ * into the entries and the watches */
+hashtable *uri_hash;
+hashtable *watch_hash;
+DESCRIBE_ENTRY *entries;
+int n_entries;
+pthread_mutex_t cache_mutex;
+
+int inotify_fd = -1;
+EVENT_LOOP *inotify_loop;
+EVENT_WATCH inotify_watch[1];
+
+int describe_cache_init(EVENT_LOOP *loop) {
+    entries = 0;
+    n_entries = 0;
+    uri_hash = newhashtable((hashfunc)stringhash, stringequal, MAX_DESCRIBE_ENTRIES * 2, 0);
+    if (!uri_hash)
+        return(0);
+    watch_hash = newhashtable(longhash, longequal, MAX_DESCRIBE_ENTRIES * 2, 0);
+    if (!watch_hash) {
+        freehashtable(&uri_hash);
+        return(0);
+    }
+    if (pthread_mutex_init(&cache_mutex, 0)) {
+        freehashtable(&uri_hash);
+        freehashtable(&watch_hash);
+        return(0);
+    }
+
+    /* Without inotify the files are checked in every lookup */
+    inotify_loop = loop;
+    inotify_fd = -1;
+    if (loop) {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd != -1) {
+            inotify_watch->fd = inotify_fd;
+            inotify_watch->handler = describe_cache_inotify_handler;
+            inotify_watch->data = 0;
+            if (!event_loop_add(loop, inotify_watch, EPOLLIN)) {
+                close(inotify_fd);
+                inotify_fd = -1;
+            }
+        }
+    }
+    return(1);
+}
+
+void describe_body_release(DESCRIBE_BODY *body) {
+    if (--body->refs == 0)
+        free(body);
+}
+
+/* Watch the media file of an entry, sharing the watch with the other
+ * entries of the file. The mutex must be locked */
+void describe_entry_watch(DESCRIBE_ENTRY *entry) {
+    DESCRIBE_WATCH *watch;
+    int wd;
+
+    wd = inotify_add_watch(inotify_fd, entry->path, INOTIFY_MASK);
+    if (wd == -1)
+        return;
+    watch = gethashtable(&watch_hash, &wd);
+    if (!watch) {
+        watch = malloc(sizeof(DESCRIBE_WATCH));
+        if (!watch) {
+            inotify_rm_watch(inotify_fd, wd);
+            return;
+        }
+        watch->wd = wd;
+        watch->entries = 0;
+        if (puthashtable(&watch_hash, &watch->wd, watch) != OK) {
+            inotify_rm_watch(inotify_fd, wd);
+            free(watch);
+            return;
+        }
+    }
+    entry->watch = watch;
+    entry->watch_next = watch->entries;
+    watch->entries = entry;
+}
+
+/* Take an entry out of its watch. The watch is removed with the last
+ * entry. The mutex must be locked */
+void describe_entry_unwatch(DESCRIBE_ENTRY *entry) {
+    DESCRIBE_WATCH *watch = entry->watch;
+    DESCRIBE_ENTRY **ptr;
+
+    for (ptr = &watch->entries; *ptr != entry; ptr = &(*ptr)->watch_next);
+    *ptr = entry->watch_next;
+    entry->watch = 0;
+    if (!watch->entries) {
+        delhashtable(&watch_hash, &watch->wd);
+        inotify_rm_watch(inotify_fd, watch->wd);
+        free(watch);
+    }
+}
+
+/* Take an entry out of the cache. The mutex must be locked */
+void describe_entry_remove(DESCRIBE_ENTRY *entry) {
+    delhashtable(&uri_hash, entry->uri);
+    if (entry->watch)
+        describe_entry_unwatch(entry);
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        entries = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    describe_body_release(entry->body);
+    free(entry);
+    --n_entries;
+}
+
+void describe_cache_free() {
+    pthread_mutex_lock(&cache_mutex);
+    while (entries)
+        describe_entry_remove(entries);
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (inotify_fd != -1) {
+        event_loop_del(inotify_loop, inotify_watch);
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    freehashtable(&uri_hash);
+    freehashtable(&watch_hash);
+    pthread_mutex_destroy(&cache_mutex);
+}
+
+/* Media files have changed. Forget their descriptions, from every uri of
+ * the file */
+void describe_cache_inotify_handler(EVENT_LOOP *loop, void *data, unsigned int events) {
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *event;
+    DESCRIBE_WATCH *watch;
+    int len;
+    int i;
+
+    for (;;) {
+        len = read(inotify_fd, buf, sizeof(buf));
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return;
+
+        pthread_mutex_lock(&cache_mutex);
+        for (i = 0; i < len; i += sizeof(struct inotify_event) + event->len) {
+            event = (struct inotify_event *)(buf + i);
+            /* The watch goes with its last entry */
+            while ((watch = gethashtable(&watch_hash, &event->wd)))
+                describe_entry_remove(watch->entries);
+        }
+        pthread_mutex_unlock(&cache_mutex);
+    }
+}
+
+int normalize_uri(const char *uri, char *normalized, int size) {
+    int len = 7;
+    int host_start;
+
+    if (strncasecmp(uri, "rtsp://", 7) || size <= len)
+        return(0);
+    memcpy(normalized, "rtsp://", 7);
+    uri += 7;
+
+    /* Host in lower case */
+    host_start = len;
+    while (*uri && *uri != '/' && *uri != '?' && *uri != '#') {
+        if (len == size - 1)
+            return(0);
+        normalized[len++] = tolower((unsigned char)*uri++);
+    }
+    if (len == host_start)
+        return(0);
+    /* Default port */
+    if (len - host_start > 4 && !memcmp(normalized + len - 4, ":554", 4))
+        len -= 4;
+
+    /* Path without query nor fragment */
+    while (*uri && *uri != '?' && *uri != '#') {
+        if (len == size - 1)
+            return(0);
+        normalized[len++] = *uri++;
+    }
+    while (normalized[len - 1] == '/')
+        --len;
+    normalized[len] = 0;
+    return(len);
+}
+
+/* Get the media file of a normalized uri
+ * return: 1 ok, 0 if the uri can't be a file
+ */
+int describe_uri_path(const char *uri, char *path) {
+    const char *file = strchr(uri + 7, '/');
+
+    /* Don't accept paths that go up in the directory tree */
+    if (!file || strstr(file, ".."))
+        return(0);
+    path[0] = '.';
+    strcpy(path + 1, file);
+    return(1);
+}
+
+/* Create the description of a media file
+ * return: Body with one reference, 0 if error
+ */
+DESCRIBE_BODY *describe_body_create(const char *uri, struct stat *file_stat) {
+    DESCRIBE_BODY *body;
+    struct tm tm;
+
+    body = malloc(sizeof(DESCRIBE_BODY));
+    if (!body)
+        return(0);
+    body->refs = 1;
+    body->mtime = file_stat->st_mtime;
+    gmtime_r(&body->mtime, &tm);
+    strftime(body->last_modified, sizeof(body->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    body->sdp_len = rtsp_describe_sdp(uri, body->sdp, DESCRIBE_SDP_MAX);
+    if (!body->sdp_len) {
+        free(body);
+        return(0);
+    }
+    return(body);
+}
+
+/* Check if the file of an entry is still the one that was described */
+int describe_entry_valid(DESCRIBE_ENTRY *entry, struct stat *file_stat) {
+    return(entry->dev == file_stat->st_dev && entry->ino == file_stat->st_ino &&
+            entry->mtime == file_stat->st_mtime && entry->size == file_stat->st_size);
+}
+
+/* Add a new description to the cache. The mutex must be locked. If the
+ * cache is full the description is used only for this request.
+ */
+void describe_entry_add(const char *uri, const char *path, struct stat *file_stat, DESCRIBE_BODY *body) {
+    DESCRIBE_ENTRY *entry;
+
+    if (n_entries >= MAX_DESCRIBE_ENTRIES)
+        return;
+    entry = malloc(sizeof(DESCRIBE_ENTRY));
+    if (!entry)
+        return;
+    strcpy(entry->uri, uri);
+    strcpy(entry->path, path);
+    entry->dev = file_stat->st_dev;
+    entry->ino = file_stat->st_ino;
+    entry->mtime = file_stat->st_mtime;
+    entry->size = file_stat->st_size;
+    entry->body = body;
+    ++body->refs;
+
+    if (puthashtable(&uri_hash, entry->uri, entry) != OK) {
+        describe_body_release(body);
+        free(entry);
+        return;
+    }
+    entry->watch = 0;
+    if (inotify_fd != -1)
+        describe_entry_watch(entry);
+    entry->prev = 0;
+    entry->next = entries;
+    if (entries)
+        entries->prev = entry;
+    entries = entry;
+    ++n_entries;
+}
+
+int describe_cache_get(const char *uri, DESCRIBE_BODY **body) {
+    char key[DESCRIBE_URI_MAX];
+    char path[DESCRIBE_URI_MAX + 1];
+    struct stat file_stat;
+    DESCRIBE_ENTRY *entry;
+
+    *body = 0;
+    if (!normalize_uri(uri, key, DESCRIBE_URI_MAX))
+        return(-1);
+    if (!describe_uri_path(key, path))
+        return(0);
+
+    pthread_mutex_lock(&cache_mutex);
+    entry = gethashtable(&uri_hash, key);
+    /* Entries watched with inotify are removed as soon as the file changes */
+    if (entry && entry->watch) {
+        *body = entry->body;
+        ++(*body)->refs;
+        pthread_mutex_unlock(&cache_mutex);
+        return(1);
+    }
+
+    if (stat(path, &file_stat) || !S_ISREG(file_stat.st_mode)) {
+        if (entry)
+            describe_entry_remove(entry);
+        pthread_mutex_unlock(&cache_mutex);
+        return(0);
+    }
+    if (entry && describe_entry_valid(entry, &file_stat)) {
+        *body = entry->body;
+        ++(*body)->refs;
+        pthread_mutex_unlock(&cache_mutex);
+        return(1);
+    }
+    if (entry)
+        describe_entry_remove(entry);
+
+    *body = describe_body_create(key, &file_stat);
+    if (!*body) {
+        pthread_mutex_unlock(&cache_mutex);
+        return(-1);
+    }
+    describe_entry_add(key, path, &file_stat, *body);
+    pthread_mutex_unlock(&cache_mutex);
+    return(1);
+}
+
+void describe_cache_release(DESCRIBE_BODY *body) {
+    pthread_mutex_lock(&cache_mutex);
+    describe_body_release(body);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+int describe_cache_not_modified(DESCRIBE_BODY *body, const char *value, int len) {
+    char date[64];
+    struct tm tm;
+    char *end;
+
+    /* Usually the client sends back the same date */
+    if (len == (int)strlen(body->last_modified) && !memcmp(value, body->last_modified, len))
+        return(1);
+    if (len >= (int)sizeof(date))
+        return(0);
+    memcpy(date, value, len);
+    date[len] = 0;
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(date, "%a, %d %b %Y %H:%M:%S", &tm);
+    if (!end)
+        return(0);
+    return(body->mtime <= timegm(&tm));
+}
@@ -0,0 +1,62 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#ifndef _DESCRIBE_CACHE_H_
+#define _DESCRIBE_CACHE_H_
+
+#include <time.h>
+#include <sys/types.h>
+#include "event_loop.h"
+
+#define MAX_DESCRIBE_ENTRIES 1024 /* Uris whose description is kept */
+#define DESCRIBE_URI_MAX 1024 /* Longer uris aren't cached */
+#define DESCRIBE_SDP_MAX 1024
+
+/* Serialized description of a media. It doesn't change once created, and
+ * it is freed when the cache and every request using it have released it */
+typedef struct {
+    int refs;
+    time_t mtime; /* Modification time of the media file */
+    char last_modified[32]; /* mtime as an RFC 1123 date */
+    int sdp_len;
+    char sdp[DESCRIBE_SDP_MAX];
+} DESCRIBE_BODY;
+
+/* Initialize the cache. The media files are watched with inotify from the
+ * loop if it is possible. If not, they are checked with stat in every lookup.
+ * loop: Loop where the inotify descriptor will be registered. Can be 0
+ * return: 1 ok, 0 err
+ */
+int describe_cache_init(EVENT_LOOP *loop);
+
+/* Free the cache. Bodies still in use are freed when they are released */
+void describe_cache_free();
+
+/* Get the description of a uri, creating it if it isn't cached or the
+ * media file has changed. It must be released with describe_cache_release
+ * uri: Null terminated uri of the request
+ * body: Description
+ * return: 1 ok, 0 if the media file doesn't exist, -1 err
+ */
+int describe_cache_get(const char *uri, DESCRIBE_BODY **body);
+
+/* Release a description returned by describe_cache_get */
+void describe_cache_release(DESCRIBE_BODY *body);
+
+/* Check an If-Modified-Since header against a description
+ * value: Value of the header, not null terminated
+ * len: Length of value
+ * return: 1 if the description hasn't changed since that date, 0 otherwise
+ */
+int describe_cache_not_modified(DESCRIBE_BODY *body, const char *value, int len);
+
+/* Write the normalized form of a uri: scheme and host in lower case,
+ * without the default port, the query or the final '/'
+ * return: Length of the normalized uri. 0 if it isn't valid or doesn't fit
+ */
+int normalize_uri(const char *uri, char *normalized, int size);
+#endif
@@ -0,0 +1,225 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include "event_loop.h"
+
+void *event_loop_fun(void *arg);
+void event_loop_tasks_handler(EVENT_LOOP *loop, void *data, unsigned int events);
+void event_loop_run_tasks(EVENT_LOOP *loop);
+
+int event_loop_init(EVENT_LOOP *loop, int index, EVENT_TICK tick) {
+    loop->index = index;
+    loop->running = 0;
+    loop->tick = tick;
+    loop->last_tick = time(0);
+    loop->tasks = 0;
+    loop->last_task = 0;
+    loop->tasks_ready = 0;
+    timer_wheel_init(loop->timers, event_loop_now());
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd == -1)
+        return(0);
+
+    /* Other threads wake up the loop when they post tasks */
+    loop->wakeup->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    loop->wakeup->handler = event_loop_tasks_handler;
+    loop->wakeup->data = 0;
+    if (loop->wakeup->fd == -1) {
+        close(loop->epfd);
+        loop->epfd = -1;
+        return(0);
+    }
+    if (pthread_mutex_init(&loop->tasks_mutex, 0)) {
+        close(loop->wakeup->fd);
+        close(loop->epfd);
+        loop->epfd = -1;
+        return(0);
+    }
+    if (!event_loop_add(loop, loop->wakeup, EPOLLIN)) {
+        pthread_mutex_destroy(&loop->tasks_mutex);
+        close(loop->wakeup->fd);
+        close(loop->epfd);
+        loop->epfd = -1;
+        return(0);
+    }
+    return(1);
+}
+
+int event_loop_start(EVENT_LOOP *loop) {
+    if (pthread_create(&loop->thread_id, 0, event_loop_fun, loop))
+        return(0);
+    loop->running = 1;
+    return(1);
+}
+
+void event_loop_stop(EVENT_LOOP *loop) {
+    if (loop->running) {
+        loop->running = 0;
+        pthread_cancel(loop->thread_id);
+        pthread_join(loop->thread_id, 0);
+    }
+    if (loop->epfd != -1) {
+        close(loop->wakeup->fd);
+        pthread_mutex_destroy(&loop->tasks_mutex);
+        close(loop->epfd);
+        loop->epfd = -1;
+    }
+}
+
+int event_loop_add(EVENT_LOOP *loop, EVENT_WATCH *watch, unsigned int events) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = watch;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, watch->fd, &ev) == -1)
+        return(0);
+    return(1);
+}
+
+int event_loop_mod(EVENT_LOOP *loop, EVENT_WATCH *watch, unsigned int events) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = watch;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, watch->fd, &ev) == -1)
+        return(0);
+    return(1);
+}
+
+void event_loop_del(EVENT_LOOP *loop, EVENT_WATCH *watch) {
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, watch->fd, 0);
+}
+
+int event_loop_post(EVENT_LOOP *loop, EVENT_TASK *task) {
+    uint64_t one = 1;
+    int wake;
+
+    task->next = 0;
+    pthread_mutex_lock(&loop->tasks_mutex);
+    /* The loop only needs to be woken up by the first task of a batch */
+    wake = !loop->tasks;
+    if (loop->last_task)
+        loop->last_task->next = task;
+    else
+        loop->tasks = task;
+    loop->last_task = task;
+    pthread_mutex_unlock(&loop->tasks_mutex);
+
+    if (wake && write(loop->wakeup->fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+        return(0);
+    return(1);
+}
+
+/* Tasks have been posted. They don't run until the batch has been
+ * dispatched: they can free connections whose events come later in it */
+void event_loop_tasks_handler(EVENT_LOOP *loop, void *data, unsigned int events) {
+    uint64_t count;
+
+    if (read(loop->wakeup->fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+        return;
+    loop->tasks_ready = 1;
+}
+
+/* Run the tasks posted to the loop */
+void event_loop_run_tasks(EVENT_LOOP *loop) {
+    EVENT_TASK *task;
+    EVENT_TASK *next;
+
+    /* Take the whole list, tasks posted while running go to the next round */
+    pthread_mutex_lock(&loop->tasks_mutex);
+    task = loop->tasks;
+    loop->tasks = 0;
+    loop->last_task = 0;
+    pthread_mutex_unlock(&loop->tasks_mutex);
+
+    for (; task; task = next) {
+        /* The task can be freed by its function */
+        next = task->next;
+        task->fun(loop, task->data);
+    }
+}
+
+unsigned long long event_loop_now() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return((unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+void event_loop_timer_add(EVENT_LOOP *loop, TIMER *timer, long ms) {
+    timer_wheel_add(loop->timers, timer, event_loop_now() + ms);
+}
+
+void event_loop_timer_del(EVENT_LOOP *loop, TIMER *timer) {
+    timer_wheel_del(loop->timers, timer);
+}
+
+int set_nonblocking(int fd) {
+    int flags;
+
+    flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1)
+        return(0);
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+        return(0);
+    return(1);
+}
+
+/* Loop thread: dispatch ready descriptors, run the posted tasks, expire the
+ * timers and call the tick function every second */
+void *event_loop_fun(void *arg) {
+    EVENT_LOOP *loop = arg;
+    struct epoll_event events[EVENT_BATCH];
+    EVENT_WATCH *watch;
+    time_t now;
+    unsigned long long now_ms;
+    long long due;
+    int timeout;
+    int n;
+    int i;
+
+    for (;;) {
+        /* Wake up for the next timer, and at least once a second for the tick */
+        timeout = 1000;
+        due = timer_wheel_timeout(loop->timers);
+        if (due != -1) {
+            due += loop->timers->now;
+            now_ms = event_loop_now();
+            if (due <= (long long)now_ms)
+                timeout = 0;
+            else if (due - now_ms < 1000)
+                timeout = due - now_ms;
+        }
+        n = epoll_wait(loop->epfd, events, EVENT_BATCH, timeout);
+        if (n == -1 && errno != EINTR)
+            return(0);
+
+        for (i = 0; i < n; ++i) {
+            watch = events[i].data.ptr;
+            watch->handler(loop, watch->data, events[i].events);
+        }
+        if (loop->tasks_ready) {
+            loop->tasks_ready = 0;
+            event_loop_run_tasks(loop);
+        }
+        timer_wheel_advance(loop->timers, event_loop_now());
+
+        now = time(0);
+        if (loop->tick && now != loop->last_tick) {
+            loop->last_tick = now;
+            loop->tick(loop, now);
+        }
+    }
+}
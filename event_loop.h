@@ -0,0 +1,128 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#ifndef _EVENT_LOOP_H_
+#define _EVENT_LOOP_H_
+
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include "timer_wheel.h"
+
+#define MAX_EVENT_LOOPS 64 /* Maximum number of loop threads */
+#define EVENT_BATCH 256 /* Events returned by a single epoll_wait */
+
+struct EVENT_LOOP;
+
+/* Function called when a watched file descriptor is ready
+ * 1st parameter: Loop where the descriptor is registered
+ * 2nd parameter: Private data of the watch
+ * 3rd parameter: Epoll events that happened
+ */
+typedef void (*EVENT_HANDLER)(struct EVENT_LOOP *, void *, unsigned int);
+
+/* Function called once per second from inside the loop thread
+ * 1st parameter: Loop
+ * 2nd parameter: Current time
+ */
+typedef void (*EVENT_TICK)(struct EVENT_LOOP *, time_t);
+
+/* Function posted to run inside the loop thread
+ * 1st parameter: Loop
+ * 2nd parameter: Private data of the task
+ */
+typedef void (*EVENT_TASK_FUN)(struct EVENT_LOOP *, void *);
+
+typedef struct {
+    int fd;
+    EVENT_HANDLER handler;
+    void *data;
+} EVENT_WATCH;
+
+/* Work posted from other threads. It is usually embedded in the structure
+ * it works on, so posting doesn't need memory */
+typedef struct EVENT_TASK {
+    EVENT_TASK_FUN fun;
+    void *data;
+    struct EVENT_TASK *next;
+} EVENT_TASK;
+
+typedef struct EVENT_LOOP {
+    int index;
+    int epfd;
+    int running;
+    pthread_t thread_id;
+    time_t last_tick;
+    EVENT_TICK tick;
+    EVENT_WATCH wakeup[1]; /* Eventfd written when a task is posted */
+    int tasks_ready; /* Set when wakeup is reported. The tasks run after the batch */
+    pthread_mutex_t tasks_mutex;
+    EVENT_TASK *tasks; /* Posted tasks, in order */
+    EVENT_TASK *last_task;
+    TIMER_WHEEL timers[1]; /* Ticks are milliseconds of event_loop_now. Only used by the loop thread */
+} EVENT_LOOP;
+
+/* Initialize a loop. It won't dispatch events until event_loop_start is called
+ * loop: Loop to initialize
+ * index: Number of the loop
+ * tick: Function called once per second in the loop thread. Can be 0
+ * return: 1 ok, 0 err
+ */
+int event_loop_init(EVENT_LOOP *loop, int index, EVENT_TICK tick);
+
+/* Start the thread of an initialized loop
+ * return: 1 ok, 0 err
+ */
+int event_loop_start(EVENT_LOOP *loop);
+
+/* Stop the loop thread and free the epoll descriptor.
+ * Watches still registered aren't closed.
+ */
+void event_loop_stop(EVENT_LOOP *loop);
+
+/* Register a watch in the loop. The watch must live until it is deleted
+ * loop: Loop
+ * watch: Descriptor, handler and private data
+ * events: Epoll events to wait for
+ * return: 1 ok, 0 err
+ */
+int event_loop_add(EVENT_LOOP *loop, EVENT_WATCH *watch, unsigned int events);
+
+/* Change the events a registered watch waits for
+ * return: 1 ok, 0 err
+ */
+int event_loop_mod(EVENT_LOOP *loop, EVENT_WATCH *watch, unsigned int events);
+
+/* Unregister a watch. It doesn't close the descriptor */
+void event_loop_del(EVENT_LOOP *loop, EVENT_WATCH *watch);
+
+/* Run a task in the loop thread. It can be called from any thread. The
+ * task must live until its function is called. It runs between batches of
+ * events, so it can free what the events of a batch refer to
+ * return: 1 ok, 0 err
+ */
+int event_loop_post(EVENT_LOOP *loop, EVENT_TASK *task);
+
+/* Current time of the timers of the loops
+ * return: Milliseconds of CLOCK_MONOTONIC
+ */
+unsigned long long event_loop_now();
+
+/* Start a timer of the loop, or move it if it's pending. Its function is
+ * called from the loop thread, the only one that can call this
+ * ms: Milliseconds until it expires
+ */
+void event_loop_timer_add(EVENT_LOOP *loop, TIMER *timer, long ms);
+
+/* Stop a timer of the loop. Only the loop thread can call it */
+void event_loop_timer_del(EVENT_LOOP *loop, TIMER *timer);
+
+/* Put a descriptor in non blocking mode
+ * return: 1 ok, 0 err
+ */
+int set_nonblocking(int fd);
+#endif
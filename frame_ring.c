@@ -0,0 +1,156 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "frame_ring.h"
+
+int frame_ring_init(FRAME_RING *ring, unsigned int n_descs, unsigned int data_size) {
+    if (!n_descs || (n_descs & (n_descs - 1)) || !data_size || (data_size & (data_size - 1)))
+        return(0);
+    ring->descs = malloc(n_descs * sizeof(FRAME_DESC));
+    ring->data = malloc(data_size);
+    if (!ring->descs || !ring->data) {
+        free(ring->descs);
+        free(ring->data);
+        return(0);
+    }
+    ring->n_descs = n_descs;
+    ring->data_size = data_size;
+    ring->head = 0;
+    ring->data_head = 0;
+    ring->tail = 0;
+    ring->data_tail = 0;
+    ring->read = 0;
+    ring->producer_waiting = 0;
+    ring->consumer_waiting = 0;
+    ring->closed = 0;
+    return(1);
+}
+
+void frame_ring_free(FRAME_RING *ring) {
+    free(ring->descs);
+    free(ring->data);
+    ring->descs = 0;
+    ring->data = 0;
+}
+
+/* Sleep while a counter of the other side has a value
+ * timeout: Microseconds, -1 without limit
+ * return: 0 if the time is over, 1 otherwise
+ */
+int frame_ring_sleep(unsigned int *counter, unsigned int value, long timeout) {
+    struct timespec ts;
+
+    if (timeout >= 0) {
+        ts.tv_sec = timeout / 1000000;
+        ts.tv_nsec = (timeout % 1000000) * 1000;
+    }
+    if (syscall(SYS_futex, counter, FUTEX_WAIT_PRIVATE, value, timeout >= 0 ? &ts : 0, 0, 0) == -1 &&
+            errno == ETIMEDOUT)
+        return(0);
+    return(1);
+}
+
+void frame_ring_wake(unsigned int *counter, int *waiting) {
+    if (__atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, counter, FUTEX_WAKE_PRIVATE, INT_MAX, 0, 0, 0);
+}
+
+int frame_ring_push(FRAME_RING *ring, const unsigned char *data, unsigned int size,
+        long long media_time, long long duration, int flags) {
+    FRAME_DESC *desc;
+    unsigned int pos;
+    unsigned int gap;
+    unsigned int tail;
+
+    if (!size)
+        return(1);
+    /* Anything up to half the ring fits wherever the free space is */
+    if (size > ring->data_size / 2)
+        return(0);
+    pos = ring->data_head & (ring->data_size - 1);
+    gap = pos + size > ring->data_size ? ring->data_size - pos : 0;
+
+    for (;;) {
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (ring->head - tail < ring->n_descs &&
+                ring->data_head + gap + size - ring->data_tail <= ring->data_size)
+            break;
+        if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE))
+            return(0);
+        /* The consumer wakes us up if it sees this after releasing */
+        __atomic_store_n(&ring->producer_waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == tail &&
+                !__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE))
+            frame_ring_sleep(&ring->tail, tail, -1);
+    }
+
+    ring->data_head += gap;
+    desc = &ring->descs[ring->head & (ring->n_descs - 1)];
+    desc->data = ring->data + (ring->data_head & (ring->data_size - 1));
+    memcpy(desc->data, data, size);
+    desc->size = size;
+    desc->media_time = media_time;
+    desc->duration = duration;
+    desc->flags = flags;
+    ring->data_head += size;
+    desc->data_end = ring->data_head;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_SEQ_CST);
+    frame_ring_wake(&ring->head, &ring->consumer_waiting);
+    return(1);
+}
+
+FRAME_DESC *frame_ring_peek(FRAME_RING *ring) {
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->read)
+        return(0);
+    return(&ring->descs[ring->read & (ring->n_descs - 1)]);
+}
+
+void frame_ring_consume(FRAME_RING *ring) {
+    ++ring->read;
+}
+
+void frame_ring_release(FRAME_RING *ring) {
+    if (ring->tail == ring->read)
+        return;
+    ring->data_tail = ring->descs[(ring->read - 1) & (ring->n_descs - 1)].data_end;
+    __atomic_store_n(&ring->tail, ring->read, __ATOMIC_SEQ_CST);
+    frame_ring_wake(&ring->tail, &ring->producer_waiting);
+}
+
+int frame_ring_wait(FRAME_RING *ring, long timeout) {
+    unsigned int head;
+
+    for (;;) {
+        if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->read)
+            return(1);
+        if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE))
+            return(-1);
+        if (timeout == 0)
+            return(0);
+        /* The producer wakes us up if it sees this after pushing */
+        __atomic_store_n(&ring->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+        if (head != ring->read || __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE))
+            continue;
+        if (!frame_ring_sleep(&ring->head, head, timeout))
+            timeout = 0;
+    }
+}
+
+void frame_ring_close(FRAME_RING *ring) {
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &ring->head, FUTEX_WAKE_PRIVATE, INT_MAX, 0, 0, 0);
+    syscall(SYS_futex, &ring->tail, FUTEX_WAKE_PRIVATE, INT_MAX, 0, 0, 0);
+}
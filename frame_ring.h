@@ -0,0 +1,87 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#ifndef _FRAME_RING_H_
+#define _FRAME_RING_H_
+
+#define FRAME_RING_DESCS 1024 /* Frames in the ring. Power of two */
+#define FRAME_RING_SIZE (4 << 20) /* Bytes of the frames. Power of two */
+#define FRAME_RING_KEY 1 /* The frame can be decoded alone */
+
+/* A frame written by the pipeline. Its data is in the ring */
+typedef struct {
+    long long media_time; /* Nanoseconds, -1 if unknown */
+    long long duration; /* Nanoseconds, -1 if unknown */
+    int flags; /* FRAME_RING_KEY */
+    unsigned int size;
+    unsigned char *data;
+    unsigned int data_end; /* Bytes written to the ring up to this frame */
+} FRAME_DESC;
+
+/* Frames passed from one producer to one consumer without locks. Each
+ * side only writes its own counters, and sleeps in a futex on the other
+ * side's counter when it can't go on. A frame is kept whole: if it doesn't
+ * fit at the end of the ring it's written at the start. The consumer
+ * releases frames after it has consumed them, so the data can be used
+ * until then without copying it */
+typedef struct {
+    FRAME_DESC *descs;
+    unsigned char *data;
+    unsigned int n_descs;
+    unsigned int data_size;
+    /* Written by the producer */
+    unsigned int head; /* Frames pushed */
+    unsigned int data_head; /* Bytes used, with the gaps left at the end */
+    /* Written by the consumer */
+    unsigned int tail; /* Frames released */
+    unsigned int data_tail;
+    unsigned int read; /* Frames consumed, released or not */
+    /* 1 if the other side must be woken up */
+    int producer_waiting;
+    int consumer_waiting;
+    int closed;
+} FRAME_RING;
+
+/* Initialize an empty ring
+ * n_descs: Maximum number of frames. Power of two
+ * data_size: Bytes of the frames. Power of two
+ * return: 1 ok, 0 err
+ */
+int frame_ring_init(FRAME_RING *ring, unsigned int n_descs, unsigned int data_size);
+
+void frame_ring_free(FRAME_RING *ring);
+
+/* Copy a frame into the ring. Called only by the producer. It waits
+ * while the ring is full
+ * flags: FRAME_RING_KEY
+ * return: 1 ok, 0 if the frame is too big or the ring is closed
+ */
+int frame_ring_push(FRAME_RING *ring, const unsigned char *data, unsigned int size,
+        long long media_time, long long duration, int flags);
+
+/* Get the next frame without consuming it. Called only by the consumer
+ * return: Frame, 0 if there isn't any
+ */
+FRAME_DESC *frame_ring_peek(FRAME_RING *ring);
+
+/* Consume the frame given by frame_ring_peek. Its data is still valid
+ * until it's released */
+void frame_ring_consume(FRAME_RING *ring);
+
+/* Give the data of the consumed frames back to the producer */
+void frame_ring_release(FRAME_RING *ring);
+
+/* Wait until there is a frame to consume. The consumed frames must have
+ * been released before waiting long, the producer may need their space
+ * timeout: Microseconds, -1 to wait until there is one
+ * return: 1 if there is a frame, 0 if the time is over, -1 if the ring is closed
+ */
+int frame_ring_wait(FRAME_RING *ring, long timeout);
+
+/* Stop the ring. Both sides stop waiting */
+void frame_ring_close(FRAME_RING *ring);
+#endif
@@ -11,6 +11,10 @@ THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGA
 typedef struct {
     unsigned char *media_uri; /* Uri for the media */
     unsigned int ssrc; /* Use the ssrc to locate the corresponding RTP session */
+    unsigned short server_port; /* Given by the RTP server in the SETUP */
+    unsigned int group; /* Multicast group given by the RTP server, network order. 0 if unicast */
+    int ttl; /* Of the packets sent to the group */
+    int interleaved; /* First channel if the media goes in the RTSP connection, -1 otherwise */
 } INTERNAL_MEDIA;
 
 typedef struct {
@@ -11,28 +11,17 @@ THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGA
 #include "parse_rtp.h"
 
 const unsigned char start_pkg[] = {128, 0};
+#define RTP_MARKER 0x80
 
 /*
  * return: Size of packet. 0 is error
  */
 int pack_rtp(RTP_PKG *pkg, unsigned char *packet, int pkg_max_size) {
-    unsigned short num_s;
-    unsigned long num_l;
     if (pkg_max_size < RTP_MIN_SIZE || pkg->d_size > pkg_max_size - RTP_MIN_SIZE)
         return(0);
 
     /* Set header */
-    memcpy(packet, start_pkg, 2);
-    packet += 2;
-    num_s = htons(pkg->header->seq);
-    memcpy(packet, &num_s, 2);
-    packet += 2;
-    num_l = htonl(pkg->header->timestamp);
-    memcpy(packet, &num_l, 4);
-    packet += 4;
-    num_l = htonl(pkg->header->ssrc);
-    memcpy(packet, &num_l, 4);
-    packet += 4;
+    packet += pack_rtp_header(pkg->header, packet);
 
     /* Copy data */
     memcpy(packet, pkg->data, pkg->d_size);
@@ -40,6 +29,34 @@ int pack_rtp(RTP_PKG *pkg, unsigned char *packet, int pkg_max_size) {
     return(RTP_MIN_SIZE + pkg->d_size);
 }
 
+int pack_rtp_header(RTP_HEADER *header, unsigned char *buf) {
+    unsigned short num_s;
+    unsigned int num_l;
+
+    memcpy(buf, start_pkg, 2);
+    if (header->marker)
+        buf[1] |= RTP_MARKER;
+    num_s = htons(header->seq);
+    memcpy(buf + 2, &num_s, 2);
+    num_l = htonl(header->timestamp);
+    memcpy(buf + 4, &num_l, 4);
+    num_l = htonl(header->ssrc);
+    memcpy(buf + 8, &num_l, 4);
+    return(RTP_MIN_SIZE);
+}
+
+int pack_rtp_iov(RTP_PKG *pkg, unsigned char *header, struct iovec *iov) {
+    iov[0].iov_base = header;
+    iov[0].iov_len = pack_rtp_header(pkg->header, header);
+    iov[1].iov_base = pkg->data;
+    iov[1].iov_len = pkg->d_size;
+    return(RTP_MIN_SIZE + pkg->d_size);
+}
+
+int pack_rtp_inplace(RTP_PKG *pkg) {
+    return(pack_rtp_header(pkg->header, pkg->data - RTP_MIN_SIZE) + pkg->d_size);
+}
+
 /*
  * return: Size of data. 0 if error
  */
@@ -50,8 +67,9 @@ int unpack_rtp(RTP_PKG *pkg, unsigned char *packet, int pkg_max_size) {
         return(0);
 
     /* Check header */
-    if (memcmp(packet, start_pkg, 2))
+    if (packet[0] != start_pkg[0] || (packet[1] & ~RTP_MARKER) != start_pkg[1])
         return(0);
+    pkg->header->marker = (packet[1] & RTP_MARKER) != 0;
     packet += 2;
     memcpy(&num_s, packet, 2);
     pkg->header->seq = ntohs(num_s);
@@ -8,9 +8,11 @@ THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGA
 #ifndef _PARSE_RTP_
 #define _PARSE_RTP_
 
+#include <sys/uio.h>
 #include "common.h"
 
 typedef struct {
+    unsigned char marker; /* 1 in the last packet of a frame */
     unsigned short seq;
     unsigned int timestamp;
     unsigned int ssrc;
@@ -29,6 +31,26 @@ typedef struct {
  */
 int pack_rtp(RTP_PKG *pkg, unsigned char *packet, int pkg_max_size);
 
+/* Write only the header of a packet
+ * header: RTP_MIN_SIZE bytes
+ * return: Size of the header
+ */
+int pack_rtp_header(RTP_HEADER *header, unsigned char *buf);
+
+/* Describe a packet as its header and its data, that isn't copied
+ * header: RTP_MIN_SIZE bytes where the header is written
+ * iov: Two elements, header and pkg->data
+ * return: Size of packet
+ */
+int pack_rtp_iov(RTP_PKG *pkg, unsigned char *header, struct iovec *iov);
+
+/* Write the header just before the data, that must have been read leaving
+ * RTP_MIN_SIZE bytes free in front of it. The packet starts at
+ * pkg->data - RTP_MIN_SIZE
+ * return: Size of packet
+ */
+int pack_rtp_inplace(RTP_PKG *pkg);
+
 /*
  * return: Size of data. 0 if error
  */
@@ -5,33 +5,60 @@ Permission to use, copy, modify, and/or distribute this software for any purpose
 
 THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
+#define _GNU_SOURCE
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <arpa/inet.h>
 #include "parse_rtsp.h"
 #include "strnstr.h"
 
 const int N_CAST = 2;
 const char *CAST_STR[] = {"unicast\0", "multicast\0"};
 
-const int N_ATTR = 6;
-const char *ATTR_STR[] = {"Accept\0", "Content-Type\0", "Content-Length\0", "CSeq\0", "Session\0", "Transport\0"};
+const int N_ATTR = 44;
+const char *ATTR_STR[] = {"Accept\0", "Content-Type\0", "Content-Length\0", "CSeq\0", "Session\0", "Transport\0",
+    "Accept-Encoding\0", "Accept-Language\0", "Allow\0", "Authorization\0", "Bandwidth\0", "Blocksize\0",
+    "Cache-Control\0", "Conference\0", "Connection\0", "Content-Base\0", "Content-Encoding\0",
+    "Content-Language\0", "Content-Location\0", "Date\0", "Expires\0", "From\0", "Host\0", "If-Match\0",
+    "If-Modified-Since\0", "Last-Modified\0", "Location\0", "Proxy-Authenticate\0", "Proxy-Require\0",
+    "Public\0", "Range\0", "Referer\0", "Require\0", "Retry-After\0", "RTP-Info\0", "Scale\0", "Speed\0",
+    "Server\0", "Timeout\0", "Unsupported\0", "User-Agent\0", "Vary\0", "Via\0", "WWW-Authenticate\0"};
 
-const int N_METHODS = 6;
-const char *METHOD_STR[] = {"DESCRIBE\0", "PLAY\0", "PAUSE\0", "SETUP\0", "TEARDOWN\0", "OPTIONS\0"};
+const int N_METHODS = 11;
+const char *METHOD_STR[] = {"DESCRIBE\0", "PLAY\0", "PAUSE\0", "SETUP\0", "TEARDOWN\0", "OPTIONS\0",
+    "ANNOUNCE\0", "GET_PARAMETER\0", "RECORD\0", "REDIRECT\0", "SET_PARAMETER\0"};
 
 const char *RTSP_STR = "RTSP/1.0\0";
 const char *RTSP_URI = "rtsp://\0";
 const char *SDP_STR = "application/sdp\0";
 const char *RTP_STR = "RTP/AVP\0";
+const char *TCP_STR = "RTP/AVP/TCP\0";
+const char *INTERLEAVED_STR = "interleaved=\0";
 const char *CLIENT_PORT_STR = "client_port=\0";
 const char *SERVER_PORT_STR = "server_port=\0";
-const char *OPTIONS_STR = "Public: DESCRIBE, SETUP, TEARDOWN, PLAY, PAUSE\0";
 
-const char *OK_STR = "OK\0";
-const char *SERVERERROR_STR = "Internal server error\0";
-const char *NOTFOUND_STR = "Not found\0";
-const char *NULL_STR = "\0";
+/* Pre-rendered beginning of the responses, up to the CSeq value */
+const char *STATUS_200_STR = "RTSP/1.0 200 OK\r\nCSeq: \0";
+const char *STATUS_304_STR = "RTSP/1.0 304 Not Modified\r\nCSeq: \0";
+const char *STATUS_404_STR = "RTSP/1.0 404 Not found\r\nCSeq: \0";
+const char *STATUS_500_STR = "RTSP/1.0 500 Internal server error\r\nCSeq: \0";
+const char *STATUS_START_STR = "RTSP/1.0 \0";
+const char *STATUS_END_STR = " \r\nCSeq: \0";
+const char *PUBLIC_LINE_STR = "\r\nPublic: DESCRIBE, SETUP, TEARDOWN, PLAY, PAUSE, GET_PARAMETER\0";
+const char *SESSION_LINE_STR = "\r\nSession: \0";
+const char *TRANSPORT_LINE_STR[] = {"\r\nTransport: RTP/AVP;unicast;client_port=\0", "\r\nTransport: RTP/AVP;multicast;client_port=\0"};
+const char *SERVER_PORT_PARAM_STR = ";server_port=\0";
+const char *MULTICAST_LINE_STR = "\r\nTransport: RTP/AVP;multicast;destination=\0";
+const char *INTERLEAVED_LINE_STR = "\r\nTransport: RTP/AVP/TCP;unicast;interleaved=\0";
+const char *PORT_PARAM_STR = ";port=\0";
+const char *TTL_PARAM_STR = ";ttl=\0";
+const char *DESTINATION_STR = "destination=\0";
+const char *LAST_MODIFIED_LINE_STR = "\r\nLast-Modified: \0";
+const char *CONTENT_LENGTH_LINE_STR = "\r\nContent-Length: \0";
+const char *END_HEADERS_STR = "\r\n\r\n\0";
 int unpack_rtsp_req(RTSP_REQUEST *req, char *req_text, int text_size) {
     char *tok_start;
     int tok_len;
@@ -41,9 +68,14 @@ int unpack_rtsp_req(RTSP_REQUEST *req, char *req_text, int text_size) {
     /* Initialize structure */
     req->method = -1;
     req->uri = 0;
+    req->uri_len = 0;
+    req->uri_borrowed = 0;
     req->CSeq = -1;
     req->Session = -1;
     req->client_port = 0;
+    req->interleaved = -1;
+    req->if_modified_since = 0;
+    req->if_modified_since_len = 0;
 
     /* Get method token */
     tok_len = strcspn(tok_start, " ");
@@ -69,6 +101,7 @@ int unpack_rtsp_req(RTSP_REQUEST *req, char *req_text, int text_size) {
     /* Copy uri */
     memcpy(req->uri, tok_start, tok_len);
     req->uri[tok_len] = 0;
+    req->uri_len = tok_len;
     if (!check_uri(req->uri))
         return(0);
     /* Prepare for next token */
@@ -139,7 +172,7 @@ int unpack_rtsp_req(RTSP_REQUEST *req, char *req_text, int text_size) {
         return(0);
     }
     /* client_port must be present if the method is SETUP */
-    if (req->client_port == 0 && req->method == SETUP) {
+    if (req->client_port == 0 && req->interleaved == -1 && req->method == SETUP) {
         free(req->uri);
         req->uri = 0;
         return(0);
@@ -149,33 +182,159 @@ int unpack_rtsp_req(RTSP_REQUEST *req, char *req_text, int text_size) {
 }
 
 int detect_method(char *tok_start, int text_size) {
-    int i;
     int method_len;
     method_len = strcspn(tok_start, " ");
     if (method_len == text_size || method_len == 0)
         return(-1);
-    /* Discover attribute */
-    for (i = 0; i < N_METHODS; ++i) {
-        if (!memcmp(METHOD_STR[i], tok_start, method_len))
-            return(i);
+    return(lookup_method(tok_start, method_len));
+}
+
+int lookup_method(const char *name, int len) {
+    int method = -1;
+
+    /* Candidate by length and first letter. The name is confirmed at the end */
+    switch (len) {
+        case 4:
+            method = PLAY;
+            break;
+        case 5:
+            method = tolower(name[0]) == 'p' ? PAUSE : SETUP;
+            break;
+        case 6:
+            method = RECORD;
+            break;
+        case 7:
+            method = OPTIONS;
+            break;
+        case 8:
+            switch (tolower(name[0])) {
+                case 'a': method = ANNOUNCE; break;
+                case 'd': method = DESCRIBE; break;
+                case 'r': method = REDIRECT; break;
+                case 't': method = TEARDOWN; break;
+            }
+            break;
+        case 13:
+            method = tolower(name[0]) == 'g' ? GET_PARAMETER : SET_PARAMETER;
+            break;
     }
-    return(-1);
+    if (method == -1 || strncasecmp(METHOD_STR[method], name, len))
+        return(-1);
+    return(method);
 }
 
-int detect_attr_req(RTSP_REQUEST *req, char *tok_start, int text_size) {
-    int i;
+int lookup_attr(const char *name, int len) {
     int attr = -1;
+
+    if (len < 3)
+        return(-1);
+    /* Candidate by length and first letter, and another letter when several
+     * headers share them. The name is confirmed at the end */
+    switch (len) {
+        case 3:
+            attr = VIA_STR;
+            break;
+        case 4:
+            switch (tolower(name[0])) {
+                case 'c': attr = CSEQ_STR; break;
+                case 'd': attr = DATE_STR; break;
+                case 'f': attr = FROM_STR; break;
+                case 'h': attr = HOST_STR; break;
+                case 'v': attr = VARY_STR; break;
+            }
+            break;
+        case 5:
+            switch (tolower(name[0])) {
+                case 'a': attr = ALLOW_STR; break;
+                case 'r': attr = RANGE_STR; break;
+                case 's': attr = tolower(name[1]) == 'c' ? SCALE_STR : SPEED_STR; break;
+            }
+            break;
+        case 6:
+            switch (tolower(name[0])) {
+                case 'a': attr = ACCEPT_STR; break;
+                case 'p': attr = PUBLIC_STR; break;
+                case 's': attr = SERVER_STR; break;
+            }
+            break;
+        case 7:
+            switch (tolower(name[0])) {
+                case 'e': attr = EXPIRES_STR; break;
+                case 'r': attr = tolower(name[2]) == 'f' ? REFERER_STR : REQUIRE_STR; break;
+                case 's': attr = SESSION_STR; break;
+                case 't': attr = TIMEOUT_STR; break;
+            }
+            break;
+        case 8:
+            switch (tolower(name[0])) {
+                case 'i': attr = IF_MATCH_STR; break;
+                case 'l': attr = LOCATION_STR; break;
+                case 'r': attr = RTP_INFO_STR; break;
+            }
+            break;
+        case 9:
+            switch (tolower(name[0])) {
+                case 'b': attr = tolower(name[1]) == 'a' ? BANDWIDTH_STR : BLOCKSIZE_STR; break;
+                case 't': attr = TRANSPORT_STR; break;
+            }
+            break;
+        case 10:
+            switch (tolower(name[0])) {
+                case 'c': attr = tolower(name[3]) == 'f' ? CONFERENCE_STR : CONNECTION_STR; break;
+                case 'u': attr = USER_AGENT_STR; break;
+            }
+            break;
+        case 11:
+            switch (tolower(name[0])) {
+                case 'r': attr = RETRY_AFTER_STR; break;
+                case 'u': attr = UNSUPPORTED_STR; break;
+            }
+            break;
+        case 12:
+            attr = tolower(name[8]) == 't' ? CONTENT_TYPE_STR : CONTENT_BASE_STR;
+            break;
+        case 13:
+            switch (tolower(name[0])) {
+                case 'a': attr = AUTHORIZATION_STR; break;
+                case 'c': attr = CACHE_CONTROL_STR; break;
+                case 'l': attr = LAST_MODIFIED_STR; break;
+                case 'p': attr = PROXY_REQUIRE_STR; break;
+            }
+            break;
+        case 14:
+            attr = CONTENT_LENGTH_STR;
+            break;
+        case 15:
+            attr = tolower(name[7]) == 'e' ? ACCEPT_ENCODING_STR : ACCEPT_LANGUAGE_STR;
+            break;
+        case 16:
+            if (tolower(name[0]) == 'w')
+                attr = WWW_AUTHENTICATE_STR;
+            else if (tolower(name[8]) == 'e')
+                attr = CONTENT_ENCODING_STR;
+            else
+                attr = tolower(name[9]) == 'a' ? CONTENT_LANGUAGE_STR : CONTENT_LOCATION_STR;
+            break;
+        case 17:
+            attr = IF_MODIFIED_SINCE_STR;
+            break;
+        case 18:
+            attr = PROXY_AUTHENTICATE_STR;
+            break;
+    }
+    if (attr == -1 || strncasecmp(ATTR_STR[attr], name, len))
+        return(-1);
+    return(attr);
+}
+
+int detect_attr_req(RTSP_REQUEST *req, char *tok_start, int text_size) {
+    int attr;
     int attr_len;
     attr_len = strcspn(tok_start, ":");
     if (attr_len == text_size || attr_len == 0)
         return(0);
     /* Discover attribute */
-    for (i = 0; i < N_ATTR; ++i) {
-        if (!memcmp(ATTR_STR[i], tok_start, attr_len)) {
-            attr = i;
-            break;
-        }
-    }
+    attr = lookup_attr(tok_start, attr_len);
     tok_start += attr_len;
     text_size -= attr_len - 1;
     /* Ignore spaces after ':' */
@@ -202,6 +361,19 @@ int detect_attr_req(RTSP_REQUEST *req, char *tok_start, int text_size) {
             /* The only acceptable transport is RTP */
             if (!strnstr(tok_start, RTP_STR, attr_len))
                 return(0);
+            /* Media interleaved in the connection, always unicast */
+            if (strnstr(tok_start, TCP_STR, attr_len)) {
+                if (!(tok_start = strnstr(tok_start, INTERLEAVED_STR, attr_len)))
+                    return(0);
+                tok_start += strlen(INTERLEAVED_STR);
+                if (*tok_start < '0' || *tok_start > '9')
+                    return(0);
+                req->interleaved = atoi(tok_start);
+                if (req->interleaved > 254)
+                    return(0);
+                req->cast = UNICAST;
+                break;
+            }
             /* Check if the transport is unicast or multicast */
             if (strnstr(tok_start, CAST_STR[UNICAST], attr_len))
                 req->cast = UNICAST;
@@ -225,6 +397,194 @@ int detect_attr_req(RTSP_REQUEST *req, char *tok_start, int text_size) {
     return(1);
 }
 
+/* Find needle in the first len characters of text, which isn't null terminated */
+char *find_in_view(char *text, int len, const char *needle) {
+    return(memmem(text, len, needle, strlen(needle)));
+}
+
+/* Parse a decimal number at the beginning of a view
+ * return: number of digits read. 0 if there isn't any digit
+ */
+int parse_view_int(char *text, int len, int *value) {
+    int i;
+
+    *value = 0;
+    for (i = 0; i < len && text[i] >= '0' && text[i] <= '9'; ++i)
+        *value = *value * 10 + (text[i] - '0');
+    return(i);
+}
+
+/* Store the value of a known header in the request
+ * return: 1 ok, 0 err
+ */
+int parse_attr_req_view(RTSP_REQUEST *req, int attr, char *value, int len) {
+    char *port;
+    int n;
+
+    switch (attr) {
+        case ACCEPT_STR:
+            /* Only can send SDP */
+            if (!find_in_view(value, len, SDP_STR))
+                return(0);
+            break;
+        case CSEQ_STR:
+            if (!parse_view_int(value, len, &req->CSeq))
+                return(0);
+            break;
+        case SESSION_STR:
+            if (!parse_view_int(value, len, &req->Session))
+                return(0);
+            break;
+        case TRANSPORT_STR:
+            /* The only acceptable transport is RTP */
+            if (!find_in_view(value, len, RTP_STR))
+                return(0);
+            /* Media interleaved in the connection, always unicast. Two
+             * channels are used, RTCP goes in the second one */
+            if (find_in_view(value, len, TCP_STR)) {
+                port = find_in_view(value, len, INTERLEAVED_STR);
+                if (!port)
+                    return(0);
+                port += strlen(INTERLEAVED_STR);
+                if (!parse_view_int(port, value + len - port, &n) || n > 254)
+                    return(0);
+                req->interleaved = n;
+                req->cast = UNICAST;
+                break;
+            }
+            /* Check if the transport is unicast or multicast */
+            if (find_in_view(value, len, CAST_STR[UNICAST]))
+                req->cast = UNICAST;
+            else if (find_in_view(value, len, CAST_STR[MULTICAST]))
+                req->cast = MULTICAST;
+            else
+                return(0);
+            /* Get the client ports */
+            port = find_in_view(value, len, CLIENT_PORT_STR);
+            if (port) {
+                port += strlen(CLIENT_PORT_STR);
+                if (!parse_view_int(port, value + len - port, &n) || n <= 0 || n > 65535)
+                    return(0);
+                req->client_port = (PORT)n;
+            }
+            break;
+        case IF_MODIFIED_SINCE_STR:
+            req->if_modified_since = value;
+            req->if_modified_since_len = len;
+            break;
+        default:
+            break;
+    }
+    return(1);
+}
+
+int unpack_rtsp_req_inplace(RTSP_REQUEST *req, char *req_text, int text_size) {
+    char *pos = req_text;
+    char *end = req_text + text_size;
+    char *line_end;
+    char *sep;
+    char *value;
+    int line_len;
+    int name_len;
+    int value_len;
+    int attr;
+
+    /* Initialize structure */
+    req->method = -1;
+    req->uri = 0;
+    req->uri_len = 0;
+    req->uri_borrowed = 1;
+    req->CSeq = -1;
+    req->Session = -1;
+    req->cast = UNICAST;
+    req->client_port = 0;
+    req->interleaved = -1;
+    req->if_modified_since = 0;
+    req->if_modified_since_len = 0;
+
+    /* Request line: method, uri and protocol */
+    line_end = memchr(pos, '\n', end - pos);
+    if (!line_end)
+        return(0);
+    line_len = line_end - pos;
+    if (line_len && pos[line_len - 1] == '\r')
+        --line_len;
+
+    sep = memchr(pos, ' ', line_len);
+    if (!sep)
+        return(0);
+    req->method = lookup_method(pos, sep - pos);
+    if (req->method == -1)
+        return(0);
+    line_len -= sep + 1 - pos;
+    pos = sep + 1;
+
+    sep = memchr(pos, ' ', line_len);
+    if (!sep)
+        return(0);
+    req->uri_len = sep - pos;
+    if (req->uri_len < (int)strlen(RTSP_URI) || memcmp(pos, RTSP_URI, strlen(RTSP_URI)))
+        return(0);
+    line_len -= sep + 1 - pos;
+    if (line_len != (int)strlen(RTSP_STR) || memcmp(sep + 1, RTSP_STR, line_len))
+        return(0);
+    /* The space after the uri is not needed anymore */
+    req->uri = pos;
+    *sep = 0;
+
+    /* Headers until an empty line */
+    for (pos = line_end + 1; ; pos = line_end + 1) {
+        line_end = memchr(pos, '\n', end - pos);
+        if (!line_end)
+            return(0);
+        line_len = line_end - pos;
+        if (line_len && pos[line_len - 1] == '\r')
+            --line_len;
+        if (!line_len)
+            break;
+
+        sep = memchr(pos, ':', line_len);
+        if (!sep || sep == pos)
+            return(0);
+        name_len = sep - pos;
+        while (name_len && pos[name_len - 1] == ' ')
+            --name_len;
+        attr = lookup_attr(pos, name_len);
+        if (attr == -1)
+            continue;
+
+        value = sep + 1;
+        value_len = pos + line_len - value;
+        while (value_len && (*value == ' ' || *value == '\t')) {
+            ++value;
+            --value_len;
+        }
+        while (value_len && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t'))
+            --value_len;
+        if (!value_len || !parse_attr_req_view(req, attr, value, value_len))
+            return(0);
+    }
+
+    /* Obligatory */
+    if (req->CSeq == -1)
+        return(0);
+    /* Session must be present if the method is PLAY, PAUSE or TEARDOWN */
+    if (req->Session == -1 && (req->method == PLAY || req->method == PAUSE || req->method == TEARDOWN))
+        return(0);
+    /* client_port must be present if the method is SETUP */
+    if (req->client_port == 0 && req->interleaved == -1 && req->method == SETUP)
+        return(0);
+
+    return(1);
+}
+
+void release_rtsp_req(RTSP_REQUEST *req) {
+    if (req->uri && !req->uri_borrowed)
+        free(req->uri);
+    req->uri = 0;
+    req->uri_len = 0;
+}
+
 /*
  * Pack the structure RTSP_REQUEST in a string
  * req: request structure
@@ -278,8 +638,13 @@ int pack_rtsp_req(RTSP_REQUEST *req, char *req_text, int text_size) {
         written += ret;
     }
 
-    /* Write client port */
-    if (req->client_port) {
+    /* Write the channels or the client port */
+    if (req->interleaved != -1) {
+        ret = snprintf(req_text + written, text_size - written, "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d\r\n", req->interleaved, req->interleaved + 1);
+        if (ret < 0 || ret >= text_size - written)
+            return(0);
+        written += ret;
+    } else if (req->client_port) {
         ret = snprintf(req_text + written, text_size - written, "Transport: RTP/AVP;%s;client_port=%d-%d\r\n", CAST_STR[req->cast], req->client_port, req->client_port + 1);
         if (ret < 0 || ret >= text_size - written)
             return(0);
@@ -319,8 +684,13 @@ int unpack_rtsp_res(RTSP_RESPONSE *res, char *res_text, int text_size) {
     res->Session = -1;
     res->client_port = 0;
     res->server_port = 0;
+    res->destination = 0;
+    res->ttl = 0;
+    res->interleaved = -1;
     res->Content_Length = -1;
     res->content = 0;
+    res->content_borrowed = 0;
+    res->last_modified = 0;
     res->options = 0;
 
     /* Get rtsp token */
@@ -431,83 +801,219 @@ int unpack_rtsp_res(RTSP_RESPONSE *res, char *res_text, int text_size) {
 
     return(1);
 }
-int pack_rtsp_res(RTSP_RESPONSE *res, char *res_text, int text_size) {
-    int ret;
-    int written;
-    const char *status_str;
+int format_int(char *text, int value) {
+    char digits[10];
+    unsigned int n = value;
+    int len = 0;
+    int i = 0;
 
-    /* Save space for the last \0 */
-    --text_size;
+    if (value < 0) {
+        text[len++] = '-';
+        n = -(unsigned int)value;
+    }
+    do {
+        digits[i++] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    while (i)
+        text[len++] = digits[--i];
+    return(len);
+}
 
-    /* Write protocol and code*/
-    if (res->code == -1)
-        return(0);
-    if (res->code == 200)
-        status_str = OK_STR;
-    else if (res->code == 500)
-        status_str = SERVERERROR_STR;
-    else if (res->code == 404)
-        status_str = NOTFOUND_STR;
-    else
-        status_str = NULL_STR;
+/* Write an IPv4 address in network order as a.b.c.d */
+int format_ipv4(char *text, unsigned int addr) {
+    unsigned char *bytes = (unsigned char *)&addr;
+    int len = 0;
+    int i;
 
-    ret = written = snprintf(res_text, text_size, "RTSP/1.0 %d %s\r\n", res->code, status_str);
-    if (ret < 0 || ret >= text_size)
-        return(0);
+    for (i = 0; i < 4; ++i) {
+        if (i)
+            text[len++] = '.';
+        len += format_int(text + len, bytes[i]);
+    }
+    return(len);
+}
 
-    /* CSeq must have a value always*/ 
-    if (!res->CSeq)
+/* Write a pair of ports as port-port+1 */
+int format_port_pair(char *text, PORT port) {
+    int len;
+
+    len = format_int(text, port);
+    text[len++] = '-';
+    len += format_int(text + len, port + 1);
+    return(len);
+}
+
+int pack_rtsp_res_iov(RTSP_RESPONSE *res, struct iovec *iov, char *scratch) {
+    int n = 0;
+    int len;
+
+    if (res->code == -1)
         return(0);
-    /* Print to res_text */
-    ret = snprintf(res_text + written, text_size - written, "CSeq: %d\r\n", res->CSeq);
-    /* Check if the printed text was larger than the space available in res_text */
-    if (ret < 0 || ret >= text_size-written)
+    /* CSeq must have a value always*/
+    if (!res->CSeq)
         return(0);
-    /* Add the number of characters written to written */
-    written += ret;
+
+    /* Status line and CSeq name */
+    if (res->code == 200) {
+        iov[n].iov_base = (char *)STATUS_200_STR;
+    } else if (res->code == 304) {
+        iov[n].iov_base = (char *)STATUS_304_STR;
+    } else if (res->code == 404) {
+        iov[n].iov_base = (char *)STATUS_404_STR;
+    } else if (res->code == 500) {
+        iov[n].iov_base = (char *)STATUS_500_STR;
+    } else {
+        iov[n].iov_base = (char *)STATUS_START_STR;
+        iov[n].iov_len = strlen(STATUS_START_STR);
+        ++n;
+        len = format_int(scratch, res->code);
+        iov[n].iov_base = scratch;
+        iov[n].iov_len = len;
+        scratch += len;
+        ++n;
+        iov[n].iov_base = (char *)STATUS_END_STR;
+    }
+    iov[n].iov_len = strlen(iov[n].iov_base);
+    ++n;
+
+    /* CSeq value. The end of each line goes with the next header */
+    len = format_int(scratch, res->CSeq);
+    iov[n].iov_base = scratch;
+    iov[n].iov_len = len;
+    scratch += len;
+    ++n;
 
     /* Respond to options */
     if (res->options != 0) {
-        ret = snprintf(res_text + written, text_size - written, "%s\r\n", OPTIONS_STR);
-        if (ret < 0 || ret >= text_size - written)
-            return(0);
-        written += ret;
+        iov[n].iov_base = (char *)PUBLIC_LINE_STR;
+        iov[n].iov_len = strlen(PUBLIC_LINE_STR);
+        ++n;
     }
 
     /* Write session number */
     if (res->Session != -1 && res->Session != 0) {
-        ret = snprintf(res_text + written, text_size - written, "Session: %d\r\n", res->Session);
-        if (ret < 0 || ret >= text_size - written)
-            return(0);
-        written += ret;
+        iov[n].iov_base = (char *)SESSION_LINE_STR;
+        iov[n].iov_len = strlen(SESSION_LINE_STR);
+        ++n;
+        len = format_int(scratch, res->Session);
+        iov[n].iov_base = scratch;
+        iov[n].iov_len = len;
+        scratch += len;
+        ++n;
     }
 
-    /* Write client and server ports*/
-    if (res->client_port && res->server_port) {
-        ret = snprintf(res_text + written, text_size - written, "Transport: RTP/AVP;%s;client_port=%d-%d;server_port=%d-%d\r\n", CAST_STR[res->cast], res->client_port, res->client_port + 1, res->server_port, res->server_port + 1);
-        if (ret < 0 || ret >= text_size - written)
-            return(0);
-        written += ret;
+    /* Write the channels of the connection the media goes in */
+    if (res->interleaved != -1) {
+        iov[n].iov_base = (char *)INTERLEAVED_LINE_STR;
+        iov[n].iov_len = strlen(INTERLEAVED_LINE_STR);
+        ++n;
+        len = format_port_pair(scratch, res->interleaved);
+        iov[n].iov_base = scratch;
+        iov[n].iov_len = len;
+        scratch += len;
+        ++n;
+    } else if (res->cast == MULTICAST && res->destination && res->server_port) {
+        /* Write the group the client must join */
+        iov[n].iov_base = (char *)MULTICAST_LINE_STR;
+        iov[n].iov_len = strlen(MULTICAST_LINE_STR);
+        ++n;
+        len = format_ipv4(scratch, res->destination);
+        iov[n].iov_base = scratch;
+        iov[n].iov_len = len;
+        scratch += len;
+        ++n;
+        iov[n].iov_base = (char *)PORT_PARAM_STR;
+        iov[n].iov_len = strlen(PORT_PARAM_STR);
+        ++n;
+        len = format_port_pair(scratch, res->server_port);
+        iov[n].iov_base = scratch;
+        iov[n].iov_len = len;
+        scratch += len;
+        ++n;
+        iov[n].iov_base = (char *)TTL_PARAM_STR;
+        iov[n].iov_len = strlen(TTL_PARAM_STR);
+        ++n;
+        len = format_int(scratch, res->ttl);
+        iov[n].iov_base = scratch;
+        iov[n].iov_len = len;
+        scratch += len;
+        ++n;
+    } else if (res->client_port && res->server_port) {
+        /* Write client and server ports*/
+        iov[n].iov_base = (char *)TRANSPORT_LINE_STR[res->cast];
+        iov[n].iov_len = strlen(TRANSPORT_LINE_STR[res->cast]);
+        ++n;
+        len = format_port_pair(scratch, res->client_port);
+        iov[n].iov_base = scratch;
+        iov[n].iov_len = len;
+        scratch += len;
+        ++n;
+        iov[n].iov_base = (char *)SERVER_PORT_PARAM_STR;
+        iov[n].iov_len = strlen(SERVER_PORT_PARAM_STR);
+        ++n;
+        len = format_port_pair(scratch, res->server_port);
+        iov[n].iov_base = scratch;
+        iov[n].iov_len = len;
+        scratch += len;
+        ++n;
+    }
+
+    if (res->last_modified) {
+        iov[n].iov_base = (char *)LAST_MODIFIED_LINE_STR;
+        iov[n].iov_len = strlen(LAST_MODIFIED_LINE_STR);
+        ++n;
+        iov[n].iov_base = (char *)res->last_modified;
+        iov[n].iov_len = strlen(res->last_modified);
+        ++n;
     }
 
     if (res->Content_Length > 0) {
-        ret = snprintf(res_text + written, text_size - written, "Content-Length: %d\r\n", res->Content_Length);
-        if (ret < 0 || ret >= text_size - written)
-            return(0);
-        written += ret;
+        iov[n].iov_base = (char *)CONTENT_LENGTH_LINE_STR;
+        iov[n].iov_len = strlen(CONTENT_LENGTH_LINE_STR);
+        ++n;
+        len = format_int(scratch, res->Content_Length);
+        iov[n].iov_base = scratch;
+        iov[n].iov_len = len;
+        scratch += len;
+        ++n;
     }
-    /* Empty line */
-    ret = snprintf(res_text + written, text_size - written, "\r\n");
-    if (ret < 0 || ret >= text_size - written)
-        return(0);
-    written += ret;
 
-    if (res->content) {
-        ret = snprintf(res_text + written, text_size - written, "%s", res->content);
-        if (ret < 0 || ret >= text_size - written)
+    /* End of the last line and empty line */
+    iov[n].iov_base = (char *)END_HEADERS_STR;
+    iov[n].iov_len = strlen(END_HEADERS_STR);
+    ++n;
+
+    /* The content is sent from where it is */
+    if (res->content && res->Content_Length > 0) {
+        iov[n].iov_base = res->content;
+        iov[n].iov_len = res->Content_Length;
+        ++n;
+    }
+
+    return(n);
+}
+
+int pack_rtsp_res(RTSP_RESPONSE *res, char *res_text, int text_size) {
+    struct iovec iov[RES_IOV_MAX];
+    char scratch[RES_SCRATCH];
+    int n;
+    int i;
+    int written = 0;
+
+    /* Save space for the last \0 */
+    --text_size;
+
+    n = pack_rtsp_res_iov(res, iov, scratch);
+    if (!n)
+        return(0);
+    for (i = 0; i < n; ++i) {
+        if (written + (int)iov[i].iov_len >= text_size)
             return(0);
-        written += ret;
+        memcpy(res_text + written, iov[i].iov_base, iov[i].iov_len);
+        written += iov[i].iov_len;
     }
+    res_text[written] = 0;
 
     return(written);
 }
@@ -519,19 +1025,16 @@ int check_uri(char *uri) {
 }
 
 int detect_attr_res(RTSP_RESPONSE *res, char *tok_start, int text_size) {
-    int i;
-    int attr = -1;
+    int attr;
     int attr_len;
+    char *param;
+    char addr[16];
+    int len;
     attr_len = strcspn(tok_start, ":");
     if (attr_len == text_size || attr_len == 0)
         return(0);
     /* Discover attribute */
-    for (i = 0; i < N_ATTR; ++i) {
-        if (!memcmp(ATTR_STR[i], tok_start, attr_len)) {
-            attr = i;
-            break;
-        }
-    }
+    attr = lookup_attr(tok_start, attr_len);
     tok_start += attr_len;
     text_size -= attr_len - 1;
     /* Ignore spaces after ':' */
@@ -570,6 +1073,40 @@ int detect_attr_res(RTSP_RESPONSE *res, char *tok_start, int text_size) {
             else
                 return(0);
 
+            /* Get the channels of the connection */
+            if (strnstr(tok_start, TCP_STR, attr_len)) {
+                param = strnstr(tok_start, INTERLEAVED_STR, attr_len);
+                if (!param)
+                    return(0);
+                param += strlen(INTERLEAVED_STR);
+                if (*param < '0' || *param > '9')
+                    return(0);
+                res->interleaved = atoi(param);
+                break;
+            }
+
+            /* Get the group, its port and ttl */
+            if ( (param = strnstr(tok_start, DESTINATION_STR, attr_len)) ) {
+                param += strlen(DESTINATION_STR);
+                len = strcspn(param, ";\r\n");
+                if (len >= (int)sizeof(addr))
+                    return(0);
+                memcpy(addr, param, len);
+                addr[len] = 0;
+                if (inet_pton(AF_INET, addr, &res->destination) != 1)
+                    return(0);
+                param = strnstr(tok_start, PORT_PARAM_STR, attr_len);
+                if (!param)
+                    return(0);
+                res->server_port = (PORT)atoi(param + strlen(PORT_PARAM_STR));
+                if (res->server_port == 0)
+                    return(0);
+                param = strnstr(tok_start, TTL_PARAM_STR, attr_len);
+                if (param)
+                    res->ttl = atoi(param + strlen(TTL_PARAM_STR));
+                break;
+            }
+
             /* Get the client ports */
             if ( (tok_start = strnstr(tok_start, CLIENT_PORT_STR, attr_len)) ) {
                 if (!tok_start)
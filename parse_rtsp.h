@@ -7,22 +7,39 @@ THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGA
 */
 #ifndef _PARSE_RTSP_H_
 #define _PARSE_RTSP_H_
+#include <sys/uio.h>
 #include "common.h"
 
+#define RES_IOV_MAX 24 /* Maximum pieces of a packed response */
+#define RES_SCRATCH 128 /* Space needed to format the numbers of a response */
+
 typedef enum {UNICAST = 0, MULTICAST} TRANSPORT_CAST;
 
-typedef enum {ACCEPT_STR = 0, CONTENT_TYPE_STR, CONTENT_LENGTH_STR, CSEQ_STR, SESSION_STR, TRANSPORT_STR} ATTR;
+/* Headers of RFC 2326. The first ones are the headers the server uses */
+typedef enum {ACCEPT_STR = 0, CONTENT_TYPE_STR, CONTENT_LENGTH_STR, CSEQ_STR, SESSION_STR, TRANSPORT_STR,
+    ACCEPT_ENCODING_STR, ACCEPT_LANGUAGE_STR, ALLOW_STR, AUTHORIZATION_STR, BANDWIDTH_STR, BLOCKSIZE_STR,
+    CACHE_CONTROL_STR, CONFERENCE_STR, CONNECTION_STR, CONTENT_BASE_STR, CONTENT_ENCODING_STR,
+    CONTENT_LANGUAGE_STR, CONTENT_LOCATION_STR, DATE_STR, EXPIRES_STR, FROM_STR, HOST_STR, IF_MATCH_STR,
+    IF_MODIFIED_SINCE_STR, LAST_MODIFIED_STR, LOCATION_STR, PROXY_AUTHENTICATE_STR, PROXY_REQUIRE_STR,
+    PUBLIC_STR, RANGE_STR, REFERER_STR, REQUIRE_STR, RETRY_AFTER_STR, RTP_INFO_STR, SCALE_STR, SPEED_STR,
+    SERVER_STR, TIMEOUT_STR, UNSUPPORTED_STR, USER_AGENT_STR, VARY_STR, VIA_STR, WWW_AUTHENTICATE_STR} ATTR;
 
 
-typedef enum {DESCRIBE = 0, PLAY, PAUSE, SETUP, TEARDOWN, OPTIONS} METHOD;
+typedef enum {DESCRIBE = 0, PLAY, PAUSE, SETUP, TEARDOWN, OPTIONS,
+    ANNOUNCE, GET_PARAMETER, RECORD, REDIRECT, SET_PARAMETER} METHOD;
 
 typedef struct {
     METHOD method;
-    char *uri; /* Memory reserved in unpack_rtsp_req */
+    char *uri; /* Memory reserved in unpack_rtsp_req, borrowed in unpack_rtsp_req_inplace */
+    int uri_len;
+    int uri_borrowed; /* 1 if uri points into the parsed text and mustn't be freed */
     int CSeq;
     int Session;
     TRANSPORT_CAST cast;
     PORT client_port;
+    int interleaved; /* First channel of RTP/AVP/TCP, -1 if the media goes over UDP */
+    char *if_modified_since; /* Points into the parsed text, not null terminated. 0 if not present */
+    int if_modified_since_len;
 } RTSP_REQUEST;
 
 typedef struct {
@@ -31,16 +48,49 @@ typedef struct {
     int Session;
     TRANSPORT_CAST cast;
     PORT client_port;
-    PORT server_port;
+    PORT server_port; /* Port of the group if destination is set */
+    unsigned int destination; /* Multicast group, network order. 0 if not sent */
+    int ttl; /* Of the multicast group */
+    int interleaved; /* First channel of RTP/AVP/TCP, -1 if not sent */
     int Content_Length;
     char *content;
+    int content_borrowed; /* 1 if content isn't freed with the response */
+    const char *last_modified; /* Date of the content, not freed. 0 if not sent */
     int options;
 } RTSP_RESPONSE;
 
 int unpack_rtsp_req(RTSP_REQUEST *req, char *req_text, int text_size);
 
+/* Unpack a request without reserving memory. The uri is left pointing into
+ * req_text, so the text must be writable and live as long as req is used.
+ * The text doesn't need to be null terminated. Unknown headers are ignored.
+ * req: request structure
+ * req_text: Text of one complete request. The character after the uri is
+ *           overwritten with a \0
+ * text_size: Length of req_text
+ * return: 1 ok, 0 err
+ */
+int unpack_rtsp_req_inplace(RTSP_REQUEST *req, char *req_text, int text_size);
+
+/* Free the uri of a request if it isn't borrowed */
+void release_rtsp_req(RTSP_REQUEST *req);
+
 int detect_method(char *tok_start, int text_size);
 
+/* Map a method name to its METHOD in constant time. It isn't case sensitive
+ * name: Method name, not null terminated
+ * len: Length of name
+ * return: METHOD, -1 if unknown
+ */
+int lookup_method(const char *name, int len);
+
+/* Map a header name to its ATTR in constant time. It isn't case sensitive
+ * name: Header name, not null terminated
+ * len: Length of name
+ * return: ATTR, -1 if unknown
+ */
+int lookup_attr(const char *name, int len);
+
 int detect_attr_req(RTSP_REQUEST *req, char *tok_start, int text_size);
 
 /*
@@ -56,6 +106,21 @@ int unpack_rtsp_res2(RTSP_RESPONSE **res, char *res_text, int text_size);
 int unpack_rtsp_res(RTSP_RESPONSE *res, char *res_text, int text_size);
 int pack_rtsp_res(RTSP_RESPONSE *res, char *res_text, int text_size);
 
+/* Pack a response as a list of pieces ready for writev. Constant parts point
+ * to pre-rendered strings, numbers are formatted in scratch and the content
+ * isn't copied, so res and scratch must live until the pieces are sent.
+ * res: Response
+ * iov: Array of at least RES_IOV_MAX pieces
+ * scratch: At least RES_SCRATCH bytes
+ * return: Number of pieces used. 0 is error
+ */
+int pack_rtsp_res_iov(RTSP_RESPONSE *res, struct iovec *iov, char *scratch);
+
+/* Write a number in decimal, without the final \0
+ * return: Number of characters written, at most 11
+ */
+int format_int(char *text, int value);
+
 int detect_attr_res(RTSP_RESPONSE *res, char *tok_start, int text_size);
 
 int check_uri(char *uri);
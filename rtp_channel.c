@@ -0,0 +1,497 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#include "rtp_channel.h"
+
+void *rtp_channel_reader_fun(void *arg);
+
+RTP_CHANNEL channels[MAX_RTP_CHANNELS];
+/* Protects the channels and their pending calls */
+pthread_mutex_t channels_mutex;
+PORT rtp_port;
+
+int rtp_channel_init(PORT port) {
+    int i;
+
+    rtp_port = port;
+    for (i = 0; i < MAX_RTP_CHANNELS; ++i) {
+        channels[i].used = 0;
+        channels[i].fd = -1;
+        channels[i].wake = -1;
+        channels[i].out = 0;
+        channels[i].calls = 0;
+    }
+    if (pthread_mutex_init(&channels_mutex, 0))
+        return(0);
+    return(1);
+}
+
+/* Call the functions of finished orders. The mutex must not be locked
+ * calls: List of orders taken out of their channel
+ * frame: Response of the first order. 0 if they have all failed
+ */
+void rtp_channel_finish(RTP_CALL *calls, RTP_CHANNEL_FRAME *frame) {
+    RTP_CHANNEL_FRAME error;
+    RTP_CALL *next;
+
+    for (; calls; calls = next) {
+        next = calls->next;
+        if (!frame) {
+            memset(&error, 0, sizeof(error));
+            error.id = calls->id;
+            error.order = ERR_RTP;
+            calls->done(&error, calls->data);
+        } else {
+            calls->done(frame, calls->data);
+            frame = 0;
+        }
+        free(calls);
+    }
+}
+
+void rtp_channel_free() {
+    RTP_CALL *failed = 0;
+    RTP_CALL *last;
+    unsigned long long one = 1;
+    int i;
+
+    pthread_mutex_lock(&channels_mutex);
+    for (i = 0; i < MAX_RTP_CHANNELS; ++i) {
+        if (channels[i].wake != -1) {
+            /* The reader thread closes the descriptors when it sees it
+             * isn't the reader of the channel any more */
+            if (channels[i].fd != -1)
+                shutdown(channels[i].fd, SHUT_RDWR);
+            write(channels[i].wake, &one, sizeof(one));
+            channels[i].fd = -1;
+            channels[i].wake = -1;
+            channels[i].connected = 0;
+        }
+        if (channels[i].calls) {
+            for (last = channels[i].calls; last->next; last = last->next);
+            last->next = failed;
+            failed = channels[i].calls;
+            channels[i].calls = 0;
+        }
+        free(channels[i].out);
+        channels[i].out = 0;
+        channels[i].used = 0;
+    }
+    pthread_mutex_unlock(&channels_mutex);
+    rtp_channel_finish(failed, 0);
+}
+
+/* Get the host of a uri, without the port
+ * return: 1 ok, 0 err
+ */
+int rtp_channel_host(const char *uri, char *host) {
+    int len;
+
+    if (strncmp(uri, "rtsp://", 7))
+        return(0);
+    uri += 7;
+    len = strcspn(uri, ":/");
+    if (len == 0 || len >= MAX_RTP_HOST)
+        return(0);
+    memcpy(host, uri, len);
+    host[len] = 0;
+    return(1);
+}
+
+/* Find the channel of a host. The mutex must be locked
+ * return: Channel, 0 if there isn't any
+ */
+RTP_CHANNEL *rtp_channel_find(const char *host) {
+    int i;
+
+    for (i = 0; i < MAX_RTP_CHANNELS; ++i)
+        if (channels[i].used && !strcmp(channels[i].host, host))
+            return(&channels[i]);
+    return(0);
+}
+
+/* Resolve the address of the RTP server of a host. It can block, so it's
+ * only called from the reader of the channel, without the mutex
+ * return: 1 ok, 0 err
+ */
+int rtp_channel_resolve(const char *host, struct sockaddr_in *addr) {
+    char port_str[6];
+    struct addrinfo hints, *res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port_str, sizeof(port_str), "%d", rtp_port);
+    if (getaddrinfo(host, port_str, &hints, &res))
+        return(0);
+    memcpy(addr, res->ai_addr, sizeof(struct sockaddr_in));
+    freeaddrinfo(res);
+    return(1);
+}
+
+/* Create the channel of a host. The mutex must be locked
+ * return: Channel, 0 if there isn't room
+ */
+RTP_CHANNEL *rtp_channel_add(const char *host) {
+    RTP_CHANNEL *channel;
+    int i;
+
+    for (i = 0; i < MAX_RTP_CHANNELS; ++i)
+        if (!channels[i].used)
+            break;
+    if (i == MAX_RTP_CHANNELS)
+        return(0);
+
+    channel = &channels[i];
+    strcpy(channel->host, host);
+    channel->resolved = 0;
+    channel->fd = -1;
+    channel->connected = 0;
+    channel->wake = -1;
+    channel->out = 0;
+    channel->out_size = 0;
+    channel->out_len = 0;
+    channel->out_sent = 0;
+    channel->next_id = 0;
+    channel->calls = 0;
+    channel->used = 1;
+    return(channel);
+}
+
+/* Start connecting to an RTP server without blocking
+ * connected: Set to 1 if the connection is already complete
+ * return: Socket, -1 err
+ */
+int rtp_channel_socket(struct sockaddr_in *addr, int *connected) {
+    int fd;
+    int one = 1;
+    int st;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return(-1);
+    /* Frames are small and must leave as soon as they are written */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    st = connect(fd, (struct sockaddr *)addr, sizeof(struct sockaddr_in));
+    if (st == -1 && errno != EINPROGRESS) {
+        close(fd);
+        return(-1);
+    }
+    *connected = st == 0;
+    return(fd);
+}
+
+/* Start the thread that resolves the server of a channel, connects it and
+ * reads its responses. Orders are queued meanwhile. The mutex must be locked
+ * return: 1 ok, 0 err
+ */
+int rtp_channel_connect(RTP_CHANNEL *channel) {
+    int wake;
+
+    wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake == -1)
+        return(0);
+    channel->fd = -1;
+    channel->wake = wake;
+    channel->connected = 0;
+    channel->out_len = 0;
+    channel->out_sent = 0;
+    if (pthread_create(&channel->reader, 0, rtp_channel_reader_fun, channel)) {
+        close(wake);
+        channel->wake = -1;
+        return(0);
+    }
+    pthread_detach(channel->reader);
+    return(1);
+}
+
+/* Write the queued orders without blocking. The mutex must be locked
+ * return: 1 ok, 0 if the connection has failed
+ */
+int rtp_channel_flush(RTP_CHANNEL *channel) {
+    int st;
+
+    while (channel->out_sent < channel->out_len) {
+        st = send(channel->fd, channel->out + channel->out_sent, channel->out_len - channel->out_sent,
+                MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (st == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return(1);
+            return(0);
+        }
+        channel->out_sent += st;
+    }
+    channel->out_len = 0;
+    channel->out_sent = 0;
+    return(1);
+}
+
+/* Add an order to the queue of a channel. The mutex must be locked
+ * uri: request->uri_len characters of it go after the frame
+ * return: 1 ok, 0 if there isn't room
+ */
+int rtp_channel_queue(RTP_CHANNEL *channel, RTP_CHANNEL_FRAME *request, const char *uri) {
+    int len = sizeof(RTP_CHANNEL_FRAME) + request->uri_len;
+    int size;
+    char *tmp;
+
+    if (channel->out_len - channel->out_sent + len > RTP_CHANNEL_MAX_QUEUE)
+        return(0);
+    /* What is left goes to the start */
+    if (channel->out_sent) {
+        memmove(channel->out, channel->out + channel->out_sent, channel->out_len - channel->out_sent);
+        channel->out_len -= channel->out_sent;
+        channel->out_sent = 0;
+    }
+    if (channel->out_len + len > channel->out_size) {
+        size = channel->out_size ? channel->out_size : RTP_CHANNEL_QUEUE_SIZE;
+        while (size < channel->out_len + len)
+            size *= 2;
+        tmp = realloc(channel->out, size);
+        if (!tmp)
+            return(0);
+        channel->out = tmp;
+        channel->out_size = size;
+    }
+    memcpy(channel->out + channel->out_len, request, sizeof(RTP_CHANNEL_FRAME));
+    memcpy(channel->out + channel->out_len + sizeof(RTP_CHANNEL_FRAME), uri, request->uri_len);
+    channel->out_len += len;
+    return(1);
+}
+
+/* Take out of a channel the order with an id, or all the orders that
+ * have timed out if id is 0. The mutex must be locked
+ * return: List of orders taken out
+ */
+RTP_CALL *rtp_channel_take(RTP_CHANNEL *channel, unsigned int id, time_t now) {
+    RTP_CALL **ptr = &channel->calls;
+    RTP_CALL *taken = 0;
+    RTP_CALL *call;
+
+    while (*ptr) {
+        call = *ptr;
+        if ((id && call->id == id) || (!id && call->deadline <= now)) {
+            *ptr = call->next;
+            call->next = taken;
+            taken = call;
+            if (id)
+                break;
+        } else {
+            ptr = &call->next;
+        }
+    }
+    return(taken);
+}
+
+/* Resolve the server the first time and connect, complete the connection,
+ * write the queued orders when the socket is writable, and read the
+ * responses and give them to the orders waiting for them. The eventfd
+ * tells if it's still the reader of the channel */
+void *rtp_channel_reader_fun(void *arg) {
+    RTP_CHANNEL *channel = arg;
+    RTP_CHANNEL_FRAME frame;
+    RTP_CALL *calls;
+    struct pollfd fds[2];
+    char host[MAX_RTP_HOST];
+    struct sockaddr_in addr;
+    unsigned long long count;
+    int got = 0;
+    int fd = -1;
+    int wake;
+    int resolved;
+    int connected = 0;
+    int err;
+    socklen_t err_len = sizeof(err);
+    int st;
+    time_t now;
+    time_t last_check = time(0);
+
+    pthread_mutex_lock(&channels_mutex);
+    wake = channel->wake;
+    resolved = channel->resolved;
+    strcpy(host, channel->host);
+    memcpy(&addr, &channel->addr, sizeof(addr));
+    pthread_mutex_unlock(&channels_mutex);
+
+    /* The orders wait in the queue while the name is resolved */
+    if (!resolved && !rtp_channel_resolve(host, &addr))
+        goto end;
+    fd = rtp_channel_socket(&addr, &connected);
+    if (fd == -1)
+        goto end;
+    pthread_mutex_lock(&channels_mutex);
+    st = channel->wake == wake;
+    if (st) {
+        memcpy(&channel->addr, &addr, sizeof(addr));
+        channel->resolved = 1;
+        channel->fd = fd;
+        channel->connected = connected;
+    }
+    pthread_mutex_unlock(&channels_mutex);
+    if (!st)
+        goto end;
+    fds[0].fd = fd;
+    fds[1].fd = wake;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        /* Writable to complete the connection, or to write the queue */
+        pthread_mutex_lock(&channels_mutex);
+        if (channel->wake != wake) {
+            pthread_mutex_unlock(&channels_mutex);
+            break;
+        }
+        fds[0].events = connected ? POLLIN : POLLOUT;
+        if (connected && channel->out_sent < channel->out_len)
+            fds[0].events |= POLLOUT;
+        pthread_mutex_unlock(&channels_mutex);
+
+        /* Wake up every second to expire the orders without response */
+        st = poll(fds, 2, 1000);
+        if (st == -1 && errno != EINTR)
+            break;
+        if (st > 0 && (fds[1].revents & POLLIN) && read(wake, &count, sizeof(count)) == -1 && errno != EAGAIN)
+            break;
+
+        if (st > 0 && !connected && fds[0].revents) {
+            if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) || err)
+                break;
+            connected = 1;
+            pthread_mutex_lock(&channels_mutex);
+            channel->connected = 1;
+            pthread_mutex_unlock(&channels_mutex);
+        }
+
+        if (connected) {
+            pthread_mutex_lock(&channels_mutex);
+            st = channel->wake == wake && rtp_channel_flush(channel);
+            pthread_mutex_unlock(&channels_mutex);
+            if (!st)
+                break;
+
+            /* A frame can arrive in several pieces */
+            for (;;) {
+                st = recv(fd, (char *)&frame + got, sizeof(frame) - got, MSG_DONTWAIT);
+                if (st == -1 && errno == EINTR)
+                    continue;
+                if (st <= 0)
+                    break;
+                got += st;
+                if (got == sizeof(frame)) {
+                    got = 0;
+                    pthread_mutex_lock(&channels_mutex);
+                    calls = rtp_channel_take(channel, frame.id, 0);
+                    pthread_mutex_unlock(&channels_mutex);
+                    rtp_channel_finish(calls, &frame);
+                }
+            }
+            if (st == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                break;
+        }
+
+        /* Orders whose response hasn't arrived in time */
+        now = time(0);
+        if (now != last_check) {
+            last_check = now;
+            pthread_mutex_lock(&channels_mutex);
+            calls = rtp_channel_take(channel, 0, now);
+            pthread_mutex_unlock(&channels_mutex);
+            rtp_channel_finish(calls, 0);
+        }
+    }
+
+end:
+    /* The connection has failed. It will be opened again with the next
+     * order. The orders still queued fail with the others */
+    calls = 0;
+    pthread_mutex_lock(&channels_mutex);
+    if (channel->wake == wake) {
+        channel->fd = -1;
+        channel->wake = -1;
+        channel->connected = 0;
+        channel->out_len = 0;
+        channel->out_sent = 0;
+        calls = channel->calls;
+        channel->calls = 0;
+    }
+    pthread_mutex_unlock(&channels_mutex);
+    close(wake);
+    if (fd != -1)
+        close(fd);
+    rtp_channel_finish(calls, 0);
+    return(0);
+}
+
+void rtp_channel_send(const char *uri, RTP_CHANNEL_FRAME *request, RTP_CALL_DONE done, void *data) {
+    char host[MAX_RTP_HOST];
+    RTP_CHANNEL *channel;
+    RTP_CALL *call;
+    RTP_CHANNEL_FRAME error;
+    unsigned long long one = 1;
+
+    if (!rtp_channel_host(uri, host))
+        goto error;
+    call = malloc(sizeof(RTP_CALL));
+    if (!call)
+        goto error;
+
+    pthread_mutex_lock(&channels_mutex);
+    channel = rtp_channel_find(host);
+    if (!channel)
+        channel = rtp_channel_add(host);
+    if (!channel || (channel->wake == -1 && !rtp_channel_connect(channel))) {
+        pthread_mutex_unlock(&channels_mutex);
+        free(call);
+        goto error;
+    }
+
+    request->id = ++channel->next_id;
+    if (!rtp_channel_queue(channel, request, uri)) {
+        pthread_mutex_unlock(&channels_mutex);
+        free(call);
+        goto error;
+    }
+    call->id = request->id;
+    call->deadline = time(0) + RTP_CALL_TIMEOUT;
+    call->done = done;
+    call->data = data;
+    call->next = channel->calls;
+    channel->calls = call;
+
+    /* Written now if the socket has room, otherwise by the reader. If the
+     * connection has failed the reader fails the order */
+    if (channel->connected) {
+        if (!rtp_channel_flush(channel))
+            shutdown(channel->fd, SHUT_RDWR);
+        else if (channel->out_len)
+            write(channel->wake, &one, sizeof(one));
+    }
+    pthread_mutex_unlock(&channels_mutex);
+    return;
+
+error:
+    memset(&error, 0, sizeof(error));
+    error.id = request->id;
+    error.order = ERR_RTP;
+    done(&error, data);
+}
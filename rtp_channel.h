@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#ifndef _RTP_CHANNEL_H_
+#define _RTP_CHANNEL_H_
+
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include "common.h"
+#include "servers_comm.h"
+
+#define MAX_RTP_CHANNELS 16 /* RTP servers the RTSP server can talk to */
+#define MAX_RTP_HOST 256
+#define RTP_CALL_TIMEOUT 10 /* Seconds waiting for a response */
+#define RTP_CHANNEL_QUEUE_SIZE 4096 /* Bytes the send queue of a channel starts with */
+#define RTP_CHANNEL_MAX_QUEUE (1 << 20) /* Bytes of orders a channel can have waiting to be written */
+
+/* Function called when an order has finished
+ * 1st parameter: Response. Its order is ERR_RTP if the order failed or timed out
+ * 2nd parameter: Private data given with the order
+ */
+typedef void (*RTP_CALL_DONE)(RTP_CHANNEL_FRAME *, void *);
+
+/* Order waiting for its response */
+typedef struct RTP_CALL {
+    unsigned int id;
+    time_t deadline;
+    RTP_CALL_DONE done;
+    void *data;
+    struct RTP_CALL *next;
+} RTP_CALL;
+
+/* Persistent connection with one RTP server. Its reader thread resolves
+ * the name of the server and connects it, so orders are never delayed by
+ * them: what can't be written at once waits in its queue, that the reader
+ * writes when the socket is writable */
+typedef struct {
+    int used;
+    char host[MAX_RTP_HOST];
+    int resolved; /* 0 until the reader has resolved host */
+    struct sockaddr_in addr; /* Resolved once, by the first reader */
+    int fd; /* -1 while disconnected */
+    int connected; /* 0 while the name is resolved or the connect is in progress */
+    int wake; /* Eventfd that tells the reader there are orders queued. -1 without reader */
+    char *out; /* Orders not written yet */
+    int out_size;
+    int out_len;
+    int out_sent;
+    unsigned int next_id;
+    RTP_CALL *calls; /* Orders sent and not answered yet */
+    pthread_t reader;
+} RTP_CHANNEL;
+
+/* Initialize the channels
+ * port: Port where the RTP servers listen for orders
+ * return: 1 ok, 0 err
+ */
+int rtp_channel_init(PORT port);
+
+/* Close all the channels. Orders waiting for a response fail */
+void rtp_channel_free();
+
+/* Send an order to the RTP server of a uri without waiting for its response.
+ * The channel with that server is opened the first time and reopened if it
+ * fails. It never blocks: the order is queued while the reader of the
+ * channel resolves the name of the server and connects, or the socket is
+ * full.
+ * done is called exactly once: from the thread reading the channel when the
+ * response arrives or the channel fails, or before returning if the order
+ * can't be queued.
+ * uri: Uri of the media. The host part selects the RTP server
+ * request: Order. request->uri_len characters of uri are sent after it
+ * done: Function that gets the response
+ * data: Private data for done
+ */
+void rtp_channel_send(const char *uri, RTP_CHANNEL_FRAME *request, RTP_CALL_DONE done, void *data);
+#endif
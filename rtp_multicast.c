@@ -0,0 +1,73 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "rtp_multicast.h"
+
+int rtp_multicast_init(RTP_MULTICAST *multicast, const char *first_group, int n_groups, PORT port, int ttl) {
+    struct in_addr addr;
+    int i;
+
+    if (inet_pton(AF_INET, first_group, &addr) != 1)
+        return(0);
+    if (n_groups > RTP_MULTICAST_MAX_GROUPS)
+        n_groups = RTP_MULTICAST_MAX_GROUPS;
+    multicast->first_group = ntohl(addr.s_addr);
+    /* The first and the last ones must be in 224.0.0.0/4 */
+    if (n_groups < 1 || !IN_MULTICAST(multicast->first_group) ||
+            !IN_MULTICAST(multicast->first_group + n_groups - 1))
+        return(0);
+    if (port == 0 || port % 2 || ttl < 1 || ttl > 255)
+        return(0);
+    multicast->n_groups = n_groups;
+    multicast->port = port;
+    multicast->ttl = ttl;
+    for (i = 0; i < n_groups; ++i)
+        multicast->owners[i] = 0;
+    return(1);
+}
+
+unsigned int rtp_multicast_get(RTP_MULTICAST *multicast, int owner) {
+    int i;
+
+    for (i = 0; i < multicast->n_groups; ++i) {
+        if (!multicast->owners[i]) {
+            multicast->owners[i] = owner;
+            return(htonl(multicast->first_group + i));
+        }
+    }
+    return(0);
+}
+
+void rtp_multicast_release(RTP_MULTICAST *multicast, int owner) {
+    int i;
+
+    for (i = 0; i < multicast->n_groups; ++i)
+        if (multicast->owners[i] == owner)
+            multicast->owners[i] = 0;
+}
+
+int rtp_multicast_socket(int fd, int ttl, const char *iface) {
+    unsigned char value = ttl;
+    unsigned char loop = 1;
+    struct in_addr addr;
+
+    if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &value, sizeof(value)))
+        return(0);
+    /* Receivers in the same machine get the packets too */
+    if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)))
+        return(0);
+    if (iface) {
+        if (inet_pton(AF_INET, iface, &addr) != 1)
+            return(0);
+        if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr)))
+            return(0);
+    }
+    return(1);
+}
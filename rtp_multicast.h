@@ -0,0 +1,53 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#ifndef _RTP_MULTICAST_H_
+#define _RTP_MULTICAST_H_
+
+#include "common.h"
+
+#define RTP_MULTICAST_MAX_GROUPS 256
+#define RTP_MULTICAST_DEFAULT_GROUP "239.255.42.1" /* Administratively scoped */
+#define RTP_MULTICAST_DEFAULT_PORT 5004
+#define RTP_MULTICAST_DEFAULT_TTL 16
+
+/* Groups the RTP server sends to: n_groups consecutive addresses from
+ * first_group, all with the same port. Each group is reserved by the
+ * worker that sends a track to it */
+typedef struct {
+    unsigned int first_group; /* Host order */
+    int n_groups;
+    PORT port; /* Even. RTCP goes to the next one */
+    int ttl;
+    int owners[RTP_MULTICAST_MAX_GROUPS]; /* 0 if the group is free */
+} RTP_MULTICAST;
+
+/* Initialize the groups, all free
+ * first_group: Address of the first group, a.b.c.d
+ * n_groups: Limited to RTP_MULTICAST_MAX_GROUPS
+ * port: Even port of the groups
+ * ttl: Time to live of the packets, 1 to 255
+ * return: 1 ok, 0 if some group isn't a multicast address or the port or ttl are wrong
+ */
+int rtp_multicast_init(RTP_MULTICAST *multicast, const char *first_group, int n_groups, PORT port, int ttl);
+
+/* Reserve a free group
+ * owner: Identifies who reserves it, not 0
+ * return: Group in network order, 0 if all are in use
+ */
+unsigned int rtp_multicast_get(RTP_MULTICAST *multicast, int owner);
+
+/* Free the groups of an owner */
+void rtp_multicast_release(RTP_MULTICAST *multicast, int owner);
+
+/* Prepare a UDP socket to send to the groups
+ * ttl: Time to live of the packets
+ * iface: Address of the interface they go out from, 0 for the route of the group
+ * return: 1 ok, 0 err
+ */
+int rtp_multicast_socket(int fd, int ttl, const char *iface);
+#endif
@@ -0,0 +1,107 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <errno.h>
+#include "rtp_pacer.h"
+
+#define NSEC 1000000000LL
+
+int rtp_pacer_init(RTP_PACER *pacer) {
+    pacer->restart = 1;
+    pacer->base_media = 0;
+    pacer->packets = 0;
+    pacer->restarts = 0;
+    pacer->total_late = 0;
+    pacer->max_late = 0;
+    if (pthread_mutex_init(&pacer->mutex, 0))
+        return(0);
+    return(1);
+}
+
+void rtp_pacer_free(RTP_PACER *pacer) {
+    pthread_mutex_destroy(&pacer->mutex);
+}
+
+void rtp_pacer_restart(RTP_PACER *pacer) {
+    pthread_mutex_lock(&pacer->mutex);
+    pacer->restart = 1;
+    pthread_mutex_unlock(&pacer->mutex);
+}
+
+/* Restart the clock if it's the first packet, after a pause or when the
+ * media time goes back */
+void rtp_pacer_check(RTP_PACER *pacer, long long media_time) {
+    int restart;
+
+    pthread_mutex_lock(&pacer->mutex);
+    restart = pacer->restart;
+    pacer->restart = 0;
+    pthread_mutex_unlock(&pacer->mutex);
+    if (restart || media_time < pacer->base_media) {
+        clock_gettime(CLOCK_MONOTONIC, &pacer->base);
+        pacer->base_media = media_time;
+    }
+}
+
+/* Get when a packet is due */
+void rtp_pacer_due(RTP_PACER *pacer, long long media_time, struct timespec *due) {
+    long long ns;
+
+    ns = pacer->base.tv_nsec + (media_time - pacer->base_media);
+    due->tv_sec = pacer->base.tv_sec + ns / NSEC;
+    due->tv_nsec = ns % NSEC;
+}
+
+long rtp_pacer_delay(RTP_PACER *pacer, long long media_time) {
+    struct timespec due, now;
+    long long ns;
+
+    rtp_pacer_check(pacer, media_time);
+    rtp_pacer_due(pacer, media_time, &due);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (due.tv_sec - now.tv_sec) * NSEC + (due.tv_nsec - now.tv_nsec);
+    if (ns <= 0)
+        return(0);
+    return(ns / 1000);
+}
+
+unsigned long long rtp_pacer_txtime(RTP_PACER *pacer, long long media_time) {
+    struct timespec due;
+
+    rtp_pacer_due(pacer, media_time, &due);
+    return((unsigned long long)due.tv_sec * NSEC + due.tv_nsec);
+}
+
+void rtp_pacer_wait(RTP_PACER *pacer, long long media_time) {
+    struct timespec due, now;
+    long long late;
+
+    rtp_pacer_check(pacer, media_time);
+    rtp_pacer_due(pacer, media_time, &due);
+    /* An absolute deadline doesn't drift when the sleep is interrupted */
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, 0) == EINTR);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    late = (now.tv_sec - due.tv_sec) * NSEC + (now.tv_nsec - due.tv_nsec);
+
+    if (late > RTP_PACER_MAX_LATE) {
+        /* Catching up would send a burst. Start again from this packet */
+        pacer->base = now;
+        pacer->base_media = media_time;
+        ++pacer->restarts;
+        return;
+    }
+    ++pacer->packets;
+    pacer->total_late += late;
+    if (late > pacer->max_late)
+        pacer->max_late = late;
+}
+
+long long rtp_pacer_mean_late(RTP_PACER *pacer) {
+    if (!pacer->packets)
+        return(0);
+    return(pacer->total_late / pacer->packets);
+}
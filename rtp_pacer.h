@@ -0,0 +1,61 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#ifndef _RTP_PACER_H_
+#define _RTP_PACER_H_
+
+#include <time.h>
+#include <pthread.h>
+
+#define RTP_PACER_MAX_LATE 200000000LL /* Nanoseconds late before the clock is restarted */
+
+/* Releases packets when their media time is due. The first packet, and
+ * any packet released too late, restart the clock */
+typedef struct {
+    pthread_mutex_t mutex; /* Restarts are asked from other threads */
+    int restart; /* 1 if the next packet restarts the clock */
+    struct timespec base; /* When base_media is due */
+    long long base_media;
+    /* Pacing error */
+    unsigned long packets;
+    unsigned long restarts;
+    long long total_late; /* Nanoseconds */
+    long long max_late;
+} RTP_PACER;
+
+/* Initialize an empty pacer
+ * return: 1 ok, 0 err
+ */
+int rtp_pacer_init(RTP_PACER *pacer);
+
+void rtp_pacer_free(RTP_PACER *pacer);
+
+/* Make the next packet restart the clock, after a pause */
+void rtp_pacer_restart(RTP_PACER *pacer);
+
+/* Time until a packet is due
+ * media_time: Nanoseconds
+ * return: Microseconds, 0 if it must be sent now
+ */
+long rtp_pacer_delay(RTP_PACER *pacer, long long media_time);
+
+/* Get when a packet is due, to give it to the kernel with SO_TXTIME
+ * media_time: Nanoseconds
+ * return: CLOCK_MONOTONIC nanoseconds
+ */
+unsigned long long rtp_pacer_txtime(RTP_PACER *pacer, long long media_time);
+
+/* Sleep until a packet is due and measure how late it wakes up
+ * media_time: Nanoseconds
+ */
+void rtp_pacer_wait(RTP_PACER *pacer, long long media_time);
+
+/* Mean pacing error
+ * return: Nanoseconds
+ */
+long long rtp_pacer_mean_late(RTP_PACER *pacer);
+#endif
@@ -0,0 +1,101 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <string.h>
+#include "parse_rtp.h"
+#include "rtp_payloader.h"
+
+void rtp_payloader_init(RTP_PAYLOADER *payloader, int max_packet) {
+    if (max_packet < RTP_PAYLOADER_MIN_PACKET)
+        max_packet = RTP_PAYLOADER_MIN_PACKET;
+    payloader->max_payload = max_packet - RTP_MIN_SIZE;
+}
+
+int rtp_payloader_must_fragment(RTP_PAYLOADER *payloader, unsigned int size) {
+    return(size > (unsigned int)(payloader->max_payload - RTP_PAYLOAD_HEADER - RTP_PAYLOAD_LENGTH));
+}
+
+int rtp_payloader_fragment(RTP_PAYLOADER *payloader, unsigned int size, unsigned int pos, int *type) {
+    unsigned int len = payloader->max_payload - RTP_PAYLOAD_HEADER - RTP_PAYLOAD_LENGTH;
+
+    if (size - pos <= len) {
+        len = size - pos;
+        *type = pos ? RTP_FRAGMENT_END : RTP_NOT_FRAGMENTED;
+    } else {
+        *type = pos ? RTP_FRAGMENT_CONTINUATION : RTP_FRAGMENT_START;
+    }
+    return(len);
+}
+
+/* Write the header of a payload. Ident and data type are always 0: the
+ * frames are sent as they are, with their configuration */
+void rtp_payload_header(unsigned char *buf, int type, int n_frames) {
+    buf[0] = 0;
+    buf[1] = 0;
+    buf[2] = 0;
+    buf[3] = (type << 6) | n_frames;
+}
+
+int rtp_payloader_fragment_header(unsigned char *buf, int type, int len) {
+    rtp_payload_header(buf, type, type == RTP_NOT_FRAGMENTED ? 1 : 0);
+    buf[4] = len >> 8;
+    buf[5] = len & 0xff;
+    return(RTP_PAYLOAD_HEADER + RTP_PAYLOAD_LENGTH);
+}
+
+void rtp_aggregate_start(RTP_AGGREGATE *aggregate, unsigned char *buf) {
+    aggregate->buf = buf;
+    aggregate->len = RTP_PAYLOAD_HEADER;
+    aggregate->n_frames = 0;
+}
+
+int rtp_aggregate_add(RTP_PAYLOADER *payloader, RTP_AGGREGATE *aggregate,
+        const unsigned char *data, unsigned int size) {
+    if (aggregate->n_frames == RTP_PAYLOADER_MAX_FRAMES ||
+            aggregate->len + RTP_PAYLOAD_LENGTH + size > (unsigned int)payloader->max_payload)
+        return(0);
+    aggregate->buf[aggregate->len] = size >> 8;
+    aggregate->buf[aggregate->len + 1] = size & 0xff;
+    memcpy(aggregate->buf + aggregate->len + RTP_PAYLOAD_LENGTH, data, size);
+    aggregate->len += RTP_PAYLOAD_LENGTH + size;
+    ++aggregate->n_frames;
+    return(1);
+}
+
+int rtp_aggregate_finish(RTP_AGGREGATE *aggregate) {
+    rtp_payload_header(aggregate->buf, RTP_NOT_FRAGMENTED, aggregate->n_frames);
+    return(aggregate->len);
+}
+
+int rtp_depayload(const unsigned char *payload, int len, RTP_PAYLOAD_FRAME *frames, int max_frames, int *type) {
+    int n_frames;
+    int pos = RTP_PAYLOAD_HEADER;
+    int size;
+    int i;
+
+    if (len < RTP_PAYLOAD_HEADER)
+        return(-1);
+    *type = payload[3] >> 6;
+    n_frames = payload[3] & 0x0f;
+    /* A fragment goes alone */
+    if (*type != RTP_NOT_FRAGMENTED)
+        n_frames = 1;
+    if (n_frames > max_frames)
+        return(-1);
+    for (i = 0; i < n_frames; ++i) {
+        if (pos + RTP_PAYLOAD_LENGTH > len)
+            return(-1);
+        size = (payload[pos] << 8) | payload[pos + 1];
+        pos += RTP_PAYLOAD_LENGTH;
+        if (pos + size > len)
+            return(-1);
+        frames[i].data = payload + pos;
+        frames[i].size = size;
+        pos += size;
+    }
+    return(n_frames);
+}
@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#ifndef _RTP_PAYLOADER_H_
+#define _RTP_PAYLOADER_H_
+
+#define RTP_PAYLOADER_DEFAULT_PACKET 1400 /* Bytes of an RTP packet, headers included */
+#define RTP_PAYLOADER_MIN_PACKET 64
+#define RTP_PAYLOAD_HEADER 4 /* Ident, fragment type, data type and number of frames */
+#define RTP_PAYLOAD_LENGTH 2 /* Length in front of each frame */
+#define RTP_PAYLOADER_MAX_FRAMES 15 /* Frames in a packet */
+
+/* Fragment types */
+#define RTP_NOT_FRAGMENTED 0
+#define RTP_FRAGMENT_START 1
+#define RTP_FRAGMENT_CONTINUATION 2
+#define RTP_FRAGMENT_END 3
+
+/* Splits frames in packets with the payload layout of RFC 5215 (Vorbis) and
+ * Theora: a header with the fragment type and the number of frames, and
+ * each frame preceded by its length. Frames too big for a packet are
+ * fragmented, small ones are put together */
+typedef struct {
+    int max_payload; /* Bytes after the RTP header */
+} RTP_PAYLOADER;
+
+/* A packet of whole frames being built */
+typedef struct {
+    unsigned char *buf;
+    int len;
+    int n_frames;
+} RTP_AGGREGATE;
+
+/* A frame, or a piece of it, found in a packet */
+typedef struct {
+    const unsigned char *data;
+    int size;
+} RTP_PAYLOAD_FRAME;
+
+/* Initialize a payloader
+ * max_packet: Bytes of the RTP packets, headers included. Limited to
+ * RTP_PAYLOADER_MIN_PACKET
+ */
+void rtp_payloader_init(RTP_PAYLOADER *payloader, int max_packet);
+
+/* Check if a frame must be fragmented
+ * return: 1 if it doesn't fit alone in a packet, 0 otherwise
+ */
+int rtp_payloader_must_fragment(RTP_PAYLOADER *payloader, unsigned int size);
+
+/* Get the next fragment of a frame
+ * size: Size of the frame
+ * pos: Bytes of the frame already sent
+ * type: Set to the fragment type
+ * return: Bytes of the fragment
+ */
+int rtp_payloader_fragment(RTP_PAYLOADER *payloader, unsigned int size, unsigned int pos, int *type);
+
+/* Write the headers of a fragment, that goes right after them
+ * buf: RTP_PAYLOAD_HEADER + RTP_PAYLOAD_LENGTH bytes
+ * return: Bytes written
+ */
+int rtp_payloader_fragment_header(unsigned char *buf, int type, int len);
+
+/* Start a packet of whole frames
+ * buf: Where the payload is written, max_payload bytes
+ */
+void rtp_aggregate_start(RTP_AGGREGATE *aggregate, unsigned char *buf);
+
+/* Copy a frame at the end of the packet
+ * return: 1 ok, 0 if it doesn't fit
+ */
+int rtp_aggregate_add(RTP_PAYLOADER *payloader, RTP_AGGREGATE *aggregate,
+        const unsigned char *data, unsigned int size);
+
+/* Write the header of the packet
+ * return: Bytes of the payload
+ */
+int rtp_aggregate_finish(RTP_AGGREGATE *aggregate);
+
+/* Get the frames of a payload
+ * frames: Where the frames are stored, they point to the payload
+ * max_frames: Size of frames
+ * type: Set to the fragment type
+ * return: Number of frames, -1 if the payload is wrong
+ */
+int rtp_depayload(const unsigned char *payload, int len, RTP_PAYLOAD_FRAME *frames, int max_frames, int *type);
+#endif
@@ -0,0 +1,273 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "rtp_registry.h"
+
+unsigned int rtp_registry_ssrc_hash(unsigned int ssrc) {
+    return(ssrc * 2654435761U);
+}
+
+unsigned int rtp_registry_key_hash(pid_t pid, RTP_STREAM *stream) {
+    unsigned long long key = (uintptr_t)stream ^ (unsigned int)pid;
+
+    return((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+/* FNV-1a of the track, different for unicast and multicast */
+unsigned int rtp_registry_track_hash(const char *track, int is_multicast) {
+    unsigned int hash = 2166136261U ^ is_multicast;
+
+    for (; *track; ++track) {
+        hash ^= (unsigned char)*track;
+        hash *= 16777619U;
+    }
+    return(hash);
+}
+
+int rtp_registry_init(RTP_REGISTRY *registry, int max_sessions) {
+    unsigned int buckets = 1;
+    int i;
+
+    /* At most one session or worker per bucket on average */
+    while (buckets < (unsigned int)max_sessions)
+        buckets <<= 1;
+    registry->max_sessions = max_sessions;
+    registry->n_sessions = 0;
+    registry->n_workers = 0;
+    registry->mask = buckets - 1;
+    registry->sessions = malloc(max_sessions * sizeof(RTP_WORKER_USE));
+    registry->workers = malloc(max_sessions * sizeof(RTP_WORKER));
+    registry->ssrc_buckets = malloc(buckets * sizeof(int));
+    registry->key_buckets = malloc(buckets * sizeof(int));
+    registry->track_buckets = malloc(buckets * sizeof(int));
+    if (!registry->sessions || !registry->workers || !registry->ssrc_buckets ||
+            !registry->key_buckets || !registry->track_buckets) {
+        free(registry->sessions);
+        free(registry->workers);
+        free(registry->ssrc_buckets);
+        free(registry->key_buckets);
+        free(registry->track_buckets);
+        registry->sessions = 0;
+        registry->workers = 0;
+        registry->ssrc_buckets = 0;
+        registry->key_buckets = 0;
+        registry->track_buckets = 0;
+        return(0);
+    }
+
+    /* All the slots are free, in order */
+    for (i = 0; i < max_sessions; ++i) {
+        registry->sessions[i].worker = -1;
+        registry->sessions[i].gen = 0;
+        registry->sessions[i].next = i + 1 < max_sessions ? i + 1 : -1;
+        registry->workers[i].track = 0;
+        registry->workers[i].key_next = i + 1 < max_sessions ? i + 1 : -1;
+    }
+    registry->free_sessions = max_sessions ? 0 : -1;
+    registry->free_workers = max_sessions ? 0 : -1;
+    for (i = 0; i < (int)buckets; ++i) {
+        registry->ssrc_buckets[i] = -1;
+        registry->key_buckets[i] = -1;
+        registry->track_buckets[i] = -1;
+    }
+    return(1);
+}
+
+void rtp_registry_free(RTP_REGISTRY *registry) {
+    int i;
+
+    if (registry->workers)
+        for (i = 0; i < registry->max_sessions; ++i)
+            free(registry->workers[i].track);
+    free(registry->sessions);
+    free(registry->workers);
+    free(registry->ssrc_buckets);
+    free(registry->key_buckets);
+    free(registry->track_buckets);
+    registry->sessions = 0;
+    registry->workers = 0;
+    registry->ssrc_buckets = 0;
+    registry->key_buckets = 0;
+    registry->track_buckets = 0;
+}
+
+/* Find the slot of a worker
+ * return: Slot, -1 if it isn't there
+ */
+int rtp_registry_key_find(RTP_REGISTRY *registry, pid_t pid, RTP_STREAM *stream) {
+    int w;
+
+    w = registry->key_buckets[rtp_registry_key_hash(pid, stream) & registry->mask];
+    for (; w != -1; w = registry->workers[w].key_next)
+        if (registry->workers[w].pid == pid && registry->workers[w].stream == stream)
+            return(w);
+    return(-1);
+}
+
+/* Add a worker without sessions
+ * return: Slot, -1 err
+ */
+int rtp_registry_worker_add(RTP_REGISTRY *registry, pid_t pid, RTP_STREAM *stream,
+        const char *track, unsigned int group) {
+    RTP_WORKER *worker;
+    unsigned int bucket;
+    int w = registry->free_workers;
+
+    if (w == -1)
+        return(-1);
+    worker = &registry->workers[w];
+    worker->track = strdup(track);
+    if (!worker->track)
+        return(-1);
+    registry->free_workers = worker->key_next;
+
+    worker->pid = pid;
+    worker->stream = stream;
+    worker->group = group;
+    worker->process = -1;
+    worker->process_gen = 0;
+    worker->n_sessions = 0;
+    worker->sessions = -1;
+    bucket = rtp_registry_key_hash(pid, stream) & registry->mask;
+    worker->key_next = registry->key_buckets[bucket];
+    registry->key_buckets[bucket] = w;
+    /* New sessions of the track join the first worker that sends it */
+    worker->indexed = !rtp_registry_find(registry, track, group != 0);
+    if (worker->indexed) {
+        bucket = rtp_registry_track_hash(track, group != 0) & registry->mask;
+        worker->track_next = registry->track_buckets[bucket];
+        registry->track_buckets[bucket] = w;
+    }
+    ++registry->n_workers;
+    return(w);
+}
+
+/* Delete a worker whose sessions have all been deleted */
+void rtp_registry_worker_del(RTP_REGISTRY *registry, int w) {
+    RTP_WORKER *worker = &registry->workers[w];
+    int *ptr;
+
+    ptr = &registry->key_buckets[rtp_registry_key_hash(worker->pid, worker->stream) & registry->mask];
+    for (; *ptr != w; ptr = &registry->workers[*ptr].key_next);
+    *ptr = worker->key_next;
+    if (worker->indexed) {
+        ptr = &registry->track_buckets[rtp_registry_track_hash(worker->track, worker->group != 0) & registry->mask];
+        for (; *ptr != w; ptr = &registry->workers[*ptr].track_next);
+        *ptr = worker->track_next;
+    }
+    free(worker->track);
+    worker->track = 0;
+    worker->key_next = registry->free_workers;
+    registry->free_workers = w;
+    --registry->n_workers;
+}
+
+RTP_WORKER_USE *rtp_registry_add(RTP_REGISTRY *registry, pid_t pid, RTP_STREAM *stream,
+        const char *track, unsigned int group) {
+    RTP_WORKER_USE *use;
+    RTP_WORKER *worker;
+    unsigned int bucket;
+    int s = registry->free_sessions;
+    int w;
+
+    if (s == -1)
+        return(0);
+    w = rtp_registry_key_find(registry, pid, stream);
+    if (w == -1)
+        w = rtp_registry_worker_add(registry, pid, stream, track, group);
+    if (w == -1)
+        return(0);
+    worker = &registry->workers[w];
+    use = &registry->sessions[s];
+    registry->free_sessions = use->next;
+
+    /* Create new ssrc */
+    do {
+        use->ssrc = rand();
+    } while (rtp_registry_get(registry, use->ssrc));
+    use->worker = w;
+    bucket = rtp_registry_ssrc_hash(use->ssrc) & registry->mask;
+    use->ssrc_next = registry->ssrc_buckets[bucket];
+    registry->ssrc_buckets[bucket] = s;
+    use->prev = -1;
+    use->next = worker->sessions;
+    if (use->next != -1)
+        registry->sessions[use->next].prev = s;
+    worker->sessions = s;
+    ++worker->n_sessions;
+    ++registry->n_sessions;
+    return(use);
+}
+
+RTP_WORKER_USE *rtp_registry_get(RTP_REGISTRY *registry, unsigned int ssrc) {
+    int s;
+
+    s = registry->ssrc_buckets[rtp_registry_ssrc_hash(ssrc) & registry->mask];
+    for (; s != -1; s = registry->sessions[s].ssrc_next)
+        if (registry->sessions[s].ssrc == ssrc)
+            return(&registry->sessions[s]);
+    return(0);
+}
+
+RTP_WORKER *rtp_registry_worker(RTP_REGISTRY *registry, RTP_WORKER_USE *use) {
+    return(&registry->workers[use->worker]);
+}
+
+RTP_WORKER *rtp_registry_find(RTP_REGISTRY *registry, const char *track, int is_multicast) {
+    RTP_WORKER *worker;
+    int w;
+
+    w = registry->track_buckets[rtp_registry_track_hash(track, is_multicast) & registry->mask];
+    for (; w != -1; w = worker->track_next) {
+        worker = &registry->workers[w];
+        if ((worker->group != 0) == is_multicast && !strcmp(worker->track, track))
+            return(worker);
+    }
+    return(0);
+}
+
+void rtp_registry_del(RTP_REGISTRY *registry, RTP_WORKER_USE *use) {
+    RTP_WORKER *worker = &registry->workers[use->worker];
+    int s = use - registry->sessions;
+    int *ptr;
+
+    ptr = &registry->ssrc_buckets[rtp_registry_ssrc_hash(use->ssrc) & registry->mask];
+    for (; *ptr != s; ptr = &registry->sessions[*ptr].ssrc_next);
+    *ptr = use->ssrc_next;
+    if (use->prev != -1)
+        registry->sessions[use->prev].next = use->next;
+    else
+        worker->sessions = use->next;
+    if (use->next != -1)
+        registry->sessions[use->next].prev = use->prev;
+    --registry->n_sessions;
+    if (--worker->n_sessions == 0)
+        rtp_registry_worker_del(registry, use->worker);
+
+    use->worker = -1;
+    ++use->gen;
+    use->next = registry->free_sessions;
+    registry->free_sessions = s;
+}
+
+int rtp_registry_del_worker(RTP_REGISTRY *registry, pid_t pid, RTP_STREAM *stream) {
+    int w;
+    int n;
+    int i;
+
+    w = rtp_registry_key_find(registry, pid, stream);
+    if (w == -1)
+        return(0);
+    /* The worker goes with its last session */
+    n = registry->workers[w].n_sessions;
+    for (i = 0; i < n; ++i)
+        rtp_registry_del(registry, &registry->sessions[registry->workers[w].sessions]);
+    return(n);
+}
@@ -0,0 +1,96 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#ifndef _RTP_REGISTRY_H_
+#define _RTP_REGISTRY_H_
+
+#include <sys/types.h>
+#include "rtp_server.h"
+
+/* Worker process, or stream of the engine, that serves sessions. It's in
+ * the registry while it has some */
+typedef struct {
+    pid_t pid; /* 0 for the engine */
+    RTP_STREAM *stream; /* 0 for a worker process */
+    char *track; /* Media track it sends */
+    unsigned int group; /* Multicast group it sends to, 0 for unicast */
+    int process; /* Slot of its process, -1 for the engine. Set by the server */
+    unsigned int process_gen; /* Generation of the slot when it was set */
+    int n_sessions;
+    int sessions; /* First of its sessions */
+    int indexed; /* 1 if new sessions of its track find it */
+    int key_next; /* Next worker in the bucket of its pid and stream */
+    int track_next; /* Next worker in the bucket of its track */
+} RTP_WORKER;
+
+/* A session and the worker that serves it */
+typedef struct {
+    unsigned int ssrc;
+    unsigned int gen; /* Changes every time the slot is released */
+    int worker; /* -1 if the slot is free */
+    int prev; /* Sessions of the same worker. next links the free slots too */
+    int next;
+    int ssrc_next; /* Next session in the bucket of its ssrc */
+} RTP_WORKER_USE;
+
+/* Sessions and workers in slots taken from free lists, found by ssrc, by
+ * pid and stream, and by track, each with a hash of chained slots. Every
+ * operation costs the same however many sessions there are, except
+ * deleting a worker, that costs its own sessions. It has no locks */
+typedef struct {
+    int max_sessions;
+    int n_sessions;
+    int n_workers;
+    RTP_WORKER_USE *sessions;
+    RTP_WORKER *workers; /* As many as sessions */
+    int free_sessions;
+    int free_workers; /* Linked by key_next */
+    unsigned int mask; /* Buckets - 1 */
+    int *ssrc_buckets;
+    int *key_buckets;
+    int *track_buckets;
+} RTP_REGISTRY;
+
+/* Initialize an empty registry
+ * max_sessions: Sessions it has room for
+ * return: 1 ok, 0 err
+ */
+int rtp_registry_init(RTP_REGISTRY *registry, int max_sessions);
+
+/* Free the memory of a registry */
+void rtp_registry_free(RTP_REGISTRY *registry);
+
+/* Add a session with a new random ssrc. Its worker is added with its
+ * first session. The track and the group are only taken from the first
+ * return: Session, 0 if there isn't room
+ */
+RTP_WORKER_USE *rtp_registry_add(RTP_REGISTRY *registry, pid_t pid, RTP_STREAM *stream,
+        const char *track, unsigned int group);
+
+/* Find a session
+ * return: Session, 0 if it isn't found
+ */
+RTP_WORKER_USE *rtp_registry_get(RTP_REGISTRY *registry, unsigned int ssrc);
+
+/* Get the worker of a session */
+RTP_WORKER *rtp_registry_worker(RTP_REGISTRY *registry, RTP_WORKER_USE *use);
+
+/* Find the worker new sessions of a track join: the first one added that
+ * is still there. Others that send the same track aren't found
+ * is_multicast: 1 for the worker that sends it to a group, 0 for unicast
+ * return: Worker, 0 if there isn't any
+ */
+RTP_WORKER *rtp_registry_find(RTP_REGISTRY *registry, const char *track, int is_multicast);
+
+/* Delete a session. Its worker is deleted with its last session */
+void rtp_registry_del(RTP_REGISTRY *registry, RTP_WORKER_USE *use);
+
+/* Delete all the sessions of a worker
+ * return: Number of sessions deleted
+ */
+int rtp_registry_del_worker(RTP_REGISTRY *registry, pid_t pid, RTP_STREAM *stream);
+#endif
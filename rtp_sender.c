@@ -0,0 +1,293 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
+#include "rtp_sender.h"
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+void rtp_sender_init(RTP_SENDER *sender, int fd, int batch, long max_delay) {
+    int i;
+
+    sender->fd = fd;
+    if (batch < 1)
+        batch = 1;
+    if (batch > RTP_SENDER_MAX_BATCH)
+        batch = RTP_SENDER_MAX_BATCH;
+    sender->batch = batch;
+    sender->max_delay = max_delay < 0 ? 0 : max_delay;
+    sender->n = 0;
+    sender->n_iov = 0;
+    sender->packets_sent = 0;
+    sender->flushes = 0;
+    sender->trains = 0;
+    sender->gso = 0;
+    sender->txtime = 0;
+#ifdef UDP_SEGMENT
+    {
+        int size;
+        socklen_t size_len = sizeof(size);
+        /* Kernels without GSO don't know the option */
+        sender->gso = getsockopt(fd, SOL_UDP, UDP_SEGMENT, &size, &size_len) == 0;
+    }
+#endif
+
+    /* The headers always point to the same destinations */
+    memset(sender->msgs, 0, sizeof(sender->msgs));
+    for (i = 0; i < RTP_SENDER_MAX_BATCH; ++i) {
+        sender->msgs[i].msg_hdr.msg_name = &sender->dests[i];
+        sender->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+}
+
+int rtp_sender_txtime(RTP_SENDER *sender) {
+#ifdef SO_TXTIME
+    struct sock_txtime config;
+
+    config.clockid = CLOCK_MONOTONIC;
+    config.flags = 0;
+    if (setsockopt(sender->fd, SOL_SOCKET, SO_TXTIME, &config, sizeof(config)))
+        return(0);
+    sender->txtime = 1;
+    return(1);
+#else
+    return(0);
+#endif
+}
+
+/* Write the departure time of a packet in its control message */
+void rtp_sender_set_txtime(struct cmsghdr *cmsg, unsigned long long txtime) {
+#ifdef SCM_TXTIME
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TXTIME;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+    memcpy(CMSG_DATA(cmsg), &txtime, sizeof(uint64_t));
+#endif
+}
+
+char *rtp_sender_buffer(RTP_SENDER *sender) {
+    return(sender->packets[sender->n]);
+}
+
+int rtp_sender_queue(RTP_SENDER *sender, int len, struct sockaddr_in *dest) {
+    return(rtp_sender_queue_at(sender, len, dest, 0));
+}
+
+int rtp_sender_queue_at(RTP_SENDER *sender, int len, struct sockaddr_in *dest, unsigned long long txtime) {
+    struct iovec iov;
+
+    iov.iov_base = sender->packets[sender->n];
+    iov.iov_len = len;
+    return(rtp_sender_queue_iov(sender, &iov, 1, dest, txtime));
+}
+
+int rtp_sender_queue_iov(RTP_SENDER *sender, const struct iovec *iov, int iovcnt,
+        struct sockaddr_in *dest, unsigned long long txtime) {
+    struct msghdr *hdr = &sender->msgs[sender->n].msg_hdr;
+    int len = 0;
+    int i;
+
+    if (iovcnt < 1 || iovcnt > RTP_SENDER_MAX_IOV)
+        return(0);
+    for (i = 0; i < iovcnt; ++i)
+        len += iov[i].iov_len;
+    if (len <= 0 || len > RTP_SENDER_PACKET)
+        return(0);
+    if (sender->n == 0)
+        clock_gettime(CLOCK_MONOTONIC, &sender->first);
+    /* Only the descriptions are copied */
+    memcpy(&sender->iov[sender->n_iov], iov, iovcnt * sizeof(struct iovec));
+    hdr->msg_iov = &sender->iov[sender->n_iov];
+    hdr->msg_iovlen = iovcnt;
+    sender->n_iov += iovcnt;
+    sender->lens[sender->n] = len;
+    memcpy(&sender->dests[sender->n], dest, sizeof(struct sockaddr_in));
+    if (!sender->txtime)
+        txtime = 0;
+    sender->txtimes[sender->n] = txtime;
+    if (txtime) {
+        hdr->msg_control = sender->control[sender->n].buf;
+        hdr->msg_controllen = CMSG_SPACE(sizeof(uint64_t));
+        rtp_sender_set_txtime(CMSG_FIRSTHDR(hdr), txtime);
+    } else {
+        hdr->msg_control = 0;
+        hdr->msg_controllen = 0;
+    }
+    ++sender->n;
+
+    if (sender->n >= sender->batch || rtp_sender_timeout(sender) == 0)
+        return(rtp_sender_flush(sender));
+    return(1);
+}
+
+/* Send the packets from first one by one
+ * return: 1 ok, 0 if some packet couldn't be sent
+ */
+int rtp_sender_flush_packets(RTP_SENDER *sender, int first) {
+    int sent = first;
+    int st = 1;
+    int ret;
+
+    while (sent < sender->n) {
+        ret = sendmmsg(sender->fd, sender->msgs + sent, sender->n - sent, 0);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            /* Drop the packet that has failed and go on with the others */
+            st = 0;
+            ++sent;
+            continue;
+        }
+        ++sender->flushes;
+        sent += ret;
+        sender->packets_sent += ret;
+    }
+    return(st);
+}
+
+#ifdef UDP_SEGMENT
+/* Group the packets in trains: same destination, departure time and size,
+ * except the last one, that can be shorter
+ * return: Number of trains
+ */
+int rtp_sender_build_trains(RTP_SENDER *sender) {
+    struct msghdr *hdr;
+    struct cmsghdr *cmsg;
+    int n_trains = 0;
+    int i = 0;
+    int j;
+    int size;
+    int total;
+    int control_len;
+    int iovlen;
+
+    while (i < sender->n) {
+        size = sender->lens[i];
+        total = size;
+        iovlen = sender->msgs[i].msg_hdr.msg_iovlen;
+        for (j = i + 1; j < sender->n && total + sender->lens[j] <= RTP_SENDER_GSO_MAX; ++j) {
+            if (sender->lens[j] > size || sender->txtimes[j] != sender->txtimes[i] ||
+                    memcmp(&sender->dests[j], &sender->dests[i], sizeof(struct sockaddr_in)))
+                break;
+            total += sender->lens[j];
+            iovlen += sender->msgs[j].msg_hdr.msg_iovlen;
+            if (sender->lens[j] < size) {
+                ++j;
+                break;
+            }
+        }
+
+        /* The pieces of the packets are already consecutive in iov. The
+         * kernel splits the train by size, wherever the pieces end */
+        hdr = &sender->train_msgs[n_trains].msg_hdr;
+        memset(hdr, 0, sizeof(struct msghdr));
+        hdr->msg_name = &sender->dests[i];
+        hdr->msg_namelen = sizeof(struct sockaddr_in);
+        hdr->msg_iov = sender->msgs[i].msg_hdr.msg_iov;
+        hdr->msg_iovlen = iovlen;
+        control_len = 0;
+        if (j - i > 1)
+            control_len += CMSG_SPACE(sizeof(uint16_t));
+        if (sender->txtimes[i])
+            control_len += CMSG_SPACE(sizeof(uint64_t));
+        if (control_len) {
+            /* CMSG_NXTHDR reads the length of the next header */
+            memset(sender->train_control[n_trains].buf, 0, control_len);
+            hdr->msg_control = sender->train_control[n_trains].buf;
+            hdr->msg_controllen = control_len;
+            cmsg = CMSG_FIRSTHDR(hdr);
+            if (j - i > 1) {
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                *(uint16_t *)CMSG_DATA(cmsg) = size;
+                cmsg = CMSG_NXTHDR(hdr, cmsg);
+            }
+            if (sender->txtimes[i])
+                rtp_sender_set_txtime(cmsg, sender->txtimes[i]);
+        }
+        sender->train_start[n_trains++] = i;
+        i = j;
+    }
+    return(n_trains);
+}
+
+/* Send the batch in trains. If the kernel rejects GSO it isn't used again
+ * st: Set to 0 if some train couldn't be sent
+ * return: First packet not sent
+ */
+int rtp_sender_flush_trains(RTP_SENDER *sender, int *st) {
+    int n_trains;
+    int packets;
+    int sent = 0;
+    int ret;
+    int i;
+
+    n_trains = rtp_sender_build_trains(sender);
+    while (sent < n_trains) {
+        ret = sendmmsg(sender->fd, sender->train_msgs + sent, n_trains - sent, 0);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP) {
+                /* The device can't segment. Send the rest packet by packet */
+                sender->gso = 0;
+                return(sender->train_start[sent]);
+            }
+            /* Drop the train that has failed and go on with the others */
+            *st = 0;
+            ++sent;
+            continue;
+        }
+        ++sender->flushes;
+        for (i = sent; i < sent + ret; ++i) {
+            packets = (i + 1 < n_trains ? sender->train_start[i + 1] : sender->n) - sender->train_start[i];
+            sender->packets_sent += packets;
+            if (packets > 1)
+                ++sender->trains;
+        }
+        sent += ret;
+    }
+    return(sender->n);
+}
+#endif
+
+int rtp_sender_flush(RTP_SENDER *sender) {
+    int first = 0;
+    int st = 1;
+
+#ifdef UDP_SEGMENT
+    if (sender->gso)
+        first = rtp_sender_flush_trains(sender, &st);
+#endif
+    if (first < sender->n && !rtp_sender_flush_packets(sender, first))
+        st = 0;
+    sender->n = 0;
+    sender->n_iov = 0;
+    return(st);
+}
+
+long rtp_sender_timeout(RTP_SENDER *sender) {
+    struct timespec now;
+    long waited;
+
+    if (!sender->n)
+        return(-1);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    waited = (now.tv_sec - sender->first.tv_sec) * 1000000 +
+        (now.tv_nsec - sender->first.tv_nsec) / 1000;
+    if (waited >= sender->max_delay)
+        return(0);
+    return(sender->max_delay - waited);
+}
@@ -0,0 +1,112 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#ifndef _RTP_SENDER_H_
+#define _RTP_SENDER_H_
+
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#define RTP_SENDER_MAX_BATCH 64 /* Packets sent with one sendmmsg */
+#define RTP_SENDER_PACKET 1500 /* Maximum size of a packet */
+#define RTP_SENDER_DEFAULT_BATCH 16
+#define RTP_SENDER_DEFAULT_DELAY 1000 /* Microseconds a packet can wait for the batch */
+#define RTP_SENDER_GSO_MAX 65000 /* Bytes of a train of packets sent with GSO */
+#define RTP_SENDER_MAX_IOV 4 /* Pieces of a packet queued with rtp_sender_queue_iov */
+
+/* Control messages with the segment size of a train and the departure time */
+typedef union {
+    char buf[CMSG_SPACE(sizeof(unsigned short)) + CMSG_SPACE(sizeof(unsigned long long))];
+    struct cmsghdr align;
+} RTP_SENDER_CONTROL;
+
+/* Packets waiting to be sent together. Each one can go to a different
+ * destination. They are written directly in the sender, or referenced
+ * in the memory of the caller, never copied.
+ * With UDP GSO, consecutive packets of the same size for the same
+ * destination are sent as a single train the kernel splits. With SO_TXTIME
+ * each packet carries the time when the kernel must send it */
+typedef struct {
+    int fd;
+    int batch; /* Packets that fill the batch */
+    long max_delay; /* Microseconds the first packet can wait */
+    int gso; /* 1 if trains are sent with UDP_SEGMENT */
+    int txtime; /* 1 if packets are sent with SCM_TXTIME */
+    int n; /* Packets queued */
+    struct timespec first; /* When the first packet was queued */
+    unsigned long packets_sent;
+    unsigned long flushes; /* sendmmsg calls */
+    unsigned long trains; /* Messages with more than one packet */
+    struct mmsghdr msgs[RTP_SENDER_MAX_BATCH];
+    struct iovec iov[RTP_SENDER_MAX_BATCH * RTP_SENDER_MAX_IOV]; /* Consecutive for each packet */
+    int n_iov; /* Elements of iov used */
+    int lens[RTP_SENDER_MAX_BATCH]; /* Size of each packet */
+    struct sockaddr_in dests[RTP_SENDER_MAX_BATCH];
+    char packets[RTP_SENDER_MAX_BATCH][RTP_SENDER_PACKET];
+    unsigned long long txtimes[RTP_SENDER_MAX_BATCH]; /* CLOCK_MONOTONIC ns, 0 to send now */
+    RTP_SENDER_CONTROL control[RTP_SENDER_MAX_BATCH];
+    /* Trains, built when the batch is sent */
+    struct mmsghdr train_msgs[RTP_SENDER_MAX_BATCH];
+    int train_start[RTP_SENDER_MAX_BATCH]; /* First packet of each train */
+    RTP_SENDER_CONTROL train_control[RTP_SENDER_MAX_BATCH];
+} RTP_SENDER;
+
+/* Initialize an empty sender. GSO is used if the kernel supports it
+ * fd: UDP socket the packets are sent from
+ * batch: Packets sent together. Limited to RTP_SENDER_MAX_BATCH
+ * max_delay: Microseconds a packet can be kept waiting for the others
+ */
+void rtp_sender_init(RTP_SENDER *sender, int fd, int batch, long max_delay);
+
+/* Make the kernel send each packet at the time given to rtp_sender_queue_at.
+ * The fq qdisc must be set in the interface, otherwise they are sent at once
+ * return: 1 ok, 0 if the kernel doesn't support it
+ */
+int rtp_sender_txtime(RTP_SENDER *sender);
+
+/* Get the memory where the next packet must be written. It has
+ * RTP_SENDER_PACKET bytes and is valid until the next packet is queued.
+ * With rtp_sender_queue_iov it can hold just the header */
+char *rtp_sender_buffer(RTP_SENDER *sender);
+
+/* Queue the packet written in rtp_sender_buffer. The batch is sent if it
+ * is full or the first packet has waited too much
+ * len: Size of the packet
+ * dest: Destination of the packet
+ * return: 1 ok, 0 if the batch couldn't be sent
+ */
+int rtp_sender_queue(RTP_SENDER *sender, int len, struct sockaddr_in *dest);
+
+/* Queue a packet that the kernel must send at a given time. Without
+ * rtp_sender_txtime it is sent as soon as the batch is sent
+ * txtime: CLOCK_MONOTONIC nanoseconds, 0 to send it now
+ * return: 1 ok, 0 if the batch couldn't be sent
+ */
+int rtp_sender_queue_at(RTP_SENDER *sender, int len, struct sockaddr_in *dest, unsigned long long txtime);
+
+/* Queue a packet made of pieces of memory, that are referenced, not
+ * copied. They must not change until the batch is sent. The same data
+ * can be queued for several destinations
+ * iov: Pieces of the packet, at most RTP_SENDER_MAX_IOV
+ * txtime: CLOCK_MONOTONIC nanoseconds, 0 to send it now
+ * return: 1 ok, 0 if the batch couldn't be sent
+ */
+int rtp_sender_queue_iov(RTP_SENDER *sender, const struct iovec *iov, int iovcnt,
+        struct sockaddr_in *dest, unsigned long long txtime);
+
+/* Send the queued packets now
+ * return: 1 ok, 0 err
+ */
+int rtp_sender_flush(RTP_SENDER *sender);
+
+/* Time until the queued packets must be sent
+ * return: Microseconds, 0 if they are already late, -1 if there aren't packets
+ */
+long rtp_sender_timeout(RTP_SENDER *sender);
+#endif
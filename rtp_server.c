@@ -5,121 +5,237 @@ Permission to use, copy, modify, and/or distribute this software for any purpose
 
 THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
+#define _GNU_SOURCE
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <limits.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
-#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "server.h"
 #include "servers_comm.h"
 #include "rtp_server.h"
-#include "hashtable/hashtable.h"
-#include "hashtable/hashfunction.h"
 #include "socketlib/socketlib.h"
 #include "server_client.h"
 #include "parse_rtp.h"
 #include "rtcp.h"
+#include "rtp_sender.h"
+#include "rtp_pacer.h"
+#include "frame_ring.h"
+#include "rtp_payloader.h"
+#include "rtp_multicast.h"
+#include "rtp_worker_comm.h"
+#include "rtp_registry.h"
 
 #include <gst/gst.h>
 #include <glib.h>
 
-#define MSG_IDENTIFIER 99324
-/* Burst size in us */
-#define RTP_BURST_TIME 100000000
+#define WORKER_EVENTS 32 /* Events of the workers read with each epoll_wait */
 
 typedef enum {VIDEO, AUDIO} MEDIA_TYPE;
-MEDIA_TYPE media_type;
-
-static GstElement * videodec = NULL, * audiodec = NULL;
-/* Gstreamer pipeline */
-GstElement *pipeline;
-GMainLoop * loop;
 
-unsigned int client_ip;
-unsigned short client_port;
-
-int sleeper_pid = -1;
-int sleeper_pipe[2];
-
-int play_state = 0;
-pthread_mutex_t play_state_mutex;
+typedef struct RTP_ENGINE RTP_ENGINE;
+
+/* A track sent to its clients: the pipeline that reads it, the ring where
+ * it leaves the frames and where the sender is in them. A worker process
+ * has one. The engine has many, that live while a session, an order or
+ * the bus watch uses them */
+struct RTP_STREAM {
+    int id; /* Owner of the multicast group in the engine */
+    int refs; /* Changed with atomics */
+    int ended; /* Changed with workers_mutex */
+    MEDIA_TYPE media_type;
+    /* Gstreamer pipeline */
+    GstElement *pipeline;
+    GstElement *videodec;
+    GstElement *audiodec;
+    guint watch; /* Bus watch in the engine */
+    /* Clients of the stream. The sender locks the mutex for each packet */
+    RTP_SUBSCRIBER *subscribers;
+    int n_subscribers;
+    int max_subscribers; /* Allocated */
+    int n_playing;
+    pthread_mutex_t mutex;
+    /* A multicast stream sends its track to the group, once for all its
+     * clients, that only count who is playing */
+    int multicast;
+    RTP_SUBSCRIBER group_stream[1];
+    /* PLAY_STATE_PAUSED or PLAY_STATE_PLAYING. Read without locks by the
+     * sender, that waits on it with a futex only while paused */
+    int play_state;
+    /* Frames written by gstreamer and sent by the sender */
+    FRAME_RING ring[1];
+    /* Releases the packets when their media time is due */
+    RTP_PACER pacer[1];
+    int rtp_sockfd;
+    int rtcp_sockfd;
+    PORT port;
+    /* Next packet to send: its byte in the frame and its media time */
+    unsigned int pos;
+    long long media_time;
+    RTP_ENGINE *engine; /* Thread that sends it, 0 in a worker process */
+    RTP_STREAM *next; /* In the list of the thread */
+};
 
-/* Pipe where gstreamer will write the data */
-int media_pipe[2];
+/* Thread of the engine that sends the streams given to it. They all go
+ * out from its ports in the batches of one sender. The mutex is locked
+ * while it sends and released while it sleeps */
+struct RTP_ENGINE {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    RTP_STREAM *streams;
+    int n_streams; /* Read without locks to balance the threads */
+    int rtp_sockfd;
+    int rtcp_sockfd;
+    PORT port;
+    RTP_SENDER sender[1];
+    long long ahead; /* Nanoseconds the packets are handed over with SO_TXTIME */
+    /* Changed to wake the thread up, that sleeps on it with a futex */
+    int wake;
+    int sleeping;
+};
 
-int rtp_sockfd = -1;
-int rtcp_sockfd = -1;
-int rtsp_sockfd = -1;
+/* The stream of a worker process */
+RTP_STREAM worker_stream[1];
+GMainLoop * loop;
 
-/* Time when a media sent data for the last time */
-struct timeval last_time_sent;
-/* Time when the pipeline started sending data */
-struct timeval time_play;
-/* Time when the pipeline paused sending data */
-struct timeval time_pause;
+/* With broadcast every SETUP of a track joins the worker already sending
+ * it, if there is one */
+int broadcast = 0;
+
+/* Groups of the multicast sessions. A worker sends its track to one */
+RTP_MULTICAST rtp_multicast[1];
+const char *multicast_iface = 0;
+
+/* With engine_threads > 0 the streams are sent by threads of this process
+ * instead of a worker process each */
+int engine_threads = 0;
+RTP_ENGINE *engines = 0;
+int engine_stream_ids = 0;
+
+/* RTP packets are sent in batches of send_batch packets, or when the first
+ * one has waited send_delay microseconds */
+RTP_SENDER rtp_sender[1];
+int send_batch = RTP_SENDER_DEFAULT_BATCH;
+long send_delay = RTP_SENDER_DEFAULT_DELAY;
+/* With SO_TXTIME packets are given to the kernel txtime_ahead milliseconds
+ * before they are due, and the fq qdisc sends them on time */
+long txtime_ahead = 0;
+
+/* Frames are fragmented or put together in packets of max_packet bytes */
+RTP_PAYLOADER rtp_payloader[1];
+int max_packet = RTP_PAYLOADER_DEFAULT_PACKET;
 
 unsigned short comm_port;
-struct msgbuf {
-    long mtype;
-    pid_t pid;
-};
-
-/* TODO: Send sockfd, RTSP_TO_RTP structure and rtsp_socket to the message queue if the ssrc exists */
-struct msg_to_worker {
-    long mtype;
-    int sockfd;
-    RTSP_TO_RTP message;
-    struct sockaddr_storage rtsp_socket;
-};
 
 void (*signal(int sig, void(*func)(int)))(int);
 void *worker_comm_fun(void *arg);
-int rtp_worker_create(int sockfd, struct sockaddr_storage *rtsp_socket);
+int rtp_control_create(int sockfd, struct sockaddr_storage *rtsp_socket);
+void *rtp_control_fun(void *arg);
+void rtp_control_reply(int channel, unsigned int channel_gen, RTP_CHANNEL_FRAME *response);
+void rtp_worker_create(int channel, unsigned int channel_gen, unsigned int id, RTSP_TO_RTP *message);
+void rtp_worker_respond(RTP_WORKER_FRAME *order, RTSP_TO_RTP *message, RESPONSE response, unsigned short server_port);
+void rtp_frame_fill(RTP_CHANNEL_FRAME *frame, unsigned int id, RTSP_TO_RTP *message);
+void rtp_message_fill(RTSP_TO_RTP *message, RTP_CHANNEL_FRAME *frame, const char *uri);
+int rtp_worker_fork(int spare);
+void rtp_process_close_inherited(int slot);
+int rtp_process_read(RTP_PROCESS *process);
+void rtp_process_end(RTP_PROCESS *process);
+void rtp_response_fill(RTP_CHANNEL_FRAME *response, unsigned int id, RTSP_TO_RTP *message,
+        RESPONSE order, unsigned short server_port);
 int check_file_exists(char *path);
 int rtp_worker_fun();
-gboolean on_pipeline_msg(GstBus * bus, GstMessage * msg, gpointer loop);
-void on_pad_added(GstElement * element, GstPad * pad);
+void rtp_worker_preload();
+void *rtp_spares_fun(void *arg);
+int rtp_spare_forget(RTP_PROCESS *process);
+int gstreamer_fun(RTP_STREAM *stream, char *path);
+gboolean on_pipeline_msg(GstBus * bus, GstMessage * msg, gpointer data);
+void on_pad_added(GstElement * element, GstPad * pad, gpointer data);
 char *get_absolute_path(char *path);
-void *gstreamer_comm_thread_fun(void *ssrc);
+void *gstreamer_comm_thread_fun(void *arg);
 void *gstreamer_loop_thread_fun(void *ssrc);
 void rtp_worker_stop_eos(int sig);
 void free_worker_process();
-void *gstreamer_limitrate_thread_fun(void *arg);
-void sleeper_fun();
-
-/* RTP workers */
-RTP_WORKER_USE workers[MAX_RTP_WORKERS][1];
+void on_media_frame(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer data);
+void play_state_set(RTP_STREAM *stream, int state);
+void play_state_wait(RTP_STREAM *stream, int state);
+int rtp_worker_use_add(int process, RTP_STREAM *stream, const char *track, unsigned int group, RTSP_TO_RTP *message);
+void rtp_worker_use_free(unsigned int ssrc);
+void rtp_worker_uses_free(pid_t pid, RTP_STREAM *stream);
+long long rtp_worker_sender(RTP_SENDER *sender, int fd);
+int rtp_subscriber_add(RTP_STREAM *stream, RTSP_TO_RTP *message);
+RTP_SUBSCRIBER *rtp_subscriber_get(RTP_STREAM *stream, unsigned int ssrc);
+int rtp_stream_init(RTP_STREAM *stream);
+int rtp_stream_open(RTP_STREAM *stream, RTSP_TO_RTP *message, unsigned int ring_descs, unsigned int ring_size);
+void rtp_stream_close(RTP_STREAM *stream);
+int rtp_stream_multicast(RTP_STREAM *stream, unsigned int group);
+RESPONSE rtp_stream_order(RTP_STREAM *stream, RTSP_TO_RTP *message, int *left);
+void rtp_stream_set_pipeline(RTP_STREAM *stream, GstState state);
+long long rtp_stream_media_time(RTP_STREAM *stream, FRAME_DESC *frame);
+void rtp_stream_send(RTP_STREAM *stream, RTP_SENDER *sender, FRAME_DESC *frame, long long ahead);
+int rtp_engine_init(int n_threads);
+void *rtp_engine_fun(void *arg);
+void rtp_engine_wake(RTP_ENGINE *engine);
+void rtp_engine_sleep(RTP_ENGINE *engine, int wake, long timeout);
+void rtp_engine_setup(int channel, unsigned int channel_gen, unsigned int id, RTSP_TO_RTP *message, const char *track);
+void rtp_engine_stream_end(RTP_STREAM *stream, int from_bus);
+void rtp_engine_stream_unref(RTP_STREAM *stream);
+void rtp_engine_watch_done(gpointer data);
+
+/* Sessions of the RTP workers, found by ssrc, and the workers, found by
+ * pid and stream or by track */
+RTP_REGISTRY registry[1];
+/* Worker processes running */
 int n_workers;
-/* Hashtable where the workers will be stored */
-hashtable *workers_hash;
+/* Slots of the workers forked ahead of time, that wait for their first
+ * SETUP with gstreamer loaded. When there are less than min_spares the
+ * spares thread forks them up to max_spares. They don't count in n_workers */
+int spares[MAX_RTP_WORKERS];
+int n_spares = 0;
+int min_spares = RTP_DEFAULT_MIN_SPARES;
+int max_spares = RTP_DEFAULT_MAX_SPARES;
+pthread_cond_t spares_cond = PTHREAD_COND_INITIALIZER; /* With workers_mutex */
+pthread_t spares_thread;
+/* Worker processes and spares with their socketpairs. Their ends and
+ * their pidfds are watched by the thread of worker_comm_fun */
+RTP_PROCESS processes[MAX_RTP_PROCESSES];
+int free_processes; /* First free slot, -1 if there isn't any */
+int workers_epoll = -1;
+/* End of the socketpair in a worker process */
+int parent_fd = -1;
 pthread_mutex_t workers_mutex;
 
 /* Socket where the RTP server will be receiving data from the RTSP server */
 int sockfd;
 
+/* Control channels with the RTSP servers. The mutex also serializes the
+ * writes of the responses */
+RTP_CONTROL controls[MAX_RTP_CONTROLS];
+pthread_mutex_t controls_mutex;
+
 /* Pthread that will receive messages from workers*/
 pthread_t worker_comm;
 
 pthread_t gstreamer_loop_thread; int gstreamer_loop_created = 0;
 pthread_t gstreamer_comm_thread; int gstreamer_comm_created = 0;
-pthread_t gstreamer_limitrate_thread; int gstreamer_limitrate_created = 0;
 pthread_t rtcp_thread; int rtcp_created = 0;
 unsigned int my_addr;
 
-int msg_queue;
-
 pid_t main_pid;
 
 void rtp_server_stop(int sig) {
-    RTP_WORKER *worker;
+    pid_t pid;
     int i;
 
     /* Close socket */
@@ -131,45 +247,53 @@ void rtp_server_stop(int sig) {
     /* Kill all workers */
     fprintf(stderr, "RTP - Starting killing workers ");
     pthread_mutex_lock(&workers_mutex);
-    for (i = 0; i < MAX_RTP_WORKERS; ++i) {
-        if (workers[i]->used) {
-            workers[i]->used = 0;
-            /* kill worker */
-            kill(workers[i]->pid, SIGINT);
-            waitpid(workers[i]->pid, 0, 0);
-            worker = gethashtable(&workers_hash, &workers[i]->ssrc);
-            if (worker) {
-                delhashtable(&workers_hash, &workers[i]->ssrc);
-            }
+    for (i = 0; i < MAX_RTP_PROCESSES; ++i) {
+        pid = processes[i].pid;
+        if (pid > 0 && !processes[i].reaped) {
+            /* Spares haven't started any pipeline. The streams of the
+             * engine end with this process */
+            kill(pid, rtp_spare_forget(&processes[i]) ? SIGKILL : SIGINT);
+            waitpid(pid, 0, 0);
+            fprintf(stderr, ".");
         }
-        fprintf(stderr, ".");
     }
     pthread_mutex_unlock(&workers_mutex);
     fprintf(stderr, "- killed\n");
 
+    /* Close control channels. Their threads end when they see it */
+    pthread_mutex_lock(&controls_mutex);
+    for (i = 0; i < MAX_RTP_CONTROLS; ++i)
+        if (controls[i].used)
+            shutdown(controls[i].fd, SHUT_RDWR);
+    pthread_mutex_unlock(&controls_mutex);
+
     /* Kill thread that checks idle workers */
     fprintf(stderr, "RTP - Killing threads ");
     pthread_cancel(worker_comm);
     pthread_join(worker_comm, 0);
 
-    /* Free workers hash. */
-    if (workers_hash) {
-        fprintf(stderr, "RTP - Deleting workers hash ");
-        clearhashtable(&workers_hash);
-        freehashtable(&workers_hash);
-        fprintf(stderr, "- deleted\n");
-    }
+    /* Free the sessions */
+    fprintf(stderr, "RTP - Deleting sessions ");
+    rtp_registry_free(registry);
+    fprintf(stderr, "- deleted\n");
 
     /* Destroy workers mutex */
     fprintf(stderr, "RTP - Destroying mutex ");
     pthread_mutex_destroy(&workers_mutex);
-    pthread_mutex_destroy(&play_state_mutex);
+    pthread_mutex_destroy(&controls_mutex);
     fprintf(stderr, "- destroyed\n");
 
-    /* Free message queue */
-    fprintf(stderr, "RTP - Destroying message queue ");
-    msgctl(msg_queue, IPC_RMID, 0);
-    fprintf(stderr, "destroyed\n");
+    /* Close the socketpairs of the workers */
+    fprintf(stderr, "RTP - Closing worker sockets ");
+    for (i = 0; i < MAX_RTP_PROCESSES; ++i) {
+        if (processes[i].pid > 0) {
+            close(processes[i].fd);
+            if (processes[i].pidfd != -1)
+                close(processes[i].pidfd);
+        }
+    }
+    close(workers_epoll);
+    fprintf(stderr, "closed\n");
 
     /* Die */
     fprintf(stderr, "RTP - Finished\n");
@@ -182,41 +306,46 @@ int initialize_rtp_globals() {
     srand(time(0));
     /* Initialize globals */
     n_workers = 0;
-    workers_hash = 0;
     sockfd = -1;
 
     main_pid = getpid();
 
-    /* Intialize workers array */
-    for (i = 0; i < MAX_RTP_WORKERS; ++i)
-        workers[i]->used = 0;
+    for (i = 0; i < MAX_RTP_CONTROLS; ++i) {
+        controls[i].used = 0;
+        controls[i].gen = 0;
+    }
+    for (i = 0; i < MAX_RTP_PROCESSES; ++i) {
+        processes[i].pid = 0;
+        processes[i].reaped = 0;
+        processes[i].spare = -1;
+        processes[i].next_free = i + 1 < MAX_RTP_PROCESSES ? i + 1 : -1;
+        processes[i].gen = 0;
+    }
+    free_processes = 0;
 
     signal(SIGINT, rtp_server_stop);
     signal(SIGUSR1, rtp_worker_stop_eos);
 
-    /* Initialize message queue */
-    msg_queue = msgget(MSG_IDENTIFIER/*TODO: Don't hardcode this */, IPC_CREAT /*| IPC_EXCL */| 0700);
-    if (msg_queue == -1)
+    /* Initialize the epoll of the workers */
+    workers_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (workers_epoll == -1)
         return(0);
-    /* Initialize hash table */
-    workers_hash = newhashtable(longhash, longequal, MAX_RTP_WORKERS * 2, 1);
-    if (!workers_hash) {
-        msgctl(msg_queue, IPC_RMID, 0);
+    /* Initialize the sessions */
+    if (!rtp_registry_init(registry, MAX_RTP_STREAMS)) {
+        close(workers_epoll);
         return(0);
     }
 
-    /* Initialize hash table mutex */
+    /* Initialize sessions mutex */
     if (pthread_mutex_init(&workers_mutex, 0)) {
-        msgctl(msg_queue, IPC_RMID, 0);
-        clearhashtable(&workers_hash);
-        freehashtable(&workers_hash);
+        close(workers_epoll);
+        rtp_registry_free(registry);
         return(0);
     }
-    if (pthread_mutex_init(&play_state_mutex, 0)) {
+    if (pthread_mutex_init(&controls_mutex, 0)) {
         pthread_mutex_destroy(&workers_mutex);
-        msgctl(msg_queue, IPC_RMID, 0);
-        clearhashtable(&workers_hash);
-        freehashtable(&workers_hash);
+        close(workers_epoll);
+        rtp_registry_free(registry);
         return(0);
     }
 
@@ -236,14 +365,10 @@ void rtp_worker_stop(int sig) {
     exit(0);
 }
 
-/* Signal handler for killing workers on end of stream */
+/* Signal handler for killing workers on end of stream. The main process
+ * sees it end through its pidfd and waits for it */
 void rtp_worker_stop_eos(int sig) {
-    struct msgbuf die_message;
     free_worker_process();
-    /* Send die message so this process is waited for */
-    die_message.mtype = getppid();
-    die_message.pid = getpid();
-    msgsnd(msg_queue, &die_message, sizeof(pid_t), 0);
     exit(0);
 }
 
@@ -254,9 +379,19 @@ int rtp_server(PORT port) {
     st = initialize_rtp_globals();
     if (!st)
         return(0);
+    if (engine_threads && !rtp_engine_init(engine_threads)) {
+        fprintf(stderr, "Error starting the engine\n");
+        kill(getpid(), SIGINT);
+        return(0);
+    }
+    /* The engine doesn't fork */
+    if (!engine_threads && min_spares && pthread_create(&spares_thread, 0, rtp_spares_fun, 0)) {
+        kill(getpid(), SIGINT);
+        return(0);
+    }
 
 
-    accept_tcp_requests(port, &sockfd, &my_addr, rtp_worker_create);
+    accept_tcp_requests(port, MAX_QUEUE_SIZE, &sockfd, &my_addr, rtp_control_create);
     /* If we reach this point, there has been a severe error. Terminate */
     kill(getpid(), SIGINT);
     return(0);
@@ -264,7 +399,74 @@ int rtp_server(PORT port) {
 
 int main(int argc, char **argv) {
     unsigned short rtp_port = 2001;
+    const char *first_group = RTP_MULTICAST_DEFAULT_GROUP;
+    int ttl = RTP_MULTICAST_DEFAULT_TTL;
     int ret;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:d:e:g:I:lm:s:S:t:T:")) != -1) {
+        switch (opt) {
+            case 'b':
+                ret = atoi(optarg);
+                if (ret > 0 && ret <= RTP_SENDER_MAX_BATCH)
+                    send_batch = ret;
+                break;
+            case 'd':
+                ret = atoi(optarg);
+                if (ret >= 0)
+                    send_delay = ret;
+                break;
+            case 'e':
+                ret = atoi(optarg);
+                if (ret > 0 && ret <= MAX_RTP_ENGINE_THREADS)
+                    engine_threads = ret;
+                break;
+            case 'g':
+                first_group = optarg;
+                break;
+            case 'I':
+                multicast_iface = optarg;
+                break;
+            case 'l':
+                broadcast = 1;
+                break;
+            case 'm':
+                ret = atoi(optarg);
+                if (ret >= RTP_PAYLOADER_MIN_PACKET && ret <= RTP_SENDER_PACKET)
+                    max_packet = ret;
+                break;
+            case 's':
+                ret = atoi(optarg);
+                if (ret >= 0 && ret <= MAX_RTP_WORKERS)
+                    min_spares = ret;
+                break;
+            case 'S':
+                ret = atoi(optarg);
+                if (ret >= 0 && ret <= MAX_RTP_WORKERS)
+                    max_spares = ret;
+                break;
+            case 't':
+                ret = atoi(optarg);
+                if (ret >= 0 && ret <= RTP_MAX_TXTIME_AHEAD)
+                    txtime_ahead = ret;
+                break;
+            case 'T':
+                ttl = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-b batch] [-d max_delay_us] [-e engine_threads] [-g first_group] [-I multicast_iface] [-l] [-m max_packet] [-s min_spares] [-S max_spares] [-t txtime_ahead_ms] [-T ttl] [rtp_port]\n", argv[0]);
+                return 0;
+        }
+    }
+    if (!rtp_multicast_init(rtp_multicast, first_group, RTP_MULTICAST_MAX_GROUPS, RTP_MULTICAST_DEFAULT_PORT, ttl)) {
+        fprintf(stderr, "Wrong multicast groups from %s with ttl %d\n", first_group, ttl);
+        return 0;
+    }
+    if (max_spares < min_spares)
+        max_spares = min_spares;
+    argc -= optind - 1;
+    argv += optind - 1;
+
     if (argc == 2) {
         ret = atoi(argv[1]);
         if (ret > 1024 && ret < 60000)
@@ -274,197 +476,596 @@ int main(int argc, char **argv) {
     return(0);
 }
 
+/* Read the responses of the workers and wait for them when they end. The
+ * events carry the slot of the process, its generation and 1 for the pidfd */
 void *worker_comm_fun(void *arg) {
-    pid_t pid = getpid();
-    pid_t worker_pid;
-    struct msgbuf buf;
-    int st;
+    struct epoll_event events[WORKER_EVENTS];
+    RTP_PROCESS *process;
+    unsigned long long data;
+    int n;
     int i;
-    RTP_WORKER *worker;
-    /* Reserve the buffer where the child processes will send their pid to be waited for */
+    int st;
 
     for (;;) {
-    /* Wait for messages sent to this pid */
-        st = msgrcv(msg_queue, &buf, sizeof(pid_t), pid, 0);
+        n = epoll_wait(workers_epoll, events, WORKER_EVENTS, -1);
+        for (i = 0; i < n; ++i) {
+            data = events[i].data.u64;
+            process = &processes[(data & 0xffffffff) >> 1];
+            /* The slot may have been ended by an earlier event */
+            if (process->pid <= 0 || process->gen != data >> 32)
+                continue;
+            if (data & 1) {
+                rtp_process_end(process);
+                continue;
+            }
+            while ((st = rtp_process_read(process)) > 0);
+            /* Without pidfd a closed socketpair tells it has ended */
+            if (st == 0 && process->pidfd == -1)
+                rtp_process_end(process);
+        }
+    }
+}
 
-        if (st != -1)
-            /* Get worker pid */
-            worker_pid = buf.pid;
+/* Keep spare workers ready. When there are less than min_spares, they are
+ * forked up to max_spares, as long as the workers are below their limit */
+void *rtp_spares_fun(void *arg) {
+    int n;
 
+    pthread_mutex_lock(&workers_mutex);
+    for (;;) {
+        /* Each round forks at most max_spares, so spares that fail at
+         * once aren't forked again until a worker is taken or ends */
+        n = n_spares < min_spares ? max_spares - n_spares : 0;
+        for (; n > 0 && n_workers + n_spares < MAX_RTP_WORKERS; --n) {
+            /* SETUPs go on meanwhile */
+            pthread_mutex_unlock(&workers_mutex);
+            if (rtp_worker_fork(1) == -1) {
+                /* Try again later */
+                sleep(1);
+                pthread_mutex_lock(&workers_mutex);
+                break;
+            }
             pthread_mutex_lock(&workers_mutex);
-            for (i = 0; i < MAX_RTP_WORKERS; ++i) {
-                if (workers[i]->pid == worker_pid) {
-                    /* Delete worker in workers array */
-                    workers[i]->used = 0;
-                    /* kill worker */
-                    kill(workers[i]->pid, SIGUSR1);
-                    waitpid(workers[i]->pid, 0, 0);
-                    worker = gethashtable(&workers_hash, &workers[i]->ssrc);
-                    if (worker) {
-                        /* Delete worker in hash table */
-                        delhashtable(&workers_hash, &workers[i]->ssrc);
-                    }
-                    break;
-                }
+        }
+        pthread_cond_wait(&spares_cond, &workers_mutex);
+    }
+    return(0);
+}
+
+/* Forget a spare worker. The last spare takes its position. The mutex
+ * must be locked
+ * return: 1 if it was a spare, 0 if not
+ */
+int rtp_spare_forget(RTP_PROCESS *process) {
+    int last;
+
+    if (process->spare == -1)
+        return(0);
+    last = spares[--n_spares];
+    spares[process->spare] = last;
+    processes[last].spare = process->spare;
+    process->spare = -1;
+    return(1);
+}
+
+/* Fork a worker with a socketpair for its orders and a pidfd that tells
+ * when it ends, both watched by worker_comm_fun. The child doesn't return.
+ * The mutex must not be locked
+ * spare: 1 to add it to the spares
+ * return: Slot of the worker, -1 err
+ */
+int rtp_worker_fork(int spare) {
+    RTP_PROCESS *process;
+    struct epoll_event event;
+    pid_t child;
+    int fds[2];
+    int i;
+
+    pthread_mutex_lock(&workers_mutex);
+    i = free_processes;
+    if (i == -1 || !rtp_worker_comm_pair(fds)) {
+        pthread_mutex_unlock(&workers_mutex);
+        return(-1);
+    }
+    /* Reserved until the child is known. Its end is closed by the
+     * workers forked meanwhile */
+    process = &processes[i];
+    free_processes = process->next_free;
+    process->pid = -1;
+    process->fd = fds[0];
+    process->pidfd = -1;
+    pthread_mutex_unlock(&workers_mutex);
+
+    child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        parent_fd = fds[1];
+        rtp_process_close_inherited(i);
+        rtp_worker_fun();
+    }
+    close(fds[1]);
+    if (child > 0) {
+        process->pidfd = rtp_worker_comm_pidfd(child);
+        event.events = EPOLLIN;
+        event.data.u64 = (unsigned long long)process->gen << 32 | i << 1 | 1;
+        if (process->pidfd != -1 && epoll_ctl(workers_epoll, EPOLL_CTL_ADD, process->pidfd, &event)) {
+            close(process->pidfd);
+            process->pidfd = -1;
+        }
+        event.data.u64 &= ~1ULL;
+        if (epoll_ctl(workers_epoll, EPOLL_CTL_ADD, process->fd, &event)) {
+            if (process->pidfd != -1) {
+                epoll_ctl(workers_epoll, EPOLL_CTL_DEL, process->pidfd, 0);
+                close(process->pidfd);
             }
-            pthread_mutex_unlock(&workers_mutex);
+            kill(child, SIGKILL);
+            waitpid(child, 0, 0);
+            child = -1;
+        }
+    }
+    pthread_mutex_lock(&workers_mutex);
+    if (child > 0) {
+        process->pid = child;
+        process->reaped = 0;
+        /* A spare is known as such before it can end */
+        if (spare) {
+            process->spare = n_spares;
+            spares[n_spares++] = i;
+        }
+    } else {
+        close(fds[0]);
+        process->pid = 0;
+        process->next_free = free_processes;
+        free_processes = i;
+        i = -1;
     }
+    pthread_mutex_unlock(&workers_mutex);
+    return(i);
 }
 
-int rtp_worker_create(int sockfd, struct sockaddr_storage *rtsp_socket) {
-    int ret;
+/* Close in a new worker the descriptors of the main process. Without exec
+ * they are inherited, and the ends and pidfds of the other workers would
+ * stay open in the epoll after those end. The other threads are gone, so
+ * the slots are read as they were at the fork
+ * slot: Slot of this worker, its end is already closed
+ */
+void rtp_process_close_inherited(int slot) {
+    int i;
+
+    for (i = 0; i < MAX_RTP_PROCESSES; ++i) {
+        if (i == slot || !processes[i].pid)
+            continue;
+        close(processes[i].fd);
+        if (processes[i].pidfd != -1)
+            close(processes[i].pidfd);
+    }
+    /* A control channel closed meanwhile may have left its number to
+     * the end of this worker */
+    for (i = 0; i < MAX_RTP_CONTROLS; ++i)
+        if (controls[i].used && controls[i].fd != parent_fd)
+            close(controls[i].fd);
+    if (sockfd != -1) {
+        close(sockfd);
+        sockfd = -1;
+    }
+    close(workers_epoll);
+    workers_epoll = -1;
+}
+
+/* Read a response of a worker and write it to its control channel
+ * return: 1 ok, 0 if the worker has closed its end, -1 if there aren't more
+ */
+int rtp_process_read(RTP_PROCESS *process) {
+    RTP_WORKER_FRAME response;
+    char uri[MAX_URI_LENGTH];
+    int st;
+
+    st = rtp_worker_comm_recv(process->fd, &response, uri, MSG_DONTWAIT);
+    if (st == 1 && response.channel != -1)
+        rtp_control_reply(response.channel, response.channel_gen, &response.frame);
+    return(st);
+}
+
+/* A worker has ended. Its last responses are still read, then its sessions
+ * are deleted and it's waited for. A worker killed by a failed SETUP had no
+ * sessions and has been waited for, so its pid isn't used again. Only
+ * worker_comm_fun calls it */
+void rtp_process_end(RTP_PROCESS *process) {
+    pid_t pid = process->pid;
+    int st;
+
+    while (rtp_process_read(process) > 0);
+
+    pthread_mutex_lock(&workers_mutex);
+    if (!process->reaped) {
+        rtp_worker_uses_free(pid, 0);
+        rtp_multicast_release(rtp_multicast, pid);
+        /* A spare that has failed to start wasn't counted */
+        st = rtp_spare_forget(process);
+        if (waitpid(pid, 0, 0) == pid && !st) {
+            --n_workers;
+            /* There may be room for more spares */
+            pthread_cond_signal(&spares_cond);
+        }
+    }
+    /* Taken out of the epoll first, an open copy would keep them there */
+    epoll_ctl(workers_epoll, EPOLL_CTL_DEL, process->fd, 0);
+    close(process->fd);
+    if (process->pidfd != -1) {
+        epoll_ctl(workers_epoll, EPOLL_CTL_DEL, process->pidfd, 0);
+        close(process->pidfd);
+    }
+    process->pid = 0;
+    ++process->gen;
+    process->next_free = free_processes;
+    free_processes = process - processes;
+    pthread_mutex_unlock(&workers_mutex);
+}
+
+/* Start reading orders from a new RTSP server connection
+ * return: 0 if the socket must be closed
+ */
+int rtp_control_create(int sockfd, struct sockaddr_storage *rtsp_socket) {
+    pthread_t thread;
+    int one = 1;
+    int i;
+    int st;
+
+    pthread_mutex_lock(&controls_mutex);
+    for (i = 0; i < MAX_RTP_CONTROLS; ++i)
+        if (!controls[i].used)
+            break;
+    if (i == MAX_RTP_CONTROLS) {
+        pthread_mutex_unlock(&controls_mutex);
+        return(0);
+    }
+    controls[i].used = 1;
+    controls[i].fd = sockfd;
+    pthread_mutex_unlock(&controls_mutex);
+
+    /* Responses are small and must leave as soon as they are written */
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    st = pthread_create(&thread, 0, rtp_control_fun, &controls[i]);
+    if (st) {
+        pthread_mutex_lock(&controls_mutex);
+        controls[i].used = 0;
+        ++controls[i].gen;
+        pthread_mutex_unlock(&controls_mutex);
+        return(0);
+    }
+    pthread_detach(thread);
+    return(1);
+}
+
+/* Read the orders of a control channel until it is closed. Each order is
+ * answered when it is done, so several can be in progress at the same time */
+void *rtp_control_fun(void *arg) {
+    RTP_CONTROL *control = arg;
+    int channel = control - controls;
+    unsigned int channel_gen;
+    RTP_CHANNEL_FRAME frame;
     RTSP_TO_RTP message;
-    RTP_TO_RTSP response;
+    int ret;
+
+    pthread_mutex_lock(&controls_mutex);
+    channel_gen = control->gen;
+    pthread_mutex_unlock(&controls_mutex);
+
+    for (;;) {
+        ret = recv(control->fd, &frame, sizeof(frame), MSG_WAITALL);
+        if (ret != sizeof(frame))
+            break;
+        if (frame.uri_len >= MAX_URI_LENGTH)
+            break;
+        ret = recv(control->fd, message.uri, frame.uri_len, MSG_WAITALL);
+        if (ret != frame.uri_len)
+            break;
+        message.uri[frame.uri_len] = 0;
+        rtp_message_fill(&message, &frame, 0);
+        message.group = 0;
+
+        rtp_worker_create(channel, channel_gen, frame.id, &message);
+    }
+
+    pthread_mutex_lock(&controls_mutex);
+    close(control->fd);
+    control->used = 0;
+    ++control->gen;
+    pthread_mutex_unlock(&controls_mutex);
+    return(0);
+}
+
+/* Write a response in a control channel, if it is still the same connection */
+void rtp_control_reply(int channel, unsigned int channel_gen, RTP_CHANNEL_FRAME *response) {
+    pthread_mutex_lock(&controls_mutex);
+    if (controls[channel].used && controls[channel].gen == channel_gen)
+        send(controls[channel].fd, response, sizeof(RTP_CHANNEL_FRAME), MSG_NOSIGNAL);
+    pthread_mutex_unlock(&controls_mutex);
+}
+
+/* Write an order in a frame. Only a SETUP carries its uri
+ * id: Id of the order in its control channel
+ */
+void rtp_frame_fill(RTP_CHANNEL_FRAME *frame, unsigned int id, RTSP_TO_RTP *message) {
+    memset(frame, 0, sizeof(RTP_CHANNEL_FRAME));
+    frame->id = id;
+    frame->order = message->order;
+    frame->Session = message->Session;
+    frame->ssrc = message->ssrc;
+    frame->client_ip = message->client_ip;
+    frame->client_port = message->client_port;
+    frame->group = message->group;
+    if (message->order == SETUP_RTP_UNICAST || message->order == SETUP_RTP_MULTICAST)
+        frame->uri_len = strlen(message->uri);
+}
+
+/* Read an order from a frame
+ * uri: Uri that came with it, 0 if it's already in the message
+ */
+void rtp_message_fill(RTSP_TO_RTP *message, RTP_CHANNEL_FRAME *frame, const char *uri) {
+    message->order = frame->order;
+    message->Session = frame->Session;
+    message->ssrc = frame->ssrc;
+    message->client_ip = frame->client_ip;
+    message->client_port = frame->client_port;
+    message->group = frame->group;
+    if (uri)
+        strcpy(message->uri, uri);
+}
+
+/* Answer an order that hasn't reached any worker */
+void rtp_control_error(int channel, unsigned int channel_gen, unsigned int id, RTSP_TO_RTP *message, RESPONSE order) {
+    RTP_CHANNEL_FRAME response;
+
+    memset(&response, 0, sizeof(response));
+    response.id = id;
+    response.order = order;
+    response.Session = message->Session;
+    response.ssrc = message->ssrc;
+    rtp_control_reply(channel, channel_gen, &response);
+}
+
+/* Give an order to its worker, creating it for SETUP_RTP_UNICAST. The
+ * response is sent through the control channel when the worker has done it */
+void rtp_worker_create(int channel, unsigned int channel_gen, unsigned int id, RTSP_TO_RTP *message) {
     RTP_WORKER *worker;
-    struct msg_to_worker msg;
+    RTP_STREAM *stream;
+    RTP_CHANNEL_FRAME response;
+    RTP_WORKER_FRAME order_frame;
+    RTP_PROCESS *process;
     char *host, *path;
+    char track[MAX_URI_LENGTH];
+    RTP_WORKER_USE *use;
+    RESPONSE order;
     int st;
-    pid_t child;
-    int i;
-    unsigned int *ssrc;
-    /* TODO */
-    ret = recv(sockfd, &message, sizeof(RTSP_TO_RTP), MSG_WAITALL);
-    if (ret != sizeof(RTSP_TO_RTP))
-        return -1;
-    switch (message.order) {
+    int left;
+    pid_t child = 0;
+    int slot = -1;
+    unsigned int group = 0;
+    int new_worker = 0;
+
+    switch (message->order) {
         case CHECK_EXISTS_RTP:
             /* Extract path from uri */
-            st = extract_uri(message.uri, &host, &path);
+            st = extract_uri(message->uri, &host, &path);
             if (st &&  host && path) {
                 /* Check if the path exists in the computer */
                 /* Ignore last /audio or /video */
                 path[strlen(path)-6] = 0;
                 st = check_file_exists(path);
-                if (st)
-                    response.order = OK_RTP;
-                else
-                    response.order = ERR_RTP;
             } else {
-                response.order = ERR_RTP;
+                st = 0;
             }
             free(host);
             free(path);
-            ret = send(sockfd, &response, sizeof(RTP_TO_RTSP), 0);
+            rtp_control_error(channel, channel_gen, id, message, st ? OK_RTP : ERR_RTP);
             break;
         case SETUP_RTP_UNICAST:
+        case SETUP_RTP_MULTICAST:
             /* Extract the path */
-            st = extract_uri(message.uri, &host, &path);
+            st = extract_uri(message->uri, &host, &path);
             if (!st || !host || !path) {
-                response.order = ERR_RTP;
-                ret = send(sockfd, &response, sizeof(RTP_TO_RTSP), 0);
-                return(0);
+                rtp_control_error(channel, channel_gen, id, message, ERR_RTP);
+                return;
             }
+            /* The track identifies the media a worker sends */
+            strcpy(track, path);
             /* Check if the file exists */
             /* Ignore last /audio or /video */
             path[strlen(path)-6] = 0;
             st = check_file_exists(path);
-            if (!st) {
-                response.order = ERR_RTP;
-                ret = send(sockfd, &response, sizeof(RTP_TO_RTSP), 0);
-                free(host);
-                free(path);
-                return(0);
-            }
             free(host);
             free(path);
-
-            /* Create worker process */
-            child = fork();
-            if (child == 0) {
-                rtp_worker_fun();
-            } else if (child < 0) {
-                response.order = ERR_RTP;
-                ret = send(sockfd, &response, sizeof(RTP_TO_RTSP), 0);
-                return(0);
+            if (!st) {
+                rtp_control_error(channel, channel_gen, id, message, ERR_RTP);
+                return;
+            }
+            if (engine_threads) {
+                rtp_engine_setup(channel, channel_gen, id, message, track);
+                return;
             }
 
+            /* In broadcast mode the session joins the worker of the track.
+             * Multicast sessions always join the one of the group */
             pthread_mutex_lock(&workers_mutex);
-            /* Check if we can have more workers */
-            if (n_workers == MAX_RTP_WORKERS) {
-                response.order = ERR_RTP;
-                ret = send(sockfd, &response, sizeof(RTP_TO_RTSP), 0);
-                kill(child, SIGKILL);
-                waitpid(child, 0, 0);
-                return(0);
-            }
-            /* Search for a free worker */
-            for (i = 0; i < MAX_RTP_WORKERS; ++i)
-                if (workers[i]->used == 0)
-                    break;
-            /* Intialize RTP_WORKER structure */
-            workers[i]->used = 1;
-            workers[i]->pid = child;
-            /* Create new ssrc */
-            do {
-                workers[i]->ssrc = rand();
-            } while (gethashtable(&workers_hash, &(workers[i]->ssrc)));
-
-            /* Reserve memory for worker */
-            worker = malloc(sizeof(RTP_WORKER));
-            if (!worker) {
-                response.order = ERR_RTP;
-                ret = send(sockfd, &response, sizeof(RTP_TO_RTSP), 0);
-                kill(child, SIGKILL);
-                waitpid(child, 0, 0);
-                return(0);
+            if (broadcast || message->order == SETUP_RTP_MULTICAST) {
+                worker = rtp_registry_find(registry, track, message->order == SETUP_RTP_MULTICAST);
+                if (worker) {
+                    child = worker->pid;
+                    slot = worker->process;
+                    group = worker->group;
+                }
             }
-            /* Initialize worker */
-            worker->pid = child;
-            /* Insert worker in workers hash */
-            ssrc = malloc(sizeof(unsigned int));
-            if (!ssrc) {
-                response.order = ERR_RTP;
-                ret = send(sockfd, &response, sizeof(RTP_TO_RTSP), 0);
-                kill(child, SIGKILL);
-                waitpid(child, 0, 0);
-                return(0);
+            st = n_workers < MAX_RTP_WORKERS;
+            if (!child && st && n_spares) {
+                /* A spare is already waiting with gstreamer loaded */
+                slot = spares[n_spares - 1];
+                rtp_spare_forget(&processes[slot]);
+                child = processes[slot].pid;
+                new_worker = 1;
+                pthread_cond_signal(&spares_cond);
             }
-            *ssrc = workers[i]->ssrc;
-            st = puthashtable(&workers_hash, ssrc, worker);
-            if (st) {
-                response.order = ERR_RTP;
-                ret = send(sockfd, &response, sizeof(RTP_TO_RTSP), 0);
-                kill(child, SIGKILL);
-                waitpid(child, 0, 0);
-                return(0);
+            pthread_mutex_unlock(&workers_mutex);
+            if (!child) {
+                if (!st) {
+                    rtp_control_error(channel, channel_gen, id, message, ERR_RTP);
+                    return;
+                }
+                /* Create worker process */
+                slot = rtp_worker_fork(0);
+                if (slot == -1) {
+                    rtp_control_error(channel, channel_gen, id, message, ERR_RTP);
+                    return;
+                }
+                new_worker = 1;
             }
-            /* Insert the ssrc in the message */
-            message.ssrc = workers[i]->ssrc;
 
+            pthread_mutex_lock(&workers_mutex);
+            /* A new worker that has already ended has released its slot */
+            if (new_worker && !child) {
+                child = processes[slot].pid;
+                if (child <= 0) {
+                    pthread_mutex_unlock(&workers_mutex);
+                    rtp_control_error(channel, channel_gen, id, message, ERR_RTP);
+                    return;
+                }
+            }
+            /* A new multicast worker gets a group for itself */
+            if (new_worker && message->order == SETUP_RTP_MULTICAST) {
+                group = rtp_multicast_get(rtp_multicast, child);
+                if (!group)
+                    goto setup_error;
+            }
+            /* The session gets a new ssrc, written in the message with the group */
+            if (!rtp_worker_use_add(slot, 0, track, group, message))
+                goto setup_error;
+            if (new_worker)
+                ++n_workers;
             pthread_mutex_unlock(&workers_mutex);
 
             /* Fall to default */
         default:
             pthread_mutex_lock(&workers_mutex);
-            /* Get the worker pid from the ssrc we got in the message */
-            worker = gethashtable(&workers_hash, &(message.ssrc));
-            if (!worker) {
-                response.order = ERR_RTP;
-                ret = send(sockfd, &response, sizeof(RTP_TO_RTSP), 0);
-                return(0);
+            /* Get the worker from the ssrc we got in the message */
+            use = rtp_registry_get(registry, message->ssrc);
+            if (!use) {
+                pthread_mutex_unlock(&workers_mutex);
+                rtp_control_error(channel, channel_gen, id, message, ERR_RTP);
+                return;
             }
 
-            /* Create message for worker */
-            msg.mtype = worker->pid;
-            msg.sockfd = sockfd;
-            memcpy(&(msg.message), &message, sizeof(RTSP_TO_RTP));
-            memcpy(&(msg.rtsp_socket), rtsp_socket, sizeof(struct sockaddr_storage));
-
-            /* Send to the message to the worker */
-            st = msgsnd(msg_queue, &msg, sizeof(struct msg_to_worker) - sizeof(long), 0);
-            if (st == -1) {
-                response.order = ERR_RTP;
-                ret = send(sockfd, &response, sizeof(RTP_TO_RTSP), 0);
-                return(0);
+            worker = rtp_registry_worker(registry, use);
+            if (worker->stream) {
+                /* The engine does the order here. The stream is kept
+                 * until it's done, even if it ends meanwhile */
+                stream = worker->stream;
+                __atomic_add_fetch(&stream->refs, 1, __ATOMIC_ACQ_REL);
+                if (message->order == TEARDOWN_RTP)
+                    rtp_registry_del(registry, use);
+                pthread_mutex_unlock(&workers_mutex);
+                order = rtp_stream_order(stream, message, &left);
+                rtp_response_fill(&response, id, message, order, stream->port);
+                rtp_control_reply(channel, channel_gen, &response);
+                /* It ends with its last client */
+                if (order == OK_RTP && !left)
+                    rtp_engine_stream_end(stream, 0);
+                rtp_engine_stream_unref(stream);
+                return;
             }
 
+            /* Create message for worker */
+            order_frame.channel = channel;
+            order_frame.channel_gen = channel_gen;
+            rtp_frame_fill(&order_frame.frame, id, message);
+
+            /* Send the message through the socketpair of the worker. A
+             * worker that doesn't read its orders fails them instead of
+             * stopping the others. Its slot is only its process while
+             * the generation is the same */
+            process = worker->process != -1 ? &processes[worker->process] : 0;
+            st = process && process->gen == worker->process_gen &&
+                rtp_worker_comm_send(process->fd, &order_frame, message->uri, MSG_DONTWAIT);
+            if (st && message->order == TEARDOWN_RTP) {
+                /* The session ends, the worker can go on with others */
+                rtp_registry_del(registry, use);
+            }
             pthread_mutex_unlock(&workers_mutex);
-            /* Now the worker must get the message and communicate with the RTSP server. */
+            if (!st)
+                rtp_control_error(channel, channel_gen, id, message, ERR_RTP);
+            /* Now the worker must do the order and answer through the main process */
             break;
     }
+    return;
+
+setup_error:
+    if (new_worker) {
+        rtp_multicast_release(rtp_multicast, child);
+        /* Waited for with the mutex locked, so it isn't taken for a
+         * worker that has ended. Its slot is released by rtp_process_end
+         * without touching the pid, that can be reused from now on */
+        kill(child, SIGKILL);
+        waitpid(child, 0, 0);
+        processes[slot].reaped = 1;
+    }
+    pthread_mutex_unlock(&workers_mutex);
+    rtp_control_error(channel, channel_gen, id, message, ERR_RTP);
+}
+
+/* Add a session served by a worker process or by a stream of the engine,
+ * with a new ssrc. The mutex must be locked
+ * process: Slot of the worker process, -1 for the engine
+ * message: The ssrc and the group are written in it
+ * return: 1 ok, 0 err
+ */
+int rtp_worker_use_add(int process, RTP_STREAM *stream, const char *track, unsigned int group, RTSP_TO_RTP *message) {
+    RTP_WORKER_USE *use;
+    RTP_WORKER *worker;
+
+    use = rtp_registry_add(registry, process != -1 ? processes[process].pid : 0, stream, track, group);
+    if (!use)
+        return(0);
+    worker = rtp_registry_worker(registry, use);
+    /* The orders of a new worker process go to its slot */
+    if (process != -1 && worker->process == -1) {
+        worker->process = process;
+        worker->process_gen = processes[process].gen;
+    }
+    message->ssrc = use->ssrc;
+    message->group = worker->group;
     return(1);
 }
 
+/* Delete a session. The mutex must be locked */
+void rtp_worker_use_free(unsigned int ssrc) {
+    RTP_WORKER_USE *use;
+
+    use = rtp_registry_get(registry, ssrc);
+    if (use)
+        rtp_registry_del(registry, use);
+}
+
+/* Delete the sessions of a worker process, or of a stream of the engine.
+ * The mutex must be locked */
+void rtp_worker_uses_free(pid_t pid, RTP_STREAM *stream) {
+    rtp_registry_del_worker(registry, pid, stream);
+}
+
+void on_media_frame(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer data) {
+  RTP_STREAM *stream = data;
+  GstClockTime timestamp = GST_BUFFER_TIMESTAMP(buffer);
+  GstClockTime duration = GST_BUFFER_DURATION(buffer);
+
+  /* Waits while the ring is full, so gstreamer goes at the pace of the sender */
+  if (!frame_ring_push(stream->ring, GST_BUFFER_DATA(buffer), GST_BUFFER_SIZE(buffer),
+		       GST_CLOCK_TIME_IS_VALID(timestamp) ? (long long)timestamp : -1,
+		       GST_CLOCK_TIME_IS_VALID(duration) ? (long long)duration : -1,
+		       GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) ? 0 : FRAME_RING_KEY))
+    fprintf(stderr, "Frame of %u bytes dropped\n", GST_BUFFER_SIZE(buffer));
+  /* A thread of the engine sends several streams, it doesn't sleep on the ring */
+  if (stream->engine)
+    rtp_engine_wake(stream->engine);
+}
 char *get_absolute_path(char *path) {
     char *base_dir = 0;
     char *full_dir;
@@ -505,261 +1106,380 @@ int check_file_exists(char *path) {
         return(0);
 }
 
+
+/* Write the response to an order. Multicast sessions get their group */
+void rtp_response_fill(RTP_CHANNEL_FRAME *response, unsigned int id, RTSP_TO_RTP *message,
+        RESPONSE order, unsigned short server_port) {
+    memset(response, 0, sizeof(RTP_CHANNEL_FRAME));
+    response->id = id;
+    response->order = order;
+    response->Session = message->Session;
+    response->ssrc = message->ssrc;
+    response->server_port = server_port;
+    if (message->group) {
+        /* Multicast clients receive from the group */
+        response->server_port = rtp_multicast->port;
+        response->group = message->group;
+        response->ttl = rtp_multicast->ttl;
+    }
+}
+
+/* Answer an order through the main process, that writes it to the
+ * control channel it came from */
+void rtp_worker_respond(RTP_WORKER_FRAME *order, RTSP_TO_RTP *message, RESPONSE response, unsigned short server_port) {
+    RTP_WORKER_FRAME response_frame;
+
+    response_frame.channel = order->channel;
+    response_frame.channel_gen = order->channel_gen;
+    rtp_response_fill(&response_frame.frame, order->frame.id, message, response, server_port);
+    rtp_worker_comm_send(parent_fd, &response_frame, 0, 0);
+}
+
 int rtp_worker_fun() {
-    unsigned short rtp_port;
-    unsigned short rtcp_port;
-    struct msg_to_worker message;
-    struct msgbuf die_message;
+    RTP_STREAM *stream = worker_stream;
+    unsigned short rtp_port = 0;
+    RTP_WORKER_FRAME order_frame;
+    RTSP_TO_RTP message;
+    char uri[MAX_URI_LENGTH];
+    RESPONSE order;
+    int left;
     int st;
-    RTP_TO_RTSP response;
-    char *abs_path = 0, *host = 0, *path = 0, *end_filename;
 
     /* Signal handler para el worker */
     signal(SIGINT, rtp_worker_stop);
 
-    /* Set paused time */
-    gettimeofday(&time_pause, 0);
+    /* No order to answer yet */
+    order_frame.channel = -1;
+    if (!rtp_stream_init(stream)) goto terminate_error;
 
-    /* Abrir cola de mensajes */
-    msg_queue = msgget(MSG_IDENTIFIER/*TODO: Don't hardcode this */, IPC_CREAT /*| IPC_EXCL */| 0700);
-    if (msg_queue == -1) goto terminate_error;
+    /* Everything but the pipeline is ready before the SETUP. A spare
+     * worker waits here until it's given one */
+    rtp_worker_preload();
+    if (!loop) goto terminate_error;
+    /* Bind two consecutive UDP ports */
+    rtp_port = bind_UDP_ports(&stream->rtp_sockfd, &stream->rtcp_sockfd);
+    if (!rtp_port) goto terminate_error;
+    stream->port = rtp_port;
 
-    message.mtype = getpid();
     /* Wait for SETUP message */
-    st = msgrcv(msg_queue, &message, sizeof(struct msg_to_worker) - sizeof(long), getpid(), 0);
-    if (st == -1) goto terminate_error;
+    st = rtp_worker_comm_recv(parent_fd, &order_frame, uri, 0);
+    if (st != 1) goto terminate;
+    rtp_message_fill(&message, &order_frame.frame, uri);
 
+    /* Gstreamer will write the frames in the ring */
+    if (!rtp_stream_open(stream, &message, FRAME_RING_DESCS, FRAME_RING_SIZE)) goto terminate_error;
+
+    /* Initialize gstreamer communication threads, that will send data to the client */
+    st = pthread_create(&gstreamer_comm_thread, 0, gstreamer_comm_thread_fun, stream);
+    if (st) goto terminate_error;
+    gstreamer_comm_created = 1;
+
+    /* Initialize the thread that will run gstreamer */
+    st = pthread_create(&gstreamer_loop_thread, 0, gstreamer_loop_thread_fun, 0);
+    if (st) goto terminate_error;
+    gstreamer_loop_created = 1;
+    /* TODO: Create rtcp thread */
 
-    /* Change the response port to the one indicated in the message */
-    ((struct sockaddr_in*)&(message.rtsp_socket))->sin_port = message.message.response_port;
-    /* Open response socket to RTSP server */
-    rtsp_sockfd = socket(PF_INET, SOCK_STREAM, 0);
-    if (rtsp_sockfd == -1) goto terminate_error;
+    /* Answer the SETUP */
+    rtp_worker_respond(&order_frame, &message, OK_RTP, rtp_port);
 
-    st = connect(rtsp_sockfd, (struct sockaddr *)&(message.rtsp_socket), sizeof(struct sockaddr));
-    if (st == -1) goto terminate_error;
+    for (;;) {
+        /* Wait for message. The main process closes its end when it ends */
+        order_frame.channel = -1;
+        st = rtp_worker_comm_recv(parent_fd, &order_frame, uri, 0);
+        if (st == 0) goto terminate;
+        if (st == -1) continue;
+        rtp_message_fill(&message, &order_frame.frame, uri);
+
+        order = rtp_stream_order(stream, &message, &left);
+        rtp_worker_respond(&order_frame, &message, order, rtp_port);
+        /* The worker ends with its last client */
+        if (order == OK_RTP && !left)
+            goto terminate;
+    }
 
-    /* Bind two consecutive UDP ports */
-    rtp_port =  bind_UDP_ports(&rtp_sockfd, &rtcp_sockfd);
-    if (!rtp_port) goto terminate_error;
-    rtcp_port = rtp_port + 1;
+terminate_error:
+    /* Answer the order that has failed */
+    if (order_frame.channel != -1)
+        rtp_worker_respond(&order_frame, &message, ERR_RTP, rtp_port);
+terminate:
+    free_worker_process();
+    /* The main process sees it end through its pidfd and waits for it */
+    kill(getpid(), SIGKILL);
+}
+
+/* Initialize gstreamer and load the plugins of the pipeline, making an
+ * element of each kind, so a SETUP only has to build it */
+void rtp_worker_preload() {
+    const char *factories[] = {"filesrc", "oggdemux", "queue", "vorbisdec", "vorbisenc",
+        "theoradec", "theoraenc", "oggmux", "fakesink", 0};
+    GstElement *element;
+    int i;
+
+    gst_init(0, 0);
+    loop = g_main_loop_new(NULL, FALSE);
+    for (i = 0; factories[i]; ++i) {
+        element = gst_element_factory_make(factories[i], 0);
+        if (element)
+            gst_object_unref(GST_OBJECT(element));
+    }
+}
 
-    /* NOTE: This isn't really necesary for the server to work */
-    /* Create socket for rtsp */
-/*    rtsp_sockfd = socket(PF_INET, SOCK_STREAM, 0);
-    if (!rtsp_sockfd) goto terminate_error;
-    ((struct sockaddr_in *)&message.rtsp_socket)->sin_port = comm_port;
-    st = connect(rtsp_sockfd, (struct sockaddr *)&message.rtsp_socket, sizeof(message.rtsp_socket));
-    if (st == -1) goto terminate_error; */
+/* Initialize a stream without clients nor pipeline
+ * return: 1 ok, 0 err
+ */
+int rtp_stream_init(RTP_STREAM *stream) {
+    memset(stream, 0, sizeof(RTP_STREAM));
+    stream->play_state = PLAY_STATE_PAUSED;
+    stream->rtp_sockfd = -1;
+    stream->rtcp_sockfd = -1;
+    if (pthread_mutex_init(&stream->mutex, 0))
+        return(0);
+    return(1);
+}
+
+/* Open a stream for the first client of a track: its ring, its pacer and
+ * the pipeline that reads the file, paused. Its sockets must be set
+ * message: SETUP of the client
+ * ring_descs, ring_size: Size of the ring. Powers of two
+ * return: 1 ok, 0 err
+ */
+int rtp_stream_open(RTP_STREAM *stream, RTSP_TO_RTP *message, unsigned int ring_descs, unsigned int ring_size) {
+    char *abs_path = 0, *host = 0, *path = 0, *end_filename;
+    int st;
 
     /* TODO: Set media type */
-    if (strstr(message.message.uri, "audio"))
-        media_type = AUDIO;
+    if (strstr(message->uri, "audio"))
+        stream->media_type = AUDIO;
     else
-        media_type = VIDEO;
-    client_ip = message.message.client_ip;
-    client_port = message.message.client_port;
+        stream->media_type = VIDEO;
+    if (!rtp_subscriber_add(stream, message))
+        return(0);
+    if (message->order == SETUP_RTP_MULTICAST && !rtp_stream_multicast(stream, message->group))
+        return(0);
 
     /* Get the absolute path to the file */
-    st = extract_uri(message.message.uri, &host, &path);
+    st = extract_uri(message->uri, &host, &path);
     free(host);
-    host = 0;
-    if (!st) goto terminate_error;
+    if (!st) {
+        free(path);
+        return(0);
+    }
     abs_path = get_absolute_path(path);
     free(path);
-    path = 0;
-    if (!abs_path) goto terminate_error;
+    if (!abs_path)
+        return(0);
     end_filename = strstr(abs_path, "/audio");
     if (!end_filename)
-      end_filename = strstr(abs_path, "/video");
-    *end_filename = 0;
+        end_filename = strstr(abs_path, "/video");
+    if (end_filename)
+        *end_filename = 0;
 
-    /* Initialize gstreamer */
-    st = gstreamer_fun(abs_path);
+    st = rtp_pacer_init(stream->pacer) && frame_ring_init(stream->ring, ring_descs, ring_size) &&
+        gstreamer_fun(stream, abs_path);
     free(abs_path);
-    abs_path = 0;
-    if (!st) goto terminate_error;
-    /* Set as paused */
-    pthread_mutex_lock(&play_state_mutex);
-
-    /* Initialize the pipe for communication with the sleeper process */
-    st = pipe(sleeper_pipe);
-    if (st == -1) goto terminate_error;
-    /* Initialize the process that will make this process sleep to limit the rate */
-    sleeper_pid = fork();
-    if (sleeper_pid < 0) goto terminate_error;
-    else if (sleeper_pid == 0) sleeper_fun();
+    return(st);
+}
 
-    /* Initialize gstreamer communication threads, that will send data to the client */
-    st = pthread_create(&gstreamer_comm_thread, 0, gstreamer_comm_thread_fun, &message.message.ssrc);
-    if (st) goto terminate_error;
-    gstreamer_comm_created = 1;
+/* Stop the pipeline of a stream. Gstreamer can be waiting for room in the
+ * ring, so it's closed first. The ring and the pacer are kept, the sender
+ * can still be using them */
+void rtp_stream_close(RTP_STREAM *stream) {
+    fprintf(stderr, "Pacing: %lu packets, mean late %lld us, max late %lld us, %lu restarts\n",
+	    stream->pacer->packets, rtp_pacer_mean_late(stream->pacer) / 1000,
+	    stream->pacer->max_late / 1000, stream->pacer->restarts);
+    frame_ring_close(stream->ring);
+    if (stream->pipeline) {
+        gst_element_set_state(stream->pipeline, GST_STATE_NULL);
+        gst_object_unref(GST_OBJECT(stream->pipeline));
+        stream->pipeline = 0;
+    }
+}
 
-    /* Initialize the thread responsible for limiting the speed of gstreamer */
-    st = pthread_create(&gstreamer_limitrate_thread, 0, gstreamer_limitrate_thread_fun, 0);
-    if (st) goto terminate_error;
-    gstreamer_limitrate_created = 1;
+/* Do an order for a client of a stream: another client joins it, or one
+ * plays, pauses or leaves. The media runs while someone is playing it
+ * left: Set to the number of clients of the stream
+ * return: OK_RTP, ERR_RTP if the client isn't found or can't be added
+ */
+RESPONSE rtp_stream_order(RTP_STREAM *stream, RTSP_TO_RTP *message, int *left) {
+    RTP_SUBSCRIBER *subscriber;
+    int start = 0;
+    int stop = 0;
+    int st = 0;
+
+    pthread_mutex_lock(&stream->mutex);
+    switch (message->order) {
+        case SETUP_RTP_UNICAST:
+        case SETUP_RTP_MULTICAST:
+            /* Another client joins the broadcast or the group */
+            fprintf(stderr, "Recibido setup en proceso %d\n", getpid());
+            st = rtp_subscriber_add(stream, message);
+            break;
+        case PLAY_RTP:
+            fprintf(stderr, "Recibido play en proceso %d\n", getpid());
+            subscriber = rtp_subscriber_get(stream, message->ssrc);
+            if (subscriber && subscriber->state != PLAY_STATE_PLAYING) {
+                subscriber->state = PLAY_STATE_PLAYING;
+                subscriber->waiting_key = 1;
+                start = stream->n_playing++ == 0;
+            }
+            if (start) {
+                stream->group_stream->state = PLAY_STATE_PLAYING;
+                stream->group_stream->waiting_key = 1;
+            }
+            st = subscriber != 0;
+            break;
+        case PAUSE_RTP:
+        case TEARDOWN_RTP:
+            if (message->order == PAUSE_RTP)
+                fprintf(stderr, "Recibido pause en proceso %d\n", getpid());
+            else
+                fprintf(stderr, "Recibido teardown en proceso %d\n", getpid());
+            subscriber = rtp_subscriber_get(stream, message->ssrc);
+            if (subscriber && subscriber->state == PLAY_STATE_PLAYING) {
+                subscriber->state = PLAY_STATE_PAUSED;
+                stop = --stream->n_playing == 0;
+            }
+            if (stop)
+                stream->group_stream->state = PLAY_STATE_PAUSED;
+            if (subscriber && message->order == TEARDOWN_RTP)
+                *subscriber = stream->subscribers[--stream->n_subscribers];
+            st = subscriber != 0;
+            break;
+        default:
+            break;
+    }
+    *left = stream->n_subscribers;
+    pthread_mutex_unlock(&stream->mutex);
+    if (!st)
+        return(ERR_RTP);
+
+    if (start) {
+        rtp_stream_set_pipeline(stream, GST_STATE_PLAYING);
+        fprintf(stderr, "Play done\n");
+        /* Set as playing. The time stopped while paused doesn't count */
+        rtp_pacer_restart(stream->pacer);
+        play_state_set(stream, PLAY_STATE_PLAYING);
+    }
+    if (stop) {
+        /* Set as paused. The sender stops before its next read */
+        play_state_set(stream, PLAY_STATE_PAUSED);
+        if (*left)
+            rtp_stream_set_pipeline(stream, GST_STATE_PAUSED);
+    }
+    return(OK_RTP);
+}
 
-    /* Initialize the thread that will run gstreamer */
-    st = pthread_create(&gstreamer_loop_thread, 0, gstreamer_loop_thread_fun, 0);
-    if (st) goto terminate_error;
-    gstreamer_loop_created = 1;
-    /* TODO: Create rtcp thread */
+/* Add a client to a stream, paused, with a random sequence number and
+ * timestamp. The mutex must be locked once the sender is running
+ * return: 1 ok, 0 err
+ */
+int rtp_subscriber_add(RTP_STREAM *stream, RTSP_TO_RTP *message) {
+    RTP_SUBSCRIBER *subscriber;
+    int max;
 
-    /* Prepare response */
-    response.Session = message.message.Session;
-    strcpy(response.uri, message.message.uri); 
-    response.ssrc = message.message.ssrc;
-    response.order = OK_RTP;
-    response.server_port = rtp_port;
-    st = send(rtsp_sockfd, &response, sizeof(RTP_TO_RTSP), 0);
+    if (stream->n_subscribers == MAX_RTP_STREAMS || rtp_subscriber_get(stream, message->ssrc))
+        return(0);
+    if (stream->n_subscribers == stream->max_subscribers) {
+        /* Most streams have a few clients. The array grows with them */
+        max = stream->max_subscribers ? 2 * stream->max_subscribers : RTP_STREAM_SUBSCRIBERS;
+        if (max > MAX_RTP_STREAMS)
+            max = MAX_RTP_STREAMS;
+        subscriber = realloc(stream->subscribers, max * sizeof(RTP_SUBSCRIBER));
+        if (!subscriber)
+            return(0);
+        stream->subscribers = subscriber;
+        stream->max_subscribers = max;
+    }
+    subscriber = &stream->subscribers[stream->n_subscribers];
+    memset(subscriber, 0, sizeof(RTP_SUBSCRIBER));
+    subscriber->ssrc = message->ssrc;
+    subscriber->state = PLAY_STATE_PAUSED;
+    subscriber->seq = rand();
+    subscriber->timestamp_base = rand();
+    subscriber->dest.sin_family = AF_INET;
+    subscriber->dest.sin_port = message->client_port;
+    subscriber->dest.sin_addr.s_addr = message->client_ip;
+    subscriber->dest_rtcp.sin_family = AF_INET;
+    subscriber->dest_rtcp.sin_port = htons(ntohs(message->client_port) + 1);
+    subscriber->dest_rtcp.sin_addr.s_addr = message->client_ip;
+    ++stream->n_subscribers;
+    return(1);
+}
 
-    close(rtsp_sockfd);
-    rtsp_sockfd = -1;
+/* Make a stream send its packets to a multicast group, once for all its
+ * clients
+ * group: Network order
+ * return: 1 ok, 0 err
+ */
+int rtp_stream_multicast(RTP_STREAM *stream, unsigned int group) {
+    RTP_SUBSCRIBER *group_stream = stream->group_stream;
 
-    for (;;) {
-        /* Wait for message */
-        st = msgrcv(msg_queue, &message, sizeof(struct msg_to_worker) - sizeof(long), getpid(), 0);
-        if (st == -1) goto terminate_error;
-
-        /* Change the response port to the one indicated in the message */
-        ((struct sockaddr_in*)&(message.rtsp_socket))->sin_port = message.message.response_port;
-        /* Open response socket to RTSP server */
-        rtsp_sockfd = socket(PF_INET, SOCK_STREAM, 0);
-        if (rtsp_sockfd == -1) goto terminate_error;
-
-        st = connect(rtsp_sockfd, (struct sockaddr *)&message.rtsp_socket, sizeof(struct sockaddr));
-        if (st == -1) goto terminate_error;
-
-        switch (message.message.order) {
-            case PLAY_RTP: {
-	        GstStateChangeReturn st_ret;
-                fprintf(stderr, "Recibido play en proceso %d\n", getpid());
-                /* TODO: Send play command to gstreamer thread */
-                /* TODO: goto error if error */
-		do {
-
-		  GstState state;
-		  GstState pending;
-
-		  fprintf(stderr, "Trying play in process %d\n", getpid());
-		  gst_element_set_state(pipeline, GST_STATE_PLAYING);
-
-		  st_ret = gst_element_get_state(pipeline, &state, &pending, GST_CLOCK_TIME_NONE);
-		  if (st_ret == GST_STATE_CHANGE_SUCCESS)
-		    fprintf(stderr, "Successful play\n");
-		  else if (st_ret == GST_STATE_CHANGE_FAILURE)
-		    fprintf(stderr, "Error in play\n");
-		} while (st_ret == GST_STATE_CHANGE_ASYNC || st_ret == GST_STATE_CHANGE_FAILURE);
-		fprintf(stderr, "Play done\n");
-		/* Set as playing */
-		pthread_mutex_unlock(&play_state_mutex);
-                /* Set play time */
-                gettimeofday(&time_play, 0);
-                response.order = OK_RTP;
-                response.server_port = rtp_port;
-                st = send(rtsp_sockfd, &response, sizeof(RTP_TO_RTSP), 0);
-                break;
-			   }
-            case PAUSE_RTP: {
-	        GstStateChangeReturn st_ret;
-                fprintf(stderr, "Recibido pause en proceso %d\n", getpid());
-                /* TODO: Send pause command to gstreamer thread */
-                /* TODO: goto error if error */
-		/* Set as paused */
-                pthread_mutex_lock(&play_state_mutex);
-		do {
-
-		  GstState state;
-		  GstState pending;
-
-		  fprintf(stderr, "Trying pause in process %d\n", getpid());
-		  gst_element_set_state(pipeline, GST_STATE_PAUSED);
-
-		  st_ret = gst_element_get_state(pipeline, &state, &pending, GST_CLOCK_TIME_NONE);
-		  if (st_ret == GST_STATE_CHANGE_SUCCESS)
-		    fprintf(stderr, "Successful pause\n");
-		  else if (st_ret == GST_STATE_CHANGE_FAILURE)
-		    fprintf(stderr, "Error in pause\n");
-		} while (st_ret == GST_STATE_CHANGE_ASYNC || st_ret == GST_STATE_CHANGE_FAILURE);
-                /* Set pause time */
-                gettimeofday(&time_pause, 0);
-		response.order = OK_RTP;
-                response.server_port = rtp_port;
-                send(rtsp_sockfd, &response, sizeof(RTP_TO_RTSP), 0);
-                break;
-			    }
-	    case TEARDOWN_RTP:
-                /* NOTE: This isn't really necesary for the server to work */
-                /* Send FINISHED_RTP to RTSP server */
-                /*response.order = FINISHED_RTP;
-                response.Session = message.message.Session;
-                strcpy(response.uri, message.message.uri); 
-                response.ssrc = message.message.ssrc;
-                send(rtsp_sockfd, &response, sizeof(response), 0); */
-                /* TODO: goto error if error */
-                fprintf(stderr, "Recibido teardown en proceso %d\n", getpid());
-                response.order = OK_RTP;
-                response.server_port = rtp_port;
-                send(rtsp_sockfd, &response, sizeof(RTP_TO_RTSP), 0);
-                goto terminate;
-                break;
-            default:
-                break;
-        }
-        close(rtsp_sockfd);
-        rtsp_sockfd = -1;
-    }
+    if (!rtp_multicast_socket(stream->rtp_sockfd, rtp_multicast->ttl, multicast_iface) ||
+            !rtp_multicast_socket(stream->rtcp_sockfd, rtp_multicast->ttl, multicast_iface))
+        return(0);
+    memset(group_stream, 0, sizeof(RTP_SUBSCRIBER));
+    group_stream->ssrc = rand();
+    group_stream->state = PLAY_STATE_PAUSED;
+    group_stream->seq = rand();
+    group_stream->timestamp_base = rand();
+    group_stream->dest.sin_family = AF_INET;
+    group_stream->dest.sin_port = htons(rtp_multicast->port);
+    group_stream->dest.sin_addr.s_addr = group;
+    group_stream->dest_rtcp.sin_family = AF_INET;
+    group_stream->dest_rtcp.sin_port = htons(rtp_multicast->port + 1);
+    group_stream->dest_rtcp.sin_addr.s_addr = group;
+    stream->multicast = 1;
+    return(1);
+}
 
-    goto terminate;
-terminate_error:
-    /* Send ERR_RTP to rtsp socket */
-    response.order = ERR_RTP;
-    send(rtsp_sockfd, &response, sizeof(RTP_TO_RTSP), 0);
-terminate:
-    free_worker_process();
-    /* Send die message so this process is waited for */
-    die_message.mtype = getppid();
-    die_message.pid = getpid();
-    msgsnd(msg_queue, &die_message, sizeof(pid_t), 0);
-    kill(getpid(), SIGKILL);
+/* Find a client of a stream. The mutex must be locked
+ * return: Client, 0 if it isn't found
+ */
+RTP_SUBSCRIBER *rtp_subscriber_get(RTP_STREAM *stream, unsigned int ssrc) {
+    int i;
+
+    for (i = 0; i < stream->n_subscribers; ++i)
+        if (stream->subscribers[i].ssrc == ssrc)
+            return(&stream->subscribers[i]);
+    return(0);
+}
+
+/* Change the state of the pipeline and wait until it's done */
+void rtp_stream_set_pipeline(RTP_STREAM *stream, GstState state) {
+    GstStateChangeReturn st_ret;
+    GstState current;
+    GstState pending;
+
+    do {
+	fprintf(stderr, "Trying %s in process %d\n", gst_element_state_get_name(state), getpid());
+	gst_element_set_state(stream->pipeline, state);
+
+	st_ret = gst_element_get_state(stream->pipeline, &current, &pending, GST_CLOCK_TIME_NONE);
+	if (st_ret == GST_STATE_CHANGE_SUCCESS)
+	    fprintf(stderr, "Successful %s\n", gst_element_state_get_name(state));
+	else if (st_ret == GST_STATE_CHANGE_FAILURE)
+	    fprintf(stderr, "Error in %s\n", gst_element_state_get_name(state));
+    } while (st_ret == GST_STATE_CHANGE_ASYNC || st_ret == GST_STATE_CHANGE_FAILURE);
 }
 
 void free_worker_process() {
-    if (sleeper_pid != -1) {
-	kill(sleeper_pid, SIGINT);
-	waitpid(sleeper_pid, 0, 0);
-    }
-    fprintf(stderr, "Killed sleeper process\n");
-    close(media_pipe[0]);
-    close(media_pipe[1]);
-    close(sleeper_pipe[0]);
-    close(sleeper_pipe[1]);
-    fprintf(stderr, "Closed pipes\n");
-    pthread_mutex_unlock(&play_state_mutex);
-    pthread_mutex_destroy(&play_state_mutex);
+    rtp_stream_close(worker_stream);
   /* Close sockets */
-  if (rtp_sockfd != -1)
-    close(rtp_sockfd);
-  if (rtcp_sockfd != -1)
-    close(rtcp_sockfd);
-  if (rtsp_sockfd != -1)
-    close(rtsp_sockfd);
+  if (worker_stream->rtp_sockfd != -1)
+    close(worker_stream->rtp_sockfd);
+  if (worker_stream->rtcp_sockfd != -1)
+    close(worker_stream->rtcp_sockfd);
   fprintf(stderr, "Closed sockets\n");
-  gst_element_set_state(pipeline, GST_STATE_NULL);
-  gst_object_unref(GST_OBJECT(pipeline));
   fprintf(stderr, "RTP WORKER - Terminated\n");
 }
 
-int gstreamer_fun(char *path) {
+int gstreamer_fun(RTP_STREAM *stream, char *path) {
   GstElement * filesrc, * demuxer, * videoqueue, * audioqueue, * videosink, * audiosink;
   GstElement * audioenc, * audiomuxer, * videomuxer, *videoenc;
   GstBus * bus;
-  int st;
-
-  // Inicialización de gstreamer y de gtk
-  gst_init(0, 0);
-  loop = g_main_loop_new(NULL, FALSE);
+  GstElement * mediasink;
+  GstElement * videodec, * audiodec;
 
   // Inicializacion de todos los elementos de gstreamer que intervendran
   // en la reproduccion
@@ -769,24 +1489,20 @@ int gstreamer_fun(char *path) {
   audiodec = gst_element_factory_make("vorbisdec", "audio-decoder");
   audioenc = gst_element_factory_make("vorbisenc",  "audio-encoder");
   audiomuxer = gst_element_factory_make("oggmux",  "audio-muxer");
-  if (media_type == AUDIO)
-    audiosink = gst_element_factory_make("fdsink", "audio-sink");
-  else
-    audiosink = gst_element_factory_make("fakesink", "audio-sink");
+  audiosink = gst_element_factory_make("fakesink", "audio-sink");
   videoqueue = gst_element_factory_make("queue", "video-queue");
   videodec = gst_element_factory_make("theoradec", "video-decoder");
   videoenc = gst_element_factory_make("theoraenc", "video-encoder");
   videomuxer = gst_element_factory_make("oggmux", "video-muxer");
-  if (media_type == VIDEO)
-    videosink = gst_element_factory_make ("fdsink", "video-sink");
-  else
-    videosink = gst_element_factory_make ("fakesink", "video-sink");
+  videosink = gst_element_factory_make ("fakesink", "video-sink");
 
-  pipeline = gst_pipeline_new("media-player");
+  stream->pipeline = gst_pipeline_new("media-player");
+  stream->videodec = videodec;
+  stream->audiodec = audiodec;
 
 
   if(! filesrc || ! demuxer || ! audioqueue || ! audiodec || ! audioenc || ! audiomuxer ||
-     ! audiosink || ! videoqueue || ! videodec || ! videoenc  || !videomuxer || ! videosink || ! pipeline)
+     ! audiosink || ! videoqueue || ! videodec || ! videoenc  || !videomuxer || ! videosink || ! stream->pipeline)
   {
     g_printerr("Error creando elementos gstreamer\n");
     return(0);
@@ -795,19 +1511,22 @@ int gstreamer_fun(char *path) {
   // Se enlazan todos los pipes gstreamer de la misma forma que se
   // haría en la línea de comandos
   g_object_set(G_OBJECT(filesrc), "location", path, NULL);
-  st = pipe(media_pipe);
-  if (st == -1)
-    return(0);
-  if (media_type == AUDIO)
-    g_object_set(G_OBJECT(audiosink), "fd", media_pipe[1], NULL);
-  else
-    g_object_set(G_OBJECT(videosink), "fd", media_pipe[1], NULL);
-
-  bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
-  gst_bus_add_watch(bus, on_pipeline_msg, loop);
+  /* The sink of the media hands each frame over to the ring */
+  mediasink = stream->media_type == AUDIO ? audiosink : videosink;
+  g_object_set(G_OBJECT(mediasink), "signal-handoffs", TRUE, "sync", FALSE, NULL);
+  g_signal_connect(mediasink, "handoff", G_CALLBACK(on_media_frame), stream);
+
+  bus = gst_pipeline_get_bus(GST_PIPELINE(stream->pipeline));
+  if (stream->engine) {
+    /* The watch keeps the stream until it's removed */
+    __atomic_add_fetch(&stream->refs, 1, __ATOMIC_ACQ_REL);
+    stream->watch = gst_bus_add_watch_full(bus, G_PRIORITY_DEFAULT, on_pipeline_msg, stream, rtp_engine_watch_done);
+  } else {
+    gst_bus_add_watch(bus, on_pipeline_msg, stream);
+  }
   gst_object_unref(bus);
 
-  gst_bin_add_many(GST_BIN(pipeline), filesrc, demuxer, videodec, audiodec, audioqueue,
+  gst_bin_add_many(GST_BIN(stream->pipeline), filesrc, demuxer, videodec, audiodec, audioqueue,
 		   videoqueue, audioenc, audiomuxer, videoenc, videomuxer, videosink, audiosink, NULL);
   gst_element_link(filesrc, demuxer);
   gst_element_link(videodec, videoqueue);
@@ -816,15 +1535,16 @@ int gstreamer_fun(char *path) {
   gst_element_link_many(videoqueue, videoenc, videomuxer, videosink, NULL);
   gst_element_link_many(audioqueue, audioenc, audiomuxer, audiosink, NULL);
 
-  g_signal_connect(demuxer, "pad-added", G_CALLBACK(on_pad_added), NULL);
+  g_signal_connect(demuxer, "pad-added", G_CALLBACK(on_pad_added), stream);
 
-  gst_element_set_state(pipeline, GST_STATE_PAUSED);
+  gst_element_set_state(stream->pipeline, GST_STATE_PAUSED);
 
   return(1);
 } 
 
-void on_pad_added(GstElement * element, GstPad * pad)
+void on_pad_added(GstElement * element, GstPad * pad, gpointer data)
 {
+  RTP_STREAM *stream = data;
   GstCaps * caps;
   GstStructure * str;
   GstPad * targetsink = NULL;
@@ -837,12 +1557,12 @@ void on_pad_added(GstElement * element, GstPad * pad)
   /* if the file has video and the media type is video connect it to the pipewriter */
   if(g_strrstr(gst_structure_get_name(str), "video"))
   {
-    targetsink = gst_element_get_pad(videodec, "sink");
+    targetsink = gst_element_get_pad(stream->videodec, "sink");
   }
   /* if the file has audio and the media type is audio connect it to the pipewriter */
   else if(g_strrstr(gst_structure_get_name (str), "audio"))
   {
-    targetsink = gst_element_get_pad(audiodec, "sink");
+    targetsink = gst_element_get_pad(stream->audiodec, "sink");
   }
 
   if (targetsink != 0) {
@@ -852,8 +1572,9 @@ void on_pad_added(GstElement * element, GstPad * pad)
     gst_caps_unref(caps);
 }
 
-gboolean on_pipeline_msg(GstBus * bus, GstMessage * msg, gpointer loop)
+gboolean on_pipeline_msg(GstBus * bus, GstMessage * msg, gpointer data)
 {
+  RTP_STREAM *stream = data;
   gchar  * debug;
   GError * error;;
 
@@ -862,6 +1583,11 @@ gboolean on_pipeline_msg(GstBus * bus, GstMessage * msg, gpointer loop)
     // Mensaje de finalización del stream
     case GST_MESSAGE_EOS:
       fprintf(stderr, "End of stream\n");
+      if (stream->engine) {
+        /* Only this stream ends in the engine. Its watch goes with it */
+        rtp_engine_stream_end(stream, 1);
+        return FALSE;
+      }
       kill(getpid(), SIGUSR1);
       break;
 
@@ -873,6 +1599,10 @@ gboolean on_pipeline_msg(GstBus * bus, GstMessage * msg, gpointer loop)
       g_printerr("Error: %s\n", error->message);
       g_error_free(error);
 
+      if (stream->engine) {
+        rtp_engine_stream_end(stream, 1);
+        return FALSE;
+      }
       kill(getpid(), SIGUSR1);
       break;
 
@@ -893,153 +1623,444 @@ gboolean on_pipeline_msg(GstBus * bus, GstMessage * msg, gpointer loop)
   return TRUE;
 }
 
+
 void *gstreamer_loop_thread_fun(void *arg) {
-    close(media_pipe[0]);
     g_main_loop_run(loop);
-    kill(getpid(), SIGUSR1);
+    /* The engine runs the loop of all its streams, a worker only its own */
+    if (!engine_threads)
+        kill(getpid(), SIGUSR1);
+    return(0);
 }
 
-void *gstreamer_comm_thread_fun(void *ssrc) {
-    char rtp_buffer[RTP_BUFFER_SIZE];
-    RTP_PKG rtp_package;
-    char rtp_packet[RTP_BUFFER_SIZE + 100];
-    struct sockaddr_in dest;
-    struct sockaddr_in dest_rtcp;
-    int readed;
-    int ret;
-    int packet_size;
+void play_state_set(RTP_STREAM *stream, int state) {
+    __atomic_store_n(&stream->play_state, state, __ATOMIC_RELEASE);
+    if (stream->engine)
+        rtp_engine_wake(stream->engine);
+    else
+        syscall(SYS_futex, &stream->play_state, FUTEX_WAKE_PRIVATE, INT_MAX, 0, 0, 0);
+}
+void play_state_wait(RTP_STREAM *stream, int state) {
+    /* The futex returns at once if the state has already changed */
+    while (__atomic_load_n(&stream->play_state, __ATOMIC_ACQUIRE) == state)
+        syscall(SYS_futex, &stream->play_state, FUTEX_WAIT_PRIVATE, state, 0, 0, 0);
+}
+
+/* Prepare the sender of a UDP socket. With txtime_ahead the packets are
+ * handed over with SO_TXTIME, if the kernel supports it
+ * return: Nanoseconds the packets are handed over before they are due
+ */
+long long rtp_worker_sender(RTP_SENDER *sender, int fd) {
+    rtp_sender_init(sender, fd, send_batch, send_delay);
+    if (!txtime_ahead)
+        return(0);
+    if (!rtp_sender_txtime(sender)) {
+        fprintf(stderr, "SO_TXTIME not supported, pacing without it\n");
+        return(0);
+    }
+    /* The kernel keeps the packets, so they can wait more for the batch */
+    if (sender->max_delay < txtime_ahead * 500)
+        sender->max_delay = txtime_ahead * 500;
+    return(txtime_ahead * 1000000LL);
+}
+
+/* Get the media time of the next packet of a stream. The data of a frame
+ * is spread along its duration. Frames without time go with the previous one
+ * return: Nanoseconds
+ */
+long long rtp_stream_media_time(RTP_STREAM *stream, FRAME_DESC *frame) {
+    if (frame->media_time >= 0) {
+        stream->media_time = frame->media_time;
+        if (frame->duration > 0)
+            stream->media_time += frame->duration * stream->pos / frame->size;
+    }
+    return(stream->media_time);
+}
+
+/* Queue the next packet of a stream for its clients, once it's due. Small
+ * frames already in the ring go together, big ones in fragments
+ * frame: Next frame of the ring
+ * ahead: Nanoseconds the packet is handed over before it's due, 0 without SO_TXTIME
+ */
+void rtp_stream_send(RTP_STREAM *stream, RTP_SENDER *sender, FRAME_DESC *frame, long long ahead) {
+    RTP_HEADER header[1];
+    RTP_SUBSCRIBER *subscriber;
+    struct iovec iov[2];
+    int n_iov;
+    unsigned char *buf;
+    /* Payload header and, for whole frames, their data */
+    unsigned char payload[RTP_SENDER_PACKET];
+    int payload_len;
+    int d_size;
+    RTP_AGGREGATE aggregate[1];
+    int type;
+    int key;
     struct timeval current_time;
     unsigned int elapsed_ms;
-    unsigned int packet_count = 1;
-    unsigned int octet_count = 0;
     char *rtcp_packet;
-    unsigned int last_rtcp_packet = 0;
-
-    rtp_package.d_size = RTP_BUFFER_SIZE;
-    rtp_package.data = rtp_buffer;
-    rtp_package.header->seq = 1;
-    rtp_package.header->ssrc = *((unsigned int *)ssrc);
-    close(media_pipe[1]);
-
-    /* Information of the client */
-    dest.sin_family = AF_INET;
-    dest.sin_port = client_port;
-    dest.sin_addr.s_addr = client_ip;
-    bzero(dest.sin_zero, 8);
-
-    dest_rtcp.sin_family = AF_INET;
-    dest_rtcp.sin_port = htons(ntohs(client_port) + 1);
-    dest_rtcp.sin_addr.s_addr = client_ip;
-    bzero(dest_rtcp.sin_zero, 8);
-
-    /* Initialize last time sent */
-    gettimeofday(&last_time_sent, 0);
-    elapsed_ms = 0;
-    for (;;) {
-        readed = 0;
-        do {
-	  pthread_mutex_lock(&play_state_mutex);
-	    ret = read(media_pipe[0], rtp_buffer + readed, RTP_BUFFER_SIZE - readed);
-	    if (ret > 0)
-	      readed += ret;
-	  pthread_mutex_unlock(&play_state_mutex);
-        } while (readed != RTP_BUFFER_SIZE);
-        ++rtp_package.header->seq;
-	++packet_count;
-	octet_count += readed;
-        /* Insert timestamp */
-
-        gettimeofday(&current_time, 0);
-        /* Check if the media was paused */
-        if (last_time_sent.tv_sec < time_pause.tv_sec ||
-            last_time_sent.tv_sec == time_pause.tv_sec && last_time_sent.tv_usec < time_pause.tv_usec)
-            /* Get current time */
-            /* Only measure time when the pipeline was generating content */
-            elapsed_ms +=
-              ((time_pause.tv_sec*1000 + time_pause.tv_usec/1000) -
-               (last_time_sent.tv_sec*1000 + last_time_sent.tv_usec/1000)) + /* time from last sent to paused */
-              ((current_time.tv_sec * 1000 + current_time.tv_usec/1000) -
-               (time_play.tv_sec*1000 + time_play.tv_usec/1000)); /* time from play to current time */
-        else 
-            elapsed_ms +=
-              (current_time.tv_sec * 1000 + current_time.tv_usec/1000) -
-              (last_time_sent.tv_sec * 1000 + last_time_sent.tv_usec/1000);
-
-        rtp_package.header->timestamp = elapsed_ms;
-        ++rtp_package.header->seq;
-
-        packet_size = pack_rtp(&rtp_package, rtp_packet, RTP_BUFFER_SIZE + 100);
-        sendto(rtp_sockfd, rtp_packet, packet_size, 0, (struct sockaddr *)&dest, sizeof(struct sockaddr_in));
-
-	/* Send rtcp SR packet as 2% of the connection (every 10976 bytes of rtp) */
-	if (octet_count % 10976 > last_rtcp_packet) {
-	    ++last_rtcp_packet;
-	    rtcp_packet = pack_rtcp_sr(rtp_package.header->ssrc, current_time,
-		elapsed_ms, packet_count, octet_count);
-	    sendto(rtcp_sockfd, rtcp_packet, 32*7, 0, (struct sockaddr *)&dest_rtcp, sizeof(struct sockaddr_in));
-	    free(rtcp_packet);
-
-	}
+    int n;
+    int i;
 
+    elapsed_ms = stream->media_time / 1000000;
+    gettimeofday(&current_time, 0);
+
+    /* Clients that have just started wait for a packet they can decode */
+    key = stream->pos == 0 && (frame->flags & FRAME_RING_KEY);
+    if (stream->pos == 0 && !rtp_payloader_must_fragment(rtp_payloader, frame->size)) {
+        /* Small frames are copied together, as many as are already in
+         * the ring and fit */
+        rtp_aggregate_start(aggregate, payload);
+        while (frame && !rtp_payloader_must_fragment(rtp_payloader, frame->size) &&
+                rtp_aggregate_add(rtp_payloader, aggregate, frame->data, frame->size)) {
+            frame_ring_consume(stream->ring);
+            frame = frame_ring_peek(stream->ring);
+        }
+        payload_len = d_size = rtp_aggregate_finish(aggregate);
+        header->marker = 1;
+        n_iov = 1;
+    } else {
+        /* Big frames are sent in fragments that reference the ring.
+         * The last one is marked */
+        d_size = rtp_payloader_fragment(rtp_payloader, frame->size, stream->pos, &type);
+        header->marker = type == RTP_FRAGMENT_END;
+        payload_len = rtp_payloader_fragment_header(payload, type, d_size);
+        iov[1].iov_base = frame->data + stream->pos;
+        iov[1].iov_len = d_size;
+        n_iov = 2;
+        stream->pos += d_size;
+        if (stream->pos == frame->size) {
+            /* It's released when the packets that reference it have been sent */
+            frame_ring_consume(stream->ring);
+            stream->pos = 0;
+        }
     }
+
+    /* Each client gets the packet with its own header, or the group
+     * gets it once. Only the headers and the small payloads are
+     * written in the batch */
+    pthread_mutex_lock(&stream->mutex);
+    n = stream->multicast ? 1 : stream->n_subscribers;
+    for (i = 0; i < n; ++i) {
+        subscriber = stream->multicast ? stream->group_stream : &stream->subscribers[i];
+        if (subscriber->state != PLAY_STATE_PLAYING || (subscriber->waiting_key && !key))
+            continue;
+        subscriber->waiting_key = 0;
+        header->ssrc = subscriber->ssrc;
+        header->seq = ++subscriber->seq;
+        header->timestamp = subscriber->timestamp_base + elapsed_ms;
+        ++subscriber->packet_count;
+        subscriber->octet_count += d_size;
+
+        buf = (unsigned char *)rtp_sender_buffer(sender);
+        pack_rtp_header(header, buf);
+        memcpy(buf + RTP_MIN_SIZE, payload, payload_len);
+        iov[0].iov_base = buf;
+        iov[0].iov_len = RTP_MIN_SIZE + payload_len;
+        rtp_sender_queue_iov(sender, iov, n_iov, &subscriber->dest,
+            ahead ? rtp_pacer_txtime(stream->pacer, stream->media_time) : 0);
+
+        /* Send rtcp SR packet as 2% of the connection (every 10976 bytes of rtp) */
+        if (subscriber->octet_count % 10976 > subscriber->last_rtcp_packet) {
+            ++subscriber->last_rtcp_packet;
+            /* The report must not get ahead of the packets it counts */
+            rtp_sender_flush(sender);
+            rtcp_packet = pack_rtcp_sr(subscriber->ssrc, current_time, header->timestamp,
+                subscriber->packet_count, subscriber->octet_count);
+            sendto(stream->rtcp_sockfd, rtcp_packet, 32*7, 0, (struct sockaddr *)&subscriber->dest_rtcp, sizeof(struct sockaddr_in));
+            free(rtcp_packet);
+        }
+    }
+    pthread_mutex_unlock(&stream->mutex);
 }
 
-void *gstreamer_limitrate_thread_fun(void *arg) {
-    GstFormat fmt = GST_FORMAT_TIME;
-    gint64 pos;
-    gint64 len;
-    gint64 last_played = 0;
-    gint64 sleep_time;
-    struct timespec sleep_nano;
-    close(sleeper_pipe[0]);
-    pid_t mypid = getpid();
+/* Send the stream of a worker process, sleeping until each packet is due */
+void *gstreamer_comm_thread_fun(void *arg) {
+    RTP_STREAM *stream = arg;
+    FRAME_DESC *frame;
+    long long media_time;
+    long long ahead;
+    long timeout;
+    int st;
+
+    ahead = rtp_worker_sender(rtp_sender, stream->rtp_sockfd);
+    rtp_payloader_init(rtp_payloader, max_packet);
+
     for (;;) {
-	/* Sleep for the burst time */
-        sleep_nano.tv_sec = 0;
-	sleep_nano.tv_nsec = RTP_BURST_TIME;
-	nanosleep(&sleep_nano, 0);
-        pthread_mutex_lock(&play_state_mutex);
-	/* Get current position in the stream in nanoseconds */
-	gst_element_query_position(pipeline, &fmt, &pos);
-	gst_element_query_duration(pipeline, &fmt, &len);
-	//gst_element_set_state(pipeline, GST_STATE_PAUSED);
-	if (media_type == AUDIO)
-	  fprintf(stderr, "audio position %Lu : %Lu\n", pos, len);
-	else
-	  fprintf(stderr, "video position %Lu : %Lu\n", pos, len);
-	/* Get the sleep time in nanoseconds */
-	sleep_time = pos - last_played - RTP_BURST_TIME;
-	if (sleep_time < 0) sleep_time = 0;
-	sleep_nano.tv_sec = sleep_time / 1000000000;
-	sleep_nano.tv_nsec = sleep_time % 1000000000;
-
-	/* Send a message to the sleeper process so he can wake up this process */
-	if (sleep_time) {
-	  write(sleeper_pipe[1], &sleep_nano, sizeof(struct timespec));
-	  /* Stop self */
-	  kill(mypid, SIGSTOP);
-	}
-
-	last_played = pos;
-
-          //gst_element_set_state(pipeline, GST_STATE_PLAYING);
-        pthread_mutex_unlock(&play_state_mutex);
-  }
+        /* Don't keep the queued packets more than allowed waiting for a frame.
+         * Once they are sent, their frames can be reused. A frame being
+         * fragmented stays in the ring until its last packet */
+        while (!(frame = frame_ring_peek(stream->ring))) {
+            if (!rtp_sender->n)
+                frame_ring_release(stream->ring);
+            st = frame_ring_wait(stream->ring, rtp_sender_timeout(rtp_sender));
+            if (st == -1)
+                return(0);
+            if (st == 0) {
+                rtp_sender_flush(rtp_sender);
+                frame_ring_release(stream->ring);
+            }
+        }
+
+        if (__atomic_load_n(&stream->play_state, __ATOMIC_ACQUIRE) != PLAY_STATE_PLAYING) {
+            /* Nothing more will be sent until play */
+            rtp_sender_flush(rtp_sender);
+            frame_ring_release(stream->ring);
+            play_state_wait(stream, PLAY_STATE_PAUSED);
+        }
+
+        /* Send the batch now if it can't wait until the packet is due.
+         * With SO_TXTIME the packet is handed over ahead of time */
+        media_time = rtp_stream_media_time(stream, frame);
+        timeout = rtp_sender_timeout(rtp_sender);
+        if (timeout != -1 && rtp_pacer_delay(stream->pacer, media_time - ahead) > timeout) {
+            rtp_sender_flush(rtp_sender);
+            frame_ring_release(stream->ring);
+        }
+        rtp_pacer_wait(stream->pacer, media_time - ahead);
+        rtp_stream_send(stream, rtp_sender, frame, ahead);
+    }
 }
 
-void sleeper_stop(int signal) {
-    close(sleeper_pipe[0]);
-    exit(0);
+/* Start the engine: gstreamer and its loop, once for all the streams, and
+ * the threads that send them, each one from its own pair of ports
+ * return: 1 ok, 0 err
+ */
+int rtp_engine_init(int n_threads) {
+    RTP_ENGINE *engine;
+    int i;
+
+    gst_init(0, 0);
+    loop = g_main_loop_new(NULL, FALSE);
+    engines = calloc(n_threads, sizeof(RTP_ENGINE));
+    if (!loop || !engines)
+        return(0);
+    rtp_payloader_init(rtp_payloader, max_packet);
+    for (i = 0; i < n_threads; ++i) {
+        engine = &engines[i];
+        engine->port = bind_UDP_ports(&engine->rtp_sockfd, &engine->rtcp_sockfd);
+        if (!engine->port || pthread_mutex_init(&engine->mutex, 0))
+            return(0);
+        engine->ahead = rtp_worker_sender(engine->sender, engine->rtp_sockfd);
+        if (pthread_create(&engine->thread, 0, rtp_engine_fun, engine))
+            return(0);
+    }
+    if (pthread_create(&gstreamer_loop_thread, 0, gstreamer_loop_thread_fun, 0))
+        return(0);
+    gstreamer_loop_created = 1;
+    return(1);
 }
 
-void sleeper_fun() {
-    pid_t sleeper = getppid();
-    struct timespec sleep_nano;
-    signal(SIGINT, sleeper_stop);
-    close(sleeper_pipe[1]);
+/* Wake up a thread of the engine: a frame has arrived or a stream has
+ * started. The futex is only called if it's sleeping */
+void rtp_engine_wake(RTP_ENGINE *engine) {
+    __atomic_add_fetch(&engine->wake, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&engine->sleeping, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, &engine->wake, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+}
+
+/* Sleep until the thread is woken up after wake was read, or the time is over
+ * timeout: Microseconds, -1 without limit
+ */
+void rtp_engine_sleep(RTP_ENGINE *engine, int wake, long timeout) {
+    struct timespec ts;
+
+    ts.tv_sec = timeout / 1000000;
+    ts.tv_nsec = (timeout % 1000000) * 1000;
+    __atomic_store_n(&engine->sleeping, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &engine->wake, FUTEX_WAIT_PRIVATE, wake, timeout == -1 ? 0 : &ts, 0, 0);
+    __atomic_store_n(&engine->sleeping, 0, __ATOMIC_SEQ_CST);
+}
+
+/* Send the streams of a thread of the engine. Every turn queues a packet of
+ * each stream that has one due. Then the thread sleeps until the next one
+ * is due, a frame arrives or the batch can't wait more */
+void *rtp_engine_fun(void *arg) {
+    RTP_ENGINE *engine = arg;
+    RTP_STREAM *stream;
+    FRAME_DESC *frame;
+    long long media_time;
+    long timeout;
+    long delay;
+    int wake;
+    int sent;
+
     for (;;) {
-	read(sleeper_pipe[0], &sleep_nano, sizeof(struct timespec));
-	nanosleep(&sleep_nano, 0);
-	kill(sleeper, SIGCONT);
+        /* A wake up after this isn't lost, the futex sees the change */
+        wake = __atomic_load_n(&engine->wake, __ATOMIC_SEQ_CST);
+        timeout = -1;
+        sent = 0;
+        pthread_mutex_lock(&engine->mutex);
+        for (stream = engine->streams; stream; stream = stream->next) {
+            if (__atomic_load_n(&stream->play_state, __ATOMIC_ACQUIRE) != PLAY_STATE_PLAYING)
+                continue;
+            frame = frame_ring_peek(stream->ring);
+            if (!frame)
+                continue;
+            media_time = rtp_stream_media_time(stream, frame) - engine->ahead;
+            delay = rtp_pacer_delay(stream->pacer, media_time);
+            if (delay) {
+                if (timeout == -1 || delay < timeout)
+                    timeout = delay;
+                continue;
+            }
+            /* It's already due, the pacer only measures how late */
+            rtp_pacer_wait(stream->pacer, media_time);
+            rtp_stream_send(stream, engine->sender, frame, engine->ahead);
+            sent = 1;
+        }
+
+        /* The batch doesn't wait more than allowed. Once it's sent, the
+         * frames of all the streams can be reused */
+        delay = rtp_sender_timeout(engine->sender);
+        if (delay == 0)
+            rtp_sender_flush(engine->sender);
+        else if (delay != -1 && (timeout == -1 || delay < timeout))
+            timeout = delay;
+        if (!engine->sender->n)
+            for (stream = engine->streams; stream; stream = stream->next)
+                frame_ring_release(stream->ring);
+        pthread_mutex_unlock(&engine->mutex);
+
+        if (!sent)
+            rtp_engine_sleep(engine, wake, timeout);
+    }
+    return(0);
+}
+
+/* Do a SETUP in the engine and answer it at once. The session joins the
+ * stream of its track if it can. Otherwise a stream is opened in the
+ * thread with fewer streams */
+void rtp_engine_setup(int channel, unsigned int channel_gen, unsigned int id, RTSP_TO_RTP *message, const char *track) {
+    RTP_CHANNEL_FRAME response;
+    RTP_WORKER *worker;
+    RTP_STREAM *stream = 0;
+    RTP_ENGINE *engine;
+    int is_multicast = message->order == SETUP_RTP_MULTICAST;
+    unsigned int group = 0;
+    RESPONSE order = ERR_RTP;
+    int left;
+    int st = 0;
+    int i;
+
+    /* The stream is kept until the order is done */
+    pthread_mutex_lock(&workers_mutex);
+    if (broadcast || is_multicast) {
+        worker = rtp_registry_find(registry, track, is_multicast);
+        if (worker) {
+            stream = worker->stream;
+            __atomic_add_fetch(&stream->refs, 1, __ATOMIC_ACQ_REL);
+            st = rtp_worker_use_add(-1, stream, track, worker->group, message);
+        }
+    }
+    pthread_mutex_unlock(&workers_mutex);
+
+    if (stream) {
+        if (st)
+            order = rtp_stream_order(stream, message, &left);
+        if (st && order != OK_RTP) {
+            pthread_mutex_lock(&workers_mutex);
+            rtp_worker_use_free(message->ssrc);
+            pthread_mutex_unlock(&workers_mutex);
+        }
+        rtp_response_fill(&response, id, message, order, stream->port);
+        rtp_control_reply(channel, channel_gen, &response);
+        rtp_engine_stream_unref(stream);
+        return;
     }
+
+    stream = malloc(sizeof(RTP_STREAM));
+    if (!stream || !rtp_stream_init(stream)) {
+        free(stream);
+        rtp_control_error(channel, channel_gen, id, message, ERR_RTP);
+        return;
+    }
+    /* It's sent from the ports of its thread */
+    engine = &engines[0];
+    for (i = 1; i < engine_threads; ++i)
+        if (engines[i].n_streams < engine->n_streams)
+            engine = &engines[i];
+    stream->engine = engine;
+    stream->rtp_sockfd = engine->rtp_sockfd;
+    stream->rtcp_sockfd = engine->rtcp_sockfd;
+    stream->port = engine->port;
+    /* Kept by its sessions and by this order */
+    stream->refs = 2;
+
+    pthread_mutex_lock(&workers_mutex);
+    stream->id = ++engine_stream_ids;
+    /* A multicast stream gets a group for itself */
+    st = !is_multicast || (group = rtp_multicast_get(rtp_multicast, stream->id));
+    if (st)
+        st = rtp_worker_use_add(-1, stream, track, group, message);
+    pthread_mutex_unlock(&workers_mutex);
+    if (st)
+        st = rtp_stream_open(stream, message, RTP_ENGINE_RING_DESCS, RTP_ENGINE_RING_SIZE);
+    if (st) {
+        /* Its thread starts sending it, unless the pipeline has already failed */
+        pthread_mutex_lock(&workers_mutex);
+        st = !stream->ended;
+        if (st) {
+            pthread_mutex_lock(&engine->mutex);
+            stream->next = engine->streams;
+            engine->streams = stream;
+            ++engine->n_streams;
+            pthread_mutex_unlock(&engine->mutex);
+        }
+        pthread_mutex_unlock(&workers_mutex);
+    }
+
+    rtp_response_fill(&response, id, message, st ? OK_RTP : ERR_RTP, stream->port);
+    rtp_control_reply(channel, channel_gen, &response);
+    if (!st)
+        rtp_engine_stream_end(stream, 0);
+    rtp_engine_stream_unref(stream);
+}
+
+/* End a stream of the engine. Its sessions are deleted and its thread
+ * stops sending it. It's freed when the orders using it are done
+ * from_bus: 1 from the bus watch, that is removed when it returns
+ */
+void rtp_engine_stream_end(RTP_STREAM *stream, int from_bus) {
+    RTP_ENGINE *engine = stream->engine;
+    RTP_STREAM **ptr;
+
+    pthread_mutex_lock(&workers_mutex);
+    if (stream->ended) {
+        pthread_mutex_unlock(&workers_mutex);
+        return;
+    }
+    stream->ended = 1;
+    rtp_worker_uses_free(0, stream);
+    rtp_multicast_release(rtp_multicast, stream->id);
+    pthread_mutex_unlock(&workers_mutex);
+
+    /* The batch can have packets that reference its ring */
+    pthread_mutex_lock(&engine->mutex);
+    for (ptr = &engine->streams; *ptr && *ptr != stream; ptr = &(*ptr)->next);
+    if (*ptr) {
+        *ptr = stream->next;
+        --engine->n_streams;
+    }
+    rtp_sender_flush(engine->sender);
+    pthread_mutex_unlock(&engine->mutex);
+
+    if (!from_bus && stream->watch)
+        g_source_remove(stream->watch);
+    rtp_engine_stream_unref(stream);
+}
+
+/* Release a stream of the engine, that is freed with its last user */
+void rtp_engine_stream_unref(RTP_STREAM *stream) {
+    if (__atomic_sub_fetch(&stream->refs, 1, __ATOMIC_ACQ_REL))
+        return;
+    rtp_stream_close(stream);
+    frame_ring_free(stream->ring);
+    rtp_pacer_free(stream->pacer);
+    pthread_mutex_destroy(&stream->mutex);
+    free(stream->subscribers);
+    free(stream);
+}
+
+/* The bus watch of a stream of the engine has been removed */
+void rtp_engine_watch_done(gpointer data) {
+    rtp_engine_stream_unref(data);
 }
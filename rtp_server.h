@@ -10,18 +10,62 @@ THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGA
 
 #include <unistd.h>
 #include <pthread.h>
+#include <netinet/in.h>
+#include "servers_comm.h"
 
 #define MAX_RTP_WORKERS 50 /* Number of processes listening for rtsp connections */
+#define MAX_RTP_STREAMS 32768 /* Sessions served by the workers. In broadcast mode several share a worker */
+#define RTP_DEFAULT_MIN_SPARES 2 /* Below this many spare workers more are forked */
+#define RTP_DEFAULT_MAX_SPARES 4 /* Spare workers forked each time */
+#define MAX_RTP_PROCESSES (2 * MAX_RTP_WORKERS) /* Workers and spares */
 #define MAX_IDLE_TIME 60 /* Number of seconds a worker can be idle before is killed */
+#define MAX_RTP_CONTROLS 64 /* Control channels open with RTSP servers */
+#define RTP_MAX_TXTIME_AHEAD 5000 /* Milliseconds. The fq qdisc drops packets due much later */
+#define MAX_RTP_ENGINE_THREADS 64 /* Sender threads of the in-process engine */
+#define RTP_ENGINE_RING_DESCS 256 /* Frames in the ring of a stream of the engine */
+#define RTP_ENGINE_RING_SIZE (512 << 10) /* Bytes of the ring of a stream of the engine */
+#define RTP_STREAM_SUBSCRIBERS 4 /* Clients a stream has room for at first. It grows with them */
 
+/* States of the media of a worker */
+#define PLAY_STATE_PAUSED 0
+#define PLAY_STATE_PLAYING 1
+
+/* Track sent by the engine. It's defined with the gstreamer types */
+typedef struct RTP_STREAM RTP_STREAM;
+
+/* Client the media of a worker is sent to, with its own RTP stream */
+typedef struct {
+    unsigned int ssrc;
+    int state; /* PLAY_STATE_PAUSED or PLAY_STATE_PLAYING */
+    int waiting_key; /* 1 until the first frame that can be decoded alone */
+    unsigned short seq;
+    unsigned int timestamp_base; /* Random, added to the media time */
+    struct sockaddr_in dest;
+    struct sockaddr_in dest_rtcp;
+    unsigned int packet_count;
+    unsigned int octet_count;
+    unsigned int last_rtcp_packet;
+} RTP_SUBSCRIBER;
+
+/* Worker process, or spare, and how the main process talks to it. The
+ * generation changes every time the slot is released, so late events of
+ * its descriptors are ignored */
 typedef struct {
-    pid_t pid;
-} RTP_WORKER;
+    pid_t pid; /* 0 if the slot is free, -1 while it's being forked */
+    int fd; /* End of the socketpair of the main process */
+    int pidfd; /* Readable when it ends. -1 without pidfd, then the end of fd tells it */
+    int reaped; /* Waited for by a failed SETUP. Its pid can belong to another process */
+    int spare; /* Position in the spares, -1 if it isn't one */
+    int next_free; /* Next free slot */
+    unsigned int gen;
+} RTP_PROCESS;
 
+/* Control channel with an RTSP server. The generation changes every time
+ * the slot is released, so late responses don't go to a new connection */
 typedef struct {
     int used;
-    pid_t pid;
-    unsigned int ssrc;
-} RTP_WORKER_USE;
+    int fd;
+    unsigned int gen;
+} RTP_CONTROL;
 
 #endif
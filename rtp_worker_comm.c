@@ -0,0 +1,77 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include "rtp_worker_comm.h"
+
+int rtp_worker_comm_pair(int fds[2]) {
+    /* Each end is inherited only by the process it is for */
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds))
+        return(0);
+    return(1);
+}
+
+int rtp_worker_comm_send(int fd, RTP_WORKER_FRAME *frame, const char *uri, int flags) {
+    struct iovec iov[2];
+    struct msghdr msg;
+    int len;
+    int ret;
+
+    if (frame->frame.uri_len >= MAX_URI_LENGTH)
+        return(0);
+    iov[0].iov_base = frame;
+    iov[0].iov_len = sizeof(RTP_WORKER_FRAME);
+    iov[1].iov_base = (char *)uri;
+    iov[1].iov_len = frame->frame.uri_len;
+    len = sizeof(RTP_WORKER_FRAME) + frame->frame.uri_len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = frame->frame.uri_len ? 2 : 1;
+    do {
+        ret = sendmsg(fd, &msg, flags | MSG_NOSIGNAL);
+    } while (ret == -1 && errno == EINTR);
+    return(ret == len);
+}
+
+int rtp_worker_comm_recv(int fd, RTP_WORKER_FRAME *frame, char *uri, int flags) {
+    struct iovec iov[2];
+    struct msghdr msg;
+    int ret;
+
+    iov[0].iov_base = frame;
+    iov[0].iov_len = sizeof(RTP_WORKER_FRAME);
+    iov[1].iov_base = uri;
+    iov[1].iov_len = MAX_URI_LENGTH - 1;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    do {
+        ret = recvmsg(fd, &msg, flags);
+    } while (ret == -1 && errno == EINTR);
+    if (ret <= 0)
+        return(ret);
+    /* A frame cut or with another size isn't from the other end */
+    if ((msg.msg_flags & MSG_TRUNC) || ret < (int)sizeof(RTP_WORKER_FRAME) ||
+            ret != (int)sizeof(RTP_WORKER_FRAME) + frame->frame.uri_len)
+        return(-1);
+    uri[frame->frame.uri_len] = 0;
+    return(1);
+}
+
+int rtp_worker_comm_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return(syscall(SYS_pidfd_open, pid, 0));
+#else
+    return(-1);
+#endif
+}
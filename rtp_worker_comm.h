@@ -0,0 +1,48 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#ifndef _RTP_WORKER_COMM_H_
+#define _RTP_WORKER_COMM_H_
+
+#include <sys/types.h>
+#include "servers_comm.h"
+
+/* Frame between the main process and a worker, through the socketpair of
+ * the worker. Orders and responses use the same one, always whole in one
+ * message. An order with frame.uri_len > 0 carries the uri after it, in
+ * the same message and without the final \0 */
+typedef struct {
+    int channel; /* Control channel of the RTSP server, -1 if none */
+    unsigned int channel_gen;
+    RTP_CHANNEL_FRAME frame;
+} RTP_WORKER_FRAME;
+
+/* Make the socketpair between the main process and a worker. It keeps the
+ * boundaries of the messages
+ * fds: [0] for the main process, [1] for the worker
+ * return: 1 ok, 0 err
+ */
+int rtp_worker_comm_pair(int fds[2]);
+
+/* Send a frame, and its uri if it has one
+ * flags: MSG_DONTWAIT to fail instead of waiting for room
+ * return: 1 ok, 0 err
+ */
+int rtp_worker_comm_send(int fd, RTP_WORKER_FRAME *frame, const char *uri, int flags);
+
+/* Receive a frame. The uri gets its characters and the final \0
+ * uri: MAX_URI_LENGTH bytes
+ * flags: MSG_DONTWAIT not to wait for a frame
+ * return: 1 ok, 0 if the other end is closed, -1 err or no frame yet
+ */
+int rtp_worker_comm_recv(int fd, RTP_WORKER_FRAME *frame, char *uri, int flags);
+
+/* Open a descriptor that becomes readable when a child process ends
+ * return: Descriptor, -1 if the kernel doesn't have pidfd
+ */
+int rtp_worker_comm_pidfd(pid_t pid);
+#endif
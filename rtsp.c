@@ -27,6 +27,10 @@ RTSP_REQUEST *construct_rtsp_request(METHOD method, const unsigned char *uri, in
     }
     strcpy((char *)req->uri, (char *)uri);
     req->uri[uri_len] = 0;
+    req->uri_len = uri_len;
+    req->uri_borrowed = 0;
+    req->if_modified_since = 0;
+    req->if_modified_since_len = 0;
 
     req->CSeq = ++CSeq;
 
@@ -36,6 +40,8 @@ RTSP_REQUEST *construct_rtsp_request(METHOD method, const unsigned char *uri, in
 
     req->client_port = client_port;
 
+    req->interleaved = -1;
+
     return req;
 }
 
@@ -72,6 +78,9 @@ RTSP_RESPONSE *construct_rtsp_response(int code, int Session, TRANSPORT_CAST cas
     res->cast = cast ? cast : req->cast;
     res->client_port = client_port ? client_port : req->client_port;
     res->server_port = server_port;
+    res->destination = 0;
+    res->ttl = 0;
+    res->interleaved = -1;
     res->Content_Length = Content_Length;
     if (Content_Length > 0 && content) {
         res->content = malloc(Content_Length + 1);
@@ -85,6 +94,8 @@ RTSP_RESPONSE *construct_rtsp_response(int code, int Session, TRANSPORT_CAST cas
     }
 
     res->options = options;
+    res->content_borrowed = 0;
+    res->last_modified = 0;
 
     return(res);
 }
@@ -99,17 +110,15 @@ RTSP_RESPONSE *rtsp_servererror(RTSP_REQUEST *req) {
     return construct_rtsp_response(501, 0, 0, 0, 0, 0, 0, 0, req);
 }
 
-RTSP_RESPONSE *rtsp_describe_res(RTSP_REQUEST *req) {
+int rtsp_describe_sdp(const char *uri, char *sdp_str, int sdp_size) {
     SDP sdp;
-    int uri_len = strlen(req->uri);
-    char sdp_str[1024];
+    int uri_len = strlen(uri);
     int sdp_len;
-    RTSP_RESPONSE *ret;
     /* Hardcoded medias */
-    if (strstr(req->uri, "audio") || strstr(req->uri, "video"))
+    if (strstr(uri, "audio") || strstr(uri, "video"))
         return(0);
     sdp.n_medias = 2;
-    sdp.uri = (unsigned char *)req->uri;
+    sdp.uri = (unsigned char *)uri;
     sdp.medias = malloc(sizeof(MEDIA) * 2);
     if (!sdp.medias)
         return(0);
@@ -120,7 +129,7 @@ RTSP_RESPONSE *rtsp_describe_res(RTSP_REQUEST *req) {
         free(sdp.medias);
         return(0);
     }
-    memcpy(sdp.medias[0]->uri, req->uri, uri_len);
+    memcpy(sdp.medias[0]->uri, uri, uri_len);
     memcpy(sdp.medias[0]->uri + uri_len, "/audio", 7);
     sdp.medias[0]->uri[uri_len + 7] = 0;
 
@@ -132,22 +141,47 @@ RTSP_RESPONSE *rtsp_describe_res(RTSP_REQUEST *req) {
         free(sdp.medias);
         return(0);
     }
-    memcpy(sdp.medias[1]->uri, req->uri, uri_len);
+    memcpy(sdp.medias[1]->uri, uri, uri_len);
     memcpy(sdp.medias[1]->uri + uri_len, "/video", 7);
     sdp.medias[1]->uri[uri_len + 7] = 0;
 
-    if (!(sdp_len = pack_sdp(&sdp, (unsigned char *)sdp_str, 1024))) {
-        free(sdp.medias[0]->uri);
-        free(sdp.medias[1]->uri);
-        free(sdp.medias);
-        return(0);
-    }
-    ret = construct_rtsp_response(200, -1, 0, 0, 0, sdp_len, sdp_str, 0, req);
+    sdp_len = pack_sdp(&sdp, (unsigned char *)sdp_str, sdp_size);
     free(sdp.medias[0]->uri);
     free(sdp.medias[1]->uri);
     free(sdp.medias);
-    return(ret);
+    return(sdp_len);
+}
+
+RTSP_RESPONSE *rtsp_describe_res(RTSP_REQUEST *req) {
+    char sdp_str[1024];
+    int sdp_len;
 
+    if (!(sdp_len = rtsp_describe_sdp(req->uri, sdp_str, 1024)))
+        return(0);
+    return(construct_rtsp_response(200, -1, 0, 0, 0, sdp_len, sdp_str, 0, req));
+}
+
+RTSP_RESPONSE *rtsp_describe_cached_res(RTSP_REQUEST *req, char *sdp_str, int sdp_len, const char *last_modified) {
+    RTSP_RESPONSE *res;
+
+    res = construct_rtsp_response(200, -1, 0, 0, 0, 0, 0, 0, req);
+    if (!res)
+        return(0);
+    /* The cache keeps the content */
+    res->Content_Length = sdp_len;
+    res->content = sdp_str;
+    res->content_borrowed = 1;
+    res->last_modified = last_modified;
+    return(res);
+}
+
+RTSP_RESPONSE *rtsp_notmodified(RTSP_REQUEST *req, const char *last_modified) {
+    RTSP_RESPONSE *res;
+
+    res = construct_rtsp_response(304, -1, 0, 0, 0, 0, 0, 0, req);
+    if (res)
+        res->last_modified = last_modified;
+    return(res);
 }
 
 /* server_port and server_port + 1 must be used for this uri/session */
@@ -158,6 +192,26 @@ RTSP_RESPONSE *rtsp_setup_res(RTSP_REQUEST *req, PORT server_port, PORT client_p
         return construct_rtsp_response(200, Session, cast, server_port, 0, 0, 0, 0, req);
 }
 
+RTSP_RESPONSE *rtsp_setup_multicast_res(RTSP_REQUEST *req, unsigned int destination, PORT port, int ttl) {
+    RTSP_RESPONSE *res;
+
+    res = construct_rtsp_response(200, 0, MULTICAST, port, 0, 0, 0, 0, req);
+    if (res) {
+        res->destination = destination;
+        res->ttl = ttl;
+    }
+    return(res);
+}
+
+RTSP_RESPONSE *rtsp_setup_interleaved_res(RTSP_REQUEST *req, int channel) {
+    RTSP_RESPONSE *res;
+
+    res = construct_rtsp_response(200, 0, UNICAST, 0, 0, 0, 0, 0, req);
+    if (res)
+        res->interleaved = channel;
+    return(res);
+}
+
 RTSP_RESPONSE *rtsp_play_res(RTSP_REQUEST *req) {
     return construct_rtsp_response(200, 0, 0, 0, 0, 0, 0, 0, req);
 }
@@ -174,14 +228,17 @@ RTSP_RESPONSE *rtsp_options_res(RTSP_REQUEST *req) {
     return construct_rtsp_response(200, 0, 0, 0, 0, 0, 0, 1, req);
 }
 
+RTSP_RESPONSE *rtsp_get_parameter_res(RTSP_REQUEST *req) {
+    return construct_rtsp_response(200, 0, 0, 0, 0, 0, 0, 0, req);
+}
+
 void free_rtsp_req(RTSP_REQUEST **req) {
-    if ((*req)->uri)
-        free((*req)->uri);
+    release_rtsp_req(*req);
     free(*req);
     *req = 0;
 }
 void free_rtsp_res(RTSP_RESPONSE **res) {
-    if((*res)->content)
+    if((*res)->content && !(*res)->content_borrowed)
         free((*res)->content);
     free(*res); 
     *res = 0;
@@ -19,7 +19,7 @@ RTSP_REQUEST *rtsp_describe(const unsigned char *uri);
 /* Generate request to setup a media.
  * uri: Uri of the media
  * Session: -1 if there is not session already, the session number otherwise
- * cast: UNICAST (TODO: or MULTICAST)
+ * cast: UNICAST or MULTICAST
  * client_port: the port where RTP is listening in the client
  */
 RTSP_REQUEST *rtsp_setup(const unsigned char *uri, int Session, TRANSPORT_CAST cast, PORT client_port);
@@ -57,6 +57,29 @@ RTSP_RESPONSE *rtsp_servererror(RTSP_REQUEST *req);
  */
 RTSP_RESPONSE *rtsp_describe_res(RTSP_REQUEST *req);
 
+/* Write the SDP describing the medias of a uri
+ * uri: Uri of the media
+ * sdp_str: Where the SDP will be written
+ * sdp_size: Size of sdp_str
+ * return: Length of the SDP. 0 is error
+ */
+int rtsp_describe_sdp(const char *uri, char *sdp_str, int sdp_size);
+
+/* Generate describe response with an SDP that is kept by the caller.
+ * The response doesn't free it.
+ * req: Request
+ * sdp_str: SDP
+ * sdp_len: Length of the SDP
+ * last_modified: Date of the media file, or 0
+ */
+RTSP_RESPONSE *rtsp_describe_cached_res(RTSP_REQUEST *req, char *sdp_str, int sdp_len, const char *last_modified);
+
+/* Generate not modified response
+ * req: Request
+ * last_modified: Date of the media file
+ */
+RTSP_RESPONSE *rtsp_notmodified(RTSP_REQUEST *req, const char *last_modified);
+
 /* Generate setup response for req
  * req: Request
  * server_port: Port in the server sending RTP media
@@ -66,6 +89,20 @@ RTSP_RESPONSE *rtsp_describe_res(RTSP_REQUEST *req);
  */
 RTSP_RESPONSE *rtsp_setup_res(RTSP_REQUEST *req, PORT server_port, PORT client_port, TRANSPORT_CAST cast, int Session);
 
+/* Generate setup response for a multicast request
+ * req: Request
+ * destination: Group the client must join, network order
+ * port: Port of the group. The next one is for RTCP
+ * ttl: Time to live of the packets sent to the group
+ */
+RTSP_RESPONSE *rtsp_setup_multicast_res(RTSP_REQUEST *req, unsigned int destination, PORT port, int ttl);
+
+/* Generate setup response for a media interleaved in the RTSP connection
+ * req: Request
+ * channel: Channel of RTP. The next one is for RTCP
+ */
+RTSP_RESPONSE *rtsp_setup_interleaved_res(RTSP_REQUEST *req, int channel);
+
 /* Generate play response for the request
  * req: Request
  */
@@ -86,6 +123,11 @@ RTSP_RESPONSE *rtsp_teardown_res(RTSP_REQUEST *req);
  */
 RTSP_RESPONSE *rtsp_options_res(RTSP_REQUEST *req);
 
+/* Generate get_parameter response for the request. It is used as keepalive
+ * req: Request
+ */
+RTSP_RESPONSE *rtsp_get_parameter_res(RTSP_REQUEST *req);
+
 /* Free all the memory associated with the RTSP_REQUEST structure
  * req: Request
  */
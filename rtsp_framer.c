@@ -0,0 +1,156 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#define _GNU_SOURCE
+#include <string.h>
+#include <strings.h>
+#include "rtsp_framer.h"
+
+const char *CONTENT_LENGTH_HEADER = "Content-Length\0";
+
+void framer_init(RTSP_FRAMER *framer) {
+    framer->start = 0;
+    framer->end = 0;
+    framer->scanned = 0;
+    framer->header_len = 0;
+    framer->content_length = 0;
+    framer->discard = 0;
+}
+
+void framer_reset(RTSP_FRAMER *framer) {
+    framer_init(framer);
+}
+
+char *framer_space(RTSP_FRAMER *framer, int *size) {
+    /* Move the incomplete message to the beginning only when there isn't space
+     * after it. This is the only copy the framer makes */
+    if (framer->end == FRAMER_BUFFER && framer->start) {
+        memmove(framer->buf, framer->buf + framer->start, framer->end - framer->start);
+        framer->end -= framer->start;
+        framer->start = 0;
+    }
+    *size = FRAMER_BUFFER - framer->end;
+    return(framer->buf + framer->end);
+}
+
+void framer_received(RTSP_FRAMER *framer, int len) {
+    framer->end += len;
+}
+
+/* Get the Content-Length of the headers, 0 if there isn't one and -1 if it is bad */
+int framer_content_length(char *headers, int len) {
+    char *line = headers;
+    char *end = headers + len;
+    char *next;
+    int name_len = strlen(CONTENT_LENGTH_HEADER);
+    int value;
+
+    while (line < end) {
+        next = memchr(line, '\n', end - line);
+        if (!next)
+            break;
+        ++next;
+        if (next - line > name_len && !strncasecmp(line, CONTENT_LENGTH_HEADER, name_len)) {
+            line += name_len;
+            while (*line == ' ' || *line == '\t')
+                ++line;
+            if (*line++ != ':')
+                return(-1);
+            while (*line == ' ' || *line == '\t')
+                ++line;
+            if (*line < '0' || *line > '9')
+                return(-1);
+            for (value = 0; *line >= '0' && *line <= '9'; ++line) {
+                value = value * 10 + *line - '0';
+                if (value > FRAMER_BUFFER)
+                    return(-1);
+            }
+            return(value);
+        }
+        line = next;
+    }
+    return(0);
+}
+
+int framer_next(RTSP_FRAMER *framer, char **msg) {
+    char *begin = framer->buf + framer->start;
+    int available = framer->end - framer->start;
+    char *found;
+    int from;
+    int skip;
+
+    /* The rest of a frame that doesn't fit is skipped, the stream goes on after it */
+    if (framer->discard) {
+        skip = available < framer->discard ? available : framer->discard;
+        framer->discard -= skip;
+        framer->start += skip;
+        if (framer->start == framer->end) {
+            framer->start = 0;
+            framer->end = 0;
+        }
+        if (framer->discard)
+            return(0);
+        begin = framer->buf + framer->start;
+        available = framer->end - framer->start;
+    }
+
+    /* Look for the empty line, continuing where the last search stopped */
+    if (!framer->header_len) {
+        /* Ignore empty lines between messages */
+        while (available && (*begin == '\r' || *begin == '\n')) {
+            ++begin;
+            ++framer->start;
+            --available;
+        }
+        /* Interleaved frames of the client, '$', channel and length */
+        if (available && *begin == '$') {
+            if (available < 4)
+                return(0);
+            framer->header_len = 4 + ((unsigned char)begin[2] << 8 | (unsigned char)begin[3]);
+            framer->content_length = 0;
+            /* The reports of the client aren't used, a big one isn't an error */
+            if (framer->header_len > FRAMER_BUFFER) {
+                framer->discard = framer->header_len;
+                framer->header_len = 0;
+            }
+            return(framer_next(framer, msg));
+        }
+        from = framer->scanned > 3 ? framer->scanned - 3 : 0;
+        found = 0;
+        if (available - from >= 4)
+            found = memmem(begin + from, available - from, "\r\n\r\n", 4);
+        if (!found) {
+            framer->scanned = available;
+            if (available == FRAMER_BUFFER)
+                return(-1);
+            return(0);
+        }
+        framer->header_len = found + 4 - begin;
+        framer->content_length = framer_content_length(begin, framer->header_len);
+        if (framer->content_length == -1)
+            return(-1);
+    }
+
+    if (framer->header_len + framer->content_length > FRAMER_BUFFER)
+        return(-1);
+    if (framer->header_len + framer->content_length > available)
+        return(0);
+
+    *msg = begin;
+    return(framer->header_len + framer->content_length);
+}
+
+void framer_consume(RTSP_FRAMER *framer, int len) {
+    framer->start += len;
+    framer->scanned = 0;
+    framer->header_len = 0;
+    framer->content_length = 0;
+    if (framer->start == framer->end) {
+        framer->start = 0;
+        framer->end = 0;
+    }
+}
@@ -0,0 +1,51 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#ifndef _RTSP_FRAMER_H_
+#define _RTSP_FRAMER_H_
+
+#define FRAMER_BUFFER 4096 /* Maximum size of a message */
+
+/* Splits the byte stream of a connection in messages. The messages are
+ * returned as slices of the internal buffer, they are never copied */
+typedef struct {
+    char buf[FRAMER_BUFFER + 1]; /* One more byte to null terminate a message */
+    int start; /* First byte of the message being framed */
+    int end; /* End of the received data */
+    int scanned; /* Bytes of the message already searched for the end of the headers */
+    int header_len; /* Length of the headers with the empty line. 0 if not found yet */
+    int content_length;
+    int discard; /* Bytes of an interleaved frame bigger than the buffer still to skip */
+} RTSP_FRAMER;
+
+/* Initialize an empty framer */
+void framer_init(RTSP_FRAMER *framer);
+
+/* Get the free space where the next received data must be written
+ * size: Variable to save the number of bytes available. 0 if the buffer is full
+ * return: Pointer to the free space
+ */
+char *framer_space(RTSP_FRAMER *framer, int *size);
+
+/* Tell the framer that len bytes were written in the free space */
+void framer_received(RTSP_FRAMER *framer, int len);
+
+/* Get the next complete message. Interleaved binary frames, starting with
+ * '$', are returned whole as messages too, except those bigger than the
+ * buffer, that are skipped as they arrive
+ * msg: Variable to save the pointer to the message. It is valid until
+ *      framer_consume or framer_space are called
+ * return: length of the message, 0 if it is incomplete, -1 if it is bad or too big
+ */
+int framer_next(RTSP_FRAMER *framer, char **msg);
+
+/* Discard the first len bytes, usually the message returned by framer_next */
+void framer_consume(RTSP_FRAMER *framer, int len);
+
+/* Discard everything received */
+void framer_reset(RTSP_FRAMER *framer);
+#endif
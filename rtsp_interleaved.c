@@ -0,0 +1,111 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "rtsp_interleaved.h"
+
+void interleaved_queue_init(INTERLEAVED_QUEUE *queue, int high_water) {
+    queue->packets = 0;
+    queue->head = 0;
+    queue->n = 0;
+    queue->sent = 0;
+    queue->bytes = 0;
+    queue->high_water = high_water;
+    queue->dropped = 0;
+}
+
+int interleaved_queue_alloc(INTERLEAVED_QUEUE *queue) {
+    if (!queue->packets)
+        queue->packets = malloc(sizeof(INTERLEAVED_PACKET) * INTERLEAVED_QUEUE_PACKETS);
+    return(queue->packets != 0);
+}
+
+void interleaved_queue_free(INTERLEAVED_QUEUE *queue) {
+    free(queue->packets);
+    interleaved_queue_init(queue, queue->high_water);
+}
+
+char *interleaved_queue_space(INTERLEAVED_QUEUE *queue) {
+    if (!queue->packets || queue->n == INTERLEAVED_QUEUE_PACKETS || queue->bytes >= queue->high_water)
+        return(0);
+    return(queue->packets[(queue->head + queue->n) % INTERLEAVED_QUEUE_PACKETS].data + INTERLEAVED_HEADER);
+}
+
+void interleaved_queue_push(INTERLEAVED_QUEUE *queue, int channel, int len) {
+    INTERLEAVED_PACKET *packet = &queue->packets[(queue->head + queue->n) % INTERLEAVED_QUEUE_PACKETS];
+
+    packet->data[0] = '$';
+    packet->data[1] = channel;
+    packet->data[2] = (len >> 8) & 0xff;
+    packet->data[3] = len & 0xff;
+    packet->len = INTERLEAVED_HEADER + len;
+    queue->bytes += packet->len;
+    ++queue->n;
+}
+
+int interleaved_queue_flush(INTERLEAVED_QUEUE *queue, int fd, int max_packets) {
+    struct iovec iov[INTERLEAVED_BATCH];
+    struct msghdr msg;
+    INTERLEAVED_PACKET *packet;
+    int n;
+    int st;
+    int i;
+
+    if (max_packets > INTERLEAVED_BATCH)
+        max_packets = INTERLEAVED_BATCH;
+    while (queue->n && max_packets > 0) {
+        /* The ring can wrap, but the slots are independent pieces anyway */
+        n = queue->n < max_packets ? queue->n : max_packets;
+        for (i = 0; i < n; ++i) {
+            packet = &queue->packets[(queue->head + i) % INTERLEAVED_QUEUE_PACKETS];
+            iov[i].iov_base = packet->data;
+            iov[i].iov_len = packet->len;
+        }
+        iov[0].iov_base = (char *)iov[0].iov_base + queue->sent;
+        iov[0].iov_len -= queue->sent;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        st = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (st == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return(1);
+            return(0);
+        }
+
+        /* Skip the packets written whole */
+        queue->bytes -= st;
+        st += queue->sent;
+        queue->sent = 0;
+        for (i = 0; i < n && st >= queue->packets[queue->head].len; ++i) {
+            st -= queue->packets[queue->head].len;
+            queue->head = (queue->head + 1) % INTERLEAVED_QUEUE_PACKETS;
+            --queue->n;
+            --max_packets;
+        }
+        if (i < n) {
+            /* The socket is full */
+            queue->sent = st;
+            return(1);
+        }
+    }
+    return(1);
+}
+
+int interleaved_frame_len(const char *buf, int *channel) {
+    if (buf[0] != '$')
+        return(0);
+    *channel = (unsigned char)buf[1];
+    return(INTERLEAVED_HEADER + ((unsigned char)buf[2] << 8 | (unsigned char)buf[3]));
+}
@@ -0,0 +1,72 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#ifndef _RTSP_INTERLEAVED_H_
+#define _RTSP_INTERLEAVED_H_
+
+#define INTERLEAVED_HEADER 4 /* '$', channel and length of the packet */
+#define INTERLEAVED_MAX_PACKET 1500 /* Biggest RTP or RTCP packet relayed */
+#define INTERLEAVED_QUEUE_PACKETS 256 /* Packets a connection can keep */
+#define INTERLEAVED_BATCH 64 /* Packets written with one sendmsg */
+#define INTERLEAVED_DEFAULT_HIGH_WATER (128 * 1024) /* Bytes queued before packets are dropped */
+#define INTERLEAVED_MAX_CHANNELS 8 /* RTP and RTCP of 4 medias in a connection */
+
+typedef struct {
+    int len; /* With the header */
+    char data[INTERLEAVED_HEADER + INTERLEAVED_MAX_PACKET];
+} INTERLEAVED_PACKET;
+
+/* Packets waiting to be written in a TCP connection, already framed. They
+ * are written whole, so a packet started must end before anything else is
+ * written in the connection. When the client is slow the queue grows up to
+ * the high water mark and the new packets are dropped, never the old ones */
+typedef struct {
+    INTERLEAVED_PACKET *packets; /* Ring of INTERLEAVED_QUEUE_PACKETS, 0 until the first channel is set up */
+    int head; /* Oldest packet */
+    int n; /* Packets queued */
+    int sent; /* Bytes of the oldest packet already written */
+    int bytes; /* Queued and not written */
+    int high_water;
+    unsigned long dropped;
+} INTERLEAVED_QUEUE;
+
+/* Initialize an empty queue without memory */
+void interleaved_queue_init(INTERLEAVED_QUEUE *queue, int high_water);
+
+/* Reserve the memory of the packets, if it isn't already
+ * return: 1 ok, 0 err
+ */
+int interleaved_queue_alloc(INTERLEAVED_QUEUE *queue);
+
+/* Free the memory and the packets queued */
+void interleaved_queue_free(INTERLEAVED_QUEUE *queue);
+
+/* Get the memory where the next packet must be received, after its header
+ * return: INTERLEAVED_MAX_PACKET bytes, 0 if the queue is full or over the high water mark
+ */
+char *interleaved_queue_space(INTERLEAVED_QUEUE *queue);
+
+/* Frame and queue the packet received in interleaved_queue_space
+ * channel: Interleaved channel, 0 to 255
+ * len: Size of the packet
+ */
+void interleaved_queue_push(INTERLEAVED_QUEUE *queue, int channel, int len);
+
+/* Write queued packets in a non blocking socket, in batches. It stops when
+ * the socket can't take more
+ * max_packets: Packets to write at most, counting the one started
+ * return: 1 ok, 0 if the connection has failed
+ */
+int interleaved_queue_flush(INTERLEAVED_QUEUE *queue, int fd, int max_packets);
+
+/* Parse the header of an interleaved frame
+ * buf: At least INTERLEAVED_HEADER bytes
+ * channel: Variable to save the channel
+ * return: Size of the frame with its header, 0 if buf isn't an interleaved frame
+ */
+int interleaved_frame_len(const char *buf, int *channel);
+#endif
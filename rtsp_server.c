@@ -5,40 +5,64 @@ Permission to use, copy, modify, and/or distribute this software for any purpose
 
 THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
+#define _GNU_SOURCE
 #include <string.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include "common.h"
 #include "server.h"
 #include "server_client.h"
 #include "rtsp_server.h"
 #include "internal_rtsp.h"
+#include "event_loop.h"
+#include "describe_cache.h"
 #include "hashtable/hashtable.h"
 #include "hashtable/hashfunction.h"
 #include "rtsp.h"
 #include "parse_rtsp.h"
 #include "servers_comm.h"
+#include "rtp_channel.h"
 #include "strnstr.h"
-
-#define REQ_BUFFER 4096
-
-void *rtsp_worker_fun(void *arg);
-void *rtsp_worker_terminator_fun(void *arg);
+#include "socketlib/socketlib.h"
+
+void rtsp_connection_handler(EVENT_LOOP *loop, void *data, unsigned int events);
+void rtsp_loop_tick(EVENT_LOOP *loop, time_t now);
+void rtsp_loop_free_closed(RTSP_LOOP *rtsp_loop);
+void rtsp_connection_close(CONNECTION *self);
+void rtsp_connection_start(EVENT_LOOP *loop, void *data);
+void rtsp_connection_idle(TIMER_WHEEL *wheel, void *data);
+int rtsp_process_request(CONNECTION *self, char *buf, int len);
+int rtsp_connection_sendv(CONNECTION *self, struct iovec *iov, int iovcnt);
 void *rtp_messenger_fun(void *arg);
-RTSP_RESPONSE *rtsp_server_options(WORKER *self, RTSP_REQUEST *req);
-RTSP_RESPONSE *rtsp_server_describe(WORKER *self, RTSP_REQUEST *req);
-RTSP_RESPONSE *rtsp_server_setup(WORKER *self, RTSP_REQUEST *req, INTERNAL_RTSP *rtsp_info);
-RTSP_RESPONSE *rtsp_server_play(WORKER *self, RTSP_REQUEST *req);
-RTSP_RESPONSE *rtsp_server_pause(WORKER *self, RTSP_REQUEST *req);
-RTSP_RESPONSE *rtsp_server_teardown(WORKER *self, RTSP_REQUEST *req);
-int rtp_send_create_unicast_connection(RTP_TO_RTSP *data_from_rtp, char *uri, int Session, struct sockaddr_storage *client_addr);
+RTSP_RESPONSE *rtsp_server_options(CONNECTION *self, RTSP_REQUEST *req);
+RTSP_RESPONSE *rtsp_server_describe(CONNECTION *self, RTSP_REQUEST *req, DESCRIBE_BODY **body);
+RTSP_RESPONSE *rtsp_server_setup(CONNECTION *self, RTSP_REQUEST *req, INTERNAL_RTSP *rtsp_info);
+RTSP_RESPONSE *rtsp_server_play(CONNECTION *self, RTSP_REQUEST *req);
+RTSP_RESPONSE *rtsp_server_pause(CONNECTION *self, RTSP_REQUEST *req);
+RTSP_RESPONSE *rtsp_server_teardown(CONNECTION *self, RTSP_REQUEST *req);
+RTP_FANOUT *rtsp_fanout_create(CONNECTION *self, RTSP_REQUEST *req, ORDER order, int n_medias);
+void rtsp_fanout_free(RTP_FANOUT *op);
+void rtsp_fanout_start(CONNECTION *self, RTP_FANOUT *op, struct sockaddr_storage *client_addr);
+void rtsp_fanout_ack(RTP_CHANNEL_FRAME *response, void *data);
+void rtsp_fanout_done(EVENT_LOOP *loop, void *data);
 int get_session(int *ext_session, INTERNAL_RTSP **rtsp_info);
-int rtsp_worker_create(int tmp_sockfd, struct sockaddr_storage *client_addr);
+int rtsp_session_forget(int Session, const char *uri, int forget);
+int rtsp_connection_create(int tmp_sockfd, struct sockaddr_storage *client_addr);
+int rtsp_connection_accept(int tmp_sockfd, struct sockaddr_storage *client_addr, void *data);
+void rtsp_listener_handler(EVENT_LOOP *loop, void *data, unsigned int events);
+void rtsp_listener_resume(TIMER_WHEEL *wheel, void *data);
+int rtsp_connection_watch(CONNECTION *self);
+int rtsp_connection_read(CONNECTION *self);
+int rtsp_interleaved_open(CONNECTION *self, int channel, struct sockaddr_storage *addr);
+void rtsp_interleaved_handler(EVENT_LOOP *loop, void *data, unsigned int events);
 
 /* Port for communication with rtp servers */
 unsigned short rtp_comm_port;
@@ -46,10 +70,15 @@ unsigned short rtp_comm_port;
 unsigned int my_addr;
 
 void (*signal(int sig, void (*func)(int)))(int);
-/* Workers array where the information of each worker will be saved */
-WORKER workers[MAX_RTSP_WORKERS][1];
-int n_workers;
-pthread_mutex_t workers_mutex;
+/* Loop threads multiplexing the client connections */
+RTSP_LOOP loops[MAX_EVENT_LOOPS];
+int n_loops;
+/* Loop that will get the next accepted connection */
+int next_loop;
+int n_connections;
+pthread_mutex_t connections_mutex;
+/* Bytes of interleaved media a connection can have waiting */
+int interleaved_high_water = INTERLEAVED_DEFAULT_HIGH_WATER;
 
 /* Hashtable where the sessions will be stored */
 hashtable *session_hash;
@@ -61,9 +90,6 @@ int sockfd;
 /* Pid of RTP process */
 pid_t rtp_proc;
 
-/* Pthread that checks for idle worker */
-pthread_t worker_terminator;
-
 /* Pthread that gets petitions from RTP */
 pthread_t rtp_messenger;
 
@@ -78,21 +104,22 @@ void rtsp_server_stop(int sig) {
         fprintf(stderr, "- closed\n");
     }
 
-    /* Kill all workers */
-    fprintf(stderr, "Starting killing workers ");
-    pthread_mutex_lock(&workers_mutex);
-    for (i = 0; i < MAX_RTSP_WORKERS; ++i) {
-        if (workers[i]->used) {
-            workers[i]->used = 0;
-            pthread_cancel(workers[i]->thread_id);
-            pthread_join(workers[i]->thread_id, 0);
-            /* Close worker socket */
-            close(workers[i]->sockfd);
-        }
+    /* Fail the orders in flight while the loops can still get them */
+    rtp_channel_free();
+
+    /* Stop loops and close their connections */
+    fprintf(stderr, "Starting closing connections ");
+    for (i = 0; i < n_loops; ++i) {
+        event_loop_stop(loops[i].loop);
+        if (loops[i].listener->fd != -1)
+            close(loops[i].listener->fd);
+        while (loops[i].connections)
+            rtsp_connection_close(loops[i].connections);
+        rtsp_loop_free_closed(&loops[i]);
+        pthread_mutex_destroy(&loops[i].mutex);
         fprintf(stderr, ".");
     }
-    pthread_mutex_unlock(&workers_mutex);
-    fprintf(stderr, "- killed\n");
+    fprintf(stderr, "- closed\n");
 
     /* Send SIGUSR1 to RTP process and wait process */
     if (rtp_proc != -1) {
@@ -102,16 +129,14 @@ void rtsp_server_stop(int sig) {
         fprintf(stderr, "- killed\n");
     }
 
-    /* Kill thread that checks idle workers */
-    fprintf(stderr, "Killing threads ");
-    pthread_cancel(worker_terminator);
-    pthread_join(worker_terminator, 0);
-
     /* Kill thread that gets petitions from RTP */
+    fprintf(stderr, "Killing threads ");
     pthread_cancel(rtp_messenger);
     pthread_join(rtp_messenger, 0);
     fprintf(stderr, "- killed\n");
 
+    describe_cache_free();
+
     /* Free session hash. Don't use mutexes because at this moment all the
      * other threads that could be accessing it have been killed */
     if (session_hash) {
@@ -124,7 +149,7 @@ void rtsp_server_stop(int sig) {
     /* Destroy hash mutex */
     fprintf(stderr, "Destroying mutex ");
     pthread_mutex_destroy(&hash_mutex);
-    pthread_mutex_destroy(&workers_mutex);
+    pthread_mutex_destroy(&connections_mutex);
     fprintf(stderr, "- destroyed\n");
 
     /* Die */
@@ -132,24 +157,23 @@ void rtsp_server_stop(int sig) {
     exit(0);
 }
 
-int initialize_rtsp_globals() {
+int initialize_rtsp_globals(int loops_wanted) {
     int i;
     int st;
     srand(time(0));
     /* Initialize globals */
-    n_workers = 0;
+    n_loops = 0;
+    next_loop = 0;
+    n_connections = 0;
     session_hash = 0;
     sockfd = -1;
     rtp_proc = -1;
 
-    /* Intialize workers array */
-    for (i = 0; i < MAX_RTSP_WORKERS; ++i)
-        workers[i]->used = 0;
-
     signal(SIGINT, rtsp_server_stop);
+    signal(SIGPIPE, SIG_IGN);
 
     /* Initialize hash table */
-    session_hash = newhashtable(longhash, longequal, MAX_RTSP_WORKERS * 2, 1);
+    session_hash = newhashtable(longhash, longequal, MAX_RTSP_CONNECTIONS * 2, 1);
     if (!session_hash)
         return(0);
 
@@ -160,17 +184,34 @@ int initialize_rtsp_globals() {
         return(0);
     }
 
-    /* Initialize workers mutex */
-    if (pthread_mutex_init(&workers_mutex, 0)) {
+    /* Initialize connections mutex */
+    if (pthread_mutex_init(&connections_mutex, 0)) {
         pthread_mutex_destroy(&hash_mutex);
         clearhashtable(&session_hash);
         freehashtable(&session_hash);
         return(0);
     }
 
-    /* Create thread that checks idle workers */
-    st = pthread_create(&worker_terminator, 0, rtsp_worker_terminator_fun, 0);
-    if (st)
+    /* Create the loop threads */
+    for (i = 0; i < loops_wanted; ++i) {
+        loops[i].connections = 0;
+        loops[i].closed = 0;
+        loops[i].listener->fd = -1;
+        if (pthread_mutex_init(&loops[i].mutex, 0))
+            kill(getpid(), SIGINT);
+        if (!event_loop_init(loops[i].loop, i, rtsp_loop_tick))
+            kill(getpid(), SIGINT);
+        ++n_loops;
+        if (!event_loop_start(loops[i].loop))
+            kill(getpid(), SIGINT);
+    }
+
+    /* Orders to the RTP servers share one connection per server */
+    if (!rtp_channel_init(rtp_comm_port))
+        kill(getpid(), SIGINT);
+
+    /* Descriptions are cached. Media files are watched from the first loop */
+    if (!describe_cache_init(loops[0].loop))
         kill(getpid(), SIGINT);
 
     /* Create thread that gets petitions from RTP */
@@ -180,24 +221,89 @@ int initialize_rtsp_globals() {
 
     return(1);
 }
-int rtsp_server(PORT port, PORT rtp_port) {
+/* Give each loop its own SO_REUSEPORT listener, so the kernel spreads the
+ * incoming connections between the loops and every loop accepts its own.
+ * return: 0 if error
+ */
+int accept_tcp_requests_sharded(PORT port, int backlog) {
+    int i;
+
+    for (i = 0; i < n_loops; ++i) {
+        loops[i].listener->fd = open_tcp_listener(port, backlog, 1, &my_addr);
+        if (loops[i].listener->fd == -1)
+            return(0);
+        if (!set_nonblocking(loops[i].listener->fd))
+            return(0);
+        loops[i].listener->handler = rtsp_listener_handler;
+        loops[i].listener->data = &loops[i];
+        timer_init(loops[i].listener_pause, rtsp_listener_resume, &loops[i]);
+        if (!event_loop_add(loops[i].loop, loops[i].listener, EPOLLIN))
+            return(0);
+    }
+
+    /* The loops do all the work from now on */
+    for (;;)
+        pause();
+}
+
+int rtsp_server(PORT port, PORT rtp_port, int loops_wanted, int backlog, int reuseport) {
     int st;
 
     rtp_comm_port = rtp_port;
-    st = initialize_rtsp_globals();
+    st = initialize_rtsp_globals(loops_wanted);
     if (!st)
         return(0);
 
-    accept_tcp_requests(port, &sockfd, &my_addr, rtsp_worker_create);
+    if (reuseport)
+        accept_tcp_requests_sharded(port, backlog);
+    else
+        accept_tcp_requests(port, backlog, &sockfd, &my_addr, rtsp_connection_create);
     /* If we reach this point, there has been a severe error. Terminate */
     kill(getpid(), SIGINT);
     return(0);
 }
 
+/* Usage: rtsp_server [-l loops] [-b backlog] [-R] [-w high_water_kb] [rtsp_port [rtp_port]]
+ * -R: one SO_REUSEPORT listener per loop instead of a single accepting thread
+ * -w: interleaved media a connection can have waiting before it is dropped
+ */
 int main(int argc, char **argv) {
     unsigned short rtsp_port = 2000;
     unsigned short rtp_port = 2001;
+    int loops_wanted = DEFAULT_RTSP_LOOPS;
+    int backlog = MAX_QUEUE_SIZE;
+    int reuseport = 0;
     int ret;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:b:Rw:")) != -1) {
+        switch (opt) {
+            case 'l':
+                ret = atoi(optarg);
+                if (ret > 0 && ret <= MAX_EVENT_LOOPS)
+                    loops_wanted = ret;
+                break;
+            case 'b':
+                ret = atoi(optarg);
+                if (ret > 0)
+                    backlog = ret;
+                break;
+            case 'R':
+                reuseport = 1;
+                break;
+            case 'w':
+                ret = atoi(optarg);
+                if (ret > 0)
+                    interleaved_high_water = ret * 1024;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-l loops] [-b backlog] [-R] [-w high_water_kb] [rtsp_port [rtp_port]]\n", argv[0]);
+                return 0;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
     if (argc >= 2) {
         ret = atoi(argv[1]);
         if (ret > 1024 && ret < 60000)
@@ -212,35 +318,44 @@ int main(int argc, char **argv) {
         fprintf(stderr, "Ports must be different\n");
         return 0;
     }
-    rtsp_server(rtsp_port, rtp_port);
+    rtsp_server(rtsp_port, rtp_port, loops_wanted, backlog, reuseport);
     return(0);
 }
 
-void *rtsp_worker_terminator_fun(void *arg) {
-    time_t now;
-    int i;
-    for (;;) {
-        /* Each second check if any worker has been idle too much time */
-        sleep(1);
-        now = time(0);
-
-        pthread_mutex_lock(&workers_mutex);
-        for (i = 0; i < MAX_RTSP_WORKERS; ++i) {
-            if (workers[i]->used) {
-                if (now - workers[i]->time_contacted > MAX_IDLE_TIME) {
-                    workers[i]->used = 0;
-                    pthread_cancel(workers[i]->thread_id);
-                    pthread_join(workers[i]->thread_id, 0);
-                    /* Close worker socket */
-                    close(workers[i]->sockfd);
-                    --n_workers;
-                }
-            }
-        }
-        pthread_mutex_unlock(&workers_mutex);
+/* Free the connections whose release was delayed. It must be called between
+ * batches of events, when none can refer to them */
+void rtsp_loop_free_closed(RTSP_LOOP *rtsp_loop) {
+    CONNECTION *conn;
+
+    while (rtsp_loop->closed) {
+        conn = rtsp_loop->closed;
+        rtsp_loop->closed = conn->next;
+        interleaved_queue_free(conn->media);
+        free(conn);
     }
 }
 
+/* Free the connections closed since the last tick. The idle ones are
+ * closed by their timers */
+void rtsp_loop_tick(EVENT_LOOP *loop, time_t now) {
+    rtsp_loop_free_closed(&loops[loop->index]);
+}
+
+/* Close a connection that has been idle MAX_IDLE_TIME */
+void rtsp_connection_idle(TIMER_WHEEL *wheel, void *data) {
+    rtsp_connection_close(data);
+}
+
+/* Start the idle timer of a connection accepted by another thread and
+ * watch it. It runs in its loop, so no event can come before */
+void rtsp_connection_start(EVENT_LOOP *loop, void *data) {
+    CONNECTION *conn = data;
+
+    event_loop_timer_add(loop, conn->idle, MAX_IDLE_TIME * 1000);
+    if (!event_loop_add(loop, conn->watch, EPOLLIN | EPOLLRDHUP))
+        rtsp_connection_close(conn);
+}
+
 void *rtp_messenger_fun(void *arg) {
     /* TODO: Messaging with RTP process */
     /* NOTE: This isn't really necesary for the server to work.
@@ -250,197 +365,593 @@ void *rtp_messenger_fun(void *arg) {
     return(0);
 }
 
-/* Create a new rtsp worker
+/* Create a new rtsp connection in a loop
+ * rtsp_loop: Loop that will handle the connection
+ * tmp_sockfd: Socket number
+ * client_addr: Structure with the information of the client
+ * returns 0 on error
+ */
+int rtsp_connection_add(RTSP_LOOP *rtsp_loop, int tmp_sockfd, struct sockaddr_storage *client_addr) {
+    CONNECTION *conn;
+
+    pthread_mutex_lock(&connections_mutex);
+    /* If the limit of connections has been reached, return error */
+    if (n_connections >= MAX_RTSP_CONNECTIONS) {
+        pthread_mutex_unlock(&connections_mutex);
+        return(0);
+    }
+    ++n_connections;
+    pthread_mutex_unlock(&connections_mutex);
+
+    conn = malloc(sizeof(CONNECTION));
+    if (!conn || !set_nonblocking(tmp_sockfd)) {
+        free(conn);
+        pthread_mutex_lock(&connections_mutex);
+        --n_connections;
+        pthread_mutex_unlock(&connections_mutex);
+        return(0);
+    }
+
+    conn->loop = rtsp_loop->loop;
+    conn->state = CONN_READING;
+    conn->sockfd = tmp_sockfd;
+    timer_init(conn->idle, rtsp_connection_idle, conn);
+    conn->start->fun = rtsp_connection_start;
+    conn->start->data = conn;
+    conn->CSeq = 0;
+    memcpy(&(conn->client_addr), client_addr, sizeof(struct sockaddr_storage));
+    framer_init(conn->framer);
+    conn->out = 0;
+    conn->out_len = 0;
+    conn->out_sent = 0;
+    conn->events = EPOLLIN | EPOLLRDHUP;
+    interleaved_queue_init(conn->media, interleaved_high_water);
+    conn->n_interleaved = 0;
+    conn->waiting = 0;
+    conn->watch->fd = tmp_sockfd;
+    conn->watch->handler = rtsp_connection_handler;
+    conn->watch->data = conn;
+
+    /* Insert in the list of the loop before it can get events */
+    pthread_mutex_lock(&rtsp_loop->mutex);
+    conn->prev = 0;
+    conn->next = rtsp_loop->connections;
+    if (conn->next)
+        conn->next->prev = conn;
+    rtsp_loop->connections = conn;
+    pthread_mutex_unlock(&rtsp_loop->mutex);
+
+    /* The timers of a loop are only used by its thread */
+    if (!pthread_equal(pthread_self(), rtsp_loop->loop->thread_id)) {
+        event_loop_post(rtsp_loop->loop, conn->start);
+        return(1);
+    }
+    event_loop_timer_add(rtsp_loop->loop, conn->idle, MAX_IDLE_TIME * 1000);
+    if (!event_loop_add(rtsp_loop->loop, conn->watch, EPOLLIN | EPOLLRDHUP)) {
+        /* The socket is closed by the caller */
+        conn->sockfd = -1;
+        rtsp_connection_close(conn);
+        return(0);
+    }
+    return(1);
+}
+
+/* Create a new rtsp connection and give it to one of the loops
  * tmp_sockfd: Socket number
  * client_addr: Structure with the information of the client
  * returns 0 on error
  */
-int rtsp_worker_create(int tmp_sockfd, struct sockaddr_storage *client_addr) {
+int rtsp_connection_create(int tmp_sockfd, struct sockaddr_storage *client_addr) {
+    RTSP_LOOP *rtsp_loop;
+
+    pthread_mutex_lock(&connections_mutex);
+    rtsp_loop = &loops[next_loop];
+    next_loop = (next_loop + 1) % n_loops;
+    pthread_mutex_unlock(&connections_mutex);
+
+    return(rtsp_connection_add(rtsp_loop, tmp_sockfd, client_addr));
+}
+
+/* Keep the connections accepted by a loop listener in the same loop */
+int rtsp_connection_accept(int tmp_sockfd, struct sockaddr_storage *client_addr, void *data) {
+    return(rtsp_connection_add(data, tmp_sockfd, client_addr));
+}
+
+/* Pending connections in the listener of a loop */
+void rtsp_listener_handler(EVENT_LOOP *loop, void *data, unsigned int events) {
+    RTSP_LOOP *rtsp_loop = data;
+
+    /* Accept a batch and go back to the loop. If there are more, epoll will
+     * report the listener again */
+    if (accept_tcp_batch(rtsp_loop->listener->fd, ACCEPT_BATCH, rtsp_connection_accept, rtsp_loop) != -1)
+        return;
+    if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+        /* The listener stays readable, it would be reported again at once.
+         * Don't watch it until some descriptors may have been released */
+        if (event_loop_mod(loop, rtsp_loop->listener, 0))
+            event_loop_timer_add(loop, rtsp_loop->listener_pause, ACCEPT_PAUSE);
+        return;
+    }
+    fprintf(stderr, "Error accepting connections in loop %d\n", loop->index);
+}
+
+/* Watch the listener of a loop again after a pause for lack of descriptors */
+void rtsp_listener_resume(TIMER_WHEEL *wheel, void *data) {
+    RTSP_LOOP *rtsp_loop = data;
+
+    if (!event_loop_mod(rtsp_loop->loop, rtsp_loop->listener, EPOLLIN))
+        fprintf(stderr, "Error watching the listener of loop %d\n", rtsp_loop->loop->index);
+}
+
+/* Close the socket and free the connection. Must be called from its loop */
+void rtsp_connection_close(CONNECTION *self) {
+    RTSP_LOOP *rtsp_loop = &loops[self->loop->index];
     int i;
-    int st;
-    pthread_mutex_lock(&workers_mutex);
-    if (n_workers < MAX_RTSP_WORKERS) {
-        /* Find an unused worker */
-        for (i = 0; i < MAX_RTSP_WORKERS; ++i)
-                if (!workers[i]->used)
-                    break;
-
-            /* Create worker */
-            st = pthread_create(&workers[i]->thread_id, 0, rtsp_worker_fun, &workers[i]);
-            if (st) 
+
+    pthread_mutex_lock(&rtsp_loop->mutex);
+    if (self->prev)
+        self->prev->next = self->next;
+    else
+        rtsp_loop->connections = self->next;
+    if (self->next)
+        self->next->prev = self->prev;
+    pthread_mutex_unlock(&rtsp_loop->mutex);
+
+    event_loop_timer_del(self->loop, self->idle);
+    /* The orders in flight will finish without a connection */
+    if (self->waiting)
+        self->waiting->conn = 0;
+
+    /* Closing the socket removes it from epoll */
+    if (self->sockfd != -1)
+        close(self->sockfd);
+    self->sockfd = -1;
+    if (self->out)
+        free(self->out);
+    self->out = 0;
+    for (i = 0; i < self->n_interleaved; ++i)
+        close(self->interleaved[i].watch->fd);
+    if (self->n_interleaved) {
+        /* Their events can still be in the batch being dispatched */
+        self->next = rtsp_loop->closed;
+        rtsp_loop->closed = self;
+    } else {
+        interleaved_queue_free(self->media);
+        free(self);
+    }
+
+    pthread_mutex_lock(&connections_mutex);
+    --n_connections;
+    pthread_mutex_unlock(&connections_mutex);
+}
+
+/* Send data to the client without blocking. What can't be sent is saved
+ * and sent when the socket is writable.
+ * return: 1 ok, 0 err
+ */
+int rtsp_connection_send(CONNECTION *self, char *buf, int len) {
+    struct iovec iov[1];
+
+    iov->iov_base = buf;
+    iov->iov_len = len;
+    return(rtsp_connection_sendv(self, iov, 1));
+}
+
+/* Send several pieces with a single writev. The pieces aren't needed after
+ * it returns, what can't be sent is copied.
+ * return: 1 ok, 0 err
+ */
+int rtsp_connection_sendv(CONNECTION *self, struct iovec *iov, int iovcnt) {
+    int st = 0;
+    int i;
+    int j;
+    int pending;
+    char *tmp;
+
+    /* Send all the pieces with one call if nothing is waiting. A media
+     * packet half written must end first */
+    if (self->state == CONN_READING && !self->media->sent) {
+        st = writev(self->sockfd, iov, iovcnt);
+        if (st == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
                 return(0);
+            st = 0;
+        }
+    }
+
+    /* Skip the pieces already sent */
+    for (i = 0; i < iovcnt && st >= (int)iov[i].iov_len; ++i)
+        st -= iov[i].iov_len;
+    if (i == iovcnt)
+        return(1);
 
-            workers[i]->used = 1;
-            /* Save socket info */
-            workers[i]->sockfd = tmp_sockfd;
-            memcpy(&(workers[i]->client_addr), client_addr, sizeof(struct sockaddr_storage));
-            /* Set as accesed now */
-            workers[i]->time_contacted = time(0);
-            ++n_workers;
-        } else {
-            /* If the limit of workers has been reached, return error */
+    /* Save the rest */
+    for (j = i, pending = -st; j < iovcnt; ++j)
+        pending += iov[j].iov_len;
+    tmp = realloc(self->out, self->out_len + pending);
+    if (!tmp)
+        return(0);
+    self->out = tmp;
+    for (; i < iovcnt; ++i) {
+        memcpy(self->out + self->out_len, (char *)iov[i].iov_base + st, iov[i].iov_len - st);
+        self->out_len += iov[i].iov_len - st;
+        st = 0;
+    }
+
+    /* Wait until the socket is writable. Don't read more requests until then */
+    if (self->state == CONN_READING) {
+        self->state = CONN_WRITING;
+        if (!rtsp_connection_watch(self))
             return(0);
-        }
-        pthread_mutex_unlock(&workers_mutex);
+    }
+    return(1);
+}
+
+/* Wait for the events the state of the connection needs. The socket must be
+ * writable too while there is interleaved media queued
+ * return: 1 ok, 0 err
+ */
+int rtsp_connection_watch(CONNECTION *self) {
+    unsigned int events = 0;
+
+    if (self->state == CONN_READING)
+        events = EPOLLIN | EPOLLRDHUP;
+    else if (self->state == CONN_WRITING)
+        events = EPOLLOUT | EPOLLRDHUP;
+    if (self->media->n)
+        events |= EPOLLOUT;
+    if (events == self->events)
         return(1);
+    self->events = events;
+    return(event_loop_mod(self->loop, self->watch, events));
+}
+
+/* Send the saved data.
+ * return: 1 ok, 0 err
+ */
+int rtsp_connection_flush(CONNECTION *self) {
+    int st;
+
+    /* A media packet half written goes before anything else */
+    if (self->media->sent) {
+        if (!interleaved_queue_flush(self->media, self->sockfd, 1))
+            return(0);
+        if (self->media->sent)
+            return(1);
+    }
+
+    while (self->out_sent < self->out_len) {
+        st = send(self->sockfd, self->out + self->out_sent, self->out_len - self->out_sent, MSG_NOSIGNAL);
+        if (st == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return(1);
+            return(0);
         }
-void *rtsp_worker_fun(void *arg) {
-    WORKER *self = arg;
-    int sockfd;
-    char buf[REQ_BUFFER];
-    int ret;
+        self->out_sent += st;
+    }
+
+    /* Everything sent, read requests again */
+    if (self->out) {
+        free(self->out);
+        self->out = 0;
+        self->out_len = 0;
+        self->out_sent = 0;
+        self->state = CONN_READING;
+    }
+
+    /* Then the media, in batches */
+    if (!interleaved_queue_flush(self->media, self->sockfd, INTERLEAVED_BATCH))
+        return(0);
+    return(rtsp_connection_watch(self));
+}
+
+/* Open a non blocking UDP socket bound to an address. If the port is 0 the
+ * one chosen by the kernel is saved in addr
+ * return: Socket, -1 err
+ */
+int rtsp_interleaved_socket(struct sockaddr_in *addr) {
+    socklen_t len = sizeof(struct sockaddr_in);
+    int fd;
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return(-1);
+    if (bind(fd, (struct sockaddr *)addr, len) || getsockname(fd, (struct sockaddr *)addr, &len)) {
+        close(fd);
+        return(-1);
+    }
+    return(fd);
+}
+
+/* Open the UDP sockets where the RTP server sends a media interleaved in the
+ * connection, RTP in an even port and RTCP in the next one. Must be called
+ * from the loop of the connection
+ * channel: Channel of RTP in the connection. RTCP goes in the next one
+ * addr: Variable to save the address the RTP server must send to
+ * return: 1 ok, 0 err
+ */
+int rtsp_interleaved_open(CONNECTION *self, int channel, struct sockaddr_storage *addr) {
+    struct sockaddr_in *local = (struct sockaddr_in *)addr;
+    socklen_t len = sizeof(struct sockaddr_storage);
+    INTERLEAVED_SOCKET *sock;
+    int fds[2];
+    int tries;
+    int i;
+
+    if (self->n_interleaved + 2 > INTERLEAVED_MAX_CHANNELS || !interleaved_queue_alloc(self->media))
+        return(0);
+    /* The RTP server reaches this server at the address the client used */
+    if (getsockname(self->sockfd, (struct sockaddr *)addr, &len) || local->sin_family != AF_INET)
+        return(0);
+
+    for (tries = 0; tries < INTERLEAVED_PORT_TRIES; ++tries) {
+        local->sin_port = 0;
+        fds[0] = rtsp_interleaved_socket(local);
+        if (fds[0] == -1)
+            return(0);
+        if (ntohs(local->sin_port) % 2 == 0) {
+            local->sin_port = htons(ntohs(local->sin_port) + 1);
+            fds[1] = rtsp_interleaved_socket(local);
+            local->sin_port = htons(ntohs(local->sin_port) - 1);
+            if (fds[1] != -1)
+                break;
+        }
+        close(fds[0]);
+    }
+    if (tries == INTERLEAVED_PORT_TRIES)
+        return(0);
+
+    for (i = 0; i < 2; ++i) {
+        sock = &self->interleaved[self->n_interleaved];
+        sock->watch->fd = fds[i];
+        sock->watch->handler = rtsp_interleaved_handler;
+        sock->watch->data = sock;
+        sock->conn = self;
+        sock->channel = channel + i;
+        if (!event_loop_add(self->loop, sock->watch, EPOLLIN)) {
+            for (; i < 2; ++i)
+                close(fds[i]);
+            return(0);
+        }
+        ++self->n_interleaved;
+    }
+    return(1);
+}
+
+/* Packets of the RTP server for an interleaved media. They are framed in the
+ * queue of the connection and written with the next batch */
+void rtsp_interleaved_handler(EVENT_LOOP *loop, void *data, unsigned int events) {
+    INTERLEAVED_SOCKET *sock = data;
+    CONNECTION *self = sock->conn;
+    char discard[1];
+    char *space;
+    int writing;
     int st;
-    RTSP_REQUEST req[1];
-    RTSP_RESPONSE *res;
-    int server_error;
-    int Session;
-    INTERNAL_RTSP *rtsp_info = 0;
-    int CSeq = 0;
+    int i;
 
-    pthread_mutex_lock(&workers_mutex);
-    sockfd = self->sockfd;
-    pthread_mutex_unlock(&workers_mutex);
+    /* The connection was closed while dispatching this batch */
+    if (self->sockfd == -1)
+        return;
+
+    for (i = 0; i < INTERLEAVED_BATCH; ++i) {
+        /* Over the high water mark the packets are read to be dropped */
+        space = interleaved_queue_space(self->media);
+        if (space)
+            st = recv(sock->watch->fd, space, INTERLEAVED_MAX_PACKET, 0);
+        else
+            st = recv(sock->watch->fd, discard, sizeof(discard), 0);
+        if (st == -1 && errno == EINTR)
+            continue;
+        if (st <= 0)
+            break;
+        if (space)
+            interleaved_queue_push(self->media, sock->channel, st);
+        else
+            ++self->media->dropped;
+    }
 
-    for(;;) {
-        rtsp_info = 0;
-        Session = -1;
-        /* Wait to get a correct request */
-        do {
-            server_error = 0;
+    /* The connection is closed from its own events. If the flush ended
+     * the pending response the requests waiting in the framer go on */
+    writing = self->state == CONN_WRITING;
+    st = rtsp_connection_flush(self);
+    if (st && writing && self->state == CONN_READING)
+        st = rtsp_connection_read(self);
+    if (!st)
+        shutdown(self->sockfd, SHUT_RDWR);
+}
 
-            st = receive_message(sockfd, buf, REQ_BUFFER);
-            if (st == -1)
-                return(0);
-            else if (!st)
-                server_error = 1;
-            st = unpack_rtsp_req(req, buf, st);
-            /* If there was an error return err*/
-            if (server_error && st) {
-                fprintf(stderr, "caca1\n");
-                res = rtsp_servererror(req);
-                if (res) {
-                    st = pack_rtsp_res(res, buf, REQ_BUFFER);
-                    if (st) {
-                        buf[st] = 0;
-                        send(sockfd, buf, st, 0);
-                    }
-                    free_rtsp_res(&res);
-                }
-            } else if (server_error || !st) {
-                memcpy(buf, "RTSP/1.0 500 Internal server error\r\n\r\n", 38);
-                buf[38] = 0;
-                send(sockfd, buf, strlen(buf), 0);
-            }
+/* Events in a client connection */
+void rtsp_connection_handler(EVENT_LOOP *loop, void *data, unsigned int events) {
+    CONNECTION *self = data;
 
-        } while (server_error || !st);
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        rtsp_connection_close(self);
+        return;
+    }
 
-        /* Correct request */
-        /* Process request */
+    if (events & EPOLLOUT) {
+        if (!rtsp_connection_flush(self)) {
+            rtsp_connection_close(self);
+            return;
+        }
+    }
 
-        /* Get or create session */
-        st = get_session(&(req->Session), &rtsp_info);
+    if (!rtsp_connection_read(self)) {
+        rtsp_connection_close(self);
+        return;
+    }
 
-        /* Check that CSeq is incrementing */
-        if (req->CSeq <= CSeq) {
-            res = rtsp_servererror(req);
-        } else {
-            CSeq = req->CSeq;
-            switch (req->method) {
-                case OPTIONS:
-                    req->Session = 0;
-                    res = rtsp_server_options(self, req);
-                    pthread_mutex_lock(&workers_mutex);
-                    self->time_contacted = time(0);
-                    pthread_mutex_unlock(&workers_mutex);
-                    break;
-                case DESCRIBE:
-                    req->Session = 0;
-                    res = rtsp_server_describe(self, req);
-                    pthread_mutex_lock(&workers_mutex);
-                    self->time_contacted = time(0);
-                    pthread_mutex_unlock(&workers_mutex);
-                    break;
-                case SETUP:
-                    res = rtsp_server_setup(self, req, rtsp_info);
-                    pthread_mutex_lock(&workers_mutex);
-                    self->time_contacted = time(0);
-                    pthread_mutex_unlock(&workers_mutex);
-                    break;
-                case PLAY:
-                    fprintf(stderr, "Recibido play\n");
-                    if (!rtsp_info) {
-                        res = rtsp_servererror(req);
-                    } else {
-                        res = rtsp_server_play(self, req);
-                        pthread_mutex_lock(&workers_mutex);
-                        self->time_contacted = time(0);
-                        pthread_mutex_unlock(&workers_mutex);
-                    }
-                    break;
-                case PAUSE:
-                    if (!rtsp_info) {
-                        res = rtsp_servererror(req);
-                    } else {
-                        res = rtsp_server_pause(self, req);
-                        pthread_mutex_lock(&workers_mutex);
-                        self->time_contacted = time(0);
-                        pthread_mutex_unlock(&workers_mutex);
-                    }
-                    break;
-                case TEARDOWN:
-                    if (!rtsp_info) {
-                        res = rtsp_servererror(req);
-                    } else {
-                        res = rtsp_server_teardown(self, req);
-                        pthread_mutex_lock(&workers_mutex);
-                        self->time_contacted = time(0);
-                        pthread_mutex_unlock(&workers_mutex);
-                    }
-                    break;
-                default:
-                    fprintf(stderr, "caca2\n");
-                    res = rtsp_servererror(req);
-                    break;
-            }
+    if ((events & EPOLLRDHUP) && self->state == CONN_READING) {
+        rtsp_connection_close(self);
+        return;
+    }
+}
+
+/* Process the requests saved in the framer and read more while the
+ * connection is reading requests
+ * return: 1 ok, 0 if the connection must be closed
+ */
+int rtsp_connection_read(CONNECTION *self) {
+    int st;
+    int msg_len = 0;
+    char *msg;
+    char *space;
+    int space_len;
+
+    while (self->state == CONN_READING) {
+        /* Process all the complete messages in the buffer. Several requests
+         * can arrive in the same segment */
+        while (self->state == CONN_READING &&
+                (msg_len = framer_next(self->framer, &msg)) > 0) {
+            /* Reports interleaved by the client aren't used */
+            st = msg[0] == '$' ? 1 : rtsp_process_request(self, msg, msg_len);
+            if (!st)
+                return(0);
+            framer_consume(self->framer, msg_len);
         }
-        if (res) {
-            st = pack_rtsp_res(res, buf, REQ_BUFFER);
-            if (st) {
-                buf[st] = 0;
-                write(2, buf, st);
-                send(sockfd, buf, st, 0);
-            }
-            free_rtsp_res(&res);
+        if (self->state != CONN_READING)
+            break;
+
+        /* A message bigger than the buffer can't be processed */
+        if (msg_len == -1) {
+            framer_reset(self->framer);
+            if (!rtsp_connection_send(self, "RTSP/1.0 500 Internal server error\r\n\r\n", 38))
+                return(0);
+            continue;
         }
 
-        if (req->uri)
-            free(req->uri);
+        space = framer_space(self->framer, &space_len);
+        st = recv(self->sockfd, space, space_len, 0);
+        if (st == -1 && errno == EINTR)
+            continue;
+        if (st == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (st <= 0)
+            return(0);
+        framer_received(self->framer, st);
     }
+    return(1);
 }
 
-RTSP_RESPONSE *rtsp_server_options(WORKER *self, RTSP_REQUEST *req) {
+/* Process one complete request and send the response
+ * return: 0 if the connection must be closed, 1 otherwise
+ */
+int rtsp_process_request(CONNECTION *self, char *buf, int len) {
+    int st;
+    RTSP_REQUEST req[1];
+    RTSP_RESPONSE *res;
+    INTERNAL_RTSP *rtsp_info = 0;
+    struct iovec iov[RES_IOV_MAX];
+    char scratch[RES_SCRATCH];
+    DESCRIBE_BODY *body = 0;
+
+    /* The uri is left pointing into buf, nothing has to be freed */
+    st = unpack_rtsp_req_inplace(req, buf, len);
+    if (!st)
+        return(rtsp_connection_send(self, "RTSP/1.0 500 Internal server error\r\n\r\n", 38));
+
+    /* Correct request */
+    /* Process request */
+
+    /* Get or create session */
+    st = get_session(&(req->Session), &rtsp_info);
+
+    /* Check that CSeq is incrementing */
+    if (req->CSeq <= self->CSeq) {
+        res = rtsp_servererror(req);
+    } else {
+        self->CSeq = req->CSeq;
+        event_loop_timer_add(self->loop, self->idle, MAX_IDLE_TIME * 1000);
+        switch (req->method) {
+            case OPTIONS:
+                req->Session = 0;
+                res = rtsp_server_options(self, req);
+                break;
+            case DESCRIBE:
+                req->Session = 0;
+                res = rtsp_server_describe(self, req, &body);
+                break;
+            case SETUP:
+                res = rtsp_server_setup(self, req, rtsp_info);
+                break;
+            case PLAY:
+                fprintf(stderr, "Recibido play\n");
+                if (!rtsp_info)
+                    res = rtsp_servererror(req);
+                else
+                    res = rtsp_server_play(self, req);
+                break;
+            case PAUSE:
+                if (!rtsp_info)
+                    res = rtsp_servererror(req);
+                else
+                    res = rtsp_server_pause(self, req);
+                break;
+            case TEARDOWN:
+                if (!rtsp_info)
+                    res = rtsp_servererror(req);
+                else
+                    res = rtsp_server_teardown(self, req);
+                break;
+            case GET_PARAMETER:
+                /* Keepalive, with or without session */
+                if (!rtsp_info)
+                    req->Session = 0;
+                res = rtsp_get_parameter_res(req);
+                break;
+            default:
+                fprintf(stderr, "caca2\n");
+                res = rtsp_servererror(req);
+                break;
+        }
+    }
+    st = 1;
+    if (res) {
+        /* The content is sent directly from the response */
+        st = pack_rtsp_res_iov(res, iov, scratch);
+        st = st ? rtsp_connection_sendv(self, iov, st) : 1;
+        free_rtsp_res(&res);
+    }
+    if (body)
+        describe_cache_release(body);
+    return(st);
+}
+
+RTSP_RESPONSE *rtsp_server_options(CONNECTION *self, RTSP_REQUEST *req) {
     return(rtsp_options_res(req));
 }
 
 
-RTSP_RESPONSE *rtsp_server_describe(WORKER *self, RTSP_REQUEST *req) {
-    if (1/* TODO: Check if file exists */) {
-        return(rtsp_describe_res(req));
-    } else {
+/* The description comes from the cache. body keeps it until the response is sent */
+RTSP_RESPONSE *rtsp_server_describe(CONNECTION *self, RTSP_REQUEST *req, DESCRIBE_BODY **body) {
+    int st;
+
+    st = describe_cache_get(req->uri, body);
+    if (st == 0)
         return(rtsp_notfound(req));
-    }
+    if (st == -1)
+        return(rtsp_servererror(req));
+
+    /* Conditional revalidation */
+    if (req->if_modified_since &&
+            describe_cache_not_modified(*body, req->if_modified_since, req->if_modified_since_len))
+        return(rtsp_notmodified(req, (*body)->last_modified));
+    return(rtsp_describe_cached_res(req, (*body)->sdp, (*body)->sdp_len, (*body)->last_modified));
 }
 
 
-RTSP_RESPONSE *rtsp_server_setup(WORKER *self, RTSP_REQUEST *req, INTERNAL_RTSP *rtsp_info) {
+RTSP_RESPONSE *rtsp_server_setup(CONNECTION *self, RTSP_REQUEST *req, INTERNAL_RTSP *rtsp_info) {
     int i;
     int j;
     int st;
     int global_uri_len;
     char * end_global_uri;
-    RTP_TO_RTSP data_from_rtp;
     RTSP_RESPONSE *res;
     int *Session;
+    RTP_FANOUT *op;
+    struct sockaddr_storage client_addr;
 
     end_global_uri = strstr(req->uri, "/audio");
     if (!end_global_uri)
@@ -449,138 +960,149 @@ RTSP_RESPONSE *rtsp_server_setup(WORKER *self, RTSP_REQUEST *req, INTERNAL_RTSP
         return(rtsp_notfound(req));
     global_uri_len = end_global_uri - req->uri;
 
-    /* Unicast */
-    if (req->cast == UNICAST) {
-        if (1/* TODO: Check if file exists */) {
-            /* Create new rtsp_info */
-            if (!rtsp_info) {
-                fprintf(stderr, "Creating new session\n");
-                rtsp_info = malloc(sizeof(INTERNAL_RTSP));
-                if (!rtsp_info)
-                    kill(getpid(), SIGINT);
+    /* Unicast and multicast medias are kept the same way in the session */
+    if (1/* TODO: Check if file exists */) {
+        /* Create new rtsp_info */
+        if (!rtsp_info) {
+            fprintf(stderr, "Creating new session\n");
+            rtsp_info = malloc(sizeof(INTERNAL_RTSP));
+            if (!rtsp_info)
+                kill(getpid(), SIGINT);
 
-                rtsp_info->n_sources = 0;
-                rtsp_info->sources = 0;
+            rtsp_info->n_sources = 0;
+            rtsp_info->sources = 0;
 
-                rtsp_info->Session = req->Session;
+            rtsp_info->Session = req->Session;
 
-                pthread_mutex_lock(&workers_mutex);
-                memcpy(&(rtsp_info->client_addr), &(self->client_addr), sizeof(struct sockaddr_storage));
-                pthread_mutex_unlock(&workers_mutex);
+            memcpy(&(rtsp_info->client_addr), &(self->client_addr), sizeof(struct sockaddr_storage));
 
-                pthread_mutex_lock(&hash_mutex);
-                Session = malloc(sizeof(unsigned int));
-                *Session = req->Session;
-                st = puthashtable(&session_hash, Session, rtsp_info);
+            pthread_mutex_lock(&hash_mutex);
+            Session = malloc(sizeof(unsigned int));
+            *Session = req->Session;
+            st = puthashtable(&session_hash, Session, rtsp_info);
+            pthread_mutex_unlock(&hash_mutex);
+            if (st)
+                kill(getpid(), SIGINT);
+        }
+
+        pthread_mutex_lock(&hash_mutex);
+        fprintf(stderr, "Getting session: %d\n", req->Session);
+        rtsp_info = gethashtable(&session_hash, &(req->Session));
+        /* Check if the session has disappeared for some reason */
+        if (!rtsp_info) {
+            pthread_mutex_unlock(&hash_mutex);
+            fprintf(stderr, "caca3\n");
+            return(rtsp_servererror(req));
+        }
+
+        /* Check if the global uri already exists */
+        for (i = 0; i < rtsp_info->n_sources; ++i)
+            if (!memcmp(req->uri, rtsp_info->sources[i]->global_uri, global_uri_len))
+                break;
+
+        /* If it doesn't exist create it */
+        if (i == rtsp_info->n_sources) {
+            rtsp_info->sources = realloc(rtsp_info->sources, sizeof(INTERNAL_SOURCE) * ++(rtsp_info->n_sources));
+            if (!rtsp_info->sources) {
                 pthread_mutex_unlock(&hash_mutex);
-                if (st)
-                    kill(getpid(), SIGINT);
+                fprintf(stderr, "caca4\n");
+                return(rtsp_servererror(req));
             }
-
-            pthread_mutex_lock(&hash_mutex);
-            fprintf(stderr, "Getting session: %d\n", req->Session);
-            rtsp_info = gethashtable(&session_hash, &(req->Session));
-            /* Check if the session has disappeared for some reason */
-            if (!rtsp_info) {
+            /* Copy global uri */
+            rtsp_info->sources[i]->global_uri = malloc (global_uri_len + 1);
+            if (!rtsp_info->sources[i]->global_uri) { 
                 pthread_mutex_unlock(&hash_mutex);
-                fprintf(stderr, "caca3\n");
+                fprintf(stderr, "caca5\n");
                 return(rtsp_servererror(req));
             }
+            memcpy(rtsp_info->sources[i]->global_uri, req->uri, global_uri_len);
+            rtsp_info->sources[i]->global_uri[global_uri_len] = 0;
+            rtsp_info->sources[i]->medias = 0;
+            rtsp_info->sources[i]->n_medias = 0;
+        }
 
-            /* Check if the global uri already exists */
-            for (i = 0; i < rtsp_info->n_sources; ++i)
-                if (!memcmp(req->uri, rtsp_info->sources[i]->global_uri, global_uri_len))
-                    break;
-
-            /* If it doesn't exist create it */
-            if (i == rtsp_info->n_sources) {
-                rtsp_info->sources = realloc(rtsp_info->sources, sizeof(INTERNAL_SOURCE) * ++(rtsp_info->n_sources));
-                if (!rtsp_info->sources) {
-                    pthread_mutex_unlock(&hash_mutex);
-                    fprintf(stderr, "caca4\n");
-                    return(rtsp_servererror(req));
-                }
-                /* Copy global uri */
-                rtsp_info->sources[i]->global_uri = malloc (global_uri_len + 1);
-                if (!rtsp_info->sources[i]->global_uri) { 
-                    pthread_mutex_unlock(&hash_mutex);
-                    fprintf(stderr, "caca5\n");
-                    return(rtsp_servererror(req));
-                }
-                memcpy(rtsp_info->sources[i]->global_uri, req->uri, global_uri_len);
-                rtsp_info->sources[i]->global_uri[global_uri_len] = 0;
-                rtsp_info->sources[i]->medias = 0;
-                rtsp_info->sources[i]->n_medias = 0;
+        /* Check if the media uri already exists */
+        for (j = 0; j < rtsp_info->sources[i]->n_medias; ++j)
+            if (!memcmp(req->uri, rtsp_info->sources[i]->medias[j]->media_uri, strlen(req->uri)))
+                break;
+        /* If it doesn't exist create it */
+        if (j == rtsp_info->sources[i]->n_medias) {
+            rtsp_info->sources[i]->medias = realloc(rtsp_info->sources[i]->medias, sizeof(INTERNAL_MEDIA) * ++(rtsp_info->sources[i]->n_medias));
+            if (!rtsp_info->sources[i]->n_medias) {
+                pthread_mutex_unlock(&hash_mutex);
+                fprintf(stderr, "caca6\n");
+                return(rtsp_servererror(req));
             }
-
-            /* Check if the media uri already exists */
-            for (j = 0; j < rtsp_info->sources[i]->n_medias; ++j)
-                if (!memcmp(req->uri, rtsp_info->sources[i]->medias[j]->media_uri, strlen(req->uri)))
-                    break;
-            /* If it doesn't exist create it */
-            if (j == rtsp_info->sources[i]->n_medias) {
-                rtsp_info->sources[i]->medias = realloc(rtsp_info->sources[i]->medias, sizeof(INTERNAL_SOURCE) * ++(rtsp_info->sources[i]->n_medias));
-                if (!rtsp_info->sources[i]->n_medias) {
-                    pthread_mutex_unlock(&hash_mutex);
-                    fprintf(stderr, "caca6\n");
-                    return(rtsp_servererror(req));
-                }
-                /* Copy global uri */
-                rtsp_info->sources[i]->medias[j]->media_uri = malloc (strlen(req->uri) + 1);
-                if (!rtsp_info->sources[i]->medias[j]->media_uri) { 
-                    pthread_mutex_unlock(&hash_mutex);
-                    fprintf(stderr, "caca7\n");
-                    return(rtsp_servererror(req));
-                }
-                memcpy(rtsp_info->sources[i]->medias[j]->media_uri, req->uri, strlen(req->uri));
-                rtsp_info->sources[i]->medias[j]->media_uri[strlen(req->uri)] = 0;
-
-                /* Put the client udp port in the structure */
-                ((struct sockaddr_in*)&rtsp_info->client_addr)->sin_port = htons(req->client_port);
+            /* Copy global uri */
+            rtsp_info->sources[i]->medias[j]->media_uri = malloc (strlen(req->uri) + 1);
+            if (!rtsp_info->sources[i]->medias[j]->media_uri) { 
                 pthread_mutex_unlock(&hash_mutex);
-                st = rtp_send_create_unicast_connection(&data_from_rtp, req->uri, rtsp_info->Session, &(rtsp_info->client_addr));
-                if (!st) {
-                    return(rtsp_servererror(req));
-                }
-                pthread_mutex_lock(&hash_mutex);
-                rtsp_info = gethashtable(&session_hash, &(req->Session));
-                /* Check if the session has disappeared for some reason */
-                if (!rtsp_info) {
-                    pthread_mutex_unlock(&hash_mutex);
-                    fprintf(stderr, "caca30\n");
-                    return(rtsp_servererror(req));
-                }
-                /* Assign ssrc */
-                rtsp_info->sources[i]->medias[j]->ssrc = data_from_rtp.ssrc; 
+                fprintf(stderr, "caca7\n");
+                return(rtsp_servererror(req));
+            }
+            memcpy(rtsp_info->sources[i]->medias[j]->media_uri, req->uri, strlen(req->uri));
+            rtsp_info->sources[i]->medias[j]->media_uri[strlen(req->uri)] = 0;
+            rtsp_info->sources[i]->medias[j]->ssrc = 0;
+            rtsp_info->sources[i]->medias[j]->server_port = 0;
+            rtsp_info->sources[i]->medias[j]->group = 0;
+            rtsp_info->sources[i]->medias[j]->ttl = 0;
+            rtsp_info->sources[i]->medias[j]->interleaved = req->interleaved;
+
+            /* Put the client udp port in the structure */
+            if (req->interleaved == -1) {
+                ((struct sockaddr_in*)&rtsp_info->client_addr)->sin_port = htons(req->client_port);
+                memcpy(&client_addr, &rtsp_info->client_addr, sizeof(struct sockaddr_storage));
             }
+            pthread_mutex_unlock(&hash_mutex);
 
+            /* Interleaved media comes to this server, that frames it in the connection */
+            if (req->interleaved != -1 && !rtsp_interleaved_open(self, req->interleaved, &client_addr))
+                return(rtsp_servererror(req));
 
-            /* TODO: this */
-            //        return rtsp_setup_res(req, data_to_rtp->server_port, 0, UNICAST, 0);
-            res = rtsp_setup_res(req, data_from_rtp.server_port, 0, UNICAST, 0);
-            pthread_mutex_unlock(&hash_mutex);
-            return res;
-        } else {
-            return(rtsp_notfound(req));
+            /* The ssrc is assigned and the response sent when the RTP server answers */
+            op = rtsp_fanout_create(self, req, req->cast == MULTICAST ? SETUP_RTP_MULTICAST : SETUP_RTP_UNICAST, 1);
+            if (!op)
+                return(rtsp_servererror(req));
+            op->medias[0].uri = strdup(req->uri);
+            if (!op->medias[0].uri) {
+                rtsp_fanout_free(op);
+                return(rtsp_servererror(req));
+            }
+            rtsp_fanout_start(self, op, &client_addr);
+            return(0);
         }
+
+        /* The media was already set up */
+        if (rtsp_info->sources[i]->medias[j]->interleaved != -1)
+            res = rtsp_setup_interleaved_res(req, rtsp_info->sources[i]->medias[j]->interleaved);
+        else if (rtsp_info->sources[i]->medias[j]->group)
+            res = rtsp_setup_multicast_res(req, rtsp_info->sources[i]->medias[j]->group,
+                    rtsp_info->sources[i]->medias[j]->server_port, rtsp_info->sources[i]->medias[j]->ttl);
+        else
+            res = rtsp_setup_res(req, rtsp_info->sources[i]->medias[j]->server_port, 0, UNICAST, 0);
+        pthread_mutex_unlock(&hash_mutex);
+        return res;
     } else {
-        /* TODO: Multicast */
-        /*create_rtsp_unicast_connection(req->uri);*/
-        fprintf(stderr, "caca8\n");
-        return(rtsp_servererror(req));
+        return(rtsp_notfound(req));
     }
 }
 
-RTSP_RESPONSE *server_simple_command(WORKER *self, RTSP_REQUEST *req, RTSP_RESPONSE *(*rtsp_command)(RTSP_REQUEST *), int (*rtp_command)(char *, unsigned int)) {
+/* Send an order for the media of the uri, or for all the medias if the uri
+ * is global. The session table isn't locked while they are in flight
+ * return: Response if it can be given now, 0 if it will be sent when the
+ * RTP servers answer
+ */
+RTSP_RESPONSE *server_simple_command(CONNECTION *self, RTSP_REQUEST *req, RTSP_RESPONSE *(*rtsp_command)(RTSP_REQUEST *), ORDER order) {
     char *end_global_uri;
     int global_uri_len;
     int global_uri;
-    unsigned int ssrc;
     INTERNAL_RTSP *rtsp_info;
+    INTERNAL_SOURCE *source;
+    RTP_FANOUT *op;
     int i;
     int j;
-    int st;
-    RTP_TO_RTSP data_to_rtp;
+    int first;
+    int n_medias;
 
     global_uri = 0;
     end_global_uri = strstr(req->uri, "/audio");
@@ -593,349 +1115,361 @@ RTSP_RESPONSE *server_simple_command(WORKER *self, RTSP_REQUEST *req, RTSP_RESPO
     global_uri_len = end_global_uri - req->uri;
 
     fprintf(stderr, "server_simple_command\n");
-    if (1/* TODO: Check if file exists */) {
-        pthread_mutex_lock(&hash_mutex);
-        rtsp_info = gethashtable(&session_hash, &req->Session);
-        /* Check if the session has disappeared for some reason */
-        if (!rtsp_info) {
-            pthread_mutex_unlock(&hash_mutex);
-            fprintf(stderr, "caca9\n");
-            return(rtsp_servererror(req));
-        }
+    pthread_mutex_lock(&hash_mutex);
+    rtsp_info = gethashtable(&session_hash, &req->Session);
+    /* Check if the session has disappeared for some reason */
+    if (!rtsp_info) {
+        pthread_mutex_unlock(&hash_mutex);
+        fprintf(stderr, "caca9\n");
+        return(rtsp_servererror(req));
+    }
 
-        /* Get global uri */
-        for (i = 0; i < rtsp_info->n_sources; ++i)
-            if (!memcmp(req->uri, rtsp_info->sources[i]->global_uri, global_uri_len))
-                break;
+    /* Get global uri */
+    for (i = 0; i < rtsp_info->n_sources; ++i)
+        if (!memcmp(req->uri, rtsp_info->sources[i]->global_uri, global_uri_len))
+            break;
 
-        /* If it doesn't exist return error*/
-        if (i == rtsp_info->n_sources) {
+    /* If it doesn't exist return error*/
+    if (i == rtsp_info->n_sources) {
+        pthread_mutex_unlock(&hash_mutex);
+        fprintf(stderr, "caca10\n");
+        return(rtsp_servererror(req));
+    }
+    source = rtsp_info->sources[i];
+
+    if (!global_uri) {
+        /* Apply to only one media */
+        for (j = 0; j < source->n_medias; ++j)
+            if (!memcmp(req->uri, source->medias[j]->media_uri, strlen(req->uri)))
+                break;
+        /* If it doesn't exist return error */
+        if (j == source->n_medias) {
             pthread_mutex_unlock(&hash_mutex);
-            fprintf(stderr, "caca10\n");
+            fprintf(stderr, "caca11\n");
             return(rtsp_servererror(req));
         }
-
-        /* If the uri isn't global */
-        if (!global_uri) {
-            /* Get the media uri */
-            for (j = 0; j < rtsp_info->sources[i]->n_medias; ++j)
-                if (!memcmp(req->uri, rtsp_info->sources[i]->medias[j]->media_uri, strlen(req->uri)))
-                    break;
-            /* If it doesn't exist return error */
-            if (j == rtsp_info->sources[i]->n_medias) {
-                pthread_mutex_unlock(&hash_mutex);
-                fprintf(stderr, "caca11\n");
-                return(rtsp_servererror(req));
-            }
-
-            /* Apply to only one media */
-            ssrc = rtsp_info->sources[i]->medias[j]->ssrc;
-            st = rtp_command(rtsp_info->sources[i]->medias[j]->media_uri, ssrc);
-            if (!st) {
-                pthread_mutex_unlock(&hash_mutex);
-                fprintf(stderr, "caca12\n");
-                return(rtsp_servererror(req));
-            }
-        } else {
-            /* Apply to all the medias in the global uri */
-            fprintf(stderr, "Número de medias: %d\n", rtsp_info->sources[i]->n_medias);
-            st = 1;
-            for (j = 0; j < rtsp_info->sources[i]->n_medias; ++j) {
-                ssrc = rtsp_info->sources[i]->medias[j]->ssrc;
-                fprintf(stderr, "El ssrc del media %d es %d\n", j, ssrc);
-                /* Try to free all medias */
-                if (st)
-                    st = rtp_command(rtsp_info->sources[i]->medias[j]->media_uri, ssrc);
-                else
-                    rtp_command(rtsp_info->sources[i]->medias[j]->media_uri, ssrc);
-            }
-            if (!st) {
-                pthread_mutex_unlock(&hash_mutex);
-                fprintf(stderr, "caca13\n");
-                return(rtsp_servererror(req));
-            }
-        }
-
-        pthread_mutex_unlock(&hash_mutex);
-
-        return(rtsp_command(req));
+        first = j;
+        n_medias = 1;
     } else {
-        return(rtsp_notfound(req));
+        /* Apply to all the medias in the global uri */
+        fprintf(stderr, "Número de medias: %d\n", source->n_medias);
+        first = 0;
+        n_medias = source->n_medias;
+        if (!n_medias) {
+            pthread_mutex_unlock(&hash_mutex);
+            return(rtsp_command(req));
+        }
     }
-}
-
-int send_to_rtp(RTSP_TO_RTP *message) {
-    int st;
-    int sockfd;
-    int rcv_sockfd;
-    int rtp_sockfd;
-    char *host, *path;
-    RTP_TO_RTSP response;
-    struct addrinfo hints, *res;
-    unsigned short port;
-    char port_str[6];
-    struct sockaddr rtp_addr;
-    int rtp_addr_len = sizeof(struct sockaddr);
-
-    fprintf(stderr, "extrayendo uri: %s\n", message->uri);
-    st = extract_uri(message->uri, &host, &path);
-    fprintf(stderr, "Status: %d\n", st);
-    if (!st)
-        return(0);
-
-    /* Open receive socket */
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_PASSIVE;
-
-    do {
-        port = rand();
-        if (!snprintf(port_str, 5, "%d", port))
-            return(0);
-        if (getaddrinfo(0, port_str, &hints, &res))
-            return(0);
-
-        rcv_sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-        if (rcv_sockfd == -1)
-            return(0);
 
-        st = bind(rcv_sockfd, res->ai_addr, res->ai_addrlen);
-
-        port = ((struct sockaddr_in*)(res->ai_addr))->sin_port;
-        freeaddrinfo(res);
-    } while (st == -1);
-    /* Listen in rcv_sockfd */
-    st = listen(rcv_sockfd, 1);
-    if (st == -1)
-        return(0);
-
-    message->response_port = port;
-
-    sockfd = TCP_connect(host, rtp_comm_port);
-    if (host)
-        free(host);
-    if (path)
-        free(path);
-    if(!sockfd)
-        return(0);
-    st = send(sockfd, message, sizeof(RTSP_TO_RTP), 0);
-    if (!st)
-        return(0);
-    close(sockfd);
-
-    rtp_sockfd = accept(rcv_sockfd, &rtp_addr, &rtp_addr_len);
-    fprintf(stderr, "Valor de rcv_sockfd: %d\n", rcv_sockfd);
-    fprintf(stderr, "Valor de rtp_sockfd: %d\n", rtp_sockfd);
-    if (rtp_sockfd == -1) {
-        perror("error: ");
-        return(0);
+    /* Copy what the orders need and send them without the lock */
+    op = rtsp_fanout_create(self, req, order, n_medias);
+    if (!op) {
+        pthread_mutex_unlock(&hash_mutex);
+        return(rtsp_servererror(req));
     }
-    st = recv(rtp_sockfd, &response, sizeof(RTP_TO_RTSP), 0);
-    close(rcv_sockfd);
-    close(rtp_sockfd);
-    fprintf(stderr, "Status de receive: %d\n", st);
-    if (st == -1) {
-        perror("error: ");
-        return(0);
+    op->rtsp_command = rtsp_command;
+    for (j = 0; j < n_medias; ++j) {
+        op->medias[j].ssrc = source->medias[first + j]->ssrc;
+        op->medias[j].uri = strdup((char *)source->medias[first + j]->media_uri);
+        if (!op->medias[j].uri) {
+            pthread_mutex_unlock(&hash_mutex);
+            rtsp_fanout_free(op);
+            return(rtsp_servererror(req));
+        }
+        fprintf(stderr, "El ssrc del media %d es %d\n", first + j, op->medias[j].ssrc);
     }
-    fprintf(stderr, "Response order: %d\n", response.order);
-    if (response.order == ERR_RTP)
-        return(0);
-    return(1);
-}
-int rtp_send_play(char *uri, unsigned int ssrc) {
-    RTSP_TO_RTP play_msg;
-    RTP_TO_RTSP response;
-    play_msg.order = PLAY_RTP;
-    play_msg.ssrc = ssrc;
-    strcpy(play_msg.uri, uri);
+    pthread_mutex_unlock(&hash_mutex);
 
-    fprintf(stderr, "rtp_send_play\n");
-    return send_to_rtp(&play_msg);
-}
-RTSP_RESPONSE *rtsp_server_play(WORKER *self, RTSP_REQUEST *req) {
-    return(server_simple_command(self, req, rtsp_play_res, rtp_send_play));
+    rtsp_fanout_start(self, op, 0);
+    return(0);
 }
 
-int rtp_send_pause(char *uri, unsigned int ssrc) {
-    RTSP_TO_RTP pause_msg;
-    pause_msg.order = PAUSE_RTP;
-    pause_msg.ssrc = ssrc;
-    strcpy(pause_msg.uri, uri);
-
-    return send_to_rtp(&pause_msg);
-}
-RTSP_RESPONSE *rtsp_server_pause(WORKER *self, RTSP_REQUEST *req) {
-    return(server_simple_command(self, req, rtsp_pause_res, rtp_send_pause));
+RTSP_RESPONSE *rtsp_server_play(CONNECTION *self, RTSP_REQUEST *req) {
+    return(server_simple_command(self, req, rtsp_play_res, PLAY_RTP));
 }
 
-int rtp_send_teardown(char *uri, unsigned int ssrc) {
-    RTSP_TO_RTP teardown_msg;
-    teardown_msg.order = TEARDOWN_RTP;
-    teardown_msg.ssrc = ssrc;
-    strcpy(teardown_msg.uri, uri);
-
-    return send_to_rtp(&teardown_msg);
+RTSP_RESPONSE *rtsp_server_pause(CONNECTION *self, RTSP_REQUEST *req) {
+    return(server_simple_command(self, req, rtsp_pause_res, PAUSE_RTP));
 }
-RTSP_RESPONSE *rtsp_server_teardown(WORKER *self, RTSP_REQUEST *req) {
-    int i, j;
+
+/* Find the medias of a session a TEARDOWN is for and, if asked, delete
+ * them. A global uri deletes the whole source
+ * forget: 0 to only check that they exist
+ * return: Number of medias, -1 if the session or the uri don't exist
+ */
+int rtsp_session_forget(int Session, const char *uri, int forget) {
     INTERNAL_RTSP *rtsp_info;
-    RTSP_RESPONSE *res;
-    char *end_global_uri;
+    INTERNAL_SOURCE *source;
+    const char *end_global_uri;
     int global_uri = 0;
     int global_uri_len;
+    int n = -1;
+    int i, j;
 
-    res = server_simple_command(self, req, rtsp_teardown_res, rtp_send_teardown);
-
-    fprintf(stderr, "Borrando uri: %s\n", req->uri);
-    end_global_uri = strstr(req->uri, "/audio");
+    end_global_uri = strstr(uri, "/audio");
     if (!end_global_uri)
-        end_global_uri = strstr(req->uri, "/video");
+        end_global_uri = strstr(uri, "/video");
     if (!end_global_uri)
         global_uri = 1;
     if (global_uri)
-        global_uri_len = strlen(req->uri);
+        global_uri_len = strlen(uri);
     else
-        global_uri_len = end_global_uri - req->uri;
+        global_uri_len = end_global_uri - uri;
 
-    /* TODO: Borrar media */
     pthread_mutex_lock(&hash_mutex);
-    /* Get the session */
-    rtsp_info = gethashtable(&session_hash, &(req->Session));
-    if (!rtsp_info) {
-        pthread_mutex_unlock(&hash_mutex);
-        fprintf(stderr, "caca20\n");
-        free(res);
-        return(rtsp_servererror(req));
-    }
-    /* Check if the global uri exists */
-    for (i = 0; i < rtsp_info->n_sources; ++i)
-        if (strlen(rtsp_info->sources[i]->global_uri) == global_uri_len &&
-                !memcmp(req->uri, rtsp_info->sources[i]->global_uri, global_uri_len))
+    /* Get the session and check if the global uri exists */
+    rtsp_info = gethashtable(&session_hash, &Session);
+    for (i = 0; rtsp_info && i < rtsp_info->n_sources; ++i)
+        if (strlen((char *)rtsp_info->sources[i]->global_uri) == global_uri_len &&
+                !memcmp(uri, rtsp_info->sources[i]->global_uri, global_uri_len))
             break;
-    if (i == rtsp_info->n_sources) {
+    if (!rtsp_info || i == rtsp_info->n_sources) {
         pthread_mutex_unlock(&hash_mutex);
-        fprintf(stderr, "caca21\n");
-        free(res);
-        return(rtsp_servererror(req));
+        return(-1);
     }
+    source = rtsp_info->sources[i];
+
     if (global_uri) {
-        /* Delete all medias with this uri */
-        for (j = 0; j < rtsp_info->sources[i]->n_medias; ++j)
-            free(rtsp_info->sources[i]->medias[j]->media_uri);
-        /* Free medias array */
-        free(rtsp_info->sources[i]->medias);
-        /* Move the other sources */
-        memmove(&(rtsp_info->sources[i]), &(rtsp_info->sources[i+1]), rtsp_info->n_sources - i - 1);
-        (--rtsp_info->n_sources);
-        /* Change size of sources array */
-        rtsp_info->sources = realloc(rtsp_info->sources, sizeof(INTERNAL_SOURCE) * rtsp_info->n_sources);
+        n = source->n_medias;
+        if (forget) {
+            /* Delete all medias with this uri */
+            for (j = 0; j < source->n_medias; ++j)
+                free(source->medias[j]->media_uri);
+            /* Free medias array */
+            free(source->medias);
+            free(source->global_uri);
+            /* Move the other sources */
+            memmove(&(rtsp_info->sources[i]), &(rtsp_info->sources[i+1]), sizeof(INTERNAL_SOURCE) * (rtsp_info->n_sources - i - 1));
+            (--rtsp_info->n_sources);
+            /* Change size of sources array */
+            rtsp_info->sources = realloc(rtsp_info->sources, sizeof(INTERNAL_SOURCE) * rtsp_info->n_sources);
+        }
     } else {
         /* Check if the media uri exists */
-        for (j = 0; j < rtsp_info->sources[i]->n_medias; ++j)
-            if (!strncmp(req->uri, rtsp_info->sources[i]->medias[j]->media_uri, strlen(req->uri)))
+        for (j = 0; j < source->n_medias; ++j)
+            if (!strncmp(uri, (char *)source->medias[j]->media_uri, strlen(uri)))
                 break;
-        if (j == rtsp_info->sources[i]->n_medias) {
-            pthread_mutex_unlock(&hash_mutex);
-            fprintf(stderr, "caca22\n");
-            free(res);
-            return(rtsp_servererror(req));
+        if (j < source->n_medias) {
+            n = 1;
+            if (forget) {
+                /* Free this media */
+                free(source->medias[j]->media_uri);
+                /* Move the other medias */
+                memmove(&(source->medias[j]), &(source->medias[j+1]), sizeof(INTERNAL_MEDIA) * (source->n_medias - j - 1));
+                --(source->n_medias);
+                /* Change size of medias array */
+                source->medias = realloc(source->medias, sizeof(INTERNAL_MEDIA) * source->n_medias);
+            }
         }
-        /* Free this media */
-        free(rtsp_info->sources[i]->medias[j]->media_uri);
-        /* Move the other medias */
-        memmove(&(rtsp_info->sources[i]->medias[j]), &(rtsp_info->sources[i]->medias[j+1]), rtsp_info->sources[i]->n_medias - j - 1);
-        --(rtsp_info->sources[i]->n_medias);
-        /* Change size of sources array */
-        rtsp_info->sources[i]->medias = realloc(rtsp_info->sources[i]->medias, sizeof(INTERNAL_MEDIA) * rtsp_info->sources[i]->n_medias);
-
     }
 
     pthread_mutex_unlock(&hash_mutex);
+    return(n);
+}
+
+RTSP_RESPONSE *rtsp_server_teardown(CONNECTION *self, RTSP_REQUEST *req) {
+    int n_medias;
 
-    return res;
+    fprintf(stderr, "Borrando uri: %s\n", req->uri);
+    /* Checked before any order is sent, so the request gets only one response */
+    n_medias = rtsp_session_forget(req->Session, req->uri, 0);
+    if (n_medias == -1)
+        return(rtsp_servererror(req));
+    /* There isn't anything to stop in the RTP servers */
+    if (n_medias == 0) {
+        rtsp_session_forget(req->Session, req->uri, 1);
+        return(rtsp_teardown_res(req));
+    }
+    /* The medias are forgotten when the RTP servers have stopped them */
+    return(server_simple_command(self, req, rtsp_teardown_res, TEARDOWN_RTP));
 }
-int rtp_send_create_unicast_connection(RTP_TO_RTSP *data_from_rtp, char *uri, int Session, struct sockaddr_storage *client_addr) {
-    RTSP_TO_RTP setup_msg;
-    int st;
-    int sockfd;
-    int rcv_sockfd;
-    int rtp_sockfd;
-    char *host, *path;
-    struct addrinfo hints, *res;
-    struct sockaddr rtp_addr;
-    unsigned short port;
-    char port_str[6];
-    int rtp_addr_len = sizeof(struct sockaddr);
-
-    setup_msg.order = SETUP_RTP_UNICAST;
-    strcpy(setup_msg.uri, uri);
-    setup_msg.Session = Session;
-    setup_msg.client_ip = ((struct sockaddr_in *)client_addr)->sin_addr.s_addr;
-    setup_msg.client_port = ((struct sockaddr_in *)client_addr)->sin_port;
-
-    /* TODO: Send to rtp server */
-    st = extract_uri(setup_msg.uri, &host, &path);
-    if (!st || !host || !path)
-        return(0);
-    fprintf(stderr, "%s\n", host);
 
-    /* Open receive socket */
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_PASSIVE;
+/* Create the orders of a request
+ * return: Orders without medias, 0 if error
+ */
+RTP_FANOUT *rtsp_fanout_create(CONNECTION *self, RTSP_REQUEST *req, ORDER order, int n_medias) {
+    RTP_FANOUT *op;
+    int i;
 
-    do {
-        port = rand();
-        if (!snprintf(port_str, 5, "%d", port))
-            return(0);
-        if (getaddrinfo(0, port_str, &hints, &res))
+    op = malloc(sizeof(RTP_FANOUT) + sizeof(RTP_FANOUT_MEDIA) * (n_medias - 1));
+    if (!op)
+        return(0);
+    if (pthread_mutex_init(&op->mutex, 0)) {
+        free(op);
+        return(0);
+    }
+    op->task->fun = rtsp_fanout_done;
+    op->task->data = op;
+    op->loop = self->loop;
+    op->conn = self;
+    memcpy(op->req, req, sizeof(RTSP_REQUEST));
+    op->order = order;
+    op->rtsp_command = 0;
+    op->uri = 0;
+    if (order == TEARDOWN_RTP) {
+        op->uri = strdup(req->uri);
+        if (!op->uri) {
+            pthread_mutex_destroy(&op->mutex);
+            free(op);
             return(0);
+        }
+    }
+    op->pending = n_medias;
+    op->failed = 0;
+    op->server_port = 0;
+    op->group = 0;
+    op->ttl = 0;
+    op->n_medias = n_medias;
+    for (i = 0; i < n_medias; ++i) {
+        op->medias[i].op = op;
+        op->medias[i].uri = 0;
+        op->medias[i].ssrc = 0;
+        op->medias[i].ok = 0;
+    }
+    return(op);
+}
 
-        rcv_sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-        if (rcv_sockfd == -1)
-            return(0);
+void rtsp_fanout_free(RTP_FANOUT *op) {
+    int i;
 
-        st = bind(rcv_sockfd, res->ai_addr, res->ai_addrlen);
+    for (i = 0; i < op->n_medias; ++i)
+        free(op->medias[i].uri);
+    free(op->uri);
+    pthread_mutex_destroy(&op->mutex);
+    free(op);
+}
 
-        port = ((struct sockaddr_in*)(res->ai_addr))->sin_port;
-        freeaddrinfo(res);
-    } while (st == -1);
-    /* Listen in rcv_sockfd */
-    st = listen(rcv_sockfd, 1);
-    if (st == -1)
-        return(0);
+/* Send all the orders at the same time. The connection doesn't process more
+ * requests until they have been answered
+ * client_addr: Destination of the media for SETUP_RTP_UNICAST. Only the
+ * session is registered with it for SETUP_RTP_MULTICAST
+ */
+void rtsp_fanout_start(CONNECTION *self, RTP_FANOUT *op, struct sockaddr_storage *client_addr) {
+    RTP_CHANNEL_FRAME request;
+    int i;
 
-    setup_msg.response_port = port;
-    fprintf(stderr, "Listening on port %d\n", port);
+    self->state = CONN_WAITING;
+    self->waiting = op;
+    /* Pipelined requests stay in the framer. Only errors and the space for
+     * interleaved media are reported */
+    rtsp_connection_watch(self);
+
+    for (i = 0; i < op->n_medias; ++i) {
+        memset(&request, 0, sizeof(request));
+        request.order = op->order;
+        request.ssrc = op->medias[i].ssrc;
+        if (op->order == SETUP_RTP_UNICAST || op->order == SETUP_RTP_MULTICAST) {
+            request.uri_len = strlen(op->medias[i].uri);
+            request.Session = op->req->Session;
+            request.client_ip = ((struct sockaddr_in *)client_addr)->sin_addr.s_addr;
+            request.client_port = ((struct sockaddr_in *)client_addr)->sin_port;
+        }
+        /* The last response can come before this loop ends, but it is
+         * processed in this same thread once the handler returns */
+        rtp_channel_send(op->medias[i].uri, &request, rtsp_fanout_ack, &op->medias[i]);
+    }
+}
 
-    sockfd = TCP_connect(host, rtp_comm_port);
-    if (host)
-        free(host);
-    if (path)
-        free(path);
-    if(!sockfd)
-        return(0);
-    st = send(sockfd, &setup_msg, sizeof(RTSP_TO_RTP), 0);
-    if (!st)
-        return(0);
-    close(sockfd);
+/* Response of an RTP server for one media. Called from the thread reading
+ * its channel */
+void rtsp_fanout_ack(RTP_CHANNEL_FRAME *response, void *data) {
+    RTP_FANOUT_MEDIA *media = data;
+    RTP_FANOUT *op = media->op;
+    int last;
+
+    pthread_mutex_lock(&op->mutex);
+    media->ok = response->order != ERR_RTP;
+    if (response->order == ERR_RTP) {
+        op->failed = 1;
+    } else if (op->order == SETUP_RTP_UNICAST || op->order == SETUP_RTP_MULTICAST) {
+        op->medias[0].ssrc = response->ssrc;
+        op->server_port = response->server_port;
+        op->group = response->group;
+        op->ttl = response->ttl;
+    }
+    last = --op->pending == 0;
+    pthread_mutex_unlock(&op->mutex);
 
-    /* Open rtp_socket */
-    rtp_sockfd = accept(rcv_sockfd, &rtp_addr, &rtp_addr_len);
-    st = recv(rtp_sockfd, data_from_rtp, sizeof(RTP_TO_RTSP), 0);
+    if (last)
+        event_loop_post(op->loop, op->task);
+}
 
-    close(rcv_sockfd);
-    close(rtp_sockfd);
-    if (!st)
-        return(0);
-    fprintf(stderr, "order: %d\n", data_from_rtp->order);
-    fprintf(stderr, "ssrc recibido: %d\n", data_from_rtp->ssrc);
-    if (data_from_rtp->order == ERR_RTP)
-        return(0);
-    return(1);
+/* All the orders of a request have finished. Runs in the loop of the
+ * connection between batches of events, so it can close and free it */
+void rtsp_fanout_done(EVENT_LOOP *loop, void *data) {
+    RTP_FANOUT *op = data;
+    CONNECTION *self = op->conn;
+    INTERNAL_RTSP *rtsp_info;
+    INTERNAL_MEDIA *media = 0;
+    RTSP_RESPONSE *res;
+    struct iovec iov[RES_IOV_MAX];
+    char scratch[RES_SCRATCH];
+    int st;
+    int i;
+    int j;
+
+    /* Assign the ssrc of the new media, even if the client has gone */
+    if ((op->order == SETUP_RTP_UNICAST || op->order == SETUP_RTP_MULTICAST) && !op->failed) {
+        fprintf(stderr, "ssrc recibido: %d\n", op->medias[0].ssrc);
+        pthread_mutex_lock(&hash_mutex);
+        rtsp_info = gethashtable(&session_hash, &(op->req->Session));
+        for (i = 0; rtsp_info && !media && i < rtsp_info->n_sources; ++i)
+            for (j = 0; !media && j < rtsp_info->sources[i]->n_medias; ++j)
+                if (!strcmp((char *)rtsp_info->sources[i]->medias[j]->media_uri, op->medias[0].uri))
+                    media = rtsp_info->sources[i]->medias[j];
+        if (media) {
+            media->ssrc = op->medias[0].ssrc;
+            media->server_port = op->server_port;
+            media->group = op->group;
+            media->ttl = op->ttl;
+        } else
+            op->failed = 1;
+        pthread_mutex_unlock(&hash_mutex);
+    }
+
+    /* The medias stopped are forgotten even if others have failed, so
+     * another TEARDOWN only goes to the ones still playing */
+    if (op->order == TEARDOWN_RTP && !op->failed) {
+        rtsp_session_forget(op->req->Session, op->uri, 1);
+    } else if (op->order == TEARDOWN_RTP) {
+        for (i = 0; i < op->n_medias; ++i)
+            if (op->medias[i].ok)
+                rtsp_session_forget(op->req->Session, op->medias[i].uri, 1);
+    }
+
+    if (!self) {
+        rtsp_fanout_free(op);
+        return;
+    }
+
+    if (op->failed)
+        res = rtsp_servererror(op->req);
+    else if (op->order == SETUP_RTP_UNICAST && op->req->interleaved != -1)
+        res = rtsp_setup_interleaved_res(op->req, op->req->interleaved);
+    else if (op->order == SETUP_RTP_UNICAST)
+        res = rtsp_setup_res(op->req, op->server_port, 0, UNICAST, 0);
+    else if (op->order == SETUP_RTP_MULTICAST)
+        res = rtsp_setup_multicast_res(op->req, op->group, op->server_port, op->ttl);
+    else
+        res = op->rtsp_command(op->req);
+    rtsp_fanout_free(op);
+
+    self->waiting = 0;
+    self->state = CONN_READING;
+    st = rtsp_connection_watch(self);
+    if (st && res) {
+        st = pack_rtsp_res_iov(res, iov, scratch);
+        st = st ? rtsp_connection_sendv(self, iov, st) : 1;
+    }
+    if (res)
+        free_rtsp_res(&res);
+    if (!st) {
+        rtsp_connection_close(self);
+        return;
+    }
+
+    /* Go on with the requests that arrived meanwhile */
+    rtsp_connection_handler(loop, self, 0);
 }
 
 
@@ -10,16 +10,92 @@ THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGA
 
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/socket.h>
+#include "event_loop.h"
+#include "rtsp_framer.h"
+#include "parse_rtsp.h"
+#include "servers_comm.h"
+#include "rtsp_interleaved.h"
 
-#define MAX_RTSP_WORKERS 20 /* Number of processes listening for rtsp connections */
-#define MAX_IDLE_TIME 60 /* Number of seconds a worker can be idle before is killed */
+#define MAX_RTSP_CONNECTIONS 16384 /* Number of simultaneous rtsp connections */
+#define DEFAULT_RTSP_LOOPS 4 /* Number of threads multiplexing the connections */
+#define MAX_IDLE_TIME 60 /* Number of seconds a connection can be idle before is closed */
+#define REQ_BUFFER 4096
+#define INTERLEAVED_PORT_TRIES 16 /* Attempts to get a free pair of ports for an interleaved media */
+#define ACCEPT_PAUSE 100 /* Milliseconds a listener isn't watched when there aren't descriptors */
 
+/* State of a client connection */
+typedef enum {CONN_READING = 0, CONN_WRITING, CONN_WAITING} CONN_STATE;
+
+struct CONNECTION;
+
+/* UDP socket where the RTP server sends a media interleaved in a connection */
+typedef struct {
+    EVENT_WATCH watch[1];
+    struct CONNECTION *conn;
+    int channel; /* Channel of its packets in the connection */
+} INTERLEAVED_SOCKET;
+
+struct RTP_FANOUT;
+
+/* Order for one media. It's the data of its call */
 typedef struct {
-    int used;
-    pthread_t thread_id;
-    time_t time_contacted;
+    struct RTP_FANOUT *op;
+    char *uri; /* Copy, the session can change while the order is in flight */
+    unsigned int ssrc;
+    int ok; /* Its RTP server has done it. With the mutex of op */
+} RTP_FANOUT_MEDIA;
+
+/* Orders sent to the RTP servers for one request. The response is sent
+ * from the loop of the connection when the last of them has been answered */
+typedef struct RTP_FANOUT {
+    EVENT_TASK task[1]; /* Posted to loop with the last response */
+    EVENT_LOOP *loop;
+    struct CONNECTION *conn; /* 0 if the connection was closed meanwhile */
+    RTSP_REQUEST req[1]; /* Its pointers are only valid while conn isn't 0 */
+    ORDER order;
+    RTSP_RESPONSE *(*rtsp_command)(RTSP_REQUEST *); /* Response if everything went well */
+    char *uri; /* Copy of the uri of a TEARDOWN. Its medias are forgotten as they are stopped */
+    pthread_mutex_t mutex; /* Protects the fields below, written by the channel readers */
+    int pending; /* Responses not received yet */
+    int failed;
+    unsigned short server_port; /* SETUP_RTP_UNICAST, port of the group for SETUP_RTP_MULTICAST */
+    unsigned int group; /* SETUP_RTP_MULTICAST, network order */
+    int ttl; /* SETUP_RTP_MULTICAST */
+    int n_medias;
+    RTP_FANOUT_MEDIA medias[1]; /* n_medias, allocated with the structure */
+} RTP_FANOUT;
+
+typedef struct CONNECTION {
+    EVENT_WATCH watch[1];
+    EVENT_LOOP *loop;
+    CONN_STATE state;
     int sockfd;
+    TIMER idle[1]; /* Closes it when no request has come for MAX_IDLE_TIME */
+    EVENT_TASK start[1]; /* Posted to its loop when another thread accepts it */
+    int CSeq; /* Last CSeq received */
     struct sockaddr_storage client_addr;
-} WORKER;
+    RTSP_FRAMER framer[1]; /* Received data not processed yet */
+    char *out; /* Data that couldn't be sent without blocking */
+    int out_len;
+    int out_sent;
+    unsigned int events; /* Epoll events the socket is waiting for */
+    INTERLEAVED_QUEUE media[1]; /* Interleaved packets not written yet */
+    INTERLEAVED_SOCKET interleaved[INTERLEAVED_MAX_CHANNELS];
+    int n_interleaved;
+    RTP_FANOUT *waiting; /* Orders in flight while state is CONN_WAITING */
+    struct CONNECTION *prev; /* Connections of the same loop */
+    struct CONNECTION *next;
+} CONNECTION;
+
+/* Connections handled by one loop thread */
+typedef struct {
+    EVENT_LOOP loop[1];
+    EVENT_WATCH listener[1]; /* Own listening socket in SO_REUSEPORT mode. fd -1 if unused */
+    TIMER listener_pause[1]; /* Watches the listener again after running out of descriptors */
+    CONNECTION *connections;
+    CONNECTION *closed; /* Closed with interleaved sockets. Freed in the next tick, when no event can refer to them */
+    pthread_mutex_t mutex; /* Protects the connection list */
+} RTSP_LOOP;
 
 #endif
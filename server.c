@@ -5,23 +5,23 @@ Permission to use, copy, modify, and/or distribute this software for any purpose
 
 THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
 #include <signal.h>
+#include <errno.h>
 #include <netdb.h>
+#include <sys/socket.h>
 #include "common.h"
+#include "server.h"
 
-#define MAX_QUEUE_SIZE 20
-typedef int (*WORKER_CREATOR)(int, struct sockaddr_storage*);
-
-int accept_tcp_requests(PORT port, int *sockfd, unsigned int *my_addr, WORKER_CREATOR create_worker) {
+int open_tcp_listener(PORT port, int backlog, int reuseport, unsigned int *my_addr) {
     int st;
+    int sockfd;
+    int on = 1;
     struct addrinfo hints, *res;
     char port_str[6];
-    int tmp_sockfd;
-    struct sockaddr_storage client_addr;
-    unsigned int client_addr_len = sizeof(client_addr);
 
     /* Listen incoming connections */
     /* Code taken from http://beej.us/guide/bgnet */
@@ -30,31 +30,55 @@ int accept_tcp_requests(PORT port, int *sockfd, unsigned int *my_addr, WORKER_CR
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE;
 
-    if (!snprintf(port_str, 5, "%d", port))
-        return(0);
+    if (!snprintf(port_str, sizeof(port_str), "%d", port))
+        return(-1);
     if (getaddrinfo(0, port_str, &hints, &res))
-        return(0);
+        return(-1);
 
-    *sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-    if (*sockfd == -1)
-        return(0);
+    sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (sockfd == -1) {
+        freeaddrinfo(res);
+        return(-1);
+    }
+
+    /* Every listener in the same port must have SO_REUSEPORT before binding */
+    if (reuseport && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+        freeaddrinfo(res);
+        close(sockfd);
+        return(-1);
+    }
 
-    st = bind(*sockfd, res->ai_addr, res->ai_addrlen);
+    st = bind(sockfd, res->ai_addr, res->ai_addrlen);
     /* Copy server address to my_addr */
     *my_addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr;
     freeaddrinfo(res);
     if (st == -1) {
-        *sockfd = -1;
-        return(0);
+        close(sockfd);
+        return(-1);
+    }
+
+    st = listen(sockfd, backlog);
+    if (st == -1) {
+        close(sockfd);
+        return(-1);
     }
+    return(sockfd);
+}
 
-    st = listen(*sockfd, MAX_QUEUE_SIZE);
-    if (st == -1)
+int accept_tcp_requests(PORT port, int backlog, int *sockfd, unsigned int *my_addr, WORKER_CREATOR create_worker) {
+    int st;
+    int tmp_sockfd;
+    struct sockaddr_storage client_addr;
+    socklen_t client_addr_len;
+
+    *sockfd = open_tcp_listener(port, backlog, 0, my_addr);
+    if (*sockfd == -1)
         return(0);
 
     /* Server loop */
     for (;;) {
         /* Accept */
+        client_addr_len = sizeof(client_addr);
         tmp_sockfd = accept(*sockfd, (struct sockaddr *)&client_addr, &client_addr_len);
         if (tmp_sockfd == -1)
             return(0);
@@ -65,3 +89,31 @@ int accept_tcp_requests(PORT port, int *sockfd, unsigned int *my_addr, WORKER_CR
     }
 }
 
+int accept_tcp_batch(int sockfd, int max, ACCEPT_HANDLER handler, void *data) {
+    int st;
+    int tmp_sockfd;
+    int accepted = 0;
+    struct sockaddr_storage client_addr;
+    socklen_t client_addr_len;
+
+    while (accepted < max) {
+        client_addr_len = sizeof(client_addr);
+        tmp_sockfd = accept4(sockfd, (struct sockaddr *)&client_addr, &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (tmp_sockfd == -1) {
+            /* The client went away before being accepted */
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            /* No more pending connections */
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return(accepted);
+            /* Out of descriptors or memory, errno tells it to the caller.
+             * The listener stays readable until some are released */
+            return(-1);
+        }
+        ++accepted;
+        st = handler(tmp_sockfd, &client_addr, data);
+        if (!st)
+            close(tmp_sockfd);
+    }
+    return(accepted);
+}
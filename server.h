@@ -11,18 +11,50 @@ THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGA
 #include <netdb.h>
 #include <sys/types.h>
 #include "common.h"
+
+#define MAX_QUEUE_SIZE 20 /* Default backlog of the listening sockets */
+#define ACCEPT_BATCH 64 /* Connections accepted each time a listener is ready */
+
 /* Prototype for the function that creates workers
  * 1st parameter: Int where the socket will be passed
  * 2nd parameter: Structure with information of the client
  */
 typedef int (*WORKER_CREATOR)(int, struct sockaddr_storage*);
 
+/* Prototype for the function that receives batch accepted connections
+ * 1st parameter: Non blocking socket of the connection
+ * 2nd parameter: Structure with information of the client
+ * 3rd parameter: Private data given to accept_tcp_batch
+ * return: 0 if the socket must be closed
+ */
+typedef int (*ACCEPT_HANDLER)(int, struct sockaddr_storage*, void *);
+
+/* Open a TCP socket listening in all the interfaces
+ * port: Port where the server will be listening
+ * backlog: Size of the queue of pending connections
+ * reuseport: 1 to allow several listeners in the same port (SO_REUSEPORT)
+ * my_addr: Variable to save the server address
+ * return: socket, -1 if error
+ */
+int open_tcp_listener(PORT port, int backlog, int reuseport, unsigned int *my_addr);
+
 /* Server loop that accepts requests y creates workers
  * port: Port where the server is listening
+ * backlog: Size of the queue of pending connections
  * sockfd: Variable to save the socket
  * my_addr: Variable to save the server address
  * create_worker: Function that creates the new worker
  * return: 0 if error
  */
-int accept_tcp_requests(PORT port, int *sockfd, unsigned int *my_addr, WORKER_CREATOR create_worker);
+int accept_tcp_requests(PORT port, int backlog, int *sockfd, unsigned int *my_addr, WORKER_CREATOR create_worker);
+
+/* Accept the pending connections of a non blocking listener without blocking
+ * sockfd: Listening socket
+ * max: Maximum number of connections accepted in this call
+ * handler: Function that receives each connection
+ * data: Private data for handler
+ * return: number of connections accepted, -1 if the listener failed or
+ * there aren't descriptors for more (EMFILE, ENFILE, ENOBUFS or ENOMEM)
+ */
+int accept_tcp_batch(int sockfd, int max, ACCEPT_HANDLER handler, void *data);
 #endif
@@ -18,68 +18,6 @@ THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGA
 #include "common.h"
 #include "server_client.h"
 
-/* Receive a message with a final empty line and possibly content
- * returns: 0 on bad message, -1 on closed socket, message length if ok */
-int receive_message(int sockfd, char * buf, int buf_size) {
-    int ret = 0;
-    int read = 0;
-    char * tmp = 0;
-    size_t tmp_size = 0;
-    int content_length = 0;
-    FILE * f = 0;
-
-    f = fdopen(sockfd, "r");
-
-    do {
-        read = getline(&tmp, &tmp_size, f);
-        if (read <= 0) {
-            fclose(f);
-            free(tmp);
-            return(-1);
-        }
-
-        if (read+ret >= buf_size) {
-            fclose(f);
-            free(tmp);
-            return(0);
-        }
-
-        if (!content_length && !strncmp(tmp, "Content-Length:", 15))
-            if (sscanf(tmp, "Content-Length: %d", &content_length) < 1)
-                content_length = 0;
-
-        strcpy(buf+ret, tmp);
-        ret += read;
-    } while (tmp[0] != '\r');
-
-    if (content_length) {
-        content_length += ret;
-        do {
-            read = getline(&tmp, &tmp_size, f);
-            if (read <= 0) {
-                fclose(f);
-                free(tmp);
-                return(-1);
-            }
-
-            if (read+ret >= buf_size) {
-                fclose(f);
-                free(tmp);
-                return(0);
-            }
-
-            memcpy(buf+ret, tmp, read);
-            ret += read;
-        } while (ret < content_length);
-    }
-
-    buf[ret] = 0;
-    fprintf(stderr, "\n########## RECEIVED ##########\n%s\n##############################\n", buf);
-    free(tmp);
-    return ret;
-}
-
-
 int extract_uri(char *uri, char **host, char **path) {
     char *path_start;
     int uri_len;
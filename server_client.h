@@ -10,14 +10,9 @@ THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGA
 #define _SERVER_CLIENT_H_
 
 #define MAX_UDP_BIND_ATTEMPTS 100
-#define RTP_BUFFER_SIZE 512
 
 #include "strnstr.h"
 
-/* Receive a message with a final empty line and possibly content
- * returns: 0 on bad message, -1 on closed socket, message length if ok */
-int receive_message(int sockfd, char *buf, int buf_size);
-
 /* Get the host and the path of an RTSP uri 
  * uri: Pointer to the null terminated string with the uri
  * host: Pointer to the null terminated string with the host. MUST be freed. null if it doesn't exist
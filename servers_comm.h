@@ -10,7 +10,7 @@ THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGA
 
 #define MAX_URI_LENGTH 1024
 
-typedef enum {SETUP_RTP_UNICAST = 0, PLAY_RTP, PAUSE_RTP, TEARDOWN_RTP, CHECK_EXISTS_RTP} ORDER;
+typedef enum {SETUP_RTP_UNICAST = 0, PLAY_RTP, PAUSE_RTP, TEARDOWN_RTP, CHECK_EXISTS_RTP, SETUP_RTP_MULTICAST} ORDER;
 
 typedef struct {
     ORDER order;
@@ -19,7 +19,7 @@ typedef struct {
     unsigned int ssrc; /* PLAY_RTP, PAUSE_RTP, TEARDOWN_RTP */
     unsigned int client_ip; /* SETUP_RTP */
     unsigned short client_port; /* SETUP_RTP */
-    unsigned short response_port; /* PLAY_RTP, PAUSE_RTP, TEARDOWN_RTP */
+    unsigned int group; /* SETUP_RTP_MULTICAST. Chosen by the RTP server, network order */
 } RTSP_TO_RTP;
 
 typedef enum {OK_RTP = 0, ERR_RTP, FINISHED_RTP} RESPONSE;
@@ -32,4 +32,22 @@ typedef struct {
     unsigned int ssrc;
     unsigned short server_port;
 } RTP_TO_RTSP;
+
+/* Frame of the control channel between the RTSP and the RTP servers. Every
+ * RTSP server keeps one connection open with each RTP server and sends its
+ * orders through it without waiting for the previous responses. Requests
+ * and responses use the same frame. A request with uri_len > 0 is followed
+ * by the uri, without the final \0 */
+typedef struct {
+    unsigned int id; /* Chosen by the RTSP server and copied in the response */
+    unsigned short order; /* ORDER in requests, RESPONSE in responses */
+    unsigned short uri_len;
+    int Session;
+    unsigned int ssrc;
+    unsigned int client_ip; /* SETUP_RTP */
+    unsigned short client_port; /* SETUP_RTP */
+    unsigned short server_port; /* Response to SETUP_RTP. Port of the group for SETUP_RTP_MULTICAST */
+    unsigned int group; /* Response to SETUP_RTP_MULTICAST, network order */
+    unsigned char ttl; /* Response to SETUP_RTP_MULTICAST */
+} RTP_CHANNEL_FRAME;
 #endif
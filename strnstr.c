@@ -10,18 +10,15 @@ THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGA
 
 #ifdef __linux__
 char *strnstr(const char *s1, const char *s2, size_t n) {
-    char *buf;
-    char *ptr;
-    char *result;
-    buf = malloc(n + 1);
-    strncpy(buf, s1, n);
-    buf[n] = 0;
-    ptr = strstr(buf, s2);
-    if (!ptr)
-        result = 0;
-    else
-        result = s1 + (ptr - buf);
-    free(buf);
-    return result;
+    size_t len = strlen(s2);
+
+    /* Compare in place, without copying s1 */
+    if (!len)
+        return((char *)s1);
+    for (; n >= len && *s1; ++s1, --n) {
+        if (*s1 == *s2 && !strncmp(s1, s2, len))
+            return((char *)s1);
+    }
+    return(0);
 }
 #endif
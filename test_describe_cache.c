@@ -0,0 +1,146 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "describe_cache.h"
+
+#define MEDIA_FILE "test_describe_cache.tmp"
+
+void append_to_media(const char *text) {
+    FILE *f = fopen(MEDIA_FILE, "a");
+    if (f) {
+        fputs(text, f);
+        fclose(f);
+    }
+}
+
+/* The same uri written in different ways must share the description, and
+ * it must be created again when the media file changes, also for the uris
+ * of other hosts */
+int check_cache(EVENT_LOOP *loop) {
+    int err = 0;
+    DESCRIBE_BODY *first;
+    DESCRIBE_BODY *second;
+    DESCRIBE_BODY *changed;
+    DESCRIBE_BODY *other;
+    DESCRIBE_BODY *other_changed = 0;
+
+    if (!describe_cache_init(loop)) {
+        fprintf(stderr, "Error initializing the cache\n");
+        return(1);
+    }
+
+    if (describe_cache_get("rtsp://Host:554/" MEDIA_FILE, &first) != 1 ||
+            describe_cache_get("rtsp://host/" MEDIA_FILE "/?x=1", &second) != 1) {
+        fprintf(stderr, "Error describing " MEDIA_FILE "\n");
+        describe_cache_free();
+        return(1);
+    }
+    if (first != second || first->refs != 3 || !strstr(first->sdp, "rtsp://host/" MEDIA_FILE)) {
+        err = 1;
+        fprintf(stderr, "Error, description not shared:\n%s\n", first->sdp);
+    }
+    if (!describe_cache_not_modified(first, first->last_modified, strlen(first->last_modified)) ||
+            describe_cache_not_modified(first, "Thu, 01 Jan 1970 00:00:00 GMT", 29)) {
+        err = 1;
+        fprintf(stderr, "Error revalidating %s\n", first->last_modified);
+    }
+    describe_cache_release(second);
+    /* Another host is another entry of the same file */
+    if (describe_cache_get("rtsp://10.0.0.1/" MEDIA_FILE, &other) != 1 || other == first) {
+        describe_cache_release(first);
+        describe_cache_free();
+        fprintf(stderr, "Error describing " MEDIA_FILE " from another host\n");
+        return(1);
+    }
+
+    append_to_media("changed\n");
+    /* Give the loop time to read the inotify event */
+    if (loop)
+        usleep(200000);
+    if (describe_cache_get("rtsp://host/" MEDIA_FILE, &changed) != 1 || changed == first) {
+        err = 1;
+        fprintf(stderr, "Error, description not invalidated\n");
+    }
+    if (describe_cache_get("rtsp://10.0.0.1/" MEDIA_FILE, &other_changed) != 1 || other_changed == other) {
+        err = 1;
+        fprintf(stderr, "Error, description of another host not invalidated\n");
+    }
+    describe_cache_release(other);
+    if (other_changed)
+        describe_cache_release(other_changed);
+    /* The old description must still be usable */
+    if (first->refs != 1 || !first->sdp_len) {
+        err = 1;
+        fprintf(stderr, "Error, description in use freed\n");
+    }
+    describe_cache_release(first);
+    if (changed)
+        describe_cache_release(changed);
+
+    if (describe_cache_get("rtsp://host/missing.ogg", &first) != 0 ||
+            describe_cache_get("rtsp://host/../" MEDIA_FILE, &first) != 0 ||
+            describe_cache_get("http://host/" MEDIA_FILE, &first) != -1) {
+        err = 1;
+        fprintf(stderr, "Error, described a missing file\n");
+    }
+
+    describe_cache_free();
+    return(err);
+}
+
+int main() {
+    int err = 0;
+    int len;
+    char normalized[64];
+    EVENT_LOOP loop[1];
+    char *uris[] = {
+        "rtsp://Example.COM:554/Media/file.ogg/", "rtsp://example.com/Media/file.ogg",
+        "RTSP://host:8554/a?b=c#d", "rtsp://host:8554/a",
+        "rtsp://host", "rtsp://host",
+        0
+    };
+    char **uri_ptr;
+
+    for (uri_ptr = uris; *uri_ptr; uri_ptr += 2) {
+        len = normalize_uri(uri_ptr[0], normalized, sizeof(normalized));
+        if (len != (int)strlen(uri_ptr[1]) || strcmp(normalized, uri_ptr[1])) {
+            err = 1;
+            fprintf(stderr, "Error normalizing %s: %s\n", uri_ptr[0], normalized);
+        }
+    }
+    if (normalize_uri("rtsp://", normalized, sizeof(normalized)) ||
+            normalize_uri("rtsp://host/a-very-long-path-that-does-not-fit-in-the-buffer-at-all", normalized, sizeof(normalized))) {
+        err = 1;
+        fprintf(stderr, "Error, normalized a bad uri\n");
+    }
+
+    /* Without inotify, checking the file in every lookup */
+    unlink(MEDIA_FILE);
+    append_to_media("media\n");
+    if (check_cache(0))
+        err = 1;
+
+    /* With inotify */
+    unlink(MEDIA_FILE);
+    append_to_media("media\n");
+    if (event_loop_init(loop, 0, 0) && event_loop_start(loop)) {
+        if (check_cache(loop))
+            err = 1;
+        event_loop_stop(loop);
+    } else {
+        err = 1;
+        fprintf(stderr, "Error starting the loop\n");
+    }
+    unlink(MEDIA_FILE);
+
+    if (!err)
+        fprintf(stderr, "Correct tests\n");
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "frame_ring.h"
+
+#define N_FRAMES 5000
+#define RING_DESCS 8
+#define RING_SIZE 256
+
+FRAME_RING ring[1];
+int blocked_push = -1;
+
+/* Frames of every size up to 100 bytes, filled with their number */
+void *producer_fun(void *arg) {
+    unsigned char frame[100];
+    int size;
+    int i;
+
+    for (i = 0; i < N_FRAMES; ++i) {
+        size = i % 100 + 1;
+        memset(frame, i & 0xff, size);
+        if (!frame_ring_push(ring, frame, size, i * 1000LL, 1000, i % 10 ? 0 : FRAME_RING_KEY))
+            break;
+    }
+    return(0);
+}
+
+/* Fill the ring and wait in the next frame until it's closed */
+void *blocked_fun(void *arg) {
+    unsigned char frame[100];
+    int i;
+
+    memset(frame, 0, sizeof(frame));
+    for (i = 0; i < RING_DESCS + 1; ++i)
+        if (!frame_ring_push(ring, frame, 10, 0, 0, 0))
+            break;
+    blocked_push = i;
+    return(0);
+}
+
+int main() {
+    int err = 0;
+    int i, j;
+    unsigned char big[RING_SIZE];
+    FRAME_DESC *frame;
+    pthread_t producer;
+
+    if (frame_ring_init(ring, 3, RING_SIZE) != 0) {
+        err = 1;
+        fprintf(stderr, "Error, ring with a size that isn't a power of two\n");
+    }
+    if (!frame_ring_init(ring, RING_DESCS, RING_SIZE)) {
+        fprintf(stderr, "Error initializing the ring\n");
+        return 0;
+    }
+
+    /* Empty */
+    if (frame_ring_peek(ring) || frame_ring_wait(ring, 10000) != 0) {
+        err = 1;
+        fprintf(stderr, "Error, frame in an empty ring\n");
+    }
+    /* A frame bigger than half the ring could never fit */
+    if (frame_ring_push(ring, big, RING_SIZE / 2 + 1, 0, 0, 0)) {
+        err = 1;
+        fprintf(stderr, "Error, frame too big accepted\n");
+    }
+
+    /* The frames go around the ring many times, whole and in order. They are
+     * released in groups, so the producer waits for space. They are all
+     * released before waiting for more */
+    pthread_create(&producer, 0, producer_fun, 0);
+    for (i = 0; i < N_FRAMES; ++i) {
+        if (!frame_ring_wait(ring, 0))
+            frame_ring_release(ring);
+        if (frame_ring_wait(ring, -1) != 1 || !(frame = frame_ring_peek(ring))) {
+            err = 1;
+            fprintf(stderr, "Error waiting for frame %d\n", i);
+            break;
+        }
+        if (frame->size != i % 100 + 1 || frame->media_time != i * 1000LL ||
+                frame->duration != 1000 || frame->flags != (i % 10 ? 0 : FRAME_RING_KEY)) {
+            err = 1;
+            fprintf(stderr, "Error, frame %d with size %u time %lld\n", i, frame->size, frame->media_time);
+        }
+        for (j = 0; j < (int)frame->size; ++j) {
+            if (frame->data[j] != (i & 0xff)) {
+                err = 1;
+                fprintf(stderr, "Error, data of frame %d\n", i);
+                break;
+            }
+        }
+        frame_ring_consume(ring);
+        if (i % 3 == 2)
+            frame_ring_release(ring);
+    }
+    frame_ring_release(ring);
+    pthread_join(producer, 0);
+
+    /* Closing wakes up both sides */
+    pthread_create(&producer, 0, blocked_fun, 0);
+    usleep(50000);
+    frame_ring_close(ring);
+    pthread_join(producer, 0);
+    if (blocked_push != RING_DESCS) {
+        err = 1;
+        fprintf(stderr, "Error, %d frames pushed before closing\n", blocked_push);
+    }
+    for (i = 0; i < RING_DESCS; ++i)
+        frame_ring_consume(ring);
+    if (frame_ring_wait(ring, -1) != -1) {
+        err = 1;
+        fprintf(stderr, "Error, wait in a closed ring\n");
+    }
+
+    frame_ring_free(ring);
+
+    if (!err)
+        fprintf(stderr, "Correct tests\n");
+    return 0;
+}
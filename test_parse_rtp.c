@@ -15,7 +15,12 @@ int main() {
     int ret;
     RTP_PKG pkg1[1], pkg2[1];
     char pkg[1024];
+    unsigned char header[RTP_MIN_SIZE];
+    unsigned char inplace[RTP_MIN_SIZE + 100];
+    unsigned char *data;
+    struct iovec iov[2];
     
+    pkg1->header->marker = 1;
     pkg1->header->seq = 1;
     pkg1->header->timestamp = 100;
     pkg1->header->ssrc = 1000;
@@ -46,6 +51,14 @@ int main() {
         return(0);
     }
     
+    if (pkg1->header->marker != pkg2->header->marker) {
+        fprintf(stderr, "Error: Different marker\n");
+        free(pkg1->data);
+        if (pkg2->data)
+            free(pkg2->data);
+        return(0);
+    }
+
     if (pkg1->header->seq != pkg2->header->seq) {
         fprintf(stderr, "Error: Different seq: %d != %d\n", pkg1->header->seq, pkg2->header->seq);
         free(pkg1->data);
@@ -94,6 +107,26 @@ int main() {
             free(pkg2->data);
         return(0);
     }
+    free(pkg2->data);
+
+    /* The header and the data in two pieces give the same packet */
+    if (pack_rtp_iov(pkg1, header, iov) != ret + RTP_MIN_SIZE || iov[1].iov_base != pkg1->data ||
+            memcmp(iov[0].iov_base, pkg, RTP_MIN_SIZE) || iov[1].iov_len != 100) {
+        fprintf(stderr, "Error: Different packet in pieces\n");
+        free(pkg1->data);
+        return(0);
+    }
+
+    /* Written in place, before the data */
+    memcpy(inplace + RTP_MIN_SIZE, pkg1->data, 100);
+    data = pkg1->data;
+    pkg1->data = inplace + RTP_MIN_SIZE;
+    if (pack_rtp_inplace(pkg1) != ret + RTP_MIN_SIZE || memcmp(inplace, pkg, ret + RTP_MIN_SIZE)) {
+        fprintf(stderr, "Error: Different packet in place\n");
+        free(data);
+        return(0);
+    }
+    free(data);
 
     return(1);
 }
@@ -8,8 +8,14 @@ THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGA
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include "parse_rtsp.h"
 
+extern const int N_ATTR;
+extern const char *ATTR_STR[];
+extern const int N_METHODS;
+extern const char *METHOD_STR[];
+
 int main() {
     int st;
     int err = 0;
@@ -17,6 +23,10 @@ int main() {
     RTSP_RESPONSE res;
     char **msg_ptr;
     char packed_msg[1024];
+    char text[1024];
+    int i;
+    int j;
+    int len;
     char *msg_ok[] = {
         "DESCRIBE rtsp://uri/cacosa RTSP/1.0\r\n"
             "CSeq: 1\r\n"
@@ -35,6 +45,10 @@ int main() {
             "Session: 2234234\r\n"
             "Transport: RTP/AVP;multicast;client_port=9000-9001\r\n"
             "\r\n\0",
+        "SETUP rtsp://uri/cacosa RTSP/1.0\r\n"
+            "CSeq: 2\r\n"
+            "Transport: RTP/AVP/TCP;unicast;interleaved=2-3\r\n"
+            "\r\n\0",
         "PLAY rtsp://uri/cacosa RTSP/1.0\r\n"
             "CSeq: 3\r\n"
             "Session: 123\r\n"
@@ -84,6 +98,11 @@ int main() {
             "Transport: RTP/AVP;unicast\r\n"
             "X-Error: Missing client_port in setup transport\r\n"
             "\r\n\0",
+        "SETUP rtsp://uri/cacosa RTSP/1.0\r\n"
+            "CSeq: 2\r\n"
+            "Transport: RTP/AVP/TCP;unicast\r\n"
+            "X-Error: Missing interleaved in tcp transport\r\n"
+            "\r\n\0",
         "PLAY rtsp://uri/cacosa RTSP/1.0\r\n"
             "CSeq: 3\r\n"
             "X-Error: Missing session in play\r\n"
@@ -109,6 +128,22 @@ int main() {
         0
     };
 
+    char *msg_inplace[] = {
+        "OPTIONS rtsp://uri/cacosa RTSP/1.0\r\n"
+            "cseq: 5\r\n"
+            "User-Agent: test\r\n"
+            "\r\n\0",
+        "SETUP rtsp://uri/cacosa RTSP/1.0\n"
+            "CSeq:2\n"
+            "X-Unknown: ignored\n"
+            "Transport: RTP/AVP;unicast;client_port=9000-9001  \n"
+            "\n\0",
+        "SETUP rtsp://uri/cacosa RTSP/1.0\r\n"
+            "CSeq: 2\r\n"
+            "Transport: RTP/AVP/TCP;interleaved=0-1\r\n"
+            "\r\n\0",
+        0
+    };
     char *res_ok[] = {
         "RTSP/1.0 200\r\n"
             "CSeq: 1\r\n"
@@ -122,6 +157,16 @@ int main() {
             "Session: 1523523\r\n"
             "Transport: RTP/AVP;unicast;client_port=9000-9001;server_port=8000-8001\r\n"
             "\r\n\0",
+        "RTSP/1.0 200\r\n"
+            "CSeq: 1\r\n"
+            "Session: 1523523\r\n"
+            "Transport: RTP/AVP;multicast;destination=239.255.0.1;port=5000-5001;ttl=16\r\n"
+            "\r\n\0",
+        "RTSP/1.0 200\r\n"
+            "CSeq: 1\r\n"
+            "Session: 1523523\r\n"
+            "Transport: RTP/AVP/TCP;unicast;interleaved=4-5\r\n"
+            "\r\n\0",
         "RTSP/1.0 200\r\n"
             "CSeq: 1\r\n"
             "Session: 1523523\r\n"
@@ -207,6 +252,88 @@ int main() {
             free(req.uri);
     } while (*(++msg_ptr));
 
+    /* Numbers are formatted without snprintf */
+    len = format_int(text, 0);
+    len += format_int(text + len, 1234567890);
+    len += format_int(text + len, -2147483647 - 1);
+    text[len] = 0;
+    if (strcmp(text, "01234567890-2147483648")) {
+        err = 1;
+        fprintf(stderr, "Error formatting numbers: %s\n", text);
+    }
+
+    /* Every method and header must be found in any case, and prefixes mustn't match */
+    for (i = 0; i < N_METHODS; ++i) {
+        len = strlen(METHOD_STR[i]);
+        for (j = 0; j < len; ++j)
+            text[j] = tolower(METHOD_STR[i][j]);
+        if (lookup_method(METHOD_STR[i], len) != i || lookup_method(text, len) != i ||
+                lookup_method(METHOD_STR[i], len - 1) != -1) {
+            err = 1;
+            fprintf(stderr, "Error looking up method %s\n", METHOD_STR[i]);
+        }
+    }
+    for (i = 0; i < N_ATTR; ++i) {
+        len = strlen(ATTR_STR[i]);
+        for (j = 0; j < len; ++j)
+            text[j] = toupper(ATTR_STR[i][j]);
+        if (lookup_attr(ATTR_STR[i], len) != i || lookup_attr(text, len) != i ||
+                lookup_attr(ATTR_STR[i], len - 1) != -1) {
+            err = 1;
+            fprintf(stderr, "Error looking up header %s\n", ATTR_STR[i]);
+        }
+    }
+    if (lookup_attr("X-Error", 7) != -1 || lookup_attr("Contents-Type", 13) != -1 || lookup_method("GET", 3) != -1) {
+        err = 1;
+        fprintf(stderr, "Error, unknown name found\n");
+    }
+
+    /* In place parsing must accept the same requests and leave the uri in the text */
+    msg_ptr = msg_ok;
+    do {
+        strcpy(text, *msg_ptr);
+        st = unpack_rtsp_req_inplace(&req, text, strlen(text));
+        if (!st) {
+            err = 1;
+            fprintf(stderr, "Error unpacking request in place:\n%s\n", *msg_ptr);
+            continue;
+        }
+        if (req.uri < text || req.uri >= text + strlen(*msg_ptr) || strcmp(req.uri, "rtsp://uri/cacosa") ||
+                req.uri_len != (int)strlen(req.uri) || !req.uri_borrowed) {
+            err = 1;
+            fprintf(stderr, "Error, uri not borrowed from the request:\n%s\n", *msg_ptr);
+            continue;
+        }
+        st = pack_rtsp_req(&req, packed_msg, 1024);
+        if (!st || strcmp(*msg_ptr, packed_msg)) {
+            err = 1;
+            fprintf(stderr, "Error, different request in place:\n%s\n%s\n", *msg_ptr, packed_msg);
+        }
+        release_rtsp_req(&req);
+    } while (*(++msg_ptr));
+
+    msg_ptr = msg_err;
+    do {
+        strcpy(text, *msg_ptr);
+        st = unpack_rtsp_req_inplace(&req, text, strlen(text));
+        if (st) {
+            err = 1;
+            fprintf(stderr, "Unpacked incorrect request in place:\n%s\n", *msg_ptr);
+        }
+    } while (*(++msg_ptr));
+
+    msg_ptr = msg_inplace;
+    do {
+        /* The text doesn't need to be null terminated */
+        strcpy(text, *msg_ptr);
+        text[strlen(*msg_ptr)] = 'x';
+        st = unpack_rtsp_req_inplace(&req, text, strlen(*msg_ptr));
+        if (!st || req.CSeq == -1) {
+            err = 1;
+            fprintf(stderr, "Error unpacking request in place:\n%s\n", *msg_ptr);
+        }
+    } while (*(++msg_ptr));
+
     msg_ptr = res_ok;
     do {
         st = unpack_rtsp_res(&res, *msg_ptr, strlen(*msg_ptr));
@@ -0,0 +1,156 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "rtp_channel.h"
+
+#define TEST_PORT 23555
+#define N_ORDERS 3
+
+int listener = -1;
+pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+RTP_CHANNEL_FRAME responses[N_ORDERS];
+int n_done;
+pthread_t done_thread; /* Thread of the last order finished */
+
+/* RTP server that answers the orders in reverse order and then closes */
+void *fake_rtp_fun(void *arg) {
+    RTP_CHANNEL_FRAME frames[N_ORDERS];
+    char uri[MAX_URI_LENGTH];
+    int fd;
+    int i;
+
+    fd = accept(listener, 0, 0);
+    if (fd == -1)
+        return(0);
+    for (i = 0; i < N_ORDERS; ++i) {
+        if (recv(fd, &frames[i], sizeof(RTP_CHANNEL_FRAME), MSG_WAITALL) != sizeof(RTP_CHANNEL_FRAME))
+            break;
+        if (frames[i].uri_len && recv(fd, uri, frames[i].uri_len, MSG_WAITALL) != frames[i].uri_len)
+            break;
+    }
+    /* The last order isn't answered. It must fail when the channel closes */
+    for (i = N_ORDERS - 2; i >= 0; --i) {
+        frames[i].order = OK_RTP;
+        frames[i].server_port = 5000 + frames[i].ssrc;
+        send(fd, &frames[i], sizeof(RTP_CHANNEL_FRAME), 0);
+    }
+    usleep(100000);
+    close(fd);
+    return(0);
+}
+
+void order_done(RTP_CHANNEL_FRAME *response, void *data) {
+    int index = (long)data;
+
+    pthread_mutex_lock(&done_mutex);
+    memcpy(&responses[index], response, sizeof(RTP_CHANNEL_FRAME));
+    done_thread = pthread_self();
+    ++n_done;
+    pthread_cond_signal(&done_cond);
+    pthread_mutex_unlock(&done_mutex);
+}
+
+int main() {
+    int err = 0;
+    int one = 1;
+    long i;
+    char *uri = "rtsp://127.0.0.1/media.ogg/audio";
+    struct sockaddr_in addr;
+    RTP_CHANNEL_FRAME request;
+    pthread_t fake_rtp;
+
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TEST_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) || listen(listener, 1) ||
+            pthread_create(&fake_rtp, 0, fake_rtp_fun, 0) || !rtp_channel_init(TEST_PORT)) {
+        fprintf(stderr, "Error starting the fake RTP server\n");
+        return 0;
+    }
+
+    /* A uri without host fails before returning */
+    memset(&request, 0, sizeof(request));
+    n_done = 0;
+    rtp_channel_send("media.ogg", &request, order_done, (void *)0);
+    if (n_done != 1 || responses[0].order != ERR_RTP) {
+        err = 1;
+        fprintf(stderr, "Error, bad uri not failed\n");
+    }
+
+    /* All the orders are in flight at the same time */
+    n_done = 0;
+    for (i = 0; i < N_ORDERS; ++i) {
+        memset(&request, 0, sizeof(request));
+        request.order = PLAY_RTP;
+        request.ssrc = i;
+        request.uri_len = i ? 0 : strlen(uri);
+        rtp_channel_send(uri, &request, order_done, (void *)i);
+    }
+    pthread_mutex_lock(&done_mutex);
+    while (n_done < N_ORDERS)
+        pthread_cond_wait(&done_cond, &done_mutex);
+    pthread_mutex_unlock(&done_mutex);
+
+    for (i = 0; i < N_ORDERS - 1; ++i) {
+        if (responses[i].order != OK_RTP || responses[i].ssrc != i || responses[i].server_port != 5000 + i) {
+            err = 1;
+            fprintf(stderr, "Error in response %ld: order %d ssrc %u\n", i, responses[i].order, responses[i].ssrc);
+        }
+    }
+    if (responses[N_ORDERS - 1].order != ERR_RTP) {
+        err = 1;
+        fprintf(stderr, "Error, order not failed when the channel closed\n");
+    }
+
+    /* A server that refuses the connection fails the order from the reader,
+     * the connection isn't waited for */
+    n_done = 0;
+    memset(&request, 0, sizeof(request));
+    request.order = PLAY_RTP;
+    rtp_channel_send("rtsp://127.0.0.2/media.ogg/audio", &request, order_done, (void *)0);
+    pthread_mutex_lock(&done_mutex);
+    while (n_done < 1)
+        pthread_cond_wait(&done_cond, &done_mutex);
+    pthread_mutex_unlock(&done_mutex);
+    if (responses[0].order != ERR_RTP) {
+        err = 1;
+        fprintf(stderr, "Error, order to a refused server not failed\n");
+    }
+
+    /* The name of a new server is resolved by the reader, not by who sends */
+    n_done = 0;
+    memset(&request, 0, sizeof(request));
+    request.order = PLAY_RTP;
+    rtp_channel_send("rtsp://missing.invalid/media.ogg/audio", &request, order_done, (void *)0);
+    pthread_mutex_lock(&done_mutex);
+    while (n_done < 1)
+        pthread_cond_wait(&done_cond, &done_mutex);
+    pthread_mutex_unlock(&done_mutex);
+    if (responses[0].order != ERR_RTP || pthread_equal(done_thread, pthread_self())) {
+        err = 1;
+        fprintf(stderr, "Error, order to an unknown server not failed by the reader\n");
+    }
+
+    pthread_join(fake_rtp, 0);
+    rtp_channel_free();
+    close(listener);
+
+    if (!err)
+        fprintf(stderr, "Correct tests\n");
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "rtp_multicast.h"
+
+#define N_GROUPS 4
+#define TEST_PORT 23600
+
+RTP_MULTICAST multicast[1];
+
+int main() {
+    int err = 0;
+    unsigned int groups[N_GROUPS];
+    unsigned int group;
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+    struct pollfd receiver_poll;
+    char buf[16];
+    int sender;
+    int receiver;
+    int one = 1;
+    int i;
+
+    /* Only multicast addresses, even ports and valid ttls */
+    if (rtp_multicast_init(multicast, "10.0.0.1", N_GROUPS, TEST_PORT, 1) ||
+            rtp_multicast_init(multicast, "239.255.255.254", N_GROUPS, TEST_PORT, 1) ||
+            rtp_multicast_init(multicast, "239.255.0.1", N_GROUPS, TEST_PORT + 1, 1) ||
+            rtp_multicast_init(multicast, "239.255.0.1", N_GROUPS, TEST_PORT, 0)) {
+        err = 1;
+        fprintf(stderr, "Error, wrong groups accepted\n");
+    }
+    if (!rtp_multicast_init(multicast, "239.255.0.1", N_GROUPS, TEST_PORT, 1)) {
+        fprintf(stderr, "Error initializing the groups\n");
+        return 0;
+    }
+
+    /* Each owner gets a different group until there are no more */
+    for (i = 0; i < N_GROUPS; ++i) {
+        groups[i] = rtp_multicast_get(multicast, i + 1);
+        if (ntohl(groups[i]) != ntohl(inet_addr("239.255.0.1")) + i) {
+            err = 1;
+            fprintf(stderr, "Error, group %d is %08x\n", i, ntohl(groups[i]));
+        }
+    }
+    if (rtp_multicast_get(multicast, N_GROUPS + 1)) {
+        err = 1;
+        fprintf(stderr, "Error, more groups than available\n");
+    }
+    /* A released group is given again */
+    rtp_multicast_release(multicast, 2);
+    group = rtp_multicast_get(multicast, N_GROUPS + 1);
+    if (group != groups[1]) {
+        err = 1;
+        fprintf(stderr, "Error, released group not given again\n");
+    }
+
+    /* A packet sent to the group through the loopback arrives to a member.
+     * It's skipped if the loopback has no multicast route */
+    sender = socket(AF_INET, SOCK_DGRAM, 0);
+    receiver = socket(AF_INET, SOCK_DGRAM, 0);
+    setsockopt(receiver, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TEST_PORT);
+    addr.sin_addr.s_addr = groups[0];
+    mreq.imr_multiaddr.s_addr = groups[0];
+    mreq.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+    if (!rtp_multicast_socket(sender, multicast->ttl, "127.0.0.1") ||
+            bind(receiver, (struct sockaddr *)&addr, sizeof(addr)) ||
+            setsockopt(receiver, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) ||
+            sendto(sender, "group", 5, 0, (struct sockaddr *)&addr, sizeof(addr)) != 5) {
+        fprintf(stderr, "No multicast in the loopback, not sending\n");
+    } else {
+        receiver_poll.fd = receiver;
+        receiver_poll.events = POLLIN;
+        if (poll(&receiver_poll, 1, 1000) != 1 || recv(receiver, buf, sizeof(buf), 0) != 5 ||
+                memcmp(buf, "group", 5)) {
+            err = 1;
+            fprintf(stderr, "Error, packet to the group not received\n");
+        }
+    }
+    close(sender);
+    close(receiver);
+
+    if (!err)
+        fprintf(stderr, "Correct tests\n");
+    return 0;
+}
@@ -0,0 +1,74 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <stdio.h>
+#include <unistd.h>
+#include "rtp_pacer.h"
+
+#define N_PACKETS 50
+#define PERIOD 4000000LL /* Nanoseconds between packets */
+#define MS 1000000LL
+
+RTP_PACER pacer[1];
+
+int main() {
+    int err = 0;
+    int i;
+    long long t;
+    long delay;
+    struct timespec start, end;
+    long long elapsed;
+
+    if (!rtp_pacer_init(pacer)) {
+        fprintf(stderr, "Error initializing the pacer\n");
+        return 0;
+    }
+
+    /* Packets are released at their time, not before */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N_PACKETS; ++i)
+        rtp_pacer_wait(pacer, 10 * MS + i * PERIOD);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+    if (elapsed < (N_PACKETS - 1) * PERIOD || elapsed > (N_PACKETS - 1) * PERIOD + 20 * MS) {
+        err = 1;
+        fprintf(stderr, "Error, %d packets paced in %lld ns\n", N_PACKETS, elapsed);
+    }
+    if (pacer->packets != N_PACKETS || pacer->restarts != 0 || pacer->max_late > 20 * MS) {
+        err = 1;
+        fprintf(stderr, "Error, %lu packets paced, %lu restarts\n", pacer->packets, pacer->restarts);
+    }
+    fprintf(stderr, "Pacing error: mean %lld us, max %lld us\n",
+            rtp_pacer_mean_late(pacer) / 1000, pacer->max_late / 1000);
+
+    /* A packet very late restarts the clock instead of sending a burst */
+    t = 10 * MS + N_PACKETS * PERIOD;
+    usleep((RTP_PACER_MAX_LATE + 100 * MS) / 1000);
+    rtp_pacer_wait(pacer, t);
+    if (pacer->restarts != 1) {
+        err = 1;
+        fprintf(stderr, "Error, clock not restarted\n");
+    }
+    delay = rtp_pacer_delay(pacer, t + 100 * MS);
+    if (delay > 100000 || delay < 80000) {
+        err = 1;
+        fprintf(stderr, "Error, delay %ld us after restarting\n", delay);
+    }
+
+    /* After a pause the next packet is sent now */
+    rtp_pacer_restart(pacer);
+    if ((delay = rtp_pacer_delay(pacer, t + 500 * MS)) != 0) {
+        err = 1;
+        fprintf(stderr, "Error, delay %ld us after a pause\n", delay);
+    }
+
+    rtp_pacer_free(pacer);
+
+    if (!err)
+        fprintf(stderr, "Correct tests\n");
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "parse_rtp.h"
+#include "rtp_payloader.h"
+
+#define MAX_PACKET 100
+#define BIG_FRAME 1000
+
+RTP_PAYLOADER payloader[1];
+
+int main() {
+    int err = 0;
+    unsigned char frame[BIG_FRAME];
+    unsigned char rebuilt[BIG_FRAME];
+    unsigned char packet[MAX_PACKET];
+    unsigned char header[RTP_PAYLOAD_HEADER + RTP_PAYLOAD_LENGTH];
+    RTP_AGGREGATE aggregate[1];
+    RTP_PAYLOAD_FRAME frames[RTP_PAYLOADER_MAX_FRAMES];
+    int rebuilt_size = 0;
+    int n_packets = 0;
+    unsigned int pos;
+    int len;
+    int type;
+    int expected;
+    int n;
+    int i;
+
+    for (i = 0; i < BIG_FRAME; ++i)
+        frame[i] = i * 7;
+    rtp_payloader_init(payloader, MAX_PACKET);
+    if (!rtp_payloader_must_fragment(payloader, BIG_FRAME) ||
+            rtp_payloader_must_fragment(payloader, MAX_PACKET - RTP_MIN_SIZE - 6)) {
+        err = 1;
+        fprintf(stderr, "Error, wrong frames fragmented\n");
+    }
+
+    /* A big frame is split in fragments that fill the packets and join again */
+    for (pos = 0; pos < BIG_FRAME; pos += len) {
+        len = rtp_payloader_fragment(payloader, BIG_FRAME, pos, &type);
+        expected = pos == 0 ? RTP_FRAGMENT_START :
+            pos + len == BIG_FRAME ? RTP_FRAGMENT_END : RTP_FRAGMENT_CONTINUATION;
+        if (type != expected || RTP_MIN_SIZE + RTP_PAYLOAD_HEADER + RTP_PAYLOAD_LENGTH + len > MAX_PACKET ||
+                (type != RTP_FRAGMENT_END && RTP_MIN_SIZE + RTP_PAYLOAD_HEADER + RTP_PAYLOAD_LENGTH + len != MAX_PACKET)) {
+            err = 1;
+            fprintf(stderr, "Error, fragment at %u of type %d with %d bytes\n", pos, type, len);
+        }
+        memcpy(packet, header, rtp_payloader_fragment_header(header, type, len));
+        memcpy(packet + sizeof(header), frame + pos, len);
+        n = rtp_depayload(packet, sizeof(header) + len, frames, RTP_PAYLOADER_MAX_FRAMES, &type);
+        if (n != 1 || type != expected || frames[0].size != len) {
+            err = 1;
+            fprintf(stderr, "Error, fragment at %u read as %d frames of type %d\n", pos, n, type);
+            break;
+        }
+        memcpy(rebuilt + rebuilt_size, frames[0].data, frames[0].size);
+        rebuilt_size += frames[0].size;
+        ++n_packets;
+    }
+    if (rebuilt_size != BIG_FRAME || memcmp(rebuilt, frame, BIG_FRAME) ||
+            n_packets != (BIG_FRAME + 81) / 82) {
+        err = 1;
+        fprintf(stderr, "Error, frame rebuilt with %d bytes in %d packets\n", rebuilt_size, n_packets);
+    }
+
+    /* Small frames go together until the packet is full */
+    rtp_aggregate_start(aggregate, packet);
+    for (i = 0; rtp_aggregate_add(payloader, aggregate, frame + i, 20); ++i);
+    len = rtp_aggregate_finish(aggregate);
+    n = rtp_depayload(packet, len, frames, RTP_PAYLOADER_MAX_FRAMES, &type);
+    if (i != 3 || n != 3 || type != RTP_NOT_FRAGMENTED || len != RTP_PAYLOAD_HEADER + 3 * 22) {
+        err = 1;
+        fprintf(stderr, "Error, %d frames put together in %d bytes\n", n, len);
+    }
+    for (i = 0; i < n; ++i) {
+        if (frames[i].size != 20 || memcmp(frames[i].data, frame + i, 20)) {
+            err = 1;
+            fprintf(stderr, "Error in frame %d put together\n", i);
+        }
+    }
+
+    /* The number of frames is limited by the header */
+    rtp_payloader_init(payloader, BIG_FRAME);
+    rtp_aggregate_start(aggregate, rebuilt);
+    for (i = 0; rtp_aggregate_add(payloader, aggregate, frame, 1); ++i);
+    len = rtp_aggregate_finish(aggregate);
+    if (i != RTP_PAYLOADER_MAX_FRAMES ||
+            rtp_depayload(rebuilt, len, frames, RTP_PAYLOADER_MAX_FRAMES, &type) != RTP_PAYLOADER_MAX_FRAMES) {
+        err = 1;
+        fprintf(stderr, "Error, %d frames of 1 byte put together\n", i);
+    }
+
+    /* Lengths beyond the payload are rejected */
+    if (rtp_depayload(rebuilt, len - 1, frames, RTP_PAYLOADER_MAX_FRAMES, &type) != -1 ||
+            rtp_depayload(packet, 2, frames, RTP_PAYLOADER_MAX_FRAMES, &type) != -1) {
+        err = 1;
+        fprintf(stderr, "Error, truncated payload accepted\n");
+    }
+
+    if (!err)
+        fprintf(stderr, "Correct tests\n");
+    return 0;
+}
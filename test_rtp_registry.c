@@ -0,0 +1,136 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "rtp_registry.h"
+
+#define N_SESSIONS 20000
+#define N_WORKERS 50
+
+RTP_REGISTRY registry[1];
+unsigned int ssrcs[N_SESSIONS];
+
+int main() {
+    int err = 0;
+    RTP_WORKER_USE *use;
+    RTP_WORKER_USE *other;
+    RTP_WORKER *worker;
+    RTP_STREAM *stream = (RTP_STREAM *)registry;
+    unsigned int gen;
+    int i;
+
+    if (!rtp_registry_init(registry, N_SESSIONS)) {
+        fprintf(stderr, "Error creating the registry\n");
+        return 0;
+    }
+
+    /* Sessions of the same worker share it. The track and the group are
+     * taken from the first one */
+    use = rtp_registry_add(registry, 100, 0, "/media.ogg/audio", 0);
+    other = rtp_registry_add(registry, 100, 0, "/other.ogg/audio", 7);
+    if (!use || !other || use->ssrc == other->ssrc ||
+            rtp_registry_worker(registry, use) != rtp_registry_worker(registry, other)) {
+        err = 1;
+        fprintf(stderr, "Error, sessions of a worker not sharing it\n");
+    }
+    worker = rtp_registry_worker(registry, use);
+    if (worker->pid != 100 || worker->stream || worker->n_sessions != 2 || worker->group ||
+            strcmp(worker->track, "/media.ogg/audio") || worker->process != -1) {
+        err = 1;
+        fprintf(stderr, "Error in the worker of the sessions\n");
+    }
+    if (rtp_registry_get(registry, use->ssrc) != use || rtp_registry_get(registry, other->ssrc) != other) {
+        err = 1;
+        fprintf(stderr, "Error, sessions not found by ssrc\n");
+    }
+
+    /* A worker is found by its track, unicast and multicast apart */
+    if (rtp_registry_find(registry, "/media.ogg/audio", 0) != worker ||
+            rtp_registry_find(registry, "/media.ogg/audio", 1) ||
+            rtp_registry_find(registry, "/media.ogg/video", 0)) {
+        err = 1;
+        fprintf(stderr, "Error finding the worker of a track\n");
+    }
+    /* A stream of the engine with the same track isn't the one found */
+    rtp_registry_add(registry, 0, stream, "/media.ogg/audio", 0);
+    rtp_registry_add(registry, 0, stream, "/media.ogg/audio", 0);
+    if (rtp_registry_find(registry, "/media.ogg/audio", 0) != worker || registry->n_workers != 2) {
+        err = 1;
+        fprintf(stderr, "Error, %d workers with the first one not found\n", registry->n_workers);
+    }
+
+    /* The worker goes with its last session. The slot of the session is
+     * reused with another generation */
+    gen = other->gen;
+    rtp_registry_del(registry, use);
+    if (rtp_registry_get(registry, use->ssrc) || worker->n_sessions != 1) {
+        err = 1;
+        fprintf(stderr, "Error deleting a session\n");
+    }
+    rtp_registry_del(registry, other);
+    if (registry->n_workers != 1 || rtp_registry_find(registry, "/media.ogg/audio", 0)) {
+        err = 1;
+        fprintf(stderr, "Error, worker not deleted with its sessions\n");
+    }
+    use = rtp_registry_add(registry, 200, 0, "/media.ogg/audio", 3);
+    if (use != other || use->gen == gen ||
+            rtp_registry_find(registry, "/media.ogg/audio", 1) != rtp_registry_worker(registry, use)) {
+        err = 1;
+        fprintf(stderr, "Error reusing the slot of a session\n");
+    }
+
+    /* The sessions of a worker are deleted together */
+    if (rtp_registry_del_worker(registry, 0, stream) != 2 || rtp_registry_del_worker(registry, 0, stream) ||
+            registry->n_sessions != 1 || registry->n_workers != 1) {
+        err = 1;
+        fprintf(stderr, "Error deleting the sessions of a worker\n");
+    }
+    rtp_registry_del(registry, use);
+
+    /* The registry fills up, every session with its own ssrc */
+    for (i = 0; i < N_SESSIONS; ++i) {
+        use = rtp_registry_add(registry, 1000 + i % N_WORKERS, 0, "/media.ogg/video", 0);
+        if (!use)
+            break;
+        ssrcs[i] = use->ssrc;
+    }
+    if (i != N_SESSIONS || rtp_registry_add(registry, 1000, 0, "/media.ogg/video", 0) ||
+            registry->n_workers != N_WORKERS) {
+        err = 1;
+        fprintf(stderr, "Error, %d sessions added to %d workers\n", i, registry->n_workers);
+    }
+    for (i = 0; i < N_SESSIONS; ++i) {
+        use = rtp_registry_get(registry, ssrcs[i]);
+        if (!use || rtp_registry_worker(registry, use)->pid != 1000 + i % N_WORKERS) {
+            err = 1;
+            fprintf(stderr, "Error, session %d not found\n", i);
+            break;
+        }
+    }
+    /* Only the first worker of the track is found. The others aren't when it goes */
+    for (i = 0; i < N_WORKERS; ++i) {
+        worker = rtp_registry_find(registry, "/media.ogg/video", 0);
+        if (i && worker) {
+            err = 1;
+            fprintf(stderr, "Error, worker %d found after the first one\n", worker->pid);
+        }
+        if (rtp_registry_del_worker(registry, 1000 + i, 0) != N_SESSIONS / N_WORKERS) {
+            err = 1;
+            fprintf(stderr, "Error deleting worker %d\n", 1000 + i);
+        }
+    }
+    if (registry->n_sessions || registry->n_workers) {
+        err = 1;
+        fprintf(stderr, "Error, %d sessions left\n", registry->n_sessions);
+    }
+    rtp_registry_free(registry);
+
+    if (!err)
+        fprintf(stderr, "Correct tests\n");
+    return 0;
+}
@@ -0,0 +1,199 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include "rtp_sender.h"
+
+#define N_PACKETS 10
+#define N_DESTS 2
+
+RTP_SENDER sender[1];
+
+/* Open a UDP socket in a free port of the loopback
+ * return: Socket, -1 if error
+ */
+int open_udp(struct sockaddr_in *addr) {
+    socklen_t len = sizeof(struct sockaddr_in);
+    int fd;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1)
+        return(-1);
+    memset(addr, 0, sizeof(struct sockaddr_in));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)addr, len) || getsockname(fd, (struct sockaddr *)addr, &len)) {
+        close(fd);
+        return(-1);
+    }
+    return(fd);
+}
+
+int main() {
+    int err = 0;
+    int fd;
+    int receivers[N_DESTS];
+    struct sockaddr_in dests[N_DESTS];
+    struct sockaddr_in local;
+    char buf[RTP_SENDER_PACKET];
+    int i;
+    int len;
+    struct timespec now;
+    unsigned long long due;
+    unsigned long long arrived;
+    struct pollfd receiver_poll;
+    char payload[] = "shared payload";
+    struct iovec iov[2];
+
+    fd = open_udp(&local);
+    for (i = 0; i < N_DESTS; ++i)
+        receivers[i] = open_udp(&dests[i]);
+    if (fd == -1 || receivers[0] == -1 || receivers[1] == -1) {
+        fprintf(stderr, "Error opening the sockets\n");
+        return 0;
+    }
+
+    /* Batches of 4 packets sent one by one. The last ones wait at most 50 ms */
+    rtp_sender_init(sender, fd, 4, 50000);
+    sender->gso = 0;
+    if (rtp_sender_timeout(sender) != -1) {
+        err = 1;
+        fprintf(stderr, "Error, timeout without packets\n");
+    }
+    for (i = 0; i < N_PACKETS; ++i) {
+        len = sprintf(rtp_sender_buffer(sender), "packet %d", i);
+        if (!rtp_sender_queue(sender, len, &dests[i % N_DESTS])) {
+            err = 1;
+            fprintf(stderr, "Error queueing packet %d\n", i);
+        }
+    }
+    if (sender->flushes != 2 || sender->packets_sent != 8 || sender->n != 2) {
+        err = 1;
+        fprintf(stderr, "Error, %lu batches with %lu packets\n", sender->flushes, sender->packets_sent);
+    }
+    if (rtp_sender_timeout(sender) <= 0) {
+        err = 1;
+        fprintf(stderr, "Error, packets late too soon\n");
+    }
+    usleep(60000);
+    if (rtp_sender_timeout(sender) != 0) {
+        err = 1;
+        fprintf(stderr, "Error, packets not late\n");
+    }
+    rtp_sender_flush(sender);
+
+    /* Each destination gets its packets in order */
+    for (i = 0; i < N_PACKETS; ++i) {
+        len = recv(receivers[i % N_DESTS], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+        if (len <= 0) {
+            err = 1;
+            fprintf(stderr, "Error, packet %d not received\n", i);
+            continue;
+        }
+        buf[len] = 0;
+        if (atoi(buf + 7) != i) {
+            err = 1;
+            fprintf(stderr, "Error, received %s instead of packet %d\n", buf, i);
+        }
+    }
+
+    /* Trains of equal packets for each destination, the last one shorter */
+    rtp_sender_init(sender, fd, RTP_SENDER_MAX_BATCH, 50000);
+    if (sender->gso) {
+        for (i = 0; i < N_PACKETS + 2; ++i) {
+            len = sprintf(rtp_sender_buffer(sender), "packet %03d", i);
+            if (i == N_PACKETS - 1)
+                len -= 2;
+            rtp_sender_queue(sender, len, &dests[i < N_PACKETS ? 0 : 1]);
+        }
+        rtp_sender_flush(sender);
+        if (sender->flushes != 1 || sender->trains != 2 || sender->packets_sent != N_PACKETS + 2) {
+            err = 1;
+            fprintf(stderr, "Error, %lu trains in %lu batches with %lu packets\n",
+                    sender->trains, sender->flushes, sender->packets_sent);
+        }
+        /* The kernel splits the trains in the original packets */
+        for (i = 0; i < N_PACKETS + 2; ++i) {
+            len = recv(receivers[i < N_PACKETS ? 0 : 1], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+            if (len != (i == N_PACKETS - 1 ? 8 : 10) || memcmp(buf, "packet ", 7) ||
+                    (i != N_PACKETS - 1 && atoi(buf + 7) != i)) {
+                err = 1;
+                fprintf(stderr, "Error, packet %d of the train received with size %d\n", i, len);
+            }
+        }
+    }
+
+    /* The same payload is referenced for every destination, each one with
+     * its own header. The headers of a destination go in a train */
+    rtp_sender_init(sender, fd, RTP_SENDER_MAX_BATCH, 50000);
+    for (i = 0; i < 2 * N_DESTS; ++i) {
+        iov[0].iov_base = rtp_sender_buffer(sender);
+        iov[0].iov_len = sprintf(iov[0].iov_base, "header %d ", i);
+        iov[1].iov_base = payload;
+        iov[1].iov_len = strlen(payload);
+        rtp_sender_queue_iov(sender, iov, 2, &dests[i / 2], 0);
+    }
+    if (!rtp_sender_flush(sender) || sender->packets_sent != 2 * N_DESTS ||
+            (sender->gso && sender->trains != N_DESTS)) {
+        err = 1;
+        fprintf(stderr, "Error, %lu packets in pieces sent in %lu trains\n",
+                sender->packets_sent, sender->trains);
+    }
+    for (i = 0; i < 2 * N_DESTS; ++i) {
+        len = recv(receivers[i / 2], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+        if (len > 0)
+            buf[len] = 0;
+        if (len != 9 + (int)strlen(payload) || atoi(buf + 7) != i || strcmp(buf + 9, payload)) {
+            err = 1;
+            fprintf(stderr, "Error, packet %d in pieces received with size %d\n", i, len);
+        }
+    }
+
+    /* Packets with departure time are accepted by the kernel and aren't
+     * grouped in trains. They only wait if lo has the fq qdisc */
+    rtp_sender_init(sender, fd, RTP_SENDER_MAX_BATCH, 50000);
+    if (rtp_sender_txtime(sender)) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        due = (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec + 100000000ULL;
+        for (i = 0; i < 3; ++i) {
+            len = sprintf(rtp_sender_buffer(sender), "packet %03d", i);
+            rtp_sender_queue_at(sender, len, &dests[0], due + i * 1000);
+        }
+        if (!rtp_sender_flush(sender) || sender->trains != 0 || sender->packets_sent != 3) {
+            err = 1;
+            fprintf(stderr, "Error, %lu packets with departure time sent in %lu trains\n",
+                    sender->packets_sent, sender->trains);
+        }
+        receiver_poll.fd = receivers[0];
+        receiver_poll.events = POLLIN;
+        for (i = 0; i < 3; ++i) {
+            len = -1;
+            if (poll(&receiver_poll, 1, 500) == 1)
+                len = recv(receivers[0], buf, sizeof(buf) - 1, 0);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            arrived = (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+            if (len != 10 || arrived > due + 300000000ULL) {
+                err = 1;
+                fprintf(stderr, "Error, packet %d with departure time not received on time\n", i);
+            }
+        }
+    }
+
+    close(fd);
+    for (i = 0; i < N_DESTS; ++i)
+        close(receivers[i]);
+
+    if (!err)
+        fprintf(stderr, "Correct tests\n");
+    return 0;
+}
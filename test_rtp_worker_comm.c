@@ -0,0 +1,118 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "rtp_worker_comm.h"
+
+int main() {
+    int err = 0;
+    int fds[2];
+    int pidfd;
+    int st;
+    pid_t child;
+    char *uri = "rtsp://127.0.0.1/media.ogg/audio";
+    char got_uri[MAX_URI_LENGTH];
+    RTP_WORKER_FRAME order;
+    RTP_WORKER_FRAME got;
+    struct pollfd pidfd_poll;
+
+    if (!rtp_worker_comm_pair(fds)) {
+        fprintf(stderr, "Error opening the socketpair\n");
+        return 0;
+    }
+
+    /* A SETUP arrives whole with its uri */
+    memset(&order, 0, sizeof(order));
+    order.channel = 3;
+    order.channel_gen = 7;
+    order.frame.id = 11;
+    order.frame.order = SETUP_RTP_UNICAST;
+    order.frame.uri_len = strlen(uri);
+    if (!rtp_worker_comm_send(fds[0], &order, uri, 0) || rtp_worker_comm_recv(fds[1], &got, got_uri, 0) != 1 ||
+            got.channel != 3 || got.channel_gen != 7 || got.frame.id != 11 || strcmp(got_uri, uri)) {
+        err = 1;
+        fprintf(stderr, "Error, SETUP with uri not received\n");
+    }
+
+    /* Frames don't mix: one without uri after another one with it */
+    order.frame.order = PLAY_RTP;
+    order.frame.uri_len = 0;
+    order.frame.ssrc = 1234;
+    rtp_worker_comm_send(fds[0], &order, uri, 0);
+    order.frame.order = PAUSE_RTP;
+    order.frame.uri_len = strlen(uri);
+    rtp_worker_comm_send(fds[0], &order, uri, 0);
+    if (rtp_worker_comm_recv(fds[1], &got, got_uri, 0) != 1 || got.frame.order != PLAY_RTP ||
+            got.frame.ssrc != 1234 || got_uri[0]) {
+        err = 1;
+        fprintf(stderr, "Error, PLAY without uri not received\n");
+    }
+    if (rtp_worker_comm_recv(fds[1], &got, got_uri, 0) != 1 || got.frame.order != PAUSE_RTP || strcmp(got_uri, uri)) {
+        err = 1;
+        fprintf(stderr, "Error, PAUSE after PLAY not received\n");
+    }
+
+    /* Without frames it doesn't wait. Pieces that aren't frames are refused */
+    if (rtp_worker_comm_recv(fds[1], &got, got_uri, MSG_DONTWAIT) != -1) {
+        err = 1;
+        fprintf(stderr, "Error, frame received from an empty socketpair\n");
+    }
+    send(fds[0], "short", 5, 0);
+    if (rtp_worker_comm_recv(fds[1], &got, got_uri, 0) != -1) {
+        err = 1;
+        fprintf(stderr, "Error, short message received as a frame\n");
+    }
+
+    /* A worker answers and ends. Its response is still read after the
+     * pidfd says it has ended, and then the socketpair is closed */
+    child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        if (rtp_worker_comm_recv(fds[1], &got, got_uri, 0) == 1) {
+            got.frame.order = OK_RTP;
+            got.frame.server_port = 5000;
+            got.frame.uri_len = 0;
+            rtp_worker_comm_send(fds[1], &got, 0, 0);
+        }
+        exit(0);
+    }
+    close(fds[1]);
+    pidfd = rtp_worker_comm_pidfd(child);
+    order.frame.order = TEARDOWN_RTP;
+    order.frame.uri_len = 0;
+    rtp_worker_comm_send(fds[0], &order, 0, 0);
+    if (pidfd != -1) {
+        pidfd_poll.fd = pidfd;
+        pidfd_poll.events = POLLIN;
+        if (poll(&pidfd_poll, 1, 2000) != 1) {
+            err = 1;
+            fprintf(stderr, "Error, the pidfd isn't readable when the worker ends\n");
+        }
+        close(pidfd);
+    }
+    st = rtp_worker_comm_recv(fds[0], &got, got_uri, MSG_DONTWAIT);
+    if (st != 1 || got.frame.order != OK_RTP || got.frame.server_port != 5000 || got.channel != 3) {
+        err = 1;
+        fprintf(stderr, "Error, response of the worker not received\n");
+    }
+    if (rtp_worker_comm_recv(fds[0], &got, got_uri, 0) != 0) {
+        err = 1;
+        fprintf(stderr, "Error, socketpair not closed when the worker ends\n");
+    }
+    waitpid(child, 0, 0);
+    close(fds[0]);
+
+    if (!err)
+        fprintf(stderr, "Correct tests\n");
+    return 0;
+}
@@ -0,0 +1,156 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "rtsp_framer.h"
+
+/* Feed text to the framer in pieces of chunk bytes and count the messages
+ * return: number of messages framed, -1 if a message was bad or different
+ */
+int feed(RTSP_FRAMER *framer, const char *text, int chunk, char **expected) {
+    int text_len = strlen(text);
+    int fed = 0;
+    int n = 0;
+    int len;
+    int space_len;
+    char *space;
+    char *msg;
+
+    framer_init(framer);
+    while (fed < text_len) {
+        space = framer_space(framer, &space_len);
+        len = text_len - fed < chunk ? text_len - fed : chunk;
+        if (len > space_len)
+            len = space_len;
+        memcpy(space, text + fed, len);
+        framer_received(framer, len);
+        fed += len;
+
+        while ((len = framer_next(framer, &msg)) > 0) {
+            if (!expected[n] || (int)strlen(expected[n]) != len || memcmp(expected[n], msg, len)) {
+                fprintf(stderr, "Error, different message:\n%s\n%.*s\n", expected[n], len, msg);
+                return(-1);
+            }
+            framer_consume(framer, len);
+            ++n;
+        }
+        if (len == -1)
+            return(-1);
+    }
+    return(n);
+}
+
+int main() {
+    int err = 0;
+    int chunk;
+    int st;
+    RTSP_FRAMER framer[1];
+    char big[FRAMER_BUFFER + 100];
+    char *none[] = {0};
+    char *pipelined[] = {
+        "OPTIONS rtsp://uri/cacosa RTSP/1.0\r\n"
+            "CSeq: 1\r\n"
+            "\r\n",
+        "GET_PARAMETER rtsp://uri/cacosa RTSP/1.0\r\n"
+            "CSeq: 2\r\n"
+            "Session: 10\r\n"
+            "content-length : 10\r\n"
+            "\r\n"
+            "0123456789",
+        "PLAY rtsp://uri/cacosa RTSP/1.0\r\n"
+            "CSeq: 3\r\n"
+            "Session: 10\r\n"
+            "\r\n",
+        0
+    };
+    char *partial =
+        "PLAY rtsp://uri/cacosa RTSP/1.0\r\n"
+        "CSeq: 3\r\n"
+        "Content-Length: 10\r\n"
+        "\r\n"
+        "01234";
+    char *bad =
+        "PLAY rtsp://uri/cacosa RTSP/1.0\r\n"
+        "CSeq: 3\r\n"
+        "Content-Length: -1\r\n"
+        "\r\n";
+    char text[FRAMER_BUFFER];
+    char frame[4 + 257 + 1];
+    char *interleaved[] = {pipelined[0], frame, pipelined[2], 0};
+    static char huge_text[FRAMER_BUFFER + 65539 + 1];
+    char *skipped[] = {pipelined[0], pipelined[2], 0};
+    int chunks[] = {1, 7, 1000, FRAMER_BUFFER, sizeof(huge_text), 0};
+    int i;
+
+    /* All the messages in one segment, and then split in every possible way */
+    strcpy(text, pipelined[0]);
+    strcat(text, "\r\n");
+    strcat(text, pipelined[1]);
+    strcat(text, pipelined[2]);
+    for (chunk = strlen(text); chunk > 0; --chunk) {
+        st = feed(framer, text, chunk, pipelined);
+        if (st != 3) {
+            err = 1;
+            fprintf(stderr, "Error framing pipelined messages in chunks of %d: %d\n", chunk, st);
+        }
+    }
+
+    /* A frame of the client between requests. No byte of its header is 0 */
+    memcpy(frame, "$\001\001\001", 4);
+    memset(frame + 4, 'r', 257);
+    frame[4 + 257] = 0;
+    strcpy(text, pipelined[0]);
+    strcat(text, frame);
+    strcat(text, pipelined[2]);
+    for (chunk = strlen(text); chunk > 0; --chunk) {
+        st = feed(framer, text, chunk, interleaved);
+        if (st != 3) {
+            err = 1;
+            fprintf(stderr, "Error framing an interleaved frame in chunks of %d: %d\n", chunk, st);
+        }
+    }
+
+    /* A frame bigger than the buffer is skipped, and the requests after it
+     * are framed */
+    strcpy(huge_text, pipelined[0]);
+    i = strlen(huge_text);
+    memcpy(huge_text + i, "$\001\377\377", 4);
+    memset(huge_text + i + 4, 'r', 65535);
+    strcpy(huge_text + i + 65539, pipelined[2]);
+    for (i = 0; chunks[i]; ++i) {
+        st = feed(framer, huge_text, chunks[i], skipped);
+        if (st != 2) {
+            err = 1;
+            fprintf(stderr, "Error skipping a big interleaved frame in chunks of %d: %d\n", chunks[i], st);
+        }
+    }
+
+    st = feed(framer, partial, 7, none);
+    if (st != 0) {
+        err = 1;
+        fprintf(stderr, "Framed incomplete message\n");
+    }
+
+    st = feed(framer, bad, 100, none);
+    if (st != -1) {
+        err = 1;
+        fprintf(stderr, "Framed message with bad Content-Length\n");
+    }
+
+    memset(big, 'a', sizeof(big) - 1);
+    big[sizeof(big) - 1] = 0;
+    st = feed(framer, big, 1000, none);
+    if (st != -1) {
+        err = 1;
+        fprintf(stderr, "Framed message bigger than the buffer\n");
+    }
+
+    if (!err)
+        fprintf(stderr, "Correct tests\n");
+    return 0;
+}
@@ -0,0 +1,114 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include "rtsp_interleaved.h"
+
+#define N_PACKETS 100
+#define PACKET_SIZE 1000
+
+INTERLEAVED_QUEUE queue[1];
+
+int main() {
+    int err = 0;
+    int fds[2];
+    int size = 4096;
+    int queued;
+    int received = 0;
+    int len;
+    int got = 0;
+    int channel;
+    int i;
+    char *space;
+    char buf[INTERLEAVED_HEADER + PACKET_SIZE];
+
+    /* Without memory nothing is queued */
+    interleaved_queue_init(queue, 20 * (INTERLEAVED_HEADER + PACKET_SIZE));
+    if (interleaved_queue_space(queue)) {
+        err = 1;
+        fprintf(stderr, "Error, space in a queue without memory\n");
+    }
+    if (!interleaved_queue_alloc(queue)) {
+        fprintf(stderr, "Error reserving the queue\n");
+        return 0;
+    }
+
+    /* New packets are dropped over the high water mark */
+    for (queued = 0; queued < N_PACKETS && (space = interleaved_queue_space(queue)); ++queued) {
+        memset(space, queued, PACKET_SIZE);
+        interleaved_queue_push(queue, queued % 2, PACKET_SIZE);
+    }
+    if (queued != 20 || queue->bytes != 20 * (INTERLEAVED_HEADER + PACKET_SIZE)) {
+        err = 1;
+        fprintf(stderr, "Error, %d packets queued with %d bytes\n", queued, queue->bytes);
+    }
+
+    /* A small socket takes packets by halves. They must arrive whole and in order */
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+        fprintf(stderr, "Error opening the sockets\n");
+        return 0;
+    }
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    for (i = 0; i < 10000 && received < queued; ++i) {
+        if (!interleaved_queue_flush(queue, fds[0], INTERLEAVED_BATCH)) {
+            err = 1;
+            fprintf(stderr, "Error flushing the queue\n");
+            break;
+        }
+        len = recv(fds[1], buf + got, sizeof(buf) - got, 0);
+        if (len <= 0)
+            continue;
+        got += len;
+        if (got < INTERLEAVED_HEADER)
+            continue;
+        len = interleaved_frame_len(buf, &channel);
+        if (len != INTERLEAVED_HEADER + PACKET_SIZE) {
+            err = 1;
+            fprintf(stderr, "Error, frame %d with size %d\n", received, len);
+            break;
+        }
+        if (got < len)
+            continue;
+        if (channel != received % 2 || buf[INTERLEAVED_HEADER] != received ||
+                buf[len - 1] != received) {
+            err = 1;
+            fprintf(stderr, "Error, frame %d different\n", received);
+        }
+        got = 0;
+        ++received;
+    }
+    if (received != queued || queue->n || queue->bytes || queue->sent) {
+        err = 1;
+        fprintf(stderr, "Error, %d frames of %d received\n", received, queued);
+    }
+
+    /* Once written there is space again */
+    if (!interleaved_queue_space(queue)) {
+        err = 1;
+        fprintf(stderr, "Error, no space in an empty queue\n");
+    }
+
+    /* A closed connection fails */
+    interleaved_queue_push(queue, 0, PACKET_SIZE);
+    close(fds[1]);
+    if (interleaved_queue_flush(queue, fds[0], INTERLEAVED_BATCH)) {
+        err = 1;
+        fprintf(stderr, "Error, flushed in a closed connection\n");
+    }
+    close(fds[0]);
+    interleaved_queue_free(queue);
+
+    if (!err)
+        fprintf(stderr, "Correct tests\n");
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "timer_wheel.h"
+
+#define N_TIMERS 100000
+#define MAX_EXPIRY 200000ULL
+
+TIMER_WHEEL wheel[1];
+TIMER timers[N_TIMERS];
+unsigned long long expected[N_TIMERS]; /* 0 if it mustn't expire */
+unsigned long long tick;
+unsigned long long wake; /* Tick the wheel asked to be advanced at */
+int err = 0;
+int n_expired;
+int n_late;
+TIMER rearmed[1];
+int n_rearmed;
+
+void expire(TIMER_WHEEL *w, void *data) {
+    int i = (long)data;
+
+    ++n_expired;
+    if (expected[i] != tick || wake > tick) {
+        if (!n_late++)
+            fprintf(stderr, "Error, timer %d due at %llu expired at %llu\n", i, expected[i], tick);
+        err = 1;
+    }
+    expected[i] = 0;
+}
+
+/* Expires every 10 ticks, added again from its own function */
+void rearm(TIMER_WHEEL *w, void *data) {
+    ++n_rearmed;
+    if (n_rearmed < 5)
+        timer_wheel_add(w, rearmed, tick + 10);
+}
+
+int main() {
+    long i;
+    int n_pending = 0;
+    TIMER late[1];
+
+    /* Many timers spread over all the levels, some deleted and some moved */
+    srand(3);
+    timer_wheel_init(wheel, 1000);
+    for (i = 0; i < N_TIMERS; ++i) {
+        timer_init(&timers[i], expire, (void *)i);
+        expected[i] = 1000 + rand() % MAX_EXPIRY;
+        timer_wheel_add(wheel, &timers[i], expected[i]);
+    }
+    for (i = 0; i < N_TIMERS; i += 7) {
+        timer_wheel_del(wheel, &timers[i]);
+        expected[i] = 0;
+    }
+    for (i = 3; i < N_TIMERS; i += 11) {
+        if (!expected[i])
+            continue;
+        expected[i] = 1000 + rand() % MAX_EXPIRY;
+        timer_wheel_add(wheel, &timers[i], expected[i]);
+    }
+    for (i = 0; i < N_TIMERS; ++i)
+        if (expected[i])
+            ++n_pending;
+    if (wheel->n_timers != n_pending) {
+        err = 1;
+        fprintf(stderr, "Error, %d timers in the wheel instead of %d\n", wheel->n_timers, n_pending);
+    }
+
+    /* Advancing tick by tick, each one expires exactly when it's due. The
+     * timeout never goes past the next expiry */
+    n_expired = 0;
+    for (tick = 1000; tick < 1000 + MAX_EXPIRY; ++tick) {
+        wake = wheel->now + timer_wheel_timeout(wheel);
+        timer_wheel_advance(wheel, tick);
+    }
+    wake = 0;
+    if (n_expired != n_pending || wheel->n_timers) {
+        err = 1;
+        fprintf(stderr, "Error, %d of %d timers expired, %d left\n", n_expired, n_pending, wheel->n_timers);
+    }
+
+    /* Timers farther than the last level wait and expire on time */
+    timer_wheel_init(wheel, 0);
+    tick = 0;
+    for (i = 0; i < 3; ++i) {
+        expected[i] = TIMER_WHEEL_SPAN * (i + 1) + 5;
+        timer_wheel_add(wheel, &timers[i], expected[i]);
+    }
+    n_expired = 0;
+    while (wheel->n_timers) {
+        /* Jump to the tick the wheel asks for */
+        tick = wake = wheel->now + timer_wheel_timeout(wheel);
+        timer_wheel_advance(wheel, tick);
+    }
+    wake = 0;
+    if (n_expired != 3) {
+        err = 1;
+        fprintf(stderr, "Error, %d far timers expired\n", n_expired);
+    }
+
+    /* A timer added from its function, and one added already late */
+    timer_wheel_init(wheel, 0);
+    timer_init(rearmed, rearm, 0);
+    timer_wheel_add(wheel, rearmed, 10);
+    for (tick = 0; tick <= 100; ++tick)
+        timer_wheel_advance(wheel, tick);
+    if (n_rearmed != 5) {
+        err = 1;
+        fprintf(stderr, "Error, timer added again expired %d times\n", n_rearmed);
+    }
+    timer_init(late, expire, (void *)0);
+    expected[0] = 101;
+    timer_wheel_add(wheel, late, 50);
+    if (timer_wheel_timeout(wheel) != 0 || timer_wheel_advance(wheel, 101) != 1 || timer_wheel_timeout(wheel) != -1) {
+        err = 1;
+        fprintf(stderr, "Error, late timer not expired in the next advance\n");
+    }
+
+    if (!err)
+        fprintf(stderr, "Correct tests\n");
+    return 0;
+}
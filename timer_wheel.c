@@ -0,0 +1,158 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "timer_wheel.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+void timer_wheel_init(TIMER_WHEEL *wheel, unsigned long long now) {
+    int i;
+    int j;
+
+    wheel->now = now;
+    wheel->n_timers = 0;
+    for (i = 0; i < TIMER_WHEEL_LEVELS; ++i)
+        for (j = 0; j < TIMER_WHEEL_SLOTS; ++j)
+            wheel->slots[i][j] = 0;
+}
+
+void timer_init(TIMER *timer, TIMER_FUN fun, void *data) {
+    timer->expires = 0;
+    timer->fun = fun;
+    timer->data = data;
+    timer->pending = 0;
+    timer->next = 0;
+    timer->pprev = 0;
+}
+
+/* Link a timer in the slot of its expiry. It must not be linked */
+void timer_wheel_link(TIMER_WHEEL *wheel, TIMER *timer) {
+    unsigned long long when = timer->expires;
+    unsigned long long delta;
+    TIMER **slot;
+    int level;
+
+    if (when < wheel->now)
+        when = wheel->now;
+    delta = when - wheel->now;
+    /* Farther than the last level, it waits in its farthest slot and is
+     * placed again when it's moved down */
+    if (delta >= TIMER_WHEEL_SPAN) {
+        when = wheel->now + TIMER_WHEEL_SPAN - 1;
+        delta = TIMER_WHEEL_SPAN - 1;
+    }
+    for (level = 0; level < TIMER_WHEEL_LEVELS - 1; ++level)
+        if (delta < 1ULL << (TIMER_WHEEL_BITS * (level + 1)))
+            break;
+    slot = &wheel->slots[level][(when >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK];
+
+    timer->next = *slot;
+    if (timer->next)
+        timer->next->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+/* Take a timer out of its slot */
+void timer_wheel_unlink(TIMER *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->next = 0;
+    timer->pprev = 0;
+}
+
+void timer_wheel_add(TIMER_WHEEL *wheel, TIMER *timer, unsigned long long expires) {
+    if (timer->pending)
+        timer_wheel_unlink(timer);
+    else
+        ++wheel->n_timers;
+    timer->pending = 1;
+    timer->expires = expires;
+    timer_wheel_link(wheel, timer);
+}
+
+void timer_wheel_del(TIMER_WHEEL *wheel, TIMER *timer) {
+    if (!timer->pending)
+        return;
+    timer_wheel_unlink(timer);
+    timer->pending = 0;
+    --wheel->n_timers;
+}
+
+/* Move the timers of the slots that start now down a level. A level is
+ * only reached when the slot of the one below has wrapped around */
+void timer_wheel_cascade(TIMER_WHEEL *wheel) {
+    TIMER *timer;
+    TIMER *next;
+    int level;
+    int index;
+
+    for (level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+        index = (wheel->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+        timer = wheel->slots[level][index];
+        wheel->slots[level][index] = 0;
+        for (; timer; timer = next) {
+            next = timer->next;
+            timer_wheel_link(wheel, timer);
+        }
+        if (index)
+            break;
+    }
+}
+
+int timer_wheel_advance(TIMER_WHEEL *wheel, unsigned long long now) {
+    TIMER *expired;
+    TIMER *timer;
+    int n = 0;
+    int index;
+
+    while (wheel->now <= now) {
+        /* Nothing to go through while it's empty */
+        if (!wheel->n_timers) {
+            wheel->now = now + 1;
+            break;
+        }
+        index = wheel->now & TIMER_WHEEL_MASK;
+        if (!index)
+            timer_wheel_cascade(wheel);
+
+        /* The slot is taken out first. Timers added by the functions go
+         * to the next ticks, even if they have already expired */
+        expired = wheel->slots[0][index];
+        wheel->slots[0][index] = 0;
+        if (expired)
+            expired->pprev = &expired;
+        ++wheel->now;
+        while (expired) {
+            timer = expired;
+            timer_wheel_unlink(timer);
+            timer->pending = 0;
+            --wheel->n_timers;
+            ++n;
+            timer->fun(wheel, timer->data);
+        }
+    }
+    return(n);
+}
+
+long long timer_wheel_timeout(TIMER_WHEEL *wheel) {
+    int index;
+    int i;
+
+    if (!wheel->n_timers)
+        return(-1);
+    /* The first level is looked at up to where it wraps around. Then the
+     * next levels are moved down, and they can have timers due at once */
+    index = wheel->now & TIMER_WHEEL_MASK;
+    if (!index)
+        return(0);
+    for (i = index; i < TIMER_WHEEL_SLOTS; ++i)
+        if (wheel->slots[0][i])
+            return(i - index);
+    return(TIMER_WHEEL_SLOTS - index);
+}
@@ -0,0 +1,78 @@
+/*
+Copyright (c) 2012, Paula Roquero Fuentes <paula.roquero.fuentes@gmail.com>
+
+Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby granted, provided that the above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED AS IS AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS) /* Slots of each level */
+#define TIMER_WHEEL_LEVELS 4 /* Each level has slots TIMER_WHEEL_SLOTS times longer */
+#define TIMER_WHEEL_SPAN (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) /* Ticks the last level covers */
+
+struct TIMER_WHEEL;
+struct TIMER;
+
+/* Function called when a timer expires. The timer isn't pending any more
+ * and can be added again or freed
+ * 1st parameter: Wheel of the timer
+ * 2nd parameter: Private data of the timer
+ */
+typedef void (*TIMER_FUN)(struct TIMER_WHEEL *, void *);
+
+/* Timer, usually embedded in the structure it works on. It's linked in the
+ * slot of its expiry, so adding and deleting it don't search anything */
+typedef struct TIMER {
+    unsigned long long expires; /* Tick */
+    TIMER_FUN fun;
+    void *data;
+    int pending; /* 1 while it's in the wheel */
+    struct TIMER *next;
+    struct TIMER **pprev; /* Field that points to it: the slot or the next of the previous timer */
+} TIMER;
+
+/* Hierarchical timer wheel. The first level has a slot for each of the
+ * next TIMER_WHEEL_SLOTS ticks. The timers of the others are moved down a
+ * level when their slot comes, so every tick costs the same however many
+ * timers there are. It has no locks: only one thread can use it */
+typedef struct TIMER_WHEEL {
+    unsigned long long now; /* Next tick to expire */
+    int n_timers;
+    TIMER *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} TIMER_WHEEL;
+
+/* Initialize an empty wheel
+ * now: Current tick. The unit of the ticks is chosen by the user
+ */
+void timer_wheel_init(TIMER_WHEEL *wheel, unsigned long long now);
+
+/* Initialize a timer that isn't pending
+ * fun: Function called when it expires
+ * data: Private data for fun
+ */
+void timer_init(TIMER *timer, TIMER_FUN fun, void *data);
+
+/* Add a timer to the wheel, or move it if it's already pending
+ * expires: Tick when it expires. If it has passed, it expires in the next advance
+ */
+void timer_wheel_add(TIMER_WHEEL *wheel, TIMER *timer, unsigned long long expires);
+
+/* Take a timer out of the wheel. Nothing is done if it isn't pending */
+void timer_wheel_del(TIMER_WHEEL *wheel, TIMER *timer);
+
+/* Expire the timers up to a tick, calling their functions in order
+ * now: Current tick
+ * return: Number of timers expired
+ */
+int timer_wheel_advance(TIMER_WHEEL *wheel, unsigned long long now);
+
+/* Ticks the wheel can wait before advancing. Timers of the other levels
+ * are found when they are moved down, so it can be earlier than the next
+ * expiry but never later
+ * return: Ticks, -1 if there aren't timers
+ */
+long long timer_wheel_timeout(TIMER_WHEEL *wheel);
+#endif